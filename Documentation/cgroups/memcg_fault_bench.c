@@ -0,0 +1,155 @@
+/*
+ * memcg_fault_bench.c - anonymous page fault rate in nested memory cgroups
+ *
+ * Creates a chain of <depth> memory cgroups with use_hierarchy set below
+ * <memcg-mount>, moves itself into the innermost one and lets <threads>
+ * threads repeatedly map, touch and unmap <size> bytes of anonymous
+ * memory.  Every fault charges each level of the hierarchy, so running
+ * with different depths shows the cost of hierarchical charging.
+ *
+ * Build: gcc -O2 -pthread -o memcg_fault_bench memcg_fault_bench.c
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define USAGE_STR "Usage: memcg_fault_bench <memcg-mount> <depth> " \
+		  "<threads> <size-in-MB> <loops>\n"
+
+static size_t size;
+static int loops;
+static long page_size;
+
+static int write_file(const char *dir, const char *file, const char *val)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	if (fputs(val, f) < 0)
+		ret = -1;
+	if (fclose(f))
+		ret = -1;
+	if (ret)
+		perror(path);
+	return ret;
+}
+
+static int move_self(const char *dir)
+{
+	char pid[32];
+
+	snprintf(pid, sizeof(pid), "%d\n", getpid());
+	return write_file(dir, "tasks", pid);
+}
+
+static void *fault_thread(void *arg)
+{
+	unsigned long *faults = arg;
+	size_t off;
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		char *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			break;
+		}
+		for (off = 0; off < size; off += page_size)
+			p[off] = 1;
+		munmap(p, size);
+		*faults += size / page_size;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	char (*dirs)[PATH_MAX];
+	unsigned long *faults, total = 0;
+	pthread_t *threads;
+	struct timespec start, end;
+	double secs;
+	int depth, nr_threads, created = 0, i, ret = 1;
+
+	if (argc != 6) {
+		fputs(USAGE_STR, stderr);
+		return 1;
+	}
+	depth = atoi(argv[2]);
+	nr_threads = atoi(argv[3]);
+	size = (size_t)atol(argv[4]) << 20;
+	loops = atoi(argv[5]);
+	page_size = sysconf(_SC_PAGESIZE);
+	if (depth < 0 || nr_threads <= 0 || !size || loops <= 0) {
+		fputs(USAGE_STR, stderr);
+		return 1;
+	}
+
+	dirs = calloc(depth + 1, sizeof(*dirs));
+	threads = calloc(nr_threads, sizeof(*threads));
+	faults = calloc(nr_threads, sizeof(*faults));
+	if (!dirs || !threads || !faults) {
+		perror("calloc");
+		return 1;
+	}
+
+	snprintf(dirs[0], PATH_MAX, "%s", argv[1]);
+	for (i = 1; i <= depth; i++) {
+		if (write_file(dirs[i - 1], "memory.use_hierarchy", "1\n"))
+			goto out;
+		snprintf(dirs[i], PATH_MAX, "%s/bench%d", dirs[i - 1], i);
+		if (mkdir(dirs[i], 0755) && errno != EEXIST) {
+			perror(dirs[i]);
+			goto out;
+		}
+		created = i;
+	}
+	if (move_self(dirs[depth]))
+		goto out;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, fault_thread,
+				   &faults[i])) {
+			perror("pthread_create");
+			nr_threads = i;
+			break;
+		}
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i], NULL);
+		total += faults[i];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("depth %d threads %d: %lu faults in %.3fs, %.0f faults/s\n",
+	       depth, nr_threads, total, secs, total / secs);
+	ret = 0;
+
+	move_self(dirs[0]);
+out:
+	for (i = created; i > 0; i--)
+		if (rmdir(dirs[i]))
+			perror(dirs[i]);
+	return ret;
+}
@@ -0,0 +1,189 @@
+/*
+ * Test of file sealing on memfd_create() files.  Checks that F_GET_SEALS
+ * reports what F_ADD_SEALS set, and that each seal refuses the changes
+ * it stands for:
+ *
+ *  F_SEAL_WRITE:  write(), a writable shared mmap(), and the seal itself
+ *                 as long as a writable shared mapping remains
+ *  F_SEAL_SHRINK: ftruncate() to a smaller size
+ *  F_SEAL_GROW:   ftruncate() to a larger size
+ *  F_SEAL_SEAL:   any further F_ADD_SEALS
+ *
+ * Prints the first check that fails and exits with 1, or exits with 0.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef __NR_memfd_create
+#if defined(__x86_64__)
+#define __NR_memfd_create 312
+#elif defined(__i386__)
+#define __NR_memfd_create 350
+#endif
+#endif
+
+#ifndef MFD_ALLOW_SEALING
+#define MFD_CLOEXEC		0x0001U
+#define MFD_ALLOW_SEALING	0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS		(1024 + 9)
+#define F_GET_SEALS		(1024 + 10)
+#define F_SEAL_SEAL		0x0001
+#define F_SEAL_SHRINK		0x0002
+#define F_SEAL_GROW		0x0004
+#define F_SEAL_WRITE		0x0008
+#endif
+
+#define SIZE (64UL*1024)
+
+static void fail(const char *what)
+{
+	printf("FAIL: %s\n", what);
+	exit(1);
+}
+
+/* The call returned -1 with errno set to @err */
+static void check_err(long ret, int err, const char *what)
+{
+	if (ret != -1 || errno != err)
+		fail(what);
+}
+
+static void check_seals(int fd, int seals, const char *what)
+{
+	if (fcntl(fd, F_GET_SEALS) != seals)
+		fail(what);
+}
+
+static int new_memfd(unsigned int flags)
+{
+	int fd;
+
+	fd = syscall(__NR_memfd_create, "memfd-seals", MFD_CLOEXEC | flags);
+	if (fd < 0) {
+		perror("memfd_create");
+		exit(1);
+	}
+	return fd;
+}
+
+static void write_bytes(char *addr)
+{
+	unsigned long i;
+
+	for (i = 0; i < SIZE; i++)
+		addr[i] = (char)i;
+}
+
+static void check_contents(char *addr)
+{
+	unsigned long i;
+
+	for (i = 0; i < SIZE; i++)
+		if (addr[i] != (char)i)
+			fail("contents changed");
+}
+
+int main(void)
+{
+	char *addr, path[64];
+	int fd, rofd, pipefd[2];
+
+	/* Only shmem files know about seals */
+	if (pipe(pipefd)) {
+		perror("pipe");
+		exit(1);
+	}
+	check_err(fcntl(pipefd[0], F_GET_SEALS), EINVAL,
+		  "F_GET_SEALS on a pipe");
+
+	/* Without MFD_ALLOW_SEALING, the file is sealed against seals */
+	fd = new_memfd(0);
+	check_seals(fd, F_SEAL_SEAL, "seals without MFD_ALLOW_SEALING");
+	check_err(fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE), EPERM,
+		  "F_ADD_SEALS without MFD_ALLOW_SEALING");
+	close(fd);
+
+	fd = new_memfd(MFD_ALLOW_SEALING);
+	check_seals(fd, 0, "seals with MFD_ALLOW_SEALING");
+	check_err(fcntl(fd, F_ADD_SEALS, 0x100), EINVAL, "unknown seal");
+	if (ftruncate(fd, SIZE)) {
+		perror("ftruncate");
+		exit(1);
+	}
+
+	addr = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	write_bytes(addr);
+	check_err(fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE), EBUSY,
+		  "F_SEAL_WRITE with a writable mapping");
+	check_seals(fd, 0, "seals after a refused F_SEAL_WRITE");
+	munmap(addr, SIZE);
+
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE))
+		fail("F_SEAL_WRITE without writable mappings");
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK))
+		fail("F_SEAL_SHRINK");
+	check_seals(fd, F_SEAL_WRITE | F_SEAL_SHRINK, "seals add up");
+
+	check_err(write(fd, "x", 1), EPERM, "write with F_SEAL_WRITE");
+	check_err(pwrite(fd, "x", 1, SIZE), EPERM,
+		  "write past the end with F_SEAL_WRITE");
+	check_err((long)mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+			     fd, 0), EPERM,
+		  "writable shared mmap with F_SEAL_WRITE");
+	check_err(ftruncate(fd, SIZE / 2), EPERM,
+		  "shrink with F_SEAL_SHRINK");
+
+	/* Private and read-only mappings cannot change the file */
+	addr = mmap(NULL, SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED)
+		fail("private mmap with F_SEAL_WRITE");
+	check_contents(addr);
+	munmap(addr, SIZE);
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	rofd = open(path, O_RDONLY);
+	if (rofd < 0) {
+		perror("open");
+		exit(1);
+	}
+	addr = mmap(NULL, SIZE, PROT_READ, MAP_SHARED, rofd, 0);
+	if (addr == MAP_FAILED)
+		fail("read-only shared mmap with F_SEAL_WRITE");
+	check_contents(addr);
+	munmap(addr, SIZE);
+	check_seals(rofd, F_SEAL_WRITE | F_SEAL_SHRINK,
+		    "seals through another open file");
+	check_err(fcntl(rofd, F_ADD_SEALS, F_SEAL_GROW), EPERM,
+		  "F_ADD_SEALS on a read-only file");
+	close(rofd);
+
+	/* Growing is still allowed, until F_SEAL_GROW */
+	if (ftruncate(fd, 2 * SIZE))
+		fail("grow without F_SEAL_GROW");
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_GROW))
+		fail("F_SEAL_GROW");
+	check_err(ftruncate(fd, 4 * SIZE), EPERM, "grow with F_SEAL_GROW");
+
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL))
+		fail("F_SEAL_SEAL");
+	check_seals(fd, F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW |
+		    F_SEAL_WRITE, "all seals");
+	check_err(fcntl(fd, F_ADD_SEALS, 0), EPERM,
+		  "F_ADD_SEALS after F_SEAL_SEAL");
+
+	close(fd);
+	printf("PASS\n");
+	return 0;
+}
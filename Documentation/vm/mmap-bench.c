@@ -0,0 +1,155 @@
+/*
+ * mmap-bench.c - cost of vma lookups and unmapped area searches
+ *
+ * Creates <regions> single page anonymous mappings that cannot merge,
+ * so that the process ends up with that many vmas, and times:
+ *
+ *  map:    creating the mappings
+ *  lookup: <threads> threads touching and madvise(MADV_DONTNEED)ing
+ *          random regions <loops> times each; every fault and madvise
+ *          looks up a vma
+ *  refill: after unmapping every other region, mapping two page
+ *          regions, which fit none of the one page holes left behind
+ *  unmap:  tearing everything down
+ *
+ * Raise vm.max_map_count for more than about 30000 regions.
+ *
+ * Build: gcc -O2 -pthread -o mmap-bench mmap-bench.c
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#define USAGE_STR "Usage: mmap-bench <regions> <threads> <loops>\n"
+
+static char **regions;
+static int nr_regions;
+static int loops;
+static long page_size;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *phase, long ops, double secs)
+{
+	printf("%-8s %8ld ops in %.3fs, %.0f ops/s\n",
+	       phase, ops, secs, ops / secs);
+}
+
+/*
+ * Alternate the protection so that neighbouring regions are never
+ * merged into one vma.
+ */
+static char *map_region(int i, size_t len)
+{
+	int prot = (i & 1) ? PROT_READ : PROT_READ | PROT_WRITE;
+	char *p = mmap(NULL, len, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static void *lookup_thread(void *arg)
+{
+	unsigned int seed = (unsigned long)arg;
+	long *ops = malloc(sizeof(*ops));
+	int i;
+
+	*ops = 0;
+	for (i = 0; i < loops * nr_regions; i++) {
+		/* only the even, writable regions */
+		int r = (rand_r(&seed) % nr_regions) & ~1;
+
+		regions[r][0] = 1;
+		madvise(regions[r], page_size, MADV_DONTNEED);
+		*ops += 2;
+	}
+	return ops;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *threads;
+	long ops;
+	double start;
+	int nr_threads, i;
+
+	if (argc != 4) {
+		fputs(USAGE_STR, stderr);
+		return 1;
+	}
+	nr_regions = atoi(argv[1]);
+	nr_threads = atoi(argv[2]);
+	loops = atoi(argv[3]);
+	page_size = sysconf(_SC_PAGESIZE);
+	if (nr_regions < 2 || nr_threads <= 0 || loops <= 0) {
+		fputs(USAGE_STR, stderr);
+		return 1;
+	}
+
+	regions = calloc(nr_regions, sizeof(*regions));
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!regions || !threads) {
+		perror("calloc");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < nr_regions; i++) {
+		regions[i] = map_region(i, page_size);
+		if (!regions[i]) {
+			perror("mmap");
+			return 1;
+		}
+	}
+	report("map", nr_regions, now() - start);
+
+	start = now();
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, lookup_thread,
+				   (void *)(unsigned long)(i + 1))) {
+			perror("pthread_create");
+			nr_threads = i;
+			break;
+		}
+	}
+	ops = 0;
+	for (i = 0; i < nr_threads; i++) {
+		void *ret;
+
+		pthread_join(threads[i], &ret);
+		ops += *(long *)ret;
+		free(ret);
+	}
+	report("lookup", ops, now() - start);
+
+	for (i = 1; i < nr_regions; i += 2) {
+		munmap(regions[i], page_size);
+		regions[i] = NULL;
+	}
+	start = now();
+	for (i = 1; i < nr_regions; i += 2) {
+		regions[i] = map_region(i, 2 * page_size);
+		if (!regions[i]) {
+			perror("mmap");
+			return 1;
+		}
+	}
+	report("refill", nr_regions / 2, now() - start);
+
+	start = now();
+	for (i = 0; i < nr_regions; i++)
+		munmap(regions[i], (i & 1) ? 2 * page_size : page_size);
+	report("unmap", nr_regions, now() - start);
+
+	return 0;
+}
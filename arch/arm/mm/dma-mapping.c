@@ -18,12 +18,14 @@
 #include <linux/device.h>
 #include <linux/dma-mapping.h>
 #include <linux/highmem.h>
+#include <linux/dma-contiguous.h>
 
 #include <asm/memory.h>
 #include <asm/highmem.h>
 #include <asm/cacheflush.h>
 #include <asm/tlbflush.h>
 #include <asm/sizes.h>
+#include <asm/dma-contiguous.h>
 
 static u64 get_coherent_dma_mask(struct device *dev)
 {
@@ -301,6 +303,86 @@ static void __dma_free_remap(void *cpu_addr, size_t size)
 
 #endif	/* CONFIG_MMU */
 
+#if defined(CONFIG_MMU) && defined(CONFIG_CMA)
+
+static int __dma_update_pte(pte_t *pte, pgtable_t token, unsigned long addr,
+			    void *data)
+{
+	struct page *page = virt_to_page(addr);
+	pgprot_t prot = *(pgprot_t *)data;
+
+	set_pte_ext(pte, mk_pte(page, prot), 0);
+	return 0;
+}
+
+/*
+ * Change the attributes of the kernel linear mapping of a buffer.  The
+ * CMA areas are mapped with pages rather than sections at boot (see
+ * dma_contiguous_remap()), so this works without splitting anything.
+ */
+static void __dma_remap(struct page *page, size_t size, pgprot_t prot)
+{
+	unsigned long start = (unsigned long)page_address(page);
+	unsigned long end = start + size;
+
+	apply_to_page_range(&init_mm, start, size, __dma_update_pte, &prot);
+	dsb();
+	flush_tlb_kernel_range(start, end);
+}
+
+/*
+ * Allocate a buffer from the device's contiguous memory area and remap
+ * its linear mapping in place with @prot, so that no consistent DMA
+ * region space is needed however large the buffer is.
+ */
+static void *__alloc_from_contiguous(struct device *dev, size_t size,
+				     pgprot_t prot, struct page **ret_page)
+{
+	unsigned long order = get_order(size);
+	size_t count = size >> PAGE_SHIFT;
+	struct page *page;
+	void *ptr;
+
+	page = dma_alloc_from_contiguous(dev, count, order);
+	if (!page)
+		return NULL;
+
+	/*
+	 * Zero the buffer and push it out of the caches before the
+	 * cacheable alias goes away.
+	 */
+	ptr = page_address(page);
+	memset(ptr, 0, size);
+	dmac_flush_range(ptr, ptr + size);
+	outer_flush_range(__pa(ptr), __pa(ptr) + size);
+
+	__dma_remap(page, size, prot);
+	*ret_page = page;
+	return ptr;
+}
+
+/*
+ * Buffers from a contiguous area are the only non-coherent allocations
+ * that live in the linear mapping; everything else was remapped into
+ * the consistent region.
+ */
+static bool __free_from_contiguous(struct device *dev, struct page *page,
+				   void *cpu_addr, size_t size)
+{
+	if (cpu_addr != page_address(page))
+		return false;
+
+	__dma_remap(page, size, pgprot_kernel);
+	return dma_release_from_contiguous(dev, page, size >> PAGE_SHIFT);
+}
+
+#else	/* !(CONFIG_MMU && CONFIG_CMA) */
+
+#define __alloc_from_contiguous(dev, size, prot, ret)	NULL
+#define __free_from_contiguous(dev, page, cpu_addr, size)	false
+
+#endif
+
 static void *
 __dma_alloc(struct device *dev, size_t size, dma_addr_t *handle, gfp_t gfp,
 	    pgprot_t prot)
@@ -311,6 +393,18 @@ __dma_alloc(struct device *dev, size_t size, dma_addr_t *handle, gfp_t gfp,
 	*handle = ~0;
 	size = PAGE_ALIGN(size);
 
+	/*
+	 * Contiguous areas can only be used by callers that may sleep,
+	 * since pages in the way have to be migrated out first.
+	 */
+	if (!arch_is_coherent() && (gfp & __GFP_WAIT)) {
+		addr = __alloc_from_contiguous(dev, size, prot, &page);
+		if (addr) {
+			*handle = pfn_to_dma(dev, page_to_pfn(page));
+			return addr;
+		}
+	}
+
 	page = __dma_alloc_buffer(dev, size, gfp);
 	if (!page)
 		return NULL;
@@ -380,6 +474,19 @@ static int dma_mmap(struct device *dev, struct vm_area_struct *vma,
 					      user_size << PAGE_SHIFT,
 					      vma->vm_page_prot);
 		}
+	} else if (virt_addr_valid(cpu_addr)) {
+		/* Buffer from a contiguous area, mapped in the linear map */
+		unsigned long off = vma->vm_pgoff;
+
+		kern_size = PAGE_ALIGN(size) >> PAGE_SHIFT;
+
+		if (off < kern_size &&
+		    user_size <= (kern_size - off)) {
+			ret = remap_pfn_range(vma, vma->vm_start,
+					      dma_to_pfn(dev, dma_addr) + off,
+					      user_size << PAGE_SHIFT,
+					      vma->vm_page_prot);
+		}
 	}
 #endif	/* CONFIG_MMU */
 
@@ -408,17 +515,23 @@ EXPORT_SYMBOL(dma_mmap_writecombine);
  */
 void dma_free_coherent(struct device *dev, size_t size, void *cpu_addr, dma_addr_t handle)
 {
+	struct page *page;
+
 	WARN_ON(irqs_disabled());
 
 	if (dma_release_from_coherent(dev, get_order(size), cpu_addr))
 		return;
 
 	size = PAGE_ALIGN(size);
+	page = pfn_to_page(dma_to_pfn(dev, handle));
 
-	if (!arch_is_coherent())
+	if (!arch_is_coherent()) {
+		if (__free_from_contiguous(dev, page, cpu_addr, size))
+			return;
 		__dma_free_remap(cpu_addr, size);
+	}
 
-	__dma_free_buffer(pfn_to_page(dma_to_pfn(dev, handle)), size);
+	__dma_free_buffer(page, size);
 }
 EXPORT_SYMBOL(dma_free_coherent);
 
@@ -20,6 +20,7 @@
 #include <linux/gfp.h>
 #include <linux/memblock.h>
 #include <linux/sort.h>
+#include <linux/dma-contiguous.h>
 
 #include <asm/mach-types.h>
 #include <asm/prom.h>
@@ -358,6 +359,17 @@ void __init arm_memblock_init(struct meminfo *mi, struct machine_desc *mdesc)
 	if (mdesc->reserve)
 		mdesc->reserve();
 
+	/*
+	 * Reserve the global CMA area last, so board specific areas
+	 * declared from ->reserve() get their fixed addresses first.
+	 */
+#ifdef ARM_DMA_ZONE_SIZE
+	dma_contiguous_reserve(min_t(phys_addr_t, PHYS_OFFSET + ARM_DMA_ZONE_SIZE,
+				     memblock.current_limit));
+#else
+	dma_contiguous_reserve(0);
+#endif
+
 	memblock_analyze();
 	memblock_dump_all();
 }
@@ -102,6 +102,11 @@ static inline int pmd_young(pmd_t pmd)
 	return pmd_flags(pmd) & _PAGE_ACCESSED;
 }
 
+static inline int pmd_dirty(pmd_t pmd)
+{
+	return pmd_flags(pmd) & _PAGE_DIRTY;
+}
+
 static inline int pte_write(pte_t pte)
 {
 	return pte_flags(pte) & _PAGE_RW;
@@ -472,8 +477,17 @@ static inline pte_t *pte_offset_kernel(pmd_t *pmd, unsigned long address)
 	return (pte_t *)pmd_page_vaddr(*pmd) + pte_index(address);
 }
 
+#ifdef CONFIG_FORK_SHARE_PTE
+extern int pmd_shared_pte_table(pmd_t pmd);
+#endif
+
 static inline int pmd_bad(pmd_t pmd)
 {
+#ifdef CONFIG_FORK_SHARE_PTE
+	/* fork write protects the pmds of the page tables it shares */
+	if ((pmd_flags(pmd) & ~_PAGE_USER) == (_KERNPG_TABLE & ~_PAGE_RW))
+		return !pmd_shared_pte_table(pmd);
+#endif
 	return (pmd_flags(pmd) & ~_PAGE_USER) != _KERNPG_TABLE;
 }
 
@@ -352,10 +352,14 @@
 #define __NR_syncfs             344
 #define __NR_sendmmsg		345
 #define __NR_setns		346
+#define __NR_userfaultfd	347
+#define __NR_process_vm_readv	348
+#define __NR_process_vm_writev	349
+#define __NR_memfd_create	350
 
 #ifdef __KERNEL__
 
-#define NR_syscalls 347
+#define NR_syscalls 351
 
 #define __ARCH_WANT_IPC_PARSE_VERSION
 #define __ARCH_WANT_OLD_READDIR
@@ -681,6 +681,14 @@ __SYSCALL(__NR_syncfs, sys_syncfs)
 __SYSCALL(__NR_sendmmsg, sys_sendmmsg)
 #define __NR_setns				308
 __SYSCALL(__NR_setns, sys_setns)
+#define __NR_userfaultfd			309
+__SYSCALL(__NR_userfaultfd, sys_userfaultfd)
+#define __NR_process_vm_readv			310
+__SYSCALL(__NR_process_vm_readv, sys_process_vm_readv)
+#define __NR_process_vm_writev			311
+__SYSCALL(__NR_process_vm_writev, sys_process_vm_writev)
+#define __NR_memfd_create			312
+__SYSCALL(__NR_memfd_create, sys_memfd_create)
 
 #ifndef __NO_STUBS
 #define __ARCH_WANT_OLD_READDIR
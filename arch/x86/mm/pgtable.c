@@ -1,4 +1,5 @@
 #include <linux/mm.h>
+#include <linux/module.h>
 #include <linux/gfp.h>
 #include <asm/pgalloc.h>
 #include <asm/pgtable.h>
@@ -30,6 +31,20 @@ pgtable_t pte_alloc_one(struct mm_struct *mm, unsigned long address)
 	return pte;
 }
 
+#ifdef CONFIG_FORK_SHARE_PTE
+/*
+ * A write protected pmd is only good if it points to a page table fork
+ * shared: their page keeps a _mapcount of 0 or more for as long as any
+ * write protected pmd points to them, see share_pte_table().
+ */
+int pmd_shared_pte_table(pmd_t pmd)
+{
+	return pfn_valid(pmd_pfn(pmd)) &&
+	       atomic_read(&pmd_page(pmd)->_mapcount) >= 0;
+}
+EXPORT_SYMBOL(pmd_shared_pte_table);
+#endif
+
 static int __init setup_userpte(char *arg)
 {
 	if (!arg)
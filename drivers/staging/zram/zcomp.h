@@ -0,0 +1,60 @@
+/*
+ * Compressed RAM block device
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+struct zcomp_strm {
+	struct crypto_comp *tfm;
+	/* compression buffer, 2 pages as some compressors expand data */
+	void *buffer;
+	struct list_head list;
+};
+
+/*
+ * A pool of compression streams.  Up to max_strm streams are created
+ * along with the pool and when the limit is raised, never on the I/O
+ * path; callers wait when all of them are busy.
+ */
+struct zcomp {
+	char name[CRYPTO_MAX_ALG_NAME];
+	/* protect idle_strm, avail_strm and max_strm */
+	spinlock_t strm_lock;
+	/* list of available strms */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	/* number of allocated strms */
+	int avail_strm;
+	/* maximum number of strms */
+	int max_strm;
+};
+
+ssize_t zcomp_available_show(const char *comp, char *buf);
+bool zcomp_available_algorithm(const char *comp);
+
+struct zcomp *zcomp_create(const char *comp, int max_strm);
+void zcomp_destroy(struct zcomp *comp);
+
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+int zcomp_compress(struct zcomp_strm *zstrm, const unsigned char *src,
+		size_t *dst_len);
+int zcomp_decompress(struct zcomp_strm *zstrm, const unsigned char *src,
+		size_t src_len, unsigned char *dst);
+
+void zcomp_set_max_streams(struct zcomp *comp, int num_strm);
+
+#endif /* _ZCOMP_H_ */
@@ -422,6 +422,8 @@ EXPORT_SYMBOL(remove_inode_hash);
 
 void end_writeback(struct inode *inode)
 {
+	unsigned long nrshadows;
+
 	might_sleep();
 	/*
 	 * We have to cycle tree_lock here because reclaim can be still in the
@@ -430,7 +432,14 @@ void end_writeback(struct inode *inode)
 	 */
 	spin_lock_irq(&inode->i_data.tree_lock);
 	BUG_ON(inode->i_data.nrpages);
+	nrshadows = inode->i_data.nrshadows;
 	spin_unlock_irq(&inode->i_data.tree_lock);
+	/*
+	 * Reclaim may have left shadow entries behind the final truncate,
+	 * or evict_inode skipped it for want of pages.
+	 */
+	if (nrshadows)
+		truncate_inode_pages(&inode->i_data, 0);
 	BUG_ON(!list_empty(&inode->i_data.private_list));
 	BUG_ON(!(inode->i_state & I_FREEING));
 	BUG_ON(inode->i_state & I_CLEAR);
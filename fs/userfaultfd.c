@@ -0,0 +1,672 @@
+/*
+ *  fs/userfaultfd.c
+ *
+ *  Missing page faults in the anonymous memory ranges registered to a
+ *  userfaultfd are not resolved by the kernel: the faulting thread is
+ *  put to sleep, without mmap_sem, and the fault is queued as a message
+ *  to be read from the file descriptor.  Userland resolves it with the
+ *  UFFDIO_COPY ioctl, which atomically maps a page filled with the data
+ *  it provides and wakes the thread up.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/mempolicy.h>
+#include <linux/anon_inodes.h>
+#include <linux/syscalls.h>
+#include <linux/userfaultfd_k.h>
+
+#include <asm/uaccess.h>
+
+enum userfaultfd_state {
+	UFFD_STATE_WAIT_API,
+	UFFD_STATE_RUNNING,
+};
+
+struct userfaultfd_ctx {
+	/*
+	 * Threads waiting for their fault to be resolved: the fault is
+	 * pending until it has been read, then it stays queued until
+	 * the thread is woken up.
+	 */
+	wait_queue_head_t fault_wqh;
+	/* poll(2) and read(2) waiting for faults to be queued */
+	wait_queue_head_t fd_wqh;
+	atomic_t refcount;
+	unsigned int flags;
+	enum userfaultfd_state state;
+	/* the file descriptor was closed: faults are no longer delivered */
+	bool released;
+	/* the mm whose faults are handled, pinned by mm_count */
+	struct mm_struct *mm;
+};
+
+struct userfaultfd_wait_queue {
+	struct uffd_msg msg;
+	wait_queue_t wq;
+	/* the message was returned by read(2) */
+	bool msg_read;
+};
+
+struct userfaultfd_wake_range {
+	unsigned long start;
+	unsigned long len;	/* 0 wakes up all the faults */
+};
+
+static int userfaultfd_wake_function(wait_queue_t *wq, unsigned mode,
+				     int wake_flags, void *key)
+{
+	struct userfaultfd_wake_range *range = key;
+	struct userfaultfd_wait_queue *uwq;
+	unsigned long address;
+	int ret;
+
+	uwq = container_of(wq, struct userfaultfd_wait_queue, wq);
+	address = uwq->msg.arg.pagefault.address;
+	if (range->len && (address < range->start ||
+			   address - range->start >= range->len))
+		return 0;
+	ret = wake_up_state(wq->private, mode);
+	if (ret)
+		/* The waiter sees the empty list and skips the locking */
+		list_del_init(&wq->task_list);
+	return ret;
+}
+
+static void userfaultfd_ctx_get(struct userfaultfd_ctx *ctx)
+{
+	if (!atomic_inc_not_zero(&ctx->refcount))
+		BUG();
+}
+
+static void userfaultfd_ctx_put(struct userfaultfd_ctx *ctx)
+{
+	if (atomic_dec_and_test(&ctx->refcount)) {
+		VM_BUG_ON(waitqueue_active(&ctx->fault_wqh));
+		VM_BUG_ON(waitqueue_active(&ctx->fd_wqh));
+		mmdrop(ctx->mm);
+		kfree(ctx);
+	}
+}
+
+/*
+ * Whether the fault at @address has still to be resolved: checked after
+ * the fault is queued, a UFFDIO_COPY mapping the page before it would
+ * otherwise find nobody to wake up.  Called with mmap_sem held.
+ */
+static bool userfaultfd_must_wait(struct mm_struct *mm,
+				  unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	bool ret;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return true;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return true;
+	pmd = pmd_offset(pud, address);
+	_pmd = *pmd;
+	barrier();
+	if (pmd_none(_pmd))
+		return true;
+	if (pmd_trans_huge(_pmd) || !pmd_present(_pmd))
+		return false;
+
+	pte = pte_offset_map(pmd, address);
+	ret = pte_none(*pte);
+	pte_unmap(pte);
+	return ret;
+}
+
+/**
+ * handle_userfault - deliver a missing page fault to userland
+ * @vma: the registered vma faulting
+ * @address: the faulting address
+ * @flags: FAULT_FLAG_xxx flags of the fault
+ *
+ * Queues the fault to the userfaultfd of @vma and sleeps until it is
+ * resolved.  mmap_sem is released before sleeping, so this returns
+ * VM_FAULT_RETRY, or VM_FAULT_SIGBUS if the caller cannot retry.
+ */
+int handle_userfault(struct vm_area_struct *vma, unsigned long address,
+		     unsigned int flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct userfaultfd_ctx *ctx = vma->vm_userfaultfd_ctx.ctx;
+	struct userfaultfd_wait_queue uwq;
+	bool must_wait;
+
+	BUG_ON(!rwsem_is_locked(&mm->mmap_sem));
+	VM_BUG_ON(!ctx || ctx->mm != mm);
+
+	/* Closing the fd unregisters the vma soon: refault until then */
+	if (unlikely(ACCESS_ONCE(ctx->released)))
+		return VM_FAULT_NOPAGE;
+
+	/*
+	 * Without FAULT_FLAG_ALLOW_RETRY mmap_sem cannot be dropped, and
+	 * it must be for userland to resolve the fault: as with
+	 * get_user_pages() on the range, fail the fault.
+	 */
+	if (!(flags & FAULT_FLAG_ALLOW_RETRY))
+		return VM_FAULT_SIGBUS;
+	if (flags & FAULT_FLAG_RETRY_NOWAIT)
+		return VM_FAULT_RETRY;
+
+	init_waitqueue_func_entry(&uwq.wq, userfaultfd_wake_function);
+	uwq.wq.private = current;
+	memset(&uwq.msg, 0, sizeof(uwq.msg));
+	uwq.msg.event = UFFD_EVENT_PAGEFAULT;
+	uwq.msg.arg.pagefault.address = address & PAGE_MASK;
+	if (flags & FAULT_FLAG_WRITE)
+		uwq.msg.arg.pagefault.flags = UFFD_PAGEFAULT_FLAG_WRITE;
+	uwq.msg_read = false;
+
+	/* The ctx may go away as soon as mmap_sem is released */
+	userfaultfd_ctx_get(ctx);
+
+	spin_lock(&ctx->fault_wqh.lock);
+	__add_wait_queue_tail(&ctx->fault_wqh, &uwq.wq);
+	set_current_state(TASK_KILLABLE);
+	spin_unlock(&ctx->fault_wqh.lock);
+
+	must_wait = userfaultfd_must_wait(mm, address);
+	up_read(&mm->mmap_sem);
+
+	if (likely(must_wait && !ACCESS_ONCE(ctx->released) &&
+		   !fatal_signal_pending(current))) {
+		wake_up_poll(&ctx->fd_wqh, POLLIN);
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+
+	/* Emptied by userfaultfd_wake_function() if we were woken up */
+	if (!list_empty_careful(&uwq.wq.task_list)) {
+		spin_lock(&ctx->fault_wqh.lock);
+		list_del(&uwq.wq.task_list);
+		spin_unlock(&ctx->fault_wqh.lock);
+	}
+
+	userfaultfd_ctx_put(ctx);
+	return VM_FAULT_RETRY;
+}
+
+static void wake_userfault(struct userfaultfd_ctx *ctx,
+			   struct userfaultfd_wake_range *range)
+{
+	__wake_up(&ctx->fault_wqh, TASK_NORMAL, 0, range);
+}
+
+/* Called with fault_wqh.lock held */
+static struct userfaultfd_wait_queue *find_userfault(
+	struct userfaultfd_ctx *ctx)
+{
+	struct userfaultfd_wait_queue *uwq;
+
+	list_for_each_entry(uwq, &ctx->fault_wqh.task_list, wq.task_list)
+		if (!uwq->msg_read)
+			return uwq;
+	return NULL;
+}
+
+static unsigned int userfaultfd_poll(struct file *file, poll_table *wait)
+{
+	struct userfaultfd_ctx *ctx = file->private_data;
+	unsigned int events = 0;
+
+	poll_wait(file, &ctx->fd_wqh, wait);
+
+	if (ctx->state == UFFD_STATE_WAIT_API)
+		return POLLERR;
+
+	spin_lock(&ctx->fault_wqh.lock);
+	if (find_userfault(ctx))
+		events |= POLLIN;
+	spin_unlock(&ctx->fault_wqh.lock);
+
+	return events;
+}
+
+static ssize_t userfaultfd_ctx_read(struct userfaultfd_ctx *ctx, int no_wait,
+				    struct uffd_msg *msg)
+{
+	DECLARE_WAITQUEUE(wait, current);
+	struct userfaultfd_wait_queue *uwq;
+	ssize_t ret;
+
+	spin_lock(&ctx->fd_wqh.lock);
+	__add_wait_queue(&ctx->fd_wqh, &wait);
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		spin_lock(&ctx->fault_wqh.lock);
+		uwq = find_userfault(ctx);
+		if (uwq) {
+			uwq->msg_read = true;
+			*msg = uwq->msg;
+			spin_unlock(&ctx->fault_wqh.lock);
+			ret = 0;
+			break;
+		}
+		spin_unlock(&ctx->fault_wqh.lock);
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+		if (no_wait) {
+			ret = -EAGAIN;
+			break;
+		}
+		spin_unlock(&ctx->fd_wqh.lock);
+		schedule();
+		spin_lock(&ctx->fd_wqh.lock);
+	}
+	__remove_wait_queue(&ctx->fd_wqh, &wait);
+	__set_current_state(TASK_RUNNING);
+	spin_unlock(&ctx->fd_wqh.lock);
+
+	return ret;
+}
+
+static ssize_t userfaultfd_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct userfaultfd_ctx *ctx = file->private_data;
+	ssize_t _ret, ret = 0;
+	struct uffd_msg msg;
+	int no_wait = file->f_flags & O_NONBLOCK;
+
+	if (ctx->state == UFFD_STATE_WAIT_API)
+		return -EINVAL;
+
+	for (;;) {
+		if (count < sizeof(msg))
+			return ret ? ret : -EINVAL;
+		_ret = userfaultfd_ctx_read(ctx, no_wait, &msg);
+		if (_ret < 0)
+			return ret ? ret : _ret;
+		if (copy_to_user(buf, &msg, sizeof(msg)))
+			return ret ? ret : -EFAULT;
+		ret += sizeof(msg);
+		buf += sizeof(msg);
+		count -= sizeof(msg);
+		/* Only block for the first message */
+		no_wait = O_NONBLOCK;
+	}
+}
+
+static int userfaultfd_release(struct inode *inode, struct file *file)
+{
+	struct userfaultfd_ctx *ctx = file->private_data;
+	struct mm_struct *mm = ctx->mm;
+	struct vm_area_struct *vma;
+	struct userfaultfd_wake_range range = { .len = 0, };
+
+	ACCESS_ONCE(ctx->released) = true;
+
+	/* Nothing to unregister once the mm is exiting */
+	if (atomic_inc_not_zero(&mm->mm_users)) {
+		down_write(&mm->mmap_sem);
+		for (vma = mm->mmap; vma; vma = vma->vm_next) {
+			if (vma->vm_userfaultfd_ctx.ctx != ctx)
+				continue;
+			vm_write_begin(vma);
+			vma->vm_flags &= ~VM_UFFD_MISSING;
+			vma->vm_userfaultfd_ctx = NULL_VM_UFFD_CTX;
+			vm_write_end(vma);
+		}
+		up_write(&mm->mmap_sem);
+		mmput(mm);
+	}
+
+	/* The faulting threads retry and find the vma unregistered */
+	wake_userfault(ctx, &range);
+	wake_up_poll(&ctx->fd_wqh, POLLHUP);
+	userfaultfd_ctx_put(ctx);
+	return 0;
+}
+
+static int validate_range(struct mm_struct *mm, __u64 start, __u64 len)
+{
+	if (start & ~PAGE_MASK)
+		return -EINVAL;
+	if (len & ~PAGE_MASK)
+		return -EINVAL;
+	if (!len)
+		return -EINVAL;
+	if (start >= TASK_SIZE || len > TASK_SIZE - start)
+		return -EINVAL;
+	return 0;
+}
+
+/* Only private anonymous memory can be registered */
+static bool vma_can_userfault(struct vm_area_struct *vma)
+{
+	return !vma->vm_ops && !(vma->vm_flags & (VM_SHARED | VM_HUGETLB));
+}
+
+static int userfaultfd_register(struct userfaultfd_ctx *ctx,
+				unsigned long arg)
+{
+	struct mm_struct *mm = ctx->mm;
+	struct vm_area_struct *vma, *prev, *cur;
+	struct uffdio_register __user *user_uffdio_register;
+	struct uffdio_register uffdio_register;
+	unsigned long start, end;
+	int ret;
+
+	user_uffdio_register = (struct uffdio_register __user *) arg;
+	if (copy_from_user(&uffdio_register, user_uffdio_register,
+			   sizeof(uffdio_register) - sizeof(__u64)))
+		return -EFAULT;
+
+	if (uffdio_register.mode != UFFDIO_REGISTER_MODE_MISSING)
+		return -EINVAL;
+	ret = validate_range(mm, uffdio_register.range.start,
+			     uffdio_register.range.len);
+	if (ret)
+		return ret;
+	start = uffdio_register.range.start;
+	end = start + uffdio_register.range.len;
+
+	if (!atomic_inc_not_zero(&mm->mm_users))
+		return -ESRCH;
+	down_write(&mm->mmap_sem);
+
+	ret = -EINVAL;
+	vma = find_vma_prev(mm, start, &prev);
+	if (!vma || vma->vm_start >= end)
+		goto out_unlock;
+
+	/* Check the whole range first, so as to fail without side effects */
+	for (cur = vma; cur && cur->vm_start < end; cur = cur->vm_next) {
+		ret = -EINVAL;
+		if (!vma_can_userfault(cur))
+			goto out_unlock;
+		ret = -EBUSY;
+		if (cur->vm_userfaultfd_ctx.ctx &&
+		    cur->vm_userfaultfd_ctx.ctx != ctx)
+			goto out_unlock;
+	}
+
+	ret = 0;
+	for (; vma && vma->vm_start < end; vma = vma->vm_next) {
+		if (vma->vm_userfaultfd_ctx.ctx == ctx)
+			continue;
+		if (vma->vm_start < start) {
+			ret = split_vma(mm, vma, start, 1);
+			if (ret)
+				break;
+		}
+		if (vma->vm_end > end) {
+			ret = split_vma(mm, vma, end, 0);
+			if (ret)
+				break;
+		}
+		/*
+		 * vm_flags are protected by the mmap_sem held in write
+		 * mode; vm_write_begin() tells speculative faults.
+		 */
+		vm_write_begin(vma);
+		vma->vm_flags |= VM_UFFD_MISSING;
+		vma->vm_userfaultfd_ctx.ctx = ctx;
+		vm_write_end(vma);
+	}
+
+out_unlock:
+	up_write(&mm->mmap_sem);
+	mmput(mm);
+	if (!ret && put_user(UFFD_API_RANGE_IOCTLS,
+			     &user_uffdio_register->ioctls))
+		ret = -EFAULT;
+	return ret;
+}
+
+static int userfaultfd_unregister(struct userfaultfd_ctx *ctx,
+				  unsigned long arg)
+{
+	struct mm_struct *mm = ctx->mm;
+	struct vm_area_struct *vma, *prev;
+	struct uffdio_range uffdio_unregister;
+	struct userfaultfd_wake_range range;
+	unsigned long start, end, vmstart, vmend, newflags;
+	pgoff_t pgoff;
+	int ret;
+
+	if (copy_from_user(&uffdio_unregister, (void __user *) arg,
+			   sizeof(uffdio_unregister)))
+		return -EFAULT;
+	ret = validate_range(mm, uffdio_unregister.start,
+			     uffdio_unregister.len);
+	if (ret)
+		return ret;
+	start = uffdio_unregister.start;
+	end = start + uffdio_unregister.len;
+
+	if (!atomic_inc_not_zero(&mm->mm_users))
+		return -ESRCH;
+	down_write(&mm->mmap_sem);
+
+	vma = find_vma_prev(mm, start, &prev);
+	for (; vma && vma->vm_start < end; prev = vma, vma = vma->vm_next) {
+		if (vma->vm_userfaultfd_ctx.ctx != ctx)
+			continue;
+
+		vmstart = max(start, vma->vm_start);
+		vmend = min(end, vma->vm_end);
+		newflags = vma->vm_flags & ~VM_UFFD_MISSING;
+
+		/* As in mprotect_fixup(), try merging back first */
+		pgoff = vma->vm_pgoff + ((vmstart - vma->vm_start) >> PAGE_SHIFT);
+		prev = vma_merge(mm, prev, vmstart, vmend, newflags,
+				 vma->anon_vma, vma->vm_file, pgoff,
+				 vma_policy(vma));
+		if (prev) {
+			vma = prev;
+			goto next;
+		}
+		if (vma->vm_start < vmstart) {
+			ret = split_vma(mm, vma, vmstart, 1);
+			if (ret)
+				break;
+		}
+		if (vma->vm_end > vmend) {
+			ret = split_vma(mm, vma, vmend, 0);
+			if (ret)
+				break;
+		}
+next:
+		vm_write_begin(vma);
+		vma->vm_flags = newflags;
+		vma->vm_userfaultfd_ctx = NULL_VM_UFFD_CTX;
+		vm_write_end(vma);
+	}
+
+	up_write(&mm->mmap_sem);
+	mmput(mm);
+
+	/* Let the threads faulting in the range refault on their own */
+	range.start = start;
+	range.len = end - start;
+	wake_userfault(ctx, &range);
+	return ret;
+}
+
+static int userfaultfd_wake(struct userfaultfd_ctx *ctx, unsigned long arg)
+{
+	struct uffdio_range uffdio_wake;
+	struct userfaultfd_wake_range range;
+	int ret;
+
+	if (copy_from_user(&uffdio_wake, (void __user *) arg,
+			   sizeof(uffdio_wake)))
+		return -EFAULT;
+	ret = validate_range(ctx->mm, uffdio_wake.start, uffdio_wake.len);
+	if (ret)
+		return ret;
+
+	range.start = uffdio_wake.start;
+	range.len = uffdio_wake.len;
+	wake_userfault(ctx, &range);
+	return 0;
+}
+
+static int userfaultfd_copy(struct userfaultfd_ctx *ctx, unsigned long arg)
+{
+	struct uffdio_copy __user *user_uffdio_copy;
+	struct uffdio_copy uffdio_copy;
+	struct userfaultfd_wake_range range;
+	ssize_t ret;
+
+	user_uffdio_copy = (struct uffdio_copy __user *) arg;
+	if (copy_from_user(&uffdio_copy, user_uffdio_copy,
+			   sizeof(uffdio_copy) - sizeof(__s64)))
+		return -EFAULT;
+
+	ret = validate_range(ctx->mm, uffdio_copy.dst, uffdio_copy.len);
+	if (ret)
+		return ret;
+	/* The source must be user memory too, and not wrap */
+	ret = validate_range(ctx->mm, uffdio_copy.src, uffdio_copy.len);
+	if (ret)
+		return ret;
+	if (uffdio_copy.mode & ~UFFDIO_COPY_MODE_DONTWAKE)
+		return -EINVAL;
+
+	if (atomic_inc_not_zero(&ctx->mm->mm_users)) {
+		ret = mcopy_atomic(ctx->mm, uffdio_copy.dst, uffdio_copy.src,
+				   uffdio_copy.len);
+		mmput(ctx->mm);
+	} else
+		ret = -ESRCH;
+
+	if (put_user(ret, &user_uffdio_copy->copy))
+		return -EFAULT;
+	if (ret < 0)
+		return ret;
+
+	range.start = uffdio_copy.dst;
+	range.len = ret;
+	if (!(uffdio_copy.mode & UFFDIO_COPY_MODE_DONTWAKE))
+		wake_userfault(ctx, &range);
+	return ret == uffdio_copy.len ? 0 : -EAGAIN;
+}
+
+static int userfaultfd_api(struct userfaultfd_ctx *ctx, unsigned long arg)
+{
+	struct uffdio_api __user *buf = (struct uffdio_api __user *) arg;
+	struct uffdio_api uffdio_api;
+	int ret = 0;
+
+	if (ctx->state != UFFD_STATE_WAIT_API)
+		return -EINVAL;
+	if (copy_from_user(&uffdio_api, buf, sizeof(uffdio_api)))
+		return -EFAULT;
+	if (uffdio_api.api != UFFD_API || uffdio_api.features) {
+		/* Tell userland what this kernel supports */
+		uffdio_api.api = UFFD_API;
+		uffdio_api.features = 0;
+		ret = -EINVAL;
+	}
+	uffdio_api.ioctls = UFFD_API_IOCTLS;
+	if (copy_to_user(buf, &uffdio_api, sizeof(uffdio_api)))
+		return -EFAULT;
+	if (!ret)
+		ctx->state = UFFD_STATE_RUNNING;
+	return ret;
+}
+
+static long userfaultfd_ioctl(struct file *file, unsigned cmd,
+			      unsigned long arg)
+{
+	struct userfaultfd_ctx *ctx = file->private_data;
+
+	if (cmd != UFFDIO_API && ctx->state == UFFD_STATE_WAIT_API)
+		return -EINVAL;
+
+	switch (cmd) {
+	case UFFDIO_API:
+		return userfaultfd_api(ctx, arg);
+	case UFFDIO_REGISTER:
+		return userfaultfd_register(ctx, arg);
+	case UFFDIO_UNREGISTER:
+		return userfaultfd_unregister(ctx, arg);
+	case UFFDIO_WAKE:
+		return userfaultfd_wake(ctx, arg);
+	case UFFDIO_COPY:
+		return userfaultfd_copy(ctx, arg);
+	}
+	return -ENOTTY;
+}
+
+static const struct file_operations userfaultfd_fops = {
+	.release	= userfaultfd_release,
+	.poll		= userfaultfd_poll,
+	.read		= userfaultfd_read,
+	.unlocked_ioctl	= userfaultfd_ioctl,
+	.compat_ioctl	= userfaultfd_ioctl,
+	.llseek		= noop_llseek,
+};
+
+SYSCALL_DEFINE1(userfaultfd, int, flags)
+{
+	struct userfaultfd_ctx *ctx;
+	struct file *file;
+	int fd, error;
+
+	/* Check the UFFD_* constants for consistency.  */
+	BUILD_BUG_ON(UFFD_CLOEXEC != O_CLOEXEC);
+	BUILD_BUG_ON(UFFD_NONBLOCK != O_NONBLOCK);
+
+	if (flags & ~UFFD_SHARED_FCNTL_FLAGS)
+		return -EINVAL;
+	if (!current->mm)
+		return -EINVAL;
+
+	ctx = kmalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	init_waitqueue_head(&ctx->fault_wqh);
+	init_waitqueue_head(&ctx->fd_wqh);
+	atomic_set(&ctx->refcount, 1);
+	ctx->flags = flags;
+	ctx->state = UFFD_STATE_WAIT_API;
+	ctx->released = false;
+	ctx->mm = current->mm;
+	/* Prevent the mm struct from being freed */
+	atomic_inc(&ctx->mm->mm_count);
+
+	error = get_unused_fd_flags(flags & UFFD_SHARED_FCNTL_FLAGS);
+	if (error < 0)
+		goto err_put_ctx;
+	fd = error;
+
+	file = anon_inode_getfile("[userfaultfd]", &userfaultfd_fops, ctx,
+				  O_RDWR | (flags & UFFD_SHARED_FCNTL_FLAGS));
+	if (IS_ERR(file)) {
+		error = PTR_ERR(file);
+		goto err_put_unused_fd;
+	}
+	fd_install(fd, file);
+
+	return fd;
+
+err_put_unused_fd:
+	put_unused_fd(fd);
+err_put_ctx:
+	userfaultfd_ctx_put(ctx);
+	return error;
+}
@@ -0,0 +1,115 @@
+/*
+ * MCS lock defines
+ *
+ * This file contains the main data structure and API definitions of MCS lock.
+ *
+ * The MCS lock (proposed by Mellor-Crummey and Scott) is a simple spin-lock
+ * with the desirable properties of being fair, and with each cpu trying
+ * to acquire the lock spinning on a local variable.
+ * It avoids expensive cache bouncings that common test-and-set spin-lock
+ * implementations incur.
+ *
+ * The lock word itself only holds a pointer to the tail of the queue of
+ * waiters; every contender brings its own node (usually on its stack or
+ * in a per-cpu area) and busy-waits on node->locked, which only its
+ * predecessor ever writes.
+ */
+#ifndef __LINUX_MCS_SPINLOCK_H
+#define __LINUX_MCS_SPINLOCK_H
+
+#include <linux/compiler.h>
+#include <asm/system.h>
+#include <asm/processor.h>
+
+struct mcs_spinlock {
+	struct mcs_spinlock *next;
+	int locked; /* 1 if lock acquired */
+	int count;  /* nesting count, see kernel/qspinlock.c */
+};
+
+#ifndef arch_mcs_spin_lock_contended
+/*
+ * Spin on our own node until the predecessor hands the lock over. The
+ * smp_mb() orders the critical section after the observed handover.
+ */
+#define arch_mcs_spin_lock_contended(l)					\
+do {									\
+	while (!(ACCESS_ONCE(*(l))))					\
+		cpu_relax();						\
+	smp_mb();							\
+} while (0)
+#endif
+
+#ifndef arch_mcs_spin_unlock_contended
+/*
+ * smp_mb() ensures that the critical section of the previous lock
+ * holder is visible before the next holder is released.
+ */
+#define arch_mcs_spin_unlock_contended(l)				\
+do {									\
+	smp_mb();							\
+	ACCESS_ONCE(*(l)) = 1;						\
+} while (0)
+#endif
+
+/*
+ * Acquire the MCS lock.
+ *
+ * In order to acquire the lock, the caller should declare a local node and
+ * pass a reference of the node to this function in addition to the lock.
+ * If the lock has already been acquired, then this will proceed to spin
+ * on this node->locked until the previous lock holder sets the node->locked
+ * in mcs_spin_unlock().
+ */
+static inline void mcs_spin_lock(struct mcs_spinlock **lock,
+				 struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *prev;
+
+	/* Init node */
+	node->locked = 0;
+	node->next   = NULL;
+
+	prev = xchg(lock, node);
+	if (likely(prev == NULL)) {
+		/*
+		 * Lock acquired, don't need to set node->locked to 1. Threads
+		 * only spin on its own node->locked value for lock acquisition.
+		 * However, since this thread can immediately acquire the lock
+		 * and does not proceed to spin on its own node->locked, this
+		 * value won't be used. If a debug mode is needed to
+		 * audit lock status, then set node->locked value here.
+		 */
+		return;
+	}
+	ACCESS_ONCE(prev->next) = node;
+
+	/* Wait until the lock holder passes the lock down. */
+	arch_mcs_spin_lock_contended(&node->locked);
+}
+
+/*
+ * Releases the lock. The caller should pass in the corresponding node that
+ * was used to acquire the lock.
+ */
+static inline void mcs_spin_unlock(struct mcs_spinlock **lock,
+				   struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *next = ACCESS_ONCE(node->next);
+
+	if (likely(!next)) {
+		/*
+		 * Release the lock by setting it to NULL
+		 */
+		if (likely(cmpxchg(lock, node, NULL) == node))
+			return;
+		/* Wait until the next pointer is set */
+		while (!(next = ACCESS_ONCE(node->next)))
+			cpu_relax();
+	}
+
+	/* Pass lock to next waiter. */
+	arch_mcs_spin_unlock_contended(&next->locked);
+}
+
+#endif /* __LINUX_MCS_SPINLOCK_H */
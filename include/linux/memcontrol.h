@@ -147,9 +147,10 @@ static inline void mem_cgroup_dec_page_stat(struct page *page,
 	mem_cgroup_update_page_stat(page, idx, -1);
 }
 
-unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
-						gfp_t gfp_mask,
-						unsigned long *total_scanned);
+unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int priority,
+					    int order, gfp_t gfp_mask,
+					    unsigned long *total_scanned);
+bool mem_cgroup_page_protected(struct page *page);
 u64 mem_cgroup_get_limit(struct mem_cgroup *mem);
 
 void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx);
@@ -348,13 +349,18 @@ static inline void mem_cgroup_dec_page_stat(struct page *page,
 }
 
 static inline
-unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
-					    gfp_t gfp_mask,
+unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int priority,
+					    int order, gfp_t gfp_mask,
 					    unsigned long *total_scanned)
 {
 	return 0;
 }
 
+static inline bool mem_cgroup_page_protected(struct page *page)
+{
+	return false;
+}
+
 static inline
 u64 mem_cgroup_get_limit(struct mem_cgroup *mem)
 {
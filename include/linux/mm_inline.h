@@ -30,9 +30,143 @@ __add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l,
 	mem_cgroup_add_lru_list(page, l);
 }
 
+#ifdef CONFIG_LRU_GEN
+
+static inline int lru_gen_enabled_zone(struct zone *zone)
+{
+	return zone->lrugen.enabled;
+}
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/*
+ * page_lru_gen - the generation a page belongs to, or -1 if it is not on
+ * a generation list.
+ */
+static inline int page_lru_gen(struct page *page)
+{
+	return (int)((page->flags & LRU_GEN_MASK) >> LRU_GEN_PGOFF) - 1;
+}
+
+/*
+ * Aging updates the generation of mapped pages without lru_lock, so the
+ * generation is always changed atomically with respect to the other flags.
+ * PG_active is meaningless for pages on generation lists and is cleared
+ * along the way.  Passing -1 takes the page off the generations.
+ */
+static inline void set_page_lru_gen(struct page *page, int gen)
+{
+	unsigned long old, new;
+
+	do {
+		old = ACCESS_ONCE(page->flags);
+		new = old & ~(LRU_GEN_MASK | (1UL << PG_active));
+		new |= (unsigned long)(gen + 1) << LRU_GEN_PGOFF;
+	} while (cmpxchg(&page->flags, old, new) != old);
+}
+
+static inline void lru_gen_del_page(struct page *page)
+{
+	if (page_lru_gen(page) >= 0)
+		set_page_lru_gen(page, -1);
+}
+
+/* Put @page on generation @seq of its type.  zone->lru_lock must be held. */
+static inline void __lru_gen_add_page(struct zone *zone, struct page *page,
+				      enum lru_list l, unsigned long seq)
+{
+	int file = is_file_lru(l);
+	int gen = lru_gen_from_seq(seq);
+
+	set_page_lru_gen(page, gen);
+	/* all pages on generation lists are accounted as inactive */
+	__add_page_to_lru_list(zone, page, file ? LRU_INACTIVE_FILE :
+			       LRU_INACTIVE_ANON, &zone->lrugen.lists[gen][file]);
+}
+
+/*
+ * Active pages go to the youngest generation.  Others go one above the
+ * oldest so that they get at least one round of aging to prove useful.
+ */
+static inline int lru_gen_add_page(struct zone *zone, struct page *page,
+				   enum lru_list l)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	unsigned long seq;
+
+	if (!lrugen->enabled || is_unevictable_lru(l))
+		return 0;
+
+	if (is_active_lru(l))
+		seq = lrugen->max_seq;
+	else
+		seq = lrugen->min_seq[is_file_lru(l)] + 1;
+
+	__lru_gen_add_page(zone, page, l, seq);
+	return 1;
+}
+
+/*
+ * Move @page to the tail of the oldest generation of its type, where the
+ * next eviction finds it first.  Returns 0 if @page is not on a
+ * generation list.
+ */
+static inline int lru_gen_move_tail(struct zone *zone, struct page *page)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	int file = page_is_file_cache(page);
+	int gen;
+
+	if (page_lru_gen(page) < 0)
+		return 0;
+
+	gen = lru_gen_from_seq(lrugen->min_seq[file]);
+	set_page_lru_gen(page, gen);
+	list_move_tail(&page->lru, &lrugen->lists[gen][file]);
+	return 1;
+}
+
+#else /* !CONFIG_LRU_GEN */
+
+static inline int lru_gen_enabled_zone(struct zone *zone)
+{
+	return 0;
+}
+
+static inline int page_lru_gen(struct page *page)
+{
+	return -1;
+}
+
+static inline void set_page_lru_gen(struct page *page, int gen)
+{
+}
+
+static inline void lru_gen_del_page(struct page *page)
+{
+}
+
+static inline int lru_gen_add_page(struct zone *zone, struct page *page,
+				   enum lru_list l)
+{
+	return 0;
+}
+
+static inline int lru_gen_move_tail(struct zone *zone, struct page *page)
+{
+	return 0;
+}
+
+#endif /* CONFIG_LRU_GEN */
+
 static inline void
 add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l)
 {
+	if (lru_gen_add_page(zone, page, l))
+		return;
 	__add_page_to_lru_list(zone, page, l, &zone->lru[l].list);
 }
 
@@ -40,6 +174,7 @@ static inline void
 del_page_from_lru_list(struct zone *zone, struct page *page, enum lru_list l)
 {
 	list_del(&page->lru);
+	lru_gen_del_page(page);
 	__mod_zone_page_state(zone, NR_LRU_BASE + l, -hpage_nr_pages(page));
 	mem_cgroup_del_lru_list(page, l);
 }
@@ -65,6 +200,7 @@ del_page_from_lru(struct zone *zone, struct page *page)
 	enum lru_list l;
 
 	list_del(&page->lru);
+	lru_gen_del_page(page);
 	if (PageUnevictable(page)) {
 		__ClearPageUnevictable(page);
 		l = LRU_UNEVICTABLE;
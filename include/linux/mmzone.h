@@ -40,8 +40,31 @@
 #define MIGRATE_MOVABLE       2
 #define MIGRATE_PCPTYPES      3 /* the number of types on the pcp lists */
 #define MIGRATE_RESERVE       3
+#ifdef CONFIG_CMA
+/*
+ * MIGRATE_CMA migration type is designed to mimic the way ZONE_MOVABLE
+ * works.  Only movable pages can be allocated from MIGRATE_CMA
+ * pageblocks and the page allocator never implicitly changes the
+ * migration type of a MIGRATE_CMA pageblock.
+ *
+ * The way to use it is to change the migratetype of a range of
+ * pageblocks to MIGRATE_CMA, which can be done by
+ * init_cma_reserved_pageblock(), and to use alloc_contig_range()
+ * to allocate from it.
+ */
+#define MIGRATE_CMA           4
+#define MIGRATE_ISOLATE       5 /* can't allocate from here */
+#define MIGRATE_TYPES         6
+#else
 #define MIGRATE_ISOLATE       4 /* can't allocate from here */
 #define MIGRATE_TYPES         5
+#endif
+
+#ifdef CONFIG_CMA
+#  define is_migrate_cma(migratetype) unlikely((migratetype) == MIGRATE_CMA)
+#else
+#  define is_migrate_cma(migratetype) false
+#endif
 
 #define for_each_migratetype_order(order, type) \
 	for (order = 0; order < MAX_ORDER; order++) \
@@ -106,6 +129,10 @@ enum zone_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_DIRTIED,		/* page dirtyings since bootup */
 	NR_WRITTEN,		/* page writings since bootup */
+	WORKINGSET_REFAULT,	/* evicted file pages faulted back in */
+	WORKINGSET_ACTIVATE,	/* refaulting pages activated right away */
+	WORKINGSET_NODERECLAIM,	/* shadow-only tree nodes reclaimed */
+	NR_SHADOW_ENTRIES,	/* shadow entries in page cache radix trees */
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -115,6 +142,9 @@ enum zone_stat_item {
 	NUMA_OTHER,		/* allocation from other node */
 #endif
 	NR_ANON_TRANSPARENT_HUGEPAGES,
+	NR_SHMEM_THPS,		/* huge extents of shmem pages, in units of
+				   HPAGE_PMD_NR pages */
+	NR_SHMEM_PMDMAPPED,	/* huge pmds mapping shmem pages */
 	NR_VM_ZONE_STAT_ITEMS };
 
 /*
@@ -178,8 +208,17 @@ struct per_cpu_pages {
 	struct list_head lists[MIGRATE_PCPTYPES];
 };
 
+/*
+ * Orders up to PCP_MAX_ORDER are cached per cpu as well: slab, kernel
+ * stacks and network buffers allocate them all the time.  Their lists
+ * count blocks of their order rather than pages.
+ */
+#define PCP_MAX_ORDER		PAGE_ALLOC_COSTLY_ORDER
+
 struct per_cpu_pageset {
 	struct per_cpu_pages pcp;
+	/* Orders 1 to PCP_MAX_ORDER, indexed by order - 1 */
+	struct per_cpu_pages pcp_orders[PCP_MAX_ORDER];
 #ifdef CONFIG_NUMA
 	s8 expire;
 #endif
@@ -275,6 +314,38 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Multi-generational LRU.  Instead of the active and inactive lists,
+ * the evictable pages of a zone are sorted into generations, indexed by
+ * sequence numbers and, separately, by type (anon or file).  Aging
+ * creates a new youngest generation, max_seq, and promotes the pages
+ * found accessed into it by walking page tables; eviction takes pages
+ * from the oldest generation of a type, min_seq[type].  A page records
+ * its generation in page->flags (see LRU_GEN_PGOFF), so aging can
+ * promote it without taking lru_lock: eviction moves it to the right
+ * list when it comes across it.
+ *
+ * There are always at least MIN_NR_GENS generations, and pages in the
+ * MIN_NR_GENS youngest ones are never evicted.
+ */
+#define MIN_NR_GENS		2
+#define MAX_NR_GENS		4
+
+struct lru_gen_struct {
+	/* the youngest generation, shared by both types */
+	unsigned long		max_seq;
+	/* the oldest generation of anon in [0] and file in [1] */
+	unsigned long		min_seq[2];
+	/* creation time of each generation, in jiffies */
+	unsigned long		timestamps[MAX_NR_GENS];
+	/* the pages of each generation, anon in [gen][0], file in [gen][1] */
+	struct list_head	lists[MAX_NR_GENS][2];
+	/* set when the zone uses the generations instead of zone->lru[] */
+	int			enabled;
+};
+#endif
+
 struct zone {
 	/* Fields commonly accessed by the page allocator */
 
@@ -334,6 +405,17 @@ struct zone {
 	 */
 	unsigned int		compact_considered;
 	unsigned int		compact_defer_shift;
+
+	/*
+	 * pfns where the free and migrate scanners of the next compaction
+	 * run resume, so that each run does not rescan the blocks the
+	 * previous ones already went through.
+	 */
+	unsigned long		compact_cached_free_pfn;
+	unsigned long		compact_cached_migrate_pfn;
+
+	/* Set when the pageblock skip bits should be cleared by kswapd */
+	bool			compact_blockskip_flush;
 #endif
 
 	ZONE_PADDING(_pad1_)
@@ -346,6 +428,12 @@ struct zone {
 
 	struct zone_reclaim_stat reclaim_stat;
 
+	/* Evictions and activations, the clock of refault distances */
+	atomic_long_t		inactive_age;
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen_struct	lrugen;
+#endif
+
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
 
@@ -636,6 +724,13 @@ typedef struct pglist_data {
 	struct task_struct *kswapd;
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+#ifdef CONFIG_COMPACTION
+	/* Background compaction requested by kswapd, see wakeup_kcompactd() */
+	int kcompactd_max_order;
+	enum zone_type kcompactd_classzone_idx;
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
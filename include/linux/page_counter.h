@@ -0,0 +1,71 @@
+#ifndef _LINUX_PAGE_COUNTER_H
+#define _LINUX_PAGE_COUNTER_H
+
+#include <linux/atomic.h>
+#include <linux/kernel.h>
+#include <asm/page.h>
+
+/*
+ * Lockless hierarchical counter of pages.  A charge is added to the
+ * counter and each of its parents, and it fails if any of them would
+ * exceed its limit.  Unlike res_counter, no lock is taken on any level.
+ */
+struct page_counter {
+	atomic_long_t count;
+	unsigned long limit;
+	struct page_counter *parent;
+
+	/* for the userspace interface, updated racily */
+	unsigned long watermark;
+	unsigned long failcnt;
+};
+
+#if BITS_PER_LONG == 32
+#define PAGE_COUNTER_MAX LONG_MAX
+#else
+#define PAGE_COUNTER_MAX (LONG_MAX / PAGE_SIZE)
+#endif
+
+static inline void page_counter_init(struct page_counter *counter,
+				     struct page_counter *parent)
+{
+	atomic_long_set(&counter->count, 0);
+	counter->limit = PAGE_COUNTER_MAX;
+	counter->parent = parent;
+	counter->watermark = 0;
+	counter->failcnt = 0;
+}
+
+static inline unsigned long page_counter_read(struct page_counter *counter)
+{
+	return atomic_long_read(&counter->count);
+}
+
+/* number of pages that can still be charged before hitting the limit */
+static inline unsigned long page_counter_margin(struct page_counter *counter)
+{
+	unsigned long count = page_counter_read(counter);
+	unsigned long limit = ACCESS_ONCE(counter->limit);
+
+	return count < limit ? limit - count : 0;
+}
+
+extern void page_counter_cancel(struct page_counter *counter,
+				unsigned long nr_pages);
+extern void page_counter_charge(struct page_counter *counter,
+				unsigned long nr_pages);
+extern int page_counter_try_charge(struct page_counter *counter,
+				   unsigned long nr_pages,
+				   struct page_counter **fail);
+extern void page_counter_uncharge(struct page_counter *counter,
+				  unsigned long nr_pages);
+extern int page_counter_limit(struct page_counter *counter,
+			      unsigned long limit);
+extern int page_counter_memparse(const char *buf, unsigned long *nr_pages);
+
+static inline void page_counter_reset_watermark(struct page_counter *counter)
+{
+	counter->watermark = page_counter_read(counter);
+}
+
+#endif /* _LINUX_PAGE_COUNTER_H */
@@ -18,6 +18,7 @@
 #include <asm/atomic.h>
 
 struct rw_semaphore;
+struct mcs_spinlock;
 
 #ifdef CONFIG_RWSEM_GENERIC_SPINLOCK
 #include <linux/rwsem-spinlock.h> /* use a generic implementation */
@@ -27,6 +28,15 @@ struct rw_semaphore {
 	long			count;
 	spinlock_t		wait_lock;
 	struct list_head	wait_list;
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+	/*
+	 * Write owner, used by the optimistic spinning code in lib/rwsem.c
+	 * to decide whether spinning on the semaphore is worth it, and the
+	 * queue of writers currently spinning.
+	 */
+	struct task_struct	*owner;
+	struct mcs_spinlock	*mcs_lock;
+#endif
 #ifdef CONFIG_DEBUG_LOCK_ALLOC
 	struct lockdep_map	dep_map;
 #endif
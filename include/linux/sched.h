@@ -514,6 +514,7 @@ struct thread_group_cputimer {
 };
 
 #include <linux/rwsem.h>
+#include <linux/percpu-rwsem.h>
 struct autogroup;
 
 /*
@@ -633,17 +634,6 @@ struct signal_struct {
 	unsigned audit_tty;
 	struct tty_audit_buf *tty_audit_buf;
 #endif
-#ifdef CONFIG_CGROUPS
-	/*
-	 * The threadgroup_fork_lock prevents threads from forking with
-	 * CLONE_THREAD while held for writing. Use this for fork-sensitive
-	 * threadgroup-wide operations. It's taken for reading in fork.c in
-	 * copy_process().
-	 * Currently only needed write-side by cgroups.
-	 */
-	struct rw_semaphore threadgroup_fork_lock;
-#endif
-
 	int oom_adj;		/* OOM kill score adjustment (bit shift) */
 	int oom_score_adj;	/* OOM kill score adjustment */
 	int oom_score_adj_min;	/* OOM kill score adjustment minimum value.
@@ -961,6 +951,8 @@ struct sched_domain {
 
 	u64 last_update;
 
+	u64 avg_scan_cost;		/* select_idle_cpu() */
+
 #ifdef CONFIG_SCHEDSTATS
 	/* load_balance() stats */
 	unsigned int lb_count[CPU_MAX_IDLE_TYPES];
@@ -991,6 +983,10 @@ struct sched_domain {
 	unsigned int ttwu_wake_remote;
 	unsigned int ttwu_move_affine;
 	unsigned int ttwu_move_balance;
+
+	/* wake_affine() stats */
+	unsigned int ttwu_affine_success;
+	unsigned int ttwu_affine_failed;
 #endif
 #ifdef CONFIG_SCHED_DEBUG
 	char *name;
@@ -1217,6 +1213,10 @@ enum perf_event_task_context {
 	perf_nr_task_contexts,
 };
 
+#define VMACACHE_BITS 2
+#define VMACACHE_SIZE (1U << VMACACHE_BITS)
+#define VMACACHE_MASK (VMACACHE_SIZE - 1)
+
 struct task_struct {
 	volatile long state;	/* -1 unrunnable, 0 runnable, >0 stopped */
 	void *stack;
@@ -1282,6 +1282,9 @@ struct task_struct {
 #endif
 
 	struct mm_struct *mm, *active_mm;
+	/* per-thread vma caching */
+	u64 vmacache_seqnum;
+	struct vm_area_struct *vmacache[VMACACHE_SIZE];
 #ifdef CONFIG_COMPAT_BRK
 	unsigned brk_randomized:1;
 #endif
@@ -2349,23 +2352,32 @@ static inline void unlock_task_sighand(struct task_struct *tsk,
 	spin_unlock_irqrestore(&tsk->sighand->siglock, *flags);
 }
 
-/* See the declaration of threadgroup_fork_lock in signal_struct. */
 #ifdef CONFIG_CGROUPS
+/*
+ * The cgroup_threadgroup_rwsem prevents threads from forking with
+ * CLONE_THREAD while held for writing. Use this for fork-sensitive
+ * threadgroup-wide operations. It's taken for reading in fork.c in
+ * copy_process(), which is why it is a percpu_rw_semaphore: the read
+ * side stays on per-cpu counters and never bounces a shared cache line.
+ * Currently only needed write-side by cgroups.
+ */
+extern struct percpu_rw_semaphore cgroup_threadgroup_rwsem;
+
 static inline void threadgroup_fork_read_lock(struct task_struct *tsk)
 {
-	down_read(&tsk->signal->threadgroup_fork_lock);
+	percpu_down_read(&cgroup_threadgroup_rwsem);
 }
 static inline void threadgroup_fork_read_unlock(struct task_struct *tsk)
 {
-	up_read(&tsk->signal->threadgroup_fork_lock);
+	percpu_up_read(&cgroup_threadgroup_rwsem);
 }
 static inline void threadgroup_fork_write_lock(struct task_struct *tsk)
 {
-	down_write(&tsk->signal->threadgroup_fork_lock);
+	percpu_down_write(&cgroup_threadgroup_rwsem);
 }
 static inline void threadgroup_fork_write_unlock(struct task_struct *tsk)
 {
-	up_write(&tsk->signal->threadgroup_fork_lock);
+	percpu_up_write(&cgroup_threadgroup_rwsem);
 }
 #else
 static inline void threadgroup_fork_read_lock(struct task_struct *tsk) {}
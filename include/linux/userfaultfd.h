@@ -0,0 +1,110 @@
+/*
+ *  include/linux/userfaultfd.h
+ *
+ *  Userspace interface of userfaultfd(2): missing page faults in
+ *  registered ranges are read as struct uffd_msg from the file
+ *  descriptor, and resolved with the UFFDIO_* ioctls.
+ */
+
+#ifndef _LINUX_USERFAULTFD_H
+#define _LINUX_USERFAULTFD_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define UFFD_API ((__u64)0xAA)
+
+/* ioctls of the file descriptor */
+#define _UFFDIO_REGISTER		(0x00)
+#define _UFFDIO_UNREGISTER		(0x01)
+#define _UFFDIO_API			(0x3F)
+/* ioctls of the registered ranges */
+#define _UFFDIO_WAKE			(0x02)
+#define _UFFDIO_COPY			(0x03)
+
+/* bitmasks of the ioctls above, as returned by UFFDIO_API/REGISTER */
+#define UFFD_API_IOCTLS				\
+	((__u64)1 << _UFFDIO_REGISTER |		\
+	 (__u64)1 << _UFFDIO_UNREGISTER |	\
+	 (__u64)1 << _UFFDIO_API)
+#define UFFD_API_RANGE_IOCTLS			\
+	((__u64)1 << _UFFDIO_WAKE |		\
+	 (__u64)1 << _UFFDIO_COPY)
+
+#define UFFDIO 0xAA
+#define UFFDIO_API		_IOWR(UFFDIO, _UFFDIO_API,	\
+				      struct uffdio_api)
+#define UFFDIO_REGISTER		_IOWR(UFFDIO, _UFFDIO_REGISTER, \
+				      struct uffdio_register)
+#define UFFDIO_UNREGISTER	_IOR(UFFDIO, _UFFDIO_UNREGISTER,	\
+				     struct uffdio_range)
+#define UFFDIO_WAKE		_IOR(UFFDIO, _UFFDIO_WAKE,	\
+				     struct uffdio_range)
+#define UFFDIO_COPY		_IOWR(UFFDIO, _UFFDIO_COPY,	\
+				      struct uffdio_copy)
+
+/* read(2) structure */
+struct uffd_msg {
+	__u8	event;
+
+	__u8	reserved1;
+	__u16	reserved2;
+	__u32	reserved3;
+
+	union {
+		struct {
+			__u64	flags;
+			__u64	address;
+		} pagefault;
+
+		struct {
+			/* unused reserved fields */
+			__u64	reserved1;
+			__u64	reserved2;
+			__u64	reserved3;
+		} reserved;
+	} arg;
+} __attribute__((packed));
+
+/* uffd_msg.event */
+#define UFFD_EVENT_PAGEFAULT	0x12
+
+/* uffd_msg.arg.pagefault.flags */
+#define UFFD_PAGEFAULT_FLAG_WRITE	(1<<0)	/* the fault was a write */
+
+struct uffdio_api {
+	/* userland asks for an API number and the features to enable */
+	__u64 api;
+	__u64 features;	/* none defined yet, must be zero */
+	/* kernel answers with the ioctls available, UFFD_API_IOCTLS */
+	__u64 ioctls;
+};
+
+struct uffdio_range {
+	__u64 start;
+	__u64 len;
+};
+
+struct uffdio_register {
+	struct uffdio_range range;
+#define UFFDIO_REGISTER_MODE_MISSING	((__u64)1<<0)
+	__u64 mode;
+	/* kernel answers with the ioctls of the range, UFFD_API_RANGE_IOCTLS */
+	__u64 ioctls;
+};
+
+struct uffdio_copy {
+	__u64 dst;
+	__u64 src;
+	__u64 len;
+	/*
+	 * Leave the faulting threads asleep: a UFFDIO_WAKE of a larger
+	 * range can follow several copies.
+	 */
+#define UFFDIO_COPY_MODE_DONTWAKE	((__u64)1<<0)
+	__u64 mode;
+	/* bytes copied, or a negative error, written back by the kernel */
+	__s64 copy;
+};
+
+#endif /* _LINUX_USERFAULTFD_H */
@@ -58,11 +58,15 @@
 #include <linux/eventfd.h>
 #include <linux/poll.h>
 #include <linux/flex_array.h> /* used in cgroup_attach_proc */
+#include <linux/percpu-rwsem.h>
 
 #include <asm/atomic.h>
 
 static DEFINE_MUTEX(cgroup_mutex);
 
+/* See the comment above threadgroup_fork_read_lock() in sched.h. */
+struct percpu_rw_semaphore cgroup_threadgroup_rwsem;
+
 /*
  * Generate an array of cgroup subsystem pointers. At boot time, this is
  * populated up to CGROUP_BUILTIN_SUBSYS_COUNT, and modular subsystems are
@@ -1982,7 +1986,7 @@ static int css_set_prefetch(struct cgroup *cgrp, struct css_set *cg,
  * @cgrp: the cgroup to attach to
  * @leader: the threadgroup leader task_struct of the group to be attached
  *
- * Call holding cgroup_mutex and the threadgroup_fork_lock of the leader. Will
+ * Call holding cgroup_mutex and cgroup_threadgroup_rwsem for writing. Will
  * take task_lock of each thread in leader's threadgroup individually in turn.
  */
 int cgroup_attach_proc(struct cgroup *cgrp, struct task_struct *leader)
@@ -2009,7 +2013,7 @@ int cgroup_attach_proc(struct cgroup *cgrp, struct task_struct *leader)
 	 * step 0: in order to do expensive, possibly blocking operations for
 	 * every thread, we cannot iterate the thread group list, since it needs
 	 * rcu or tasklist locked. instead, build an array of all threads in the
-	 * group - threadgroup_fork_lock prevents new threads from appearing,
+	 * group - cgroup_threadgroup_rwsem prevents new threads from appearing,
 	 * and if threads exit, this will just be an over-estimate.
 	 */
 	group_size = get_nr_threads(leader);
@@ -4328,6 +4332,8 @@ int __init cgroup_init(void)
 	int i;
 	struct hlist_head *hhead;
 
+	BUG_ON(percpu_init_rwsem(&cgroup_threadgroup_rwsem));
+
 	err = bdi_init(&cgroup_backing_dev_info);
 	if (err)
 		return err;
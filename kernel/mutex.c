@@ -23,6 +23,7 @@
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
 #include <linux/debug_locks.h>
+#include <linux/mcs_spinlock.h>
 
 /*
  * In the DEBUG case we are using the "NULL fastpath" for mutexes,
@@ -43,6 +44,9 @@ __mutex_init(struct mutex *lock, const char *name, struct lock_class_key *key)
 	spin_lock_init(&lock->wait_lock);
 	INIT_LIST_HEAD(&lock->wait_list);
 	mutex_clear_owner(lock);
+#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+	lock->mcs_lock = NULL;
+#endif
 
 	debug_mutex_init(lock, name, key);
 }
@@ -126,6 +130,30 @@ void __sched mutex_unlock(struct mutex *lock)
 
 EXPORT_SYMBOL(mutex_unlock);
 
+#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+/*
+ * Initial check for entering the optimistic spin loop: only bother
+ * when the lock has no owner (it is about to be released or was just
+ * taken) or when the owner is running on another CPU right now.
+ */
+static inline int mutex_can_spin_on_owner(struct mutex *lock)
+{
+	struct task_struct *owner;
+	int retval = 1;
+
+	if (need_resched())
+		return 0;
+
+	rcu_read_lock();
+	owner = ACCESS_ONCE(lock->owner);
+	if (owner)
+		retval = owner->on_cpu;
+	rcu_read_unlock();
+
+	return retval;
+}
+#endif
+
 /*
  * Lock a mutex (possibly interruptible), slowpath:
  */
@@ -157,42 +185,55 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 	 *
 	 * We can't do this for DEBUG_MUTEXES because that relies on wait_lock
 	 * to serialize everything.
+	 *
+	 * The spinners are queued on an MCS lock so that only the spinner at
+	 * the head of the queue polls lock->count and lock->owner; the others
+	 * each busy-wait on their own on-stack node, which keeps the mutex
+	 * cache line from bouncing between all of the contending CPUs.
 	 */
-
-	for (;;) {
-		struct task_struct *owner;
-
-		/*
-		 * If there's an owner, wait for it to either
-		 * release the lock or go to sleep.
-		 */
-		owner = ACCESS_ONCE(lock->owner);
-		if (owner && !mutex_spin_on_owner(lock, owner))
-			break;
-
-		if (atomic_cmpxchg(&lock->count, 1, 0) == 1) {
-			lock_acquired(&lock->dep_map, ip);
-			mutex_set_owner(lock);
-			preempt_enable();
-			return 0;
+	if (mutex_can_spin_on_owner(lock)) {
+		struct mcs_spinlock node;
+
+		mcs_spin_lock(&lock->mcs_lock, &node);
+		for (;;) {
+			struct task_struct *owner;
+
+			/*
+			 * If there's an owner, wait for it to either
+			 * release the lock or go to sleep.
+			 */
+			owner = ACCESS_ONCE(lock->owner);
+			if (owner && !mutex_spin_on_owner(lock, owner))
+				break;
+
+			if (atomic_read(&lock->count) == 1 &&
+			    atomic_cmpxchg(&lock->count, 1, 0) == 1) {
+				lock_acquired(&lock->dep_map, ip);
+				mutex_set_owner(lock);
+				mcs_spin_unlock(&lock->mcs_lock, &node);
+				preempt_enable();
+				return 0;
+			}
+
+			/*
+			 * When there's no owner, we might have preempted
+			 * between the owner acquiring the lock and setting
+			 * the owner field. If we're an RT task that will
+			 * live-lock because we won't let the owner complete.
+			 */
+			if (!owner && (need_resched() || rt_task(task)))
+				break;
+
+			/*
+			 * The cpu_relax() call is a compiler barrier which
+			 * forces everything in this loop to be re-loaded. We
+			 * don't need memory barriers as we'll eventually
+			 * observe the right values at the cost of a few extra
+			 * spins.
+			 */
+			arch_mutex_cpu_relax();
 		}
-
-		/*
-		 * When there's no owner, we might have preempted between the
-		 * owner acquiring the lock and setting the owner field. If
-		 * we're an RT task that will live-lock because we won't let
-		 * the owner complete.
-		 */
-		if (!owner && (need_resched() || rt_task(task)))
-			break;
-
-		/*
-		 * The cpu_relax() call is a compiler barrier which forces
-		 * everything in this loop to be re-loaded. We don't need
-		 * memory barriers as we'll eventually observe the right
-		 * values at the cost of a few extra spins.
-		 */
-		arch_mutex_cpu_relax();
+		mcs_spin_unlock(&lock->mcs_lock, &node);
 	}
 #endif
 	spin_lock_mutex(&lock->wait_lock, flags);
@@ -598,6 +598,54 @@ static inline int cpu_of(struct rq *rq)
 #define this_rq()		(&__get_cpu_var(runqueues))
 #define task_rq(p)		cpu_rq(task_cpu(p))
 #define cpu_curr(cpu)		(cpu_rq(cpu)->curr)
+
+#ifdef CONFIG_SMP
+/*
+ * The highest SD_SHARE_PKG_RESOURCES domain of each cpu, ie. the one
+ * spanning its last level cache, and the first cpu of that span.  The
+ * latter indexes state shared by all cpus of the LLC.
+ */
+static DEFINE_PER_CPU(struct sched_domain *, sd_llc);
+static DEFINE_PER_CPU(int, sd_llc_id);
+
+#ifdef CONFIG_SCHED_SMT
+/* per LLC hint that it has a core whose siblings are all idle */
+static DEFINE_PER_CPU_SHARED_ALIGNED(int, sd_llc_idle_cores);
+
+static inline void set_idle_cores(int cpu, int val)
+{
+	ACCESS_ONCE(per_cpu(sd_llc_idle_cores, per_cpu(sd_llc_id, cpu))) = val;
+}
+
+static inline int test_idle_cores(int cpu)
+{
+	return ACCESS_ONCE(per_cpu(sd_llc_idle_cores, per_cpu(sd_llc_id, cpu)));
+}
+
+/*
+ * Called as @rq's cpu goes idle.  If all its SMT siblings are idle
+ * already, the whole core is and select_idle_core() may find it.
+ */
+static void update_idle_core(struct rq *rq)
+{
+	int core = cpu_of(rq);
+	int cpu;
+
+	if (test_idle_cores(core))
+		return;
+
+	for_each_cpu(cpu, topology_thread_cpumask(core)) {
+		if (cpu != core && !idle_cpu(cpu))
+			return;
+	}
+	set_idle_cores(core, 1);
+}
+#else
+static inline void update_idle_core(struct rq *rq) { }
+#endif /* CONFIG_SCHED_SMT */
+#else
+static inline void update_idle_core(struct rq *rq) { }
+#endif /* CONFIG_SMP */
 #define raw_rq()		(&__raw_get_cpu_var(runqueues))
 
 #ifdef CONFIG_CGROUP_SCHED
@@ -6839,6 +6887,23 @@ static void destroy_sched_domains(struct sched_domain *sd, int cpu)
 		destroy_sched_domain(sd, cpu);
 }
 
+static void update_top_cache_domain(int cpu, struct sched_domain *sd)
+{
+	struct sched_domain *llc = NULL;
+	int id = cpu;
+
+	for (; sd; sd = sd->parent) {
+		if (!(sd->flags & SD_SHARE_PKG_RESOURCES))
+			break;
+		llc = sd;
+	}
+	if (llc)
+		id = cpumask_first(sched_domain_span(llc));
+
+	rcu_assign_pointer(per_cpu(sd_llc, cpu), llc);
+	per_cpu(sd_llc_id, cpu) = id;
+}
+
 /*
  * Attach the domain 'sd' to 'cpu' as its base domain. Callers must
  * hold the hotplug lock.
@@ -6878,6 +6943,8 @@ cpu_attach_domain(struct sched_domain *sd, struct root_domain *rd, int cpu)
 	tmp = rq->sd;
 	rcu_assign_pointer(rq->sd, sd);
 	destroy_sched_domains(tmp, cpu);
+
+	update_top_cache_domain(cpu, sd);
 }
 
 /* cpus with isolated domains */
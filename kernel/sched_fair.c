@@ -1524,8 +1524,10 @@ static int wake_affine(struct sched_domain *sd, struct task_struct *p, int sync)
 	 * a reasonable amount of time then attract this newly
 	 * woken task:
 	 */
-	if (sync && balanced)
+	if (sync && balanced) {
+		schedstat_inc(sd, ttwu_affine_success);
 		return 1;
+	}
 
 	schedstat_inc(p, se.statistics.nr_wakeups_affine_attempts);
 	tl_per_task = cpu_avg_load_per_task(this_cpu);
@@ -1539,10 +1541,12 @@ static int wake_affine(struct sched_domain *sd, struct task_struct *p, int sync)
 		 * there is no bad imbalance.
 		 */
 		schedstat_inc(sd, ttwu_move_affine);
+		schedstat_inc(sd, ttwu_affine_success);
 		schedstat_inc(p, se.statistics.nr_wakeups_affine);
 
 		return 1;
 	}
+	schedstat_inc(sd, ttwu_affine_failed);
 	return 0;
 }
 
@@ -1623,8 +1627,109 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 	return idlest;
 }
 
+#ifdef CONFIG_SCHED_SMT
 /*
- * Try and locate an idle CPU in the sched_domain.
+ * Scan the LLC domain for a core whose siblings are all idle.  The
+ * scan only happens while the LLC is hinted to have one, and a scan
+ * that comes up empty clears the hint until a core goes idle again.
+ */
+static int select_idle_core(struct task_struct *p, struct sched_domain *sd,
+			    int target)
+{
+	int core, cpu;
+
+	if (!test_idle_cores(target))
+		return -1;
+
+	for_each_cpu(core, sched_domain_span(sd)) {
+		const struct cpumask *smt = topology_thread_cpumask(core);
+		bool idle = true;
+
+		/* look at each core once, through its first sibling */
+		if (core != cpumask_first(smt))
+			continue;
+
+		for_each_cpu(cpu, smt) {
+			if (!idle_cpu(cpu)) {
+				idle = false;
+				break;
+			}
+		}
+		if (!idle)
+			continue;
+
+		for_each_cpu_and(cpu, smt, &p->cpus_allowed)
+			return cpu;
+	}
+
+	set_idle_cores(target, 0);
+	return -1;
+}
+#else
+static inline int select_idle_core(struct task_struct *p,
+				   struct sched_domain *sd, int target)
+{
+	return -1;
+}
+#endif
+
+/*
+ * Scan the LLC domain for an idle cpu, starting right after @target so
+ * that successive wakeups aimed at different cpus look at different
+ * parts of the domain first.  The number of cpus looked at is bounded
+ * by how long this cpu is expected to stay idle relative to the
+ * average cost of a scan, see SIS_AVG_CPU and SIS_PROP.
+ */
+static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd,
+			   int target)
+{
+	const struct cpumask *span = sched_domain_span(sd);
+	u64 avg_idle, avg_cost, time;
+	s64 delta;
+	int cpu, i, nr = INT_MAX;
+
+	/* large fuzz factor, avg_idle is a very rough estimate */
+	avg_idle = this_rq()->avg_idle / 512;
+	avg_cost = sd->avg_scan_cost + 1;
+
+	if (sched_feat(SIS_AVG_CPU) && avg_idle < avg_cost)
+		return -1;
+
+	if (sched_feat(SIS_PROP)) {
+		u64 span_avg = sd->span_weight * avg_idle;
+
+		if (span_avg > 4 * avg_cost)
+			nr = div64_u64(span_avg, avg_cost);
+		else
+			nr = 4;
+	}
+
+	time = local_clock();
+
+	for (i = 0, cpu = target; i < sd->span_weight; i++) {
+		cpu = cpumask_next(cpu, span);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(span);
+
+		if (!nr--)
+			break;
+		if (!cpumask_test_cpu(cpu, &p->cpus_allowed))
+			continue;
+		if (idle_cpu(cpu))
+			goto found;
+	}
+	cpu = -1;
+found:
+	time = local_clock() - time;
+	delta = (s64)(time - sd->avg_scan_cost) / 8;
+	sd->avg_scan_cost += delta;
+
+	return cpu;
+}
+
+/*
+ * Try and locate an idle CPU in the last level cache domain of @target,
+ * preferring a fully idle core over an idle SMT sibling.
  */
 static int select_idle_sibling(struct task_struct *p, int target)
 {
@@ -1648,28 +1753,20 @@ static int select_idle_sibling(struct task_struct *p, int target)
 		return prev_cpu;
 
 	/*
-	 * Otherwise, iterate the domains and find an elegible idle cpu.
+	 * Otherwise, look for an elegible idle core, then cpu, sharing
+	 * the cache with target.
 	 */
 	rcu_read_lock();
-	for_each_domain(target, sd) {
-		if (!(sd->flags & SD_SHARE_PKG_RESOURCES))
-			break;
-
-		for_each_cpu_and(i, sched_domain_span(sd), &p->cpus_allowed) {
-			if (idle_cpu(i)) {
-				target = i;
-				break;
-			}
-		}
+	sd = rcu_dereference(per_cpu(sd_llc, target));
+	if (!sd)
+		goto unlock;
 
-		/*
-		 * Lets stop looking for an idle sibling when we reached
-		 * the domain that spans the current cpu and prev_cpu.
-		 */
-		if (cpumask_test_cpu(cpu, sched_domain_span(sd)) &&
-		    cpumask_test_cpu(prev_cpu, sched_domain_span(sd)))
-			break;
-	}
+	i = select_idle_core(p, sd, target);
+	if (i < 0)
+		i = select_idle_cpu(p, sd, target);
+	if (i >= 0)
+		target = i;
+unlock:
 	rcu_read_unlock();
 
 	return target;
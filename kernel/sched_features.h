@@ -72,3 +72,12 @@ SCHED_FEAT(NONIRQ_POWER, 1)
 SCHED_FEAT(TTWU_QUEUE, 1)
 
 SCHED_FEAT(FORCE_SD_OVERLAP, 0)
+
+/*
+ * Bound the idle cpu search in select_idle_cpu() by how long the
+ * waking cpu is expected to stay idle versus the average cost of a
+ * scan: SIS_AVG_CPU skips the search altogether when it can't pay
+ * off, SIS_PROP scans a proportional number of cpus.
+ */
+SCHED_FEAT(SIS_AVG_CPU, 0)
+SCHED_FEAT(SIS_PROP, 1)
@@ -188,6 +188,7 @@ cond_syscall(compat_sys_timerfd_settime);
 cond_syscall(compat_sys_timerfd_gettime);
 cond_syscall(sys_eventfd);
 cond_syscall(sys_eventfd2);
+cond_syscall(sys_userfaultfd);
 
 /* performance counters: */
 cond_syscall(sys_perf_event_open);
@@ -196,6 +197,15 @@ cond_syscall(sys_perf_event_open);
 cond_syscall(sys_fanotify_init);
 cond_syscall(sys_fanotify_mark);
 
+/* cross memory attach, MMU only */
+cond_syscall(sys_process_vm_readv);
+cond_syscall(sys_process_vm_writev);
+cond_syscall(compat_sys_process_vm_readv);
+cond_syscall(compat_sys_process_vm_writev);
+
+/* memfd_create, tmpfs only */
+cond_syscall(sys_memfd_create);
+
 /* open by handle */
 cond_syscall(sys_name_to_handle_at);
 cond_syscall(sys_open_by_handle_at);
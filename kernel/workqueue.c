@@ -41,6 +41,7 @@
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
 #include <linux/idr.h>
+#include <linux/device.h>
 
 #include "workqueue_sched.h"
 
@@ -115,6 +116,7 @@ enum {
  */
 
 struct global_cwq;
+struct wq_device;
 
 /*
  * The poor guys doing the actual heavy lifting.  All on-duty workers
@@ -184,7 +186,7 @@ struct cpu_workqueue_struct {
 	int			nr_active;	/* L: nr of active works */
 	int			max_active;	/* L: max active works */
 	struct list_head	delayed_works;	/* L: delayed works */
-};
+} __aligned(1 << WORK_STRUCT_FLAG_BITS);
 
 /*
  * Structure used to wait for workqueue flush.
@@ -224,7 +226,7 @@ struct workqueue_struct {
 	unsigned int		flags;		/* I: WQ_* flags */
 	union {
 		struct cpu_workqueue_struct __percpu	*pcpu;
-		struct cpu_workqueue_struct		*single;
+		struct cpu_workqueue_struct		*single; /* per-node if unbound */
 		unsigned long				v;
 	} cpu_wq;				/* I: cwq's */
 	struct list_head	list;		/* W: list of all workqueues */
@@ -242,6 +244,15 @@ struct workqueue_struct {
 
 	int			saved_max_active; /* W: saved cwq max_active */
 	const char		*name;		/* I: workqueue name */
+
+	/* unbound workqueues only */
+	int			nice;		/* nice level of the workers */
+	int			ordered_node;	/* I: the only node if ordered */
+	nodemask_t		nodes;		/* W: nodes works may go to */
+	cpumask_var_t		cpumask;	/* W: cpus as set through sysfs */
+#ifdef CONFIG_SYSFS
+	struct wq_device	*wq_dev;	/* I: for sysfs interface */
+#endif
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map	lockdep_map;
 #endif
@@ -265,9 +276,17 @@ EXPORT_SYMBOL_GPL(system_freezable_wq);
 	for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)			\
 		hlist_for_each_entry(worker, pos, &gcwq->busy_hash[i], hentry)
 
+/* unbound gcwqs are identified by WORK_CPU_UNBOUND + node */
+static inline bool cpu_is_unbound(unsigned int cpu)
+{
+	return cpu >= WORK_CPU_UNBOUND && cpu < WORK_CPU_NONE;
+}
+
 static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				  unsigned int sw)
 {
+	int node;
+
 	if (cpu < nr_cpu_ids) {
 		if (sw & 1) {
 			cpu = cpumask_next(cpu, mask);
@@ -275,7 +294,11 @@ static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				return cpu;
 		}
 		if (sw & 2)
-			return WORK_CPU_UNBOUND;
+			return WORK_CPU_UNBOUND + first_node(node_possible_map);
+	} else if (cpu_is_unbound(cpu)) {
+		node = next_node(cpu - WORK_CPU_UNBOUND, node_possible_map);
+		if (node < MAX_NUMNODES)
+			return WORK_CPU_UNBOUND + node;
 	}
 	return WORK_CPU_NONE;
 }
@@ -289,15 +312,15 @@ static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
 /*
  * CPU iterators
  *
- * An extra gcwq is defined for an invalid cpu number
- * (WORK_CPU_UNBOUND) to host workqueues which are not bound to any
- * specific CPU.  The following iterators are similar to
- * for_each_*_cpu() iterators but also considers the unbound gcwq.
+ * Extra gcwqs are defined for invalid cpu numbers, one per possible
+ * NUMA node starting at WORK_CPU_UNBOUND, to host workqueues which are
+ * not bound to any specific CPU.  The following iterators are similar
+ * to for_each_*_cpu() iterators but also consider the unbound gcwqs.
  *
- * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND
- * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND
+ * for_each_gcwq_cpu()		: possible CPUs + unbound gcwqs
+ * for_each_online_gcwq_cpu()	: online CPUs + unbound gcwqs
  * for_each_cwq_cpu()		: possible CPUs for bound workqueues,
- *				  WORK_CPU_UNBOUND for unbound workqueues
+ *				  unbound gcwqs for unbound workqueues
  */
 #define for_each_gcwq_cpu(cpu)						\
 	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 3);		\
@@ -444,26 +467,28 @@ static DEFINE_PER_CPU(struct global_cwq, global_cwq);
 static DEFINE_PER_CPU_SHARED_ALIGNED(atomic_t, gcwq_nr_running);
 
 /*
- * Global cpu workqueue and nr_running counter for unbound gcwq.  The
- * gcwq is always online, has GCWQ_DISASSOCIATED set, and all its
- * workers have WORKER_UNBOUND set.
+ * Global cpu workqueues and nr_running counter for unbound gcwqs.
+ * There's one gcwq per possible node, allocated on that node and
+ * served by workers affine to its cpus.  The gcwqs are always online,
+ * have GCWQ_DISASSOCIATED set, and all their workers have
+ * WORKER_UNBOUND set.
  */
-static struct global_cwq unbound_global_cwq;
+static struct global_cwq *unbound_global_cwq[MAX_NUMNODES];
 static atomic_t unbound_gcwq_nr_running = ATOMIC_INIT(0);	/* always 0 */
 
 static int worker_thread(void *__worker);
 
 static struct global_cwq *get_gcwq(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (!cpu_is_unbound(cpu))
 		return &per_cpu(global_cwq, cpu);
 	else
-		return &unbound_global_cwq;
+		return unbound_global_cwq[cpu - WORK_CPU_UNBOUND];
 }
 
 static atomic_t *get_gcwq_nr_running(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (!cpu_is_unbound(cpu))
 		return &per_cpu(gcwq_nr_running, cpu);
 	else
 		return &unbound_gcwq_nr_running;
@@ -480,8 +505,8 @@ static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 			return wq->cpu_wq.single;
 #endif
 		}
-	} else if (likely(cpu == WORK_CPU_UNBOUND))
-		return wq->cpu_wq.single;
+	} else if (likely(cpu_is_unbound(cpu)))
+		return wq->cpu_wq.single + (cpu - WORK_CPU_UNBOUND);
 	return NULL;
 }
 
@@ -563,7 +588,7 @@ static struct global_cwq *get_work_gcwq(struct work_struct *work)
 	if (cpu == WORK_CPU_NONE)
 		return NULL;
 
-	BUG_ON(cpu >= nr_cpu_ids && cpu != WORK_CPU_UNBOUND);
+	BUG_ON(cpu >= nr_cpu_ids && !cpu_is_unbound(cpu));
 	return get_gcwq(cpu);
 }
 
@@ -978,10 +1003,51 @@ static bool is_chained_work(struct workqueue_struct *wq)
 	return false;
 }
 
+/*
+ * Pick the unbound gcwq for a work item queued from this cpu.  Works
+ * go to the pool of the submitting node unless @wq is ordered or its
+ * cpumask excludes the node.  If that pool has no idle worker, the
+ * nearest allowed node with one takes the work instead of waiting for
+ * the local manager to create a new worker.
+ */
+static struct global_cwq *unbound_gcwq_for_work(struct workqueue_struct *wq)
+{
+	struct global_cwq *gcwq, *best = NULL;
+	int node, local, dist, best_dist = INT_MAX;
+
+	if (wq->flags & WQ_ORDERED)
+		return get_gcwq(WORK_CPU_UNBOUND + wq->ordered_node);
+
+	local = numa_node_id();
+	if (unlikely(!node_isset(local, wq->nodes))) {
+		node = first_node(wq->nodes);
+		if (node < MAX_NUMNODES)
+			local = node;
+	}
+
+	gcwq = get_gcwq(WORK_CPU_UNBOUND + local);
+	if (nr_node_ids == 1 || ACCESS_ONCE(gcwq->nr_idle))
+		return gcwq;
+
+	/* unlocked peeks, it's only a hint */
+	for_each_node_mask(node, wq->nodes) {
+		struct global_cwq *remote = get_gcwq(WORK_CPU_UNBOUND + node);
+
+		if (node == local || !ACCESS_ONCE(remote->nr_idle))
+			continue;
+		dist = node_distance(local, node);
+		if (dist < best_dist) {
+			best = remote;
+			best_dist = dist;
+		}
+	}
+	return best ?: gcwq;
+}
+
 static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
-	struct global_cwq *gcwq;
+	struct global_cwq *gcwq, *last_gcwq;
 	struct cpu_workqueue_struct *cwq;
 	struct list_head *worklist;
 	unsigned int work_flags;
@@ -996,39 +1062,36 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 
 	/* determine gcwq to use */
 	if (!(wq->flags & WQ_UNBOUND)) {
-		struct global_cwq *last_gcwq;
-
 		if (unlikely(cpu == WORK_CPU_UNBOUND))
 			cpu = raw_smp_processor_id();
-
-		/*
-		 * It's multi cpu.  If @wq is non-reentrant and @work
-		 * was previously on a different cpu, it might still
-		 * be running there, in which case the work needs to
-		 * be queued on that cpu to guarantee non-reentrance.
-		 */
 		gcwq = get_gcwq(cpu);
-		if (wq->flags & WQ_NON_REENTRANT &&
-		    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
-			struct worker *worker;
+	} else
+		gcwq = unbound_gcwq_for_work(wq);
 
-			spin_lock_irqsave(&last_gcwq->lock, flags);
+	/*
+	 * It's multi cpu or multi node.  If @wq is non-reentrant and
+	 * @work was previously on a different gcwq, it might still be
+	 * running there, in which case the work needs to be queued on
+	 * that gcwq to guarantee non-reentrance.  Unbound workqueues
+	 * have always been non-reentrant and stay so.
+	 */
+	if (wq->flags & (WQ_NON_REENTRANT | WQ_UNBOUND) &&
+	    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
+		struct worker *worker;
 
-			worker = find_worker_executing_work(last_gcwq, work);
+		spin_lock_irqsave(&last_gcwq->lock, flags);
 
-			if (worker && worker->current_cwq->wq == wq)
-				gcwq = last_gcwq;
-			else {
-				/* meh... not running there, queue here */
-				spin_unlock_irqrestore(&last_gcwq->lock, flags);
-				spin_lock_irqsave(&gcwq->lock, flags);
-			}
-		} else
+		worker = find_worker_executing_work(last_gcwq, work);
+
+		if (worker && worker->current_cwq->wq == wq)
+			gcwq = last_gcwq;
+		else {
+			/* meh... not running there, queue here */
+			spin_unlock_irqrestore(&last_gcwq->lock, flags);
 			spin_lock_irqsave(&gcwq->lock, flags);
-	} else {
-		gcwq = get_gcwq(WORK_CPU_UNBOUND);
+		}
+	} else
 		spin_lock_irqsave(&gcwq->lock, flags);
-	}
 
 	/* gcwq determined, get cwq and queue */
 	cwq = get_cwq(gcwq->cpu, wq);
@@ -1141,6 +1204,8 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 	struct work_struct *work = &dwork->work;
 
 	if (!test_and_set_bit(WORK_STRUCT_PENDING_BIT, work_data_bits(work))) {
+		struct global_cwq *gcwq = get_work_gcwq(work);
+		bool unbound = wq->flags & WQ_UNBOUND;
 		unsigned int lcpu;
 
 		BUG_ON(timer_pending(timer));
@@ -1153,14 +1218,11 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 		 * Note that the work's gcwq is preserved to allow
 		 * reentrance detection for delayed works.
 		 */
-		if (!(wq->flags & WQ_UNBOUND)) {
-			struct global_cwq *gcwq = get_work_gcwq(work);
-
-			if (gcwq && gcwq->cpu != WORK_CPU_UNBOUND)
-				lcpu = gcwq->cpu;
-			else
-				lcpu = raw_smp_processor_id();
-		} else
+		if (gcwq && cpu_is_unbound(gcwq->cpu) == unbound)
+			lcpu = gcwq->cpu;
+		else if (!unbound)
+			lcpu = raw_smp_processor_id();
+		else
 			lcpu = WORK_CPU_UNBOUND;
 
 		set_work_cwq(work, get_cwq(lcpu, wq), 0);
@@ -1351,7 +1413,9 @@ static struct worker *alloc_worker(void)
  */
 static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 {
-	bool on_unbound_cpu = gcwq->cpu == WORK_CPU_UNBOUND;
+	bool on_unbound_cpu = cpu_is_unbound(gcwq->cpu);
+	int node = on_unbound_cpu ? gcwq->cpu - WORK_CPU_UNBOUND
+				  : cpu_to_node(gcwq->cpu);
 	struct worker *worker = NULL;
 	int id = -1;
 
@@ -1373,15 +1437,23 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 
 	if (!on_unbound_cpu)
 		worker->task = kthread_create_on_node(worker_thread,
-						      worker,
-						      cpu_to_node(gcwq->cpu),
+						      worker, node,
 						      "kworker/%u:%d", gcwq->cpu, id);
 	else
-		worker->task = kthread_create(worker_thread, worker,
-					      "kworker/u:%d", id);
+		worker->task = kthread_create_on_node(worker_thread,
+						      worker, node,
+						      "kworker/u%d:%d", node, id);
 	if (IS_ERR(worker->task))
 		goto fail;
 
+	/*
+	 * Unbound workers stay on the cpus of their node.  This is
+	 * best effort; if the node has no cpu online, let it roam.
+	 */
+	if (on_unbound_cpu &&
+	    cpumask_intersects(cpumask_of_node(node), cpu_online_mask))
+		set_cpus_allowed_ptr(worker->task, cpumask_of_node(node));
+
 	/*
 	 * A rogue worker will become a regular one if CPU comes
 	 * online later on.  Make sure every worker has
@@ -1495,8 +1567,11 @@ static bool send_mayday(struct work_struct *work)
 
 	/* mayday mayday mayday */
 	cpu = cwq->gcwq->cpu;
-	/* WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead */
-	if (cpu == WORK_CPU_UNBOUND)
+	/*
+	 * Unbound gcwq ids can't be set in cpumask, use cpu 0 instead.
+	 * The rescuer then looks at the cwqs of all nodes.
+	 */
+	if (cpu_is_unbound(cpu))
 		cpu = 0;
 	if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
 		wake_up_process(wq->rescuer->task);
@@ -1861,6 +1936,11 @@ __acquires(&gcwq->lock)
 
 	spin_unlock_irq(&gcwq->lock);
 
+	/* unbound workers are shared, wear the nice level of this wq */
+	if ((worker->flags & WORKER_UNBOUND) &&
+	    unlikely(task_nice(current) != ACCESS_ONCE(cwq->wq->nice)))
+		set_user_nice(current, ACCESS_ONCE(cwq->wq->nice));
+
 	work_clear_pending(work);
 	lock_map_acquire_read(&cwq->wq->lockdep_map);
 	lock_map_acquire(&lockdep_map);
@@ -2004,6 +2084,40 @@ sleep:
 	goto woke_up;
 }
 
+/* process the works of @cwq on behalf of its stalled gcwq */
+static void rescue_cwq(struct worker *rescuer,
+		       struct cpu_workqueue_struct *cwq)
+{
+	struct list_head *scheduled = &rescuer->scheduled;
+	struct global_cwq *gcwq = cwq->gcwq;
+	struct work_struct *work, *n;
+
+	/* migrate to the target cpu if possible */
+	rescuer->gcwq = gcwq;
+	worker_maybe_bind_and_lock(rescuer);
+
+	/*
+	 * Slurp in all works issued via this workqueue and
+	 * process'em.
+	 */
+	BUG_ON(!list_empty(&rescuer->scheduled));
+	list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
+		if (get_work_cwq(work) == cwq)
+			move_linked_works(work, scheduled, &n);
+
+	process_scheduled_works(rescuer);
+
+	/*
+	 * Leave this gcwq.  If keep_working() is %true, notify a
+	 * regular worker; otherwise, we end up with 0 concurrency
+	 * and stalling the execution.
+	 */
+	if (keep_working(gcwq))
+		wake_up_worker(gcwq);
+
+	spin_unlock_irq(&gcwq->lock);
+}
+
 /**
  * rescuer_thread - the rescuer thread function
  * @__wq: the associated workqueue
@@ -2027,9 +2141,8 @@ static int rescuer_thread(void *__wq)
 {
 	struct workqueue_struct *wq = __wq;
 	struct worker *rescuer = wq->rescuer;
-	struct list_head *scheduled = &rescuer->scheduled;
 	bool is_unbound = wq->flags & WQ_UNBOUND;
-	unsigned int cpu;
+	unsigned int cpu, tcpu;
 
 	set_user_nice(current, RESCUER_NICE_LEVEL);
 repeat:
@@ -2040,41 +2153,18 @@ repeat:
 
 	/*
 	 * See whether any cpu is asking for help.  Unbounded
-	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND.
+	 * workqueues use cpu 0 in mayday_mask for all nodes.
 	 */
 	for_each_mayday_cpu(cpu, wq->mayday_mask) {
-		unsigned int tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
-		struct cpu_workqueue_struct *cwq = get_cwq(tcpu, wq);
-		struct global_cwq *gcwq = cwq->gcwq;
-		struct work_struct *work, *n;
-
 		__set_current_state(TASK_RUNNING);
 		mayday_clear_cpu(cpu, wq->mayday_mask);
 
-		/* migrate to the target cpu if possible */
-		rescuer->gcwq = gcwq;
-		worker_maybe_bind_and_lock(rescuer);
-
-		/*
-		 * Slurp in all works issued via this workqueue and
-		 * process'em.
-		 */
-		BUG_ON(!list_empty(&rescuer->scheduled));
-		list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
-			if (get_work_cwq(work) == cwq)
-				move_linked_works(work, scheduled, &n);
-
-		process_scheduled_works(rescuer);
-
-		/*
-		 * Leave this gcwq.  If keep_working() is %true, notify a
-		 * regular worker; otherwise, we end up with 0 concurrency
-		 * and stalling the execution.
-		 */
-		if (keep_working(gcwq))
-			wake_up_worker(gcwq);
-
-		spin_unlock_irq(&gcwq->lock);
+		if (!is_unbound) {
+			rescue_cwq(rescuer, get_cwq(cpu, wq));
+			continue;
+		}
+		for_each_cwq_cpu(tcpu, wq)
+			rescue_cwq(rescuer, get_cwq(tcpu, wq));
 	}
 
 	schedule();
@@ -2833,6 +2923,272 @@ int keventd_up(void)
 	return system_wq != NULL;
 }
 
+#ifdef CONFIG_SYSFS
+/*
+ * Workqueues created with WQ_SYSFS show up under
+ * /sys/bus/workqueue/devices/.  All of them export per_cpu and
+ * max_active.  Unbound ones also export
+ *
+ *  pool_ids	node:gcwq-id pairs of the per-node pools serving the wq
+ *  nice	nice level of the workers while executing its works
+ *  cpumask	only the nodes of these cpus are queued to
+ */
+struct wq_device {
+	struct workqueue_struct		*wq;
+	struct device			dev;
+};
+
+static DEFINE_MUTEX(wq_sysfs_mutex);
+static bool wq_sysfs_ready;
+
+static struct workqueue_struct *dev_to_wq(struct device *dev)
+{
+	return container_of(dev, struct wq_device, dev)->wq;
+}
+
+static ssize_t wq_per_cpu_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", !(wq->flags & WQ_UNBOUND));
+}
+
+static ssize_t wq_max_active_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", wq->saved_max_active);
+}
+
+static ssize_t wq_max_active_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int val;
+
+	if (wq->flags & WQ_ORDERED)
+		return -EINVAL;
+	if (kstrtoint(buf, 0, &val) || val <= 0)
+		return -EINVAL;
+
+	workqueue_set_max_active(wq, val);
+	return count;
+}
+
+static struct device_attribute wq_sysfs_attrs[] = {
+	__ATTR(per_cpu, 0444, wq_per_cpu_show, NULL),
+	__ATTR(max_active, 0644, wq_max_active_show, wq_max_active_store),
+	__ATTR_NULL,
+};
+
+static ssize_t wq_pool_ids_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	unsigned int cpu;
+	int written = 0;
+
+	for_each_cwq_cpu(cpu, wq)
+		written += scnprintf(buf + written, PAGE_SIZE - written,
+				     "%s%u:%u", written ? " " : "",
+				     cpu - WORK_CPU_UNBOUND, cpu);
+	written += scnprintf(buf + written, PAGE_SIZE - written, "\n");
+	return written;
+}
+
+static ssize_t wq_nice_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", wq->nice);
+}
+
+static ssize_t wq_nice_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int val;
+
+	if (kstrtoint(buf, 0, &val) || val < -20 || val > 19)
+		return -EINVAL;
+
+	/* picked up by the workers on the next work item */
+	ACCESS_ONCE(wq->nice) = val;
+	return count;
+}
+
+static ssize_t wq_cpumask_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int written;
+
+	spin_lock(&workqueue_lock);
+	written = cpumask_scnprintf(buf, PAGE_SIZE, wq->cpumask);
+	spin_unlock(&workqueue_lock);
+
+	written += scnprintf(buf + written, PAGE_SIZE - written, "\n");
+	return written;
+}
+
+static ssize_t wq_cpumask_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	nodemask_t nodes = NODE_MASK_NONE;
+	cpumask_var_t mask;
+	int cpu, ret;
+
+	/* an ordered workqueue can't move its works around */
+	if (wq->flags & WQ_ORDERED)
+		return -EINVAL;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = bitmap_parse(buf, count, cpumask_bits(mask), nr_cpumask_bits);
+	if (!ret && !cpumask_intersects(mask, cpu_online_mask))
+		ret = -EINVAL;
+	if (!ret) {
+		for_each_cpu(cpu, mask)
+			node_set(cpu_to_node(cpu), nodes);
+
+		/* __queue_work() peeks at ->nodes without the lock */
+		spin_lock(&workqueue_lock);
+		cpumask_copy(wq->cpumask, mask);
+		wq->nodes = nodes;
+		spin_unlock(&workqueue_lock);
+	}
+
+	free_cpumask_var(mask);
+	return ret ?: count;
+}
+
+static struct device_attribute wq_sysfs_unbound_attrs[] = {
+	__ATTR(pool_ids, 0444, wq_pool_ids_show, NULL),
+	__ATTR(nice, 0644, wq_nice_show, wq_nice_store),
+	__ATTR(cpumask, 0644, wq_cpumask_show, wq_cpumask_store),
+	__ATTR_NULL,
+};
+
+static struct bus_type wq_subsys = {
+	.name		= "workqueue",
+	.dev_attrs	= wq_sysfs_attrs,
+};
+
+static void wq_device_release(struct device *dev)
+{
+	kfree(container_of(dev, struct wq_device, dev));
+}
+
+/* called with wq_sysfs_mutex held */
+static int __wq_sysfs_register(struct workqueue_struct *wq)
+{
+	struct wq_device *wq_dev;
+	struct device_attribute *attr;
+	int ret;
+
+	wq_dev = kzalloc(sizeof(*wq_dev), GFP_KERNEL);
+	if (!wq_dev)
+		return -ENOMEM;
+
+	wq_dev->wq = wq;
+	wq_dev->dev.bus = &wq_subsys;
+	wq_dev->dev.release = wq_device_release;
+	dev_set_name(&wq_dev->dev, "%s", wq->name);
+
+	ret = device_register(&wq_dev->dev);
+	if (ret) {
+		put_device(&wq_dev->dev);
+		return ret;
+	}
+
+	if (wq->flags & WQ_UNBOUND) {
+		for (attr = wq_sysfs_unbound_attrs; attr->attr.name; attr++) {
+			ret = device_create_file(&wq_dev->dev, attr);
+			if (ret) {
+				device_unregister(&wq_dev->dev);
+				return ret;
+			}
+		}
+	}
+
+	wq->wq_dev = wq_dev;
+	return 0;
+}
+
+/*
+ * Workqueues allocated before the bus is up are registered from
+ * wq_sysfs_init().
+ */
+static void wq_sysfs_register(struct workqueue_struct *wq)
+{
+	int ret = 0;
+
+	mutex_lock(&wq_sysfs_mutex);
+	if (wq_sysfs_ready && !wq->wq_dev)
+		ret = __wq_sysfs_register(wq);
+	mutex_unlock(&wq_sysfs_mutex);
+
+	if (ret)
+		printk(KERN_WARNING "workqueue: failed to register %s in "
+		       "sysfs (%d)\n", wq->name, ret);
+}
+
+static void wq_sysfs_unregister(struct workqueue_struct *wq)
+{
+	mutex_lock(&wq_sysfs_mutex);
+	if (wq->wq_dev) {
+		device_unregister(&wq->wq_dev->dev);
+		wq->wq_dev = NULL;
+	}
+	mutex_unlock(&wq_sysfs_mutex);
+}
+
+static int __init wq_sysfs_init(void)
+{
+	struct workqueue_struct *wq;
+	int ret;
+
+	mutex_lock(&wq_sysfs_mutex);
+
+	ret = bus_register(&wq_subsys);
+	if (ret)
+		goto out_unlock;
+
+	/*
+	 * Nothing is destroyed this early and new workqueues are only
+	 * ever added at the head, so walking without workqueue_lock
+	 * is safe.  Ones added behind our back block on the mutex.
+	 */
+	list_for_each_entry(wq, &workqueues, list)
+		if (wq->flags & WQ_SYSFS && __wq_sysfs_register(wq))
+			printk(KERN_WARNING "workqueue: failed to register "
+			       "%s in sysfs\n", wq->name);
+
+	wq_sysfs_ready = true;
+out_unlock:
+	mutex_unlock(&wq_sysfs_mutex);
+	return ret;
+}
+core_initcall(wq_sysfs_init);
+#else	/* CONFIG_SYSFS */
+static void wq_sysfs_register(struct workqueue_struct *wq)	{ }
+static void wq_sysfs_unregister(struct workqueue_struct *wq)	{ }
+#endif	/* CONFIG_SYSFS */
+
+/* number of cwqs in cpu_wq.single */
+static int wq_nr_single_cwqs(struct workqueue_struct *wq)
+{
+	return wq->flags & WQ_UNBOUND ? nr_node_ids : 1;
+}
+
 static int alloc_cwqs(struct workqueue_struct *wq)
 {
 	/*
@@ -2852,17 +3208,19 @@ static int alloc_cwqs(struct workqueue_struct *wq)
 	if (percpu)
 		wq->cpu_wq.pcpu = __alloc_percpu(size, align);
 	else {
+		int nr = wq_nr_single_cwqs(wq);
 		void *ptr;
 
 		/*
-		 * Allocate enough room to align cwq and put an extra
-		 * pointer at the end pointing back to the originally
-		 * allocated pointer which will be used for free.
+		 * Allocate enough room to align cwqs, one for each node
+		 * if unbound, and put an extra pointer at the end
+		 * pointing back to the originally allocated pointer
+		 * which will be used for free.
 		 */
-		ptr = kzalloc(size + align + sizeof(void *), GFP_KERNEL);
+		ptr = kzalloc(nr * size + align + sizeof(void *), GFP_KERNEL);
 		if (ptr) {
 			wq->cpu_wq.single = PTR_ALIGN(ptr, align);
-			*(void **)(wq->cpu_wq.single + 1) = ptr;
+			*(void **)(wq->cpu_wq.single + nr) = ptr;
 		}
 	}
 
@@ -2882,8 +3240,8 @@ static void free_cwqs(struct workqueue_struct *wq)
 	if (percpu)
 		free_percpu(wq->cpu_wq.pcpu);
 	else if (wq->cpu_wq.single) {
-		/* the pointer to free is stored right after the cwq */
-		kfree(*(void **)(wq->cpu_wq.single + 1));
+		/* the pointer to free is stored right after the cwqs */
+		kfree(*(void **)(wq->cpu_wq.single + wq_nr_single_cwqs(wq)));
 	}
 }
 
@@ -2923,6 +3281,13 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 	if (flags & WQ_UNBOUND)
 		flags |= WQ_HIGHPRI;
 
+	/*
+	 * Unbound workqueues with @max_active of one are ordered and
+	 * must keep all their works on a single node.
+	 */
+	if (flags & WQ_UNBOUND && max_active == 1)
+		flags |= WQ_ORDERED;
+
 	max_active = max_active ?: WQ_DFL_ACTIVE;
 	max_active = wq_clamp_max_active(max_active, flags, name);
 
@@ -2944,6 +3309,14 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 	if (alloc_cwqs(wq) < 0)
 		goto err;
 
+	if (flags & WQ_UNBOUND) {
+		if (!alloc_cpumask_var(&wq->cpumask, GFP_KERNEL))
+			goto err;
+		cpumask_copy(wq->cpumask, cpu_possible_mask);
+		wq->nodes = node_possible_map;
+		wq->ordered_node = numa_node_id();
+	}
+
 	for_each_cwq_cpu(cpu, wq) {
 		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
 		struct global_cwq *gcwq = get_gcwq(cpu);
@@ -2989,9 +3362,14 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 
 	spin_unlock(&workqueue_lock);
 
+	if (flags & WQ_SYSFS)
+		wq_sysfs_register(wq);
+
 	return wq;
 err:
 	if (wq) {
+		if (flags & WQ_UNBOUND)
+			free_cpumask_var(wq->cpumask);
 		free_cwqs(wq);
 		free_mayday_mask(wq->mayday_mask);
 		kfree(wq->rescuer);
@@ -3043,6 +3421,8 @@ reflush:
 		goto reflush;
 	}
 
+	wq_sysfs_unregister(wq);
+
 	/*
 	 * wq list is used to freeze wq, remove from list after
 	 * flushing is complete in case freeze races us.
@@ -3068,6 +3448,8 @@ reflush:
 		kfree(wq->rescuer);
 	}
 
+	if (wq->flags & WQ_UNBOUND)
+		free_cpumask_var(wq->cpumask);
 	free_cwqs(wq);
 	kfree(wq);
 }
@@ -3123,7 +3505,12 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  */
 bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq)
 {
-	struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	struct cpu_workqueue_struct *cwq;
+
+	/* unbound workqueues are congested per node */
+	if (wq->flags & WQ_UNBOUND && cpu < nr_cpu_ids)
+		cpu = WORK_CPU_UNBOUND + cpu_to_node(cpu);
+	cwq = get_cwq(cpu, wq);
 
 	return !list_empty(&cwq->delayed_works);
 }
@@ -3745,10 +4132,19 @@ out_unlock:
 static int __init init_workqueues(void)
 {
 	unsigned int cpu;
-	int i;
+	int node, i;
 
 	cpu_notifier(workqueue_cpu_callback, CPU_PRI_WORKQUEUE);
 
+	/* allocate unbound gcwqs, on their nodes if they have memory */
+	for_each_node(node) {
+		int nid = node_state(node, N_HIGH_MEMORY) ? node : NUMA_NO_NODE;
+
+		unbound_global_cwq[node] = kzalloc_node(sizeof(struct global_cwq),
+							GFP_KERNEL, nid);
+		BUG_ON(!unbound_global_cwq[node]);
+	}
+
 	/* initialize gcwqs */
 	for_each_gcwq_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
@@ -3780,7 +4176,7 @@ static int __init init_workqueues(void)
 		struct global_cwq *gcwq = get_gcwq(cpu);
 		struct worker *worker;
 
-		if (cpu != WORK_CPU_UNBOUND)
+		if (!cpu_is_unbound(cpu))
 			gcwq->flags &= ~GCWQ_DISASSOCIATED;
 		worker = create_worker(gcwq, true);
 		BUG_ON(!worker);
@@ -3792,7 +4188,8 @@ static int __init init_workqueues(void)
 	system_wq = alloc_workqueue("events", 0, 0);
 	system_long_wq = alloc_workqueue("events_long", 0, 0);
 	system_nrt_wq = alloc_workqueue("events_nrt", WQ_NON_REENTRANT, 0);
-	system_unbound_wq = alloc_workqueue("events_unbound", WQ_UNBOUND,
+	system_unbound_wq = alloc_workqueue("events_unbound",
+					    WQ_UNBOUND | WQ_SYSFS,
 					    WQ_UNBOUND_MAX_ACTIVE);
 	system_freezable_wq = alloc_workqueue("events_freezable",
 					      WQ_FREEZABLE, 0);
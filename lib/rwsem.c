@@ -7,6 +7,7 @@
 #include <linux/sched.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/mcs_spinlock.h>
 
 /*
  * Initialize an rwsem:
@@ -24,6 +25,10 @@ void __init_rwsem(struct rw_semaphore *sem, const char *name,
 	sem->count = RWSEM_UNLOCKED_VALUE;
 	spin_lock_init(&sem->wait_lock);
 	INIT_LIST_HEAD(&sem->wait_list);
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+	sem->owner = NULL;
+	sem->mcs_lock = NULL;
+#endif
 }
 
 EXPORT_SYMBOL(__init_rwsem);
@@ -201,7 +206,7 @@ rwsem_down_failed_common(struct rw_semaphore *sem,
 	if (count == RWSEM_WAITING_BIAS)
 		sem = __rwsem_do_wake(sem, RWSEM_WAKE_NO_ACTIVE);
 	else if (count > RWSEM_WAITING_BIAS &&
-		 adjustment == -RWSEM_ACTIVE_WRITE_BIAS)
+		 (flags & RWSEM_WAITING_FOR_WRITE))
 		sem = __rwsem_do_wake(sem, RWSEM_WAKE_READ_OWNED);
 
 	spin_unlock_irq(&sem->wait_lock);
@@ -228,13 +233,160 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 					-RWSEM_ACTIVE_READ_BIAS);
 }
 
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+/*
+ * Try to take the write lock while spinning. This only succeeds when the
+ * semaphore is completely idle: with sleepers queued the lock is handed
+ * over by __rwsem_do_wake(), and stealing it from under the wakeup would
+ * break the assumptions of RWSEM_WAKE_NO_ACTIVE.
+ */
+static inline int rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
+{
+	return ACCESS_ONCE(sem->count) == RWSEM_UNLOCKED_VALUE &&
+	       cmpxchg(&sem->count, RWSEM_UNLOCKED_VALUE,
+		       RWSEM_ACTIVE_WRITE_BIAS) == RWSEM_UNLOCKED_VALUE;
+}
+
+static inline int rwsem_can_spin_on_owner(struct rw_semaphore *sem)
+{
+	struct task_struct *owner;
+	int on_cpu = 1;
+
+	if (need_resched())
+		return 0;
+
+	rcu_read_lock();
+	owner = ACCESS_ONCE(sem->owner);
+	if (owner)
+		on_cpu = owner->on_cpu;
+	rcu_read_unlock();
+
+	/*
+	 * If sem->owner is not set, the rwsem is either free, held by
+	 * readers or the writer has not recorded itself yet; the spin
+	 * loop sorts those cases out.
+	 */
+	return on_cpu;
+}
+
+static inline int owner_running(struct rw_semaphore *sem,
+				struct task_struct *owner)
+{
+	if (sem->owner != owner)
+		return 0;
+
+	/*
+	 * Ensure we emit the owner->on_cpu dereference _after_ checking
+	 * sem->owner still matches owner; if that fails, owner might
+	 * point to freed memory. If it still matches, the rcu_read_lock()
+	 * ensures the memory stays valid.
+	 */
+	barrier();
+
+	return owner->on_cpu;
+}
+
+/*
+ * Spin while the current write owner is running. Returns true if the
+ * owner released the semaphore, false if it went to sleep, we need to
+ * reschedule or ownership moved on to another writer.
+ */
+static noinline int rwsem_spin_on_owner(struct rw_semaphore *sem,
+					struct task_struct *owner)
+{
+	rcu_read_lock();
+	while (owner_running(sem, owner)) {
+		if (need_resched())
+			break;
+
+		arch_mutex_cpu_relax();
+	}
+	rcu_read_unlock();
+
+	return ACCESS_ONCE(sem->owner) == NULL;
+}
+
+/*
+ * Optimistic spinning for writers: if the write owner is running on
+ * another CPU it will likely release the semaphore soon, so a short
+ * critical section is cheaper to wait out than a sleep and a wakeup.
+ *
+ * As for mutexes, the spinners are queued on an MCS lock so that only
+ * the spinner at the head polls the semaphore; the rest spin on their
+ * own node.
+ */
+static int rwsem_optimistic_spin(struct rw_semaphore *sem)
+{
+	struct mcs_spinlock node;
+	struct task_struct *owner;
+	int taken = 0;
+
+	preempt_disable();
+
+	if (!rwsem_can_spin_on_owner(sem))
+		goto done;
+
+	mcs_spin_lock(&sem->mcs_lock, &node);
+	for (;;) {
+		/* sleepers are queued, the lock will be handed to them */
+		if (!list_empty(&sem->wait_list))
+			break;
+
+		owner = ACCESS_ONCE(sem->owner);
+		if (owner && !rwsem_spin_on_owner(sem, owner))
+			break;
+
+		if (rwsem_try_write_lock_unqueued(sem)) {
+			taken = 1;
+			break;
+		}
+
+		/*
+		 * Readers do not record themselves as owner, and may hold
+		 * the semaphore for an unbounded time: don't spin on them.
+		 */
+		if (!owner && ACCESS_ONCE(sem->count) > RWSEM_UNLOCKED_VALUE)
+			break;
+
+		/*
+		 * When there's no owner, we might have preempted between the
+		 * owner acquiring the lock and setting the owner field. If
+		 * we're an RT task that will live-lock because we won't let
+		 * the owner complete.
+		 */
+		if (!owner && (need_resched() || rt_task(current)))
+			break;
+
+		arch_mutex_cpu_relax();
+	}
+	mcs_spin_unlock(&sem->mcs_lock, &node);
+done:
+	preempt_enable();
+	return taken;
+}
+#endif
+
 /*
  * wait for the write lock to be granted
  */
 struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 {
+	signed long adjustment = -RWSEM_ACTIVE_WRITE_BIAS;
+
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+	/*
+	 * Back out the active bias the fastpath added before spinning, so
+	 * that the semaphore can be seen as free. If we end up sleeping,
+	 * rwsem_down_failed_common() rechecks the count under wait_lock,
+	 * so a release that happened meanwhile still wakes the queue.
+	 */
+	rwsem_atomic_add(adjustment, sem);
+	if (rwsem_optimistic_spin(sem))
+		return sem;
+	adjustment = 0;
+#endif
 	return rwsem_down_failed_common(sem, RWSEM_WAITING_FOR_WRITE,
-					-RWSEM_ACTIVE_WRITE_BIAS);
+					adjustment);
 }
 
 /*
@@ -14,6 +14,10 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/huge_mm.h>
+#include <linux/hugetlb.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -34,6 +38,12 @@ struct compact_control {
 	unsigned long free_pfn;		/* isolate_freepages search base */
 	unsigned long migrate_pfn;	/* isolate_migratepages search base */
 	bool sync;			/* Synchronous migration */
+	bool ignore_skip_hint;		/* Scan blocks even if marked skip */
+	bool finished_update_free;	/* True when the zone cached pfns are
+					 * no longer being updated
+					 */
+	bool finished_update_migrate;
+	bool proactive;			/* kcompactd proactive compaction */
 
 	/* Account for isolated anon and file pages */
 	unsigned long nr_anon;
@@ -58,6 +68,104 @@ static unsigned long release_freepages(struct list_head *freelist)
 	return count;
 }
 
+/* Returns true if the pageblock should be scanned for pages to isolate. */
+static inline bool isolation_suitable(struct compact_control *cc,
+					struct page *page)
+{
+	if (cc->ignore_skip_hint)
+		return true;
+
+	return !get_pageblock_skip(page);
+}
+
+/*
+ * This function is called to clear all cached information on pageblocks that
+ * should be skipped for page isolation when the migrate and free page scanner
+ * meet.
+ */
+static void __reset_isolation_suitable(struct zone *zone)
+{
+	unsigned long start_pfn = zone->zone_start_pfn;
+	unsigned long end_pfn = zone->zone_start_pfn + zone->spanned_pages;
+	unsigned long pfn;
+
+	zone->compact_cached_migrate_pfn = start_pfn;
+	zone->compact_cached_free_pfn = end_pfn & ~(pageblock_nr_pages-1);
+	zone->compact_blockskip_flush = false;
+
+	/* Walk the zone and mark every pageblock as suitable for isolation */
+	for (pfn = start_pfn; pfn < end_pfn; pfn += pageblock_nr_pages) {
+		struct page *page;
+
+		cond_resched();
+
+		if (!pfn_valid(pfn))
+			continue;
+
+		page = pfn_to_page(pfn);
+		if (zone != page_zone(page))
+			continue;
+
+		clear_pageblock_skip(page);
+	}
+}
+
+/**
+ * reset_isolation_suitable - forget which pageblocks compaction skips
+ * @pgdat: node whose zones are reset
+ *
+ * Called by kswapd before it goes to sleep.  Only zones in which a
+ * compaction run went through the whole zone since the last reset are
+ * touched, so the skip bits of a zone being compacted incrementally
+ * survive.
+ */
+void reset_isolation_suitable(pg_data_t *pgdat)
+{
+	int zoneid;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		/* Only flush if a full compaction finished recently */
+		if (zone->compact_blockskip_flush)
+			__reset_isolation_suitable(zone);
+	}
+}
+
+/*
+ * If no pages were isolated then mark this pageblock to be skipped in the
+ * future. The information is later cleared by __reset_isolation_suitable().
+ */
+static void update_pageblock_skip(struct compact_control *cc,
+			struct page *page, unsigned long nr_isolated,
+			bool migrate_scanner)
+{
+	struct zone *zone = cc->zone;
+	unsigned long pfn;
+
+	if (cc->ignore_skip_hint)
+		return;
+
+	if (!page || nr_isolated)
+		return;
+
+	set_pageblock_skip(page);
+	pfn = page_to_pfn(page);
+
+	/* Update where compaction should restart */
+	if (migrate_scanner) {
+		if (!cc->finished_update_migrate &&
+		    pfn > zone->compact_cached_migrate_pfn)
+			zone->compact_cached_migrate_pfn = pfn;
+	} else {
+		if (!cc->finished_update_free &&
+		    pfn < zone->compact_cached_free_pfn)
+			zone->compact_cached_free_pfn = pfn;
+	}
+}
+
 /* Isolate free pages onto a private freelist. Must hold zone->lock */
 static unsigned long isolate_freepages_block(struct zone *zone,
 				unsigned long blockpfn,
@@ -109,6 +217,11 @@ static unsigned long isolate_freepages_block(struct zone *zone,
 	return total_isolated;
 }
 
+static inline bool migrate_async_suitable(int migratetype)
+{
+	return is_migrate_cma(migratetype) || migratetype == MIGRATE_MOVABLE;
+}
+
 /* Returns true if the page is within a block suitable for migration to */
 static bool suitable_migration_target(struct page *page)
 {
@@ -123,8 +236,8 @@ static bool suitable_migration_target(struct page *page)
 	if (PageBuddy(page) && page_order(page) >= pageblock_order)
 		return true;
 
-	/* If the block is MIGRATE_MOVABLE, allow migration */
-	if (migratetype == MIGRATE_MOVABLE)
+	/* If the block is MIGRATE_MOVABLE or MIGRATE_CMA, allow migration */
+	if (migrate_async_suitable(migratetype))
 		return true;
 
 	/* Otherwise skip the block */
@@ -186,6 +299,10 @@ static void isolate_freepages(struct zone *zone,
 		if (!suitable_migration_target(page))
 			continue;
 
+		/* If isolation recently failed, do not retry */
+		if (!isolation_suitable(cc, page))
+			continue;
+
 		/*
 		 * Found a block suitable for isolating free pages from. Now
 		 * we disabled interrupts, double check things are ok and
@@ -205,8 +322,13 @@ static void isolate_freepages(struct zone *zone,
 		 * looking for free pages, the search will restart here as
 		 * page migration may have returned some pages to the allocator
 		 */
-		if (isolated)
+		if (isolated) {
+			cc->finished_update_free = true;
 			high_pfn = max(high_pfn, pfn);
+		}
+
+		/* Skip this pageblock in the future as it's full or nearly full */
+		update_pageblock_skip(cc, page, isolated, false);
 	}
 
 	/* split_free_page does not map the pages */
@@ -269,6 +391,7 @@ static isolate_migrate_t isolate_migratepages(struct zone *zone,
 	unsigned long last_pageblock_nr = 0, pageblock_nr;
 	unsigned long nr_scanned = 0, nr_isolated = 0;
 	struct list_head *migratelist = &cc->migratepages;
+	struct page *valid_page = NULL;
 
 	/* Do not scan outside zone boundaries */
 	low_pfn = max(cc->migrate_pfn, zone->zone_start_pfn);
@@ -282,6 +405,12 @@ static isolate_migrate_t isolate_migratepages(struct zone *zone,
 		return ISOLATE_NONE;
 	}
 
+	/* Skip the pageblock if isolation recently failed in it */
+	if (!isolation_suitable(cc, pfn_to_page(low_pfn))) {
+		cc->migrate_pfn = end_pfn;
+		return ISOLATE_NONE;
+	}
+
 	/*
 	 * Ensure that there are not too many pages isolated from the LRU
 	 * list by either parallel reclaimers or compaction. If there are,
@@ -326,6 +455,8 @@ static isolate_migrate_t isolate_migratepages(struct zone *zone,
 
 		/* Get the page and skip if free */
 		page = pfn_to_page(low_pfn);
+		if (!valid_page)
+			valid_page = page;
 		if (PageBuddy(page))
 			continue;
 
@@ -336,7 +467,13 @@ static isolate_migrate_t isolate_migratepages(struct zone *zone,
 		 */
 		pageblock_nr = low_pfn >> pageblock_order;
 		if (!cc->sync && last_pageblock_nr != pageblock_nr &&
-				get_pageblock_migratetype(page) != MIGRATE_MOVABLE) {
+		    !migrate_async_suitable(get_pageblock_migratetype(page))) {
+			/*
+			 * Sync compaction still has to scan this block, so
+			 * neither cache its position nor mark it skipped.
+			 */
+			cc->finished_update_migrate = true;
+			valid_page = NULL;
 			low_pfn += pageblock_nr_pages;
 			low_pfn = ALIGN(low_pfn, pageblock_nr_pages) - 1;
 			last_pageblock_nr = pageblock_nr;
@@ -363,6 +500,7 @@ static isolate_migrate_t isolate_migratepages(struct zone *zone,
 		VM_BUG_ON(PageTransCompound(page));
 
 		/* Successfully isolated */
+		cc->finished_update_migrate = true;
 		del_page_from_lru_list(zone, page, page_lru(page));
 		list_add(&page->lru, migratelist);
 		cc->nr_migratepages++;
@@ -376,6 +514,11 @@ static isolate_migrate_t isolate_migratepages(struct zone *zone,
 	acct_isolated(zone, cc);
 
 	spin_unlock_irq(&zone->lru_lock);
+
+	/* If the whole pageblock was scanned without isolating, skip it */
+	if (low_pfn == end_pfn)
+		update_pageblock_skip(cc, valid_page, nr_isolated, true);
+
 	cc->migrate_pfn = low_pfn;
 
 	trace_mm_compaction_isolate_migratepages(nr_scanned, nr_isolated);
@@ -429,6 +572,39 @@ static void update_nr_listpages(struct compact_control *cc)
 	cc->nr_freepages = nr_freepages;
 }
 
+/*
+ * kcompactd compacts a zone proactively when the share of its free memory
+ * that cannot back a huge page, the unusable free index of order
+ * COMPACTION_HPAGE_ORDER in units of 1/1000, goes above the high mark and
+ * stops once it is at or below the low mark.  Both follow
+ * sysctl_compaction_proactiveness: the more proactive, the lower they are.
+ */
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE)
+#define COMPACTION_HPAGE_ORDER	HPAGE_PMD_ORDER
+#elif defined(CONFIG_HUGETLBFS)
+#define COMPACTION_HPAGE_ORDER	HUGETLB_PAGE_ORDER
+#else
+#define COMPACTION_HPAGE_ORDER	(PMD_SHIFT - PAGE_SHIFT)
+#endif
+
+int sysctl_compaction_proactiveness = 20;
+
+static unsigned int proactive_low_wmark(void)
+{
+	return (100 - sysctl_compaction_proactiveness) * 10;
+}
+
+static unsigned int proactive_high_wmark(void)
+{
+	return min(proactive_low_wmark() + 100, 1000U);
+}
+
+static bool proactive_zone_compacted(struct zone *zone)
+{
+	return unusable_free_index(zone, COMPACTION_HPAGE_ORDER) <=
+						(int)proactive_low_wmark();
+}
+
 static int compact_finished(struct zone *zone,
 			    struct compact_control *cc)
 {
@@ -439,8 +615,29 @@ static int compact_finished(struct zone *zone,
 		return COMPACT_PARTIAL;
 
 	/* Compaction run completes if the migrate and free scanner meet */
-	if (cc->free_pfn <= cc->migrate_pfn)
+	if (cc->free_pfn <= cc->migrate_pfn) {
+		unsigned long end_pfn = zone->zone_start_pfn +
+					zone->spanned_pages;
+
+		/* Let the next compaction start anew */
+		zone->compact_cached_migrate_pfn = zone->zone_start_pfn;
+		zone->compact_cached_free_pfn =
+					end_pfn & ~(pageblock_nr_pages-1);
+
+		/*
+		 * Mark that the PG_migrate_skip information should be cleared
+		 * by kswapd when it goes to sleep, or by the next compaction
+		 * run if that comes first.
+		 */
+		zone->compact_blockskip_flush = true;
+
 		return COMPACT_COMPLETE;
+	}
+
+	/* kcompactd: stop once the zone is back below the low mark */
+	if (cc->proactive)
+		return proactive_zone_compacted(zone) ? COMPACT_PARTIAL :
+							COMPACT_CONTINUE;
 
 	/*
 	 * order == -1 is expected when compacting via
@@ -522,6 +719,7 @@ unsigned long compaction_suitable(struct zone *zone, int order)
 
 static int compact_zone(struct zone *zone, struct compact_control *cc)
 {
+	unsigned long start_pfn, end_pfn;
 	int ret;
 
 	ret = compaction_suitable(zone, cc->order);
@@ -535,10 +733,36 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 		;
 	}
 
-	/* Setup to move all movable pages to the end of the zone */
-	cc->migrate_pfn = zone->zone_start_pfn;
-	cc->free_pfn = cc->migrate_pfn + zone->spanned_pages;
-	cc->free_pfn &= ~(pageblock_nr_pages-1);
+	/*
+	 * A previous run went through the whole zone: blocks it skipped may
+	 * have become suitable again if kswapd did not reset them meanwhile.
+	 */
+	if (zone->compact_blockskip_flush)
+		__reset_isolation_suitable(zone);
+
+	/*
+	 * Setup to move all movable pages to the end of the zone. Use cached
+	 * information on where the scanners should start but check that it
+	 * is initialised by ensuring the values are within zone boundaries.
+	 * A compaction that ignores the skip hints scans the whole zone.
+	 */
+	start_pfn = zone->zone_start_pfn;
+	end_pfn = (start_pfn + zone->spanned_pages) & ~(pageblock_nr_pages-1);
+	if (cc->ignore_skip_hint) {
+		cc->migrate_pfn = start_pfn;
+		cc->free_pfn = end_pfn;
+	} else {
+		cc->migrate_pfn = zone->compact_cached_migrate_pfn;
+		cc->free_pfn = zone->compact_cached_free_pfn;
+	}
+	if (cc->free_pfn <= start_pfn || cc->free_pfn > end_pfn) {
+		cc->free_pfn = end_pfn;
+		zone->compact_cached_free_pfn = cc->free_pfn;
+	}
+	if (cc->migrate_pfn < start_pfn || cc->migrate_pfn >= end_pfn) {
+		cc->migrate_pfn = start_pfn;
+		zone->compact_cached_migrate_pfn = cc->migrate_pfn;
+	}
 
 	migrate_prep_local();
 
@@ -673,6 +897,7 @@ static int compact_node(int nid)
 			.nr_freepages = 0,
 			.nr_migratepages = 0,
 			.order = -1,
+			.ignore_skip_hint = true,
 		};
 
 		zone = &pgdat->node_zones[zoneid];
@@ -745,3 +970,250 @@ void compaction_unregister_node(struct node *node)
 	return sysdev_remove_file(&node->sysdev, &attr_compact);
 }
 #endif /* CONFIG_SYSFS && CONFIG_NUMA */
+
+/* How often an idle kcompactd checks whether to compact proactively */
+#define KCOMPACTD_PROACTIVE_INTERVAL	(HZ / 2)
+
+static bool kcompactd_work_requested(pg_data_t *pgdat)
+{
+	return pgdat->kcompactd_max_order > 0 || kthread_should_stop();
+}
+
+static bool kcompactd_node_suitable(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+	enum zone_type classzone_idx = pgdat->kcompactd_classzone_idx;
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_suitable(zone, pgdat->kcompactd_max_order) ==
+							COMPACT_CONTINUE)
+			return true;
+	}
+
+	return false;
+}
+
+/* Compact the zones of the node for the order kswapd last reclaimed for */
+static void kcompactd_do_work(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+	int order = pgdat->kcompactd_max_order;
+	enum zone_type classzone_idx = pgdat->kcompactd_classzone_idx;
+
+	count_vm_event(KCOMPACTD_WAKE);
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.sync = true,
+		};
+
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		if (kthread_should_stop())
+			return;
+
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		compact_zone(zone, &cc);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+
+	/*
+	 * Regardless of success, we are done until woken up next. But remember
+	 * the requested order/classzone_idx in case it was higher/tighter than
+	 * our current ones
+	 */
+	if (pgdat->kcompactd_max_order <= order)
+		pgdat->kcompactd_max_order = 0;
+	if (pgdat->kcompactd_classzone_idx >= classzone_idx)
+		pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+}
+
+/*
+ * Proactive compaction of the zones above the high mark. Returns false if
+ * a zone was compacted without lowering its unusable free index, in which
+ * case the caller backs off for a while.
+ */
+static bool kcompactd_do_proactive(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+	bool progress = true;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = -1,
+			.migratetype = MIGRATE_MOVABLE,
+			.sync = true,
+			.proactive = true,
+		};
+		unsigned long watermark;
+		int score;
+
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		if (kthread_should_stop())
+			break;
+
+		/* Leave zones that are short of memory to reclaim */
+		watermark = low_wmark_pages(zone) +
+				(2UL << COMPACTION_HPAGE_ORDER);
+		if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+			continue;
+
+		score = unusable_free_index(zone, COMPACTION_HPAGE_ORDER);
+		if (score <= (int)proactive_high_wmark())
+			continue;
+
+		count_vm_event(KCOMPACTD_PROACTIVE);
+
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		compact_zone(zone, &cc);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+
+		if (unusable_free_index(zone, COMPACTION_HPAGE_ORDER) >= score)
+			progress = false;
+	}
+
+	return progress;
+}
+
+/*
+ * The background compaction daemon, started as a kernel thread
+ * from the init process.
+ */
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = (pg_data_t *)p;
+	struct task_struct *tsk = current;
+	unsigned int proactive_defer = 0;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(tsk, cpumask);
+
+	set_freezable();
+
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+	while (!kthread_should_stop()) {
+		if (wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				kcompactd_work_requested(pgdat),
+				KCOMPACTD_PROACTIVE_INTERVAL)) {
+			if (!kthread_should_stop())
+				kcompactd_do_work(pgdat);
+			continue;
+		}
+
+		/* Timed out: see whether the node needs compacting anyway */
+		if (!sysctl_compaction_proactiveness)
+			continue;
+		if (proactive_defer) {
+			proactive_defer--;
+			continue;
+		}
+		if (!kcompactd_do_proactive(pgdat))
+			proactive_defer = 1 << COMPACT_MAX_DEFER_SHIFT;
+	}
+
+	return 0;
+}
+
+/**
+ * wakeup_kcompactd - hand a high-order request over to kcompactd
+ * @pgdat: node to compact
+ * @order: order kswapd was woken for
+ * @classzone_idx: highest zone the allocation could use
+ *
+ * Called by kswapd when it is done reclaiming and about to go to sleep,
+ * so that the memory it freed is also defragmented for @order.
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx)
+{
+	if (!order)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+
+	if (pgdat->kcompactd_classzone_idx > classzone_idx)
+		pgdat->kcompactd_classzone_idx = classzone_idx;
+
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+
+	if (!kcompactd_node_suitable(pgdat))
+		return;
+
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * This kcompactd start function will be called by init and node-hot-add.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int ret = 0;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		ret = PTR_ERR(pgdat->kcompactd);
+		pgdat->kcompactd = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+subsys_initcall(kcompactd_init);
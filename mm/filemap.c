@@ -110,12 +110,136 @@
  *    ->i_mmap_mutex
  */
 
+/**
+ * page_cache_tree_insert - insert a page into a mapping's radix tree
+ * @mapping: the address_space
+ * @index: the page index
+ * @page: the page
+ * @shadowp: where to return a replaced shadow entry, or %NULL
+ *
+ * Like radix_tree_insert(), but a shadow entry left in the slot by an
+ * evicted page is replaced rather than failing with -EEXIST, and passed
+ * back at @shadowp for refault detection.  The caller holds the
+ * tree_lock, has preloaded the radix tree, and accounts the page.
+ */
+int page_cache_tree_insert(struct address_space *mapping, pgoff_t index,
+			   struct page *page, void **shadowp)
+{
+	struct radix_tree_node *node;
+	void **slot;
+	void *p;
+	int error;
+
+	p = __radix_tree_lookup(&mapping->page_tree, index, &node, &slot);
+	if (p) {
+		if (!radix_tree_exceptional_entry(p))
+			return -EEXIST;
+		radix_tree_replace_slot(slot, page);
+		mapping->nrshadows--;
+		workingset_forget(p);
+		if (shadowp)
+			*shadowp = p;
+		if (node) {
+			node->shadows--;
+			workingset_update_node(node, mapping, index);
+		}
+		return 0;
+	}
+	error = radix_tree_insert(&mapping->page_tree, index, page);
+	if (error || !mapping->nrshadows)
+		return error;
+	/* The page may have gone in next to shadow entries */
+	__radix_tree_lookup(&mapping->page_tree, index, &node, NULL);
+	if (node)
+		workingset_update_node(node, mapping, index);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(page_cache_tree_insert);
+
+/**
+ * page_cache_tree_remove - remove an entry from a mapping's radix tree
+ * @mapping: the address_space
+ * @index: the index of the page or shadow entry
+ *
+ * Like radix_tree_delete(), but keeps the leaf node's shadow entry count
+ * and its place on the list of nodes that hold only shadow entries up
+ * to date.  The caller holds the tree_lock and accounts the entry.
+ */
+void page_cache_tree_remove(struct address_space *mapping, pgoff_t index)
+{
+	struct radix_tree_node *node;
+	bool shadows_left;
+	void *p;
+
+	p = __radix_tree_lookup(&mapping->page_tree, index, &node, NULL);
+	if (!p)
+		return;
+	if (!node) {
+		radix_tree_delete(&mapping->page_tree, index);
+		return;
+	}
+	if (radix_tree_exceptional_entry(p))
+		node->shadows--;
+	/*
+	 * The node is freed with its last entry, so take it off the list
+	 * before, unless it survives with shadow entries only - those
+	 * the deletion cannot free it under.
+	 */
+	shadows_left = node->shadows && node->shadows == node->count - 1;
+	if (!shadows_left)
+		workingset_update_node(node, mapping, index);
+	radix_tree_delete(&mapping->page_tree, index);
+	if (shadows_left)
+		workingset_update_node(node, mapping, index);
+}
+
+static void page_cache_tree_delete(struct address_space *mapping,
+				   struct page *page, void *shadow)
+{
+	struct radix_tree_node *node;
+	void **slot;
+	int tag;
+
+	__radix_tree_lookup(&mapping->page_tree, page->index, &node, &slot);
+	/*
+	 * Shadow entries are only left in tree nodes, where the shadow
+	 * node shrinker can find them again.
+	 */
+	if (shadow && !node) {
+		workingset_forget(shadow);
+		shadow = NULL;
+	}
+
+	if (!shadow) {
+		page_cache_tree_remove(mapping, page->index);
+		return;
+	}
+
+	/* Unlike radix_tree_delete(), replacing the slot keeps its tags */
+	for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++) {
+		if (radix_tree_tagged(&mapping->page_tree, tag))
+			radix_tree_tag_clear(&mapping->page_tree,
+					     page->index, tag);
+	}
+
+	/*
+	 * The final truncate finds the slot empty of pages once the shadow
+	 * entry is in; make sure it also finds nrshadows raised then.
+	 * radix_tree_replace_slot() orders the two.
+	 */
+	mapping->nrshadows++;
+	radix_tree_replace_slot(slot, shadow);
+	node->shadows++;
+	workingset_update_node(node, mapping, page->index);
+}
+
 /*
  * Delete a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
- * is safe.  The caller must hold the mapping's tree_lock.
+ * is safe.  The caller must hold the mapping's tree_lock.  If @shadow
+ * is not NULL, it is left in the page's slot for refault detection.
  */
-void __delete_from_page_cache(struct page *page)
+void __delete_from_page_cache(struct page *page, void *shadow)
 {
 	struct address_space *mapping = page->mapping;
 
@@ -129,7 +253,7 @@ void __delete_from_page_cache(struct page *page)
 	else
 		cleancache_flush_page(mapping, page);
 
-	radix_tree_delete(&mapping->page_tree, page->index);
+	page_cache_tree_delete(mapping, page, shadow);
 	page->mapping = NULL;
 	mapping->nrpages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
@@ -167,7 +291,7 @@ void delete_from_page_cache(struct page *page)
 
 	freepage = mapping->a_ops->freepage;
 	spin_lock_irq(&mapping->tree_lock);
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
@@ -427,8 +551,8 @@ int replace_page_cache_page(struct page *old, struct page *new, gfp_t gfp_mask)
 		new->index = offset;
 
 		spin_lock_irq(&mapping->tree_lock);
-		__delete_from_page_cache(old);
-		error = radix_tree_insert(&mapping->page_tree, offset, new);
+		__delete_from_page_cache(old, NULL);
+		error = page_cache_tree_insert(mapping, offset, new, NULL);
 		BUG_ON(error);
 		mapping->nrpages++;
 		__inc_zone_page_state(new, NR_FILE_PAGES);
@@ -448,18 +572,10 @@ int replace_page_cache_page(struct page *old, struct page *new, gfp_t gfp_mask)
 }
 EXPORT_SYMBOL_GPL(replace_page_cache_page);
 
-/**
- * add_to_page_cache_locked - add a locked page to the pagecache
- * @page:	page to add
- * @mapping:	the page's address_space
- * @offset:	page index
- * @gfp_mask:	page allocation mode
- *
- * This function is used to add a page to the pagecache. It must be locked.
- * This function does not add the page to the LRU.  The caller must do that.
- */
-int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
-		pgoff_t offset, gfp_t gfp_mask)
+static int __add_to_page_cache_locked(struct page *page,
+				      struct address_space *mapping,
+				      pgoff_t offset, gfp_t gfp_mask,
+				      void **shadowp)
 {
 	int error;
 
@@ -477,7 +593,7 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 		page->index = offset;
 
 		spin_lock_irq(&mapping->tree_lock);
-		error = radix_tree_insert(&mapping->page_tree, offset, page);
+		error = page_cache_tree_insert(mapping, offset, page, shadowp);
 		if (likely(!error)) {
 			mapping->nrpages++;
 			__inc_zone_page_state(page, NR_FILE_PAGES);
@@ -496,11 +612,29 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 out:
 	return error;
 }
+
+/**
+ * add_to_page_cache_locked - add a locked page to the pagecache
+ * @page:	page to add
+ * @mapping:	the page's address_space
+ * @offset:	page index
+ * @gfp_mask:	page allocation mode
+ *
+ * This function is used to add a page to the pagecache. It must be locked.
+ * This function does not add the page to the LRU.  The caller must do that.
+ */
+int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
+		pgoff_t offset, gfp_t gfp_mask)
+{
+	return __add_to_page_cache_locked(page, mapping, offset,
+					  gfp_mask, NULL);
+}
 EXPORT_SYMBOL(add_to_page_cache_locked);
 
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
 {
+	void *shadow = NULL;
 	int ret;
 
 	/*
@@ -512,14 +646,24 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 	if (mapping_cap_swap_backed(mapping))
 		SetPageSwapBacked(page);
 
-	ret = add_to_page_cache(page, mapping, offset, gfp_mask);
-	if (ret == 0) {
-		if (page_is_file_cache(page))
-			lru_cache_add_file(page);
-		else
-			lru_cache_add_anon(page);
+	__set_page_locked(page);
+	ret = __add_to_page_cache_locked(page, mapping, offset,
+					 gfp_mask, &shadow);
+	if (unlikely(ret)) {
+		__clear_page_locked(page);
+		return ret;
 	}
-	return ret;
+
+	if (!page_is_file_cache(page))
+		lru_cache_add_anon(page);
+	else if (shadow && workingset_refault(shadow)) {
+		/* evicted recently enough to have stayed if active */
+		workingset_activation(page);
+		lru_cache_add_lru(page, LRU_ACTIVE_FILE);
+	} else
+		lru_cache_add_file(page);
+
+	return 0;
 }
 EXPORT_SYMBOL_GPL(add_to_page_cache_lru);
 
@@ -694,6 +838,82 @@ int __lock_page_or_retry(struct page *page, struct mm_struct *mm,
 	}
 }
 
+/**
+ * page_cache_next_hole - find the next hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Search the set [index, min(index+max_scan-1, MAX_INDEX)] for the
+ * lowest indexed hole.  Like radix_tree_next_hole(), except that shadow
+ * entries of evicted pages count as holes.
+ *
+ * Returns: the index of the hole if found, otherwise returns an index
+ * outside of the set specified (in which case 'return - index >=
+ * max_scan' will be true). In rare cases of index wrap-around, 0 will
+ * be returned.
+ *
+ * page_cache_next_hole may be called under rcu_read_lock, with the
+ * same caveats as radix_tree_next_hole().
+ */
+pgoff_t page_cache_next_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_scan; i++) {
+		struct page *page;
+
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index++;
+		if (index == 0)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_next_hole);
+
+/**
+ * page_cache_prev_hole - find the prev hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Search backwards in the range [max(index-max_scan+1, 0), index] for
+ * the first hole.  Like radix_tree_prev_hole(), except that shadow
+ * entries of evicted pages count as holes.
+ *
+ * Returns: the index of the hole if found, otherwise returns an index
+ * outside of the set specified (in which case 'index - return >=
+ * max_scan' will be true). In rare cases of wrap-around, ULONG_MAX will
+ * be returned.
+ *
+ * page_cache_prev_hole may be called under rcu_read_lock, with the
+ * same caveats as radix_tree_prev_hole().
+ */
+pgoff_t page_cache_prev_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_scan; i++) {
+		struct page *page;
+
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index--;
+		if (index == ULONG_MAX)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_prev_hole);
+
 /**
  * find_get_page - find and get a page reference
  * @mapping: the address_space to search
@@ -715,8 +935,13 @@ repeat:
 		page = radix_tree_deref_slot(pagep);
 		if (unlikely(!page))
 			goto out;
-		if (radix_tree_deref_retry(page))
-			goto repeat;
+		if (radix_tree_exception(page)) {
+			if (radix_tree_deref_retry(page))
+				goto repeat;
+			/* A shadow entry of an evicted page: not present */
+			page = NULL;
+			goto out;
+		}
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -834,50 +1059,63 @@ EXPORT_SYMBOL(find_or_create_page);
 unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 			    unsigned int nr_pages, struct page **pages)
 {
+	void **slots[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
 	unsigned int i;
-	unsigned int ret;
+	unsigned int ret = 0;
 	unsigned int nr_found;
 
+	/*
+	 * The radix tree may hold shadow entries of evicted pages, which are
+	 * skipped: look up in batches so that a run of them does not make
+	 * this return 0, which callers take for the end of the mapping.
+	 */
 	rcu_read_lock();
+	while (ret < nr_pages) {
 restart:
-	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, start, nr_pages);
-	ret = 0;
-	for (i = 0; i < nr_found; i++) {
-		struct page *page;
+		nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				slots, indices, start,
+				min_t(unsigned int, nr_pages - ret,
+				      PAGEVEC_SIZE));
+		if (!nr_found)
+			break;
+		for (i = 0; i < nr_found; i++) {
+			struct page *page;
 repeat:
-		page = radix_tree_deref_slot((void **)pages[i]);
-		if (unlikely(!page))
-			continue;
+			page = radix_tree_deref_slot(slots[i]);
+			if (unlikely(!page))
+				continue;
 
-		/*
-		 * This can only trigger when the entry at index 0 moves out
-		 * of or back to the root: none yet gotten, safe to restart.
-		 */
-		if (radix_tree_deref_retry(page)) {
-			WARN_ON(start | i);
-			goto restart;
-		}
+			if (radix_tree_exception(page)) {
+				/*
+				 * This can only trigger when the entry at
+				 * index 0 moves out of or back to the root:
+				 * none yet gotten, safe to restart.
+				 */
+				if (radix_tree_deref_retry(page)) {
+					WARN_ON(start | i);
+					goto restart;
+				}
+				/* A shadow entry of an evicted page */
+				continue;
+			}
 
-		if (!page_cache_get_speculative(page))
-			goto repeat;
+			if (!page_cache_get_speculative(page))
+				goto repeat;
 
-		/* Has the page moved? */
-		if (unlikely(page != *((void **)pages[i]))) {
-			page_cache_release(page);
-			goto repeat;
-		}
+			/* Has the page moved? */
+			if (unlikely(page != *slots[i])) {
+				page_cache_release(page);
+				goto repeat;
+			}
 
-		pages[ret] = page;
-		ret++;
+			pages[ret] = page;
+			ret++;
+		}
+		start = indices[nr_found - 1] + 1;
+		if (!start)
+			break;
 	}
-
-	/*
-	 * If all entries were removed before we could secure them,
-	 * try again, because callers stop trying once 0 is returned.
-	 */
-	if (unlikely(!ret && nr_found))
-		goto restart;
 	rcu_read_unlock();
 	return ret;
 }
@@ -904,7 +1142,7 @@ unsigned find_get_pages_contig(struct address_space *mapping, pgoff_t index,
 	rcu_read_lock();
 restart:
 	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, index, nr_pages);
+				(void ***)pages, NULL, index, nr_pages);
 	ret = 0;
 	for (i = 0; i < nr_found; i++) {
 		struct page *page;
@@ -913,12 +1151,17 @@ repeat:
 		if (unlikely(!page))
 			continue;
 
-		/*
-		 * This can only trigger when the entry at index 0 moves out
-		 * of or back to the root: none yet gotten, safe to restart.
-		 */
-		if (radix_tree_deref_retry(page))
-			goto restart;
+		if (radix_tree_exception(page)) {
+			/*
+			 * This can only trigger when the entry at index 0
+			 * moves out of or back to the root: none yet gotten,
+			 * safe to restart.
+			 */
+			if (radix_tree_deref_retry(page))
+				goto restart;
+			/* A shadow entry is a hole in the range */
+			break;
+		}
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -978,12 +1221,20 @@ repeat:
 		if (unlikely(!page))
 			continue;
 
-		/*
-		 * This can only trigger when the entry at index 0 moves out
-		 * of or back to the root: none yet gotten, safe to restart.
-		 */
-		if (radix_tree_deref_retry(page))
-			goto restart;
+		if (radix_tree_exception(page)) {
+			/*
+			 * This can only trigger when the entry at index 0
+			 * moves out of or back to the root: none yet gotten,
+			 * safe to restart.
+			 */
+			if (radix_tree_deref_retry(page))
+				goto restart;
+			/*
+			 * A page replaced by its shadow entry since the
+			 * lookup; its tags are gone, a restart skips it.
+			 */
+			continue;
+		}
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -211,6 +211,10 @@ SYSCALL_DEFINE5(remap_file_pages, unsigned long, start, unsigned long, size,
 			}
 			goto out;
 		}
+		/* Nonlinear vmas are only ever mapped by ptes */
+		split_huge_page_vma(vma);
+		/* speculative faults must see the vma turn nonlinear */
+		vm_write_begin(vma);
 		mutex_lock(&mapping->i_mmap_mutex);
 		flush_dcache_mmap_lock(mapping);
 		vma->vm_flags |= VM_NONLINEAR;
@@ -218,6 +222,7 @@ SYSCALL_DEFINE5(remap_file_pages, unsigned long, start, unsigned long, size,
 		vma_nonlinear_insert(vma, &mapping->i_mmap_nonlinear);
 		flush_dcache_mmap_unlock(mapping);
 		mutex_unlock(&mapping->i_mmap_mutex);
+		vm_write_end(vma);
 	}
 
 	if (vma->vm_flags & VM_LOCKED) {
@@ -12,11 +12,13 @@
 #include <linux/mmu_notifier.h>
 #include <linux/rmap.h>
 #include <linux/swap.h>
+#include <linux/swapops.h>
 #include <linux/mm_inline.h>
 #include <linux/kthread.h>
 #include <linux/khugepaged.h>
 #include <linux/freezer.h>
 #include <linux/mman.h>
+#include <linux/userfaultfd_k.h>
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
 #include "internal.h"
@@ -55,8 +57,11 @@ static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
  * fault.
  */
 static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR-1;
+static unsigned int khugepaged_max_ptes_swap __read_mostly = HPAGE_PMD_NR/8;
+static unsigned int khugepaged_max_ptes_shared __read_mostly = HPAGE_PMD_NR/2;
 
 static int khugepaged(void *none);
+static void khugepaged_prioritize(struct mm_struct *mm);
 static int mm_slots_hash_init(void);
 static int khugepaged_slab_init(void);
 static void khugepaged_slab_free(void);
@@ -471,9 +476,68 @@ static struct kobj_attribute khugepaged_max_ptes_none_attr =
 	__ATTR(max_ptes_none, 0644, khugepaged_max_ptes_none_show,
 	       khugepaged_max_ptes_none_store);
 
+/*
+ * max_ptes_swap is the number of swapped out ptes khugepaged will read
+ * back in to collapse an otherwise suitable range, and max_ptes_shared
+ * the number of ptes mapping pages shared with other processes (after
+ * fork) that it will copy into a private huge page.  0 refuses such
+ * ranges altogether.
+ */
+static ssize_t khugepaged_max_ptes_swap_show(struct kobject *kobj,
+					     struct kobj_attribute *attr,
+					     char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_max_ptes_swap);
+}
+static ssize_t khugepaged_max_ptes_swap_store(struct kobject *kobj,
+					      struct kobj_attribute *attr,
+					      const char *buf, size_t count)
+{
+	int err;
+	unsigned long max_ptes_swap;
+
+	err = strict_strtoul(buf, 10, &max_ptes_swap);
+	if (err || max_ptes_swap > HPAGE_PMD_NR-1)
+		return -EINVAL;
+
+	khugepaged_max_ptes_swap = max_ptes_swap;
+
+	return count;
+}
+static struct kobj_attribute khugepaged_max_ptes_swap_attr =
+	__ATTR(max_ptes_swap, 0644, khugepaged_max_ptes_swap_show,
+	       khugepaged_max_ptes_swap_store);
+
+static ssize_t khugepaged_max_ptes_shared_show(struct kobject *kobj,
+					       struct kobj_attribute *attr,
+					       char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_max_ptes_shared);
+}
+static ssize_t khugepaged_max_ptes_shared_store(struct kobject *kobj,
+						struct kobj_attribute *attr,
+						const char *buf, size_t count)
+{
+	int err;
+	unsigned long max_ptes_shared;
+
+	err = strict_strtoul(buf, 10, &max_ptes_shared);
+	if (err || max_ptes_shared > HPAGE_PMD_NR-1)
+		return -EINVAL;
+
+	khugepaged_max_ptes_shared = max_ptes_shared;
+
+	return count;
+}
+static struct kobj_attribute khugepaged_max_ptes_shared_attr =
+	__ATTR(max_ptes_shared, 0644, khugepaged_max_ptes_shared_show,
+	       khugepaged_max_ptes_shared_store);
+
 static struct attribute *khugepaged_attr[] = {
 	&khugepaged_defrag_attr.attr,
 	&khugepaged_max_ptes_none_attr.attr,
+	&khugepaged_max_ptes_swap_attr.attr,
+	&khugepaged_max_ptes_shared_attr.attr,
 	&pages_to_scan_attr.attr,
 	&pages_collapsed_attr.attr,
 	&full_scans_attr.attr,
@@ -680,7 +744,7 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (haddr >= vma->vm_start && haddr + HPAGE_PMD_SIZE <= vma->vm_end) {
 		if (unlikely(anon_vma_prepare(vma)))
 			return VM_FAULT_OOM;
-		if (unlikely(khugepaged_enter(vma)))
+		if (unlikely(khugepaged_enter(vma, vma->vm_flags)))
 			return VM_FAULT_OOM;
 		page = alloc_hugepage_vma(transparent_hugepage_defrag(vma),
 					  vma, haddr, numa_node_id(), 0);
@@ -972,7 +1036,7 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		goto out;
 
 	page = pmd_page(*pmd);
-	VM_BUG_ON(!PageHead(page));
+	VM_BUG_ON(PageAnon(page) && !PageHead(page));
 	if (flags & FOLL_TOUCH) {
 		pmd_t _pmd;
 		/*
@@ -987,6 +1051,23 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		set_pmd_at(mm, addr & HPAGE_PMD_MASK, pmd, _pmd);
 	}
 	page += (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+	if (!PageAnon(page)) {
+		if (flags & FOLL_GET)
+			get_page(page);
+		/*
+		 * Page cache pages mapped by a huge pmd are not compound
+		 * and have to be mlocked one by one, like from a pte.
+		 * FOLL_MLOCK is only passed for VM_LOCKED vmas.
+		 */
+		if ((flags & FOLL_MLOCK) && page->mapping &&
+		    trylock_page(page)) {
+			lru_add_drain();
+			if (page->mapping)
+				mlock_vma_page(page);
+			unlock_page(page);
+		}
+		goto out;
+	}
 	VM_BUG_ON(!PageCompound(page));
 	if (flags & FOLL_GET)
 		get_page_foll(page);
@@ -995,8 +1076,30 @@ out:
 	return page;
 }
 
+/*
+ * Drop the rmap and rss accounting of the page cache pages that were
+ * mapped by the huge pmd @orig_pmd, and hand its dirty and accessed
+ * bits down to them.
+ */
+static void unmap_file_huge_pmd(struct vm_area_struct *vma, pmd_t orig_pmd)
+{
+	struct page *page = pmd_page(orig_pmd);
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (pmd_dirty(orig_pmd))
+			set_page_dirty(page + i);
+		if (pmd_young(orig_pmd) && likely(!VM_SequentialReadHint(vma)))
+			mark_page_accessed(page + i);
+		page_remove_rmap(page + i);
+		VM_BUG_ON(page_mapcount(page + i) < 0);
+	}
+	add_mm_counter(vma->vm_mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+	dec_zone_page_state(page, NR_SHMEM_PMDMAPPED);
+}
+
 int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
-		 pmd_t *pmd)
+		 pmd_t *pmd, unsigned long addr)
 {
 	int ret = 0;
 
@@ -1011,6 +1114,18 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 			pgtable_t pgtable;
 			pgtable = get_pmd_huge_pte(tlb->mm);
 			page = pmd_page(*pmd);
+			if (!PageAnon(page)) {
+				pmd_t orig_pmd;
+				int i;
+
+				orig_pmd = pmdp_get_and_clear(tlb->mm, addr, pmd);
+				unmap_file_huge_pmd(vma, orig_pmd);
+				spin_unlock(&tlb->mm->page_table_lock);
+				for (i = 0; i < HPAGE_PMD_NR; i++)
+					tlb_remove_page(tlb, page + i);
+				pte_free(tlb->mm, pgtable);
+				return 1;
+			}
 			pmd_clear(pmd);
 			page_remove_rmap(page);
 			VM_BUG_ON(page_mapcount(page) < 0);
@@ -1123,6 +1238,85 @@ out:
 	return ret;
 }
 
+/*
+ * Look for the huge pmd that maps the page cache @page at @address.
+ * Returns it with mm->page_table_lock held, or NULL.
+ */
+pmd_t *page_check_address_file_pmd(struct page *page,
+				   struct mm_struct *mm,
+				   unsigned long address)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, haddr);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, haddr);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, haddr);
+	if (!pmd_trans_huge(*pmd))
+		return NULL;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) &&
+	    pmd_page(*pmd) + ((address - haddr) >> PAGE_SHIFT) == page)
+		return pmd;
+	spin_unlock(&mm->page_table_lock);
+	return NULL;
+}
+
+/*
+ * Map the HPAGE_PMD_NR page cache pages starting at @page, which are
+ * physically contiguous and back a naturally aligned range of the
+ * file, with a single huge pmd.  The caller holds a reference and the
+ * page lock on each of them; on success the references are taken over
+ * by the mapping.
+ *
+ * Returns 0 on success, -EAGAIN if the pmd got populated meanwhile and
+ * -ENOMEM if the page table to deposit could not be allocated.
+ */
+int map_file_huge_pmd(struct vm_area_struct *vma, unsigned long address,
+		      pmd_t *pmd, struct page *page, unsigned int flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgtable_t pgtable;
+	pmd_t entry;
+	int i;
+
+	VM_BUG_ON(PageCompound(page) || PageAnon(page));
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		return -ENOMEM;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		return -EAGAIN;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_file_rmap(page + i);
+	entry = mk_pmd(page, vma->vm_page_prot);
+	if (flags & FAULT_FLAG_WRITE)
+		entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+	entry = pmd_mkhuge(entry);
+	set_pmd_at(mm, haddr, pmd, entry);
+	prepare_pmd_huge_pte(pgtable, mm);
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	inc_zone_page_state(page, NR_SHMEM_PMDMAPPED);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FILE_MAPPED);
+	return 0;
+}
+
 static int __split_huge_page_splitting(struct page *page,
 				       struct vm_area_struct *vma,
 				       unsigned long address)
@@ -1429,12 +1623,18 @@ out:
 int hugepage_madvise(struct vm_area_struct *vma,
 		     unsigned long *vm_flags, int advice)
 {
+	unsigned long no_thp = VM_NO_THP;
+
+	/* shared page cache that can be mapped by huge pmds */
+	if (vma_has_file_pmds(vma))
+		no_thp &= ~(VM_SHARED | VM_MAYSHARE);
+
 	switch (advice) {
 	case MADV_HUGEPAGE:
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
-		if (*vm_flags & (VM_HUGEPAGE | VM_NO_THP))
+		if (*vm_flags & (VM_HUGEPAGE | no_thp))
 			return -EINVAL;
 		*vm_flags &= ~VM_NOHUGEPAGE;
 		*vm_flags |= VM_HUGEPAGE;
@@ -1443,14 +1643,16 @@ int hugepage_madvise(struct vm_area_struct *vma,
 		 * register it here without waiting a page fault that
 		 * may not happen any time soon.
 		 */
-		if (unlikely(khugepaged_enter_vma_merge(vma)))
+		if (unlikely(khugepaged_enter_vma_merge(vma, *vm_flags)))
 			return -ENOMEM;
+		/* and have it scanned next */
+		khugepaged_prioritize(vma->vm_mm);
 		break;
 	case MADV_NOHUGEPAGE:
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
-		if (*vm_flags & (VM_NOHUGEPAGE | VM_NO_THP))
+		if (*vm_flags & (VM_NOHUGEPAGE | no_thp))
 			return -EINVAL;
 		*vm_flags &= ~VM_HUGEPAGE;
 		*vm_flags |= VM_NOHUGEPAGE;
@@ -1575,7 +1777,8 @@ int __khugepaged_enter(struct mm_struct *mm)
 	return 0;
 }
 
-int khugepaged_enter_vma_merge(struct vm_area_struct *vma)
+int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
+			       unsigned long vm_flags)
 {
 	unsigned long hstart, hend;
 	if (!vma->anon_vma)
@@ -1591,14 +1794,39 @@ int khugepaged_enter_vma_merge(struct vm_area_struct *vma)
 	 * If is_pfn_mapping() is true is_learn_pfn_mapping() must be
 	 * true too, verify it here.
 	 */
-	VM_BUG_ON(is_linear_pfn_mapping(vma) || vma->vm_flags & VM_NO_THP);
+	VM_BUG_ON(is_linear_pfn_mapping(vma) || vm_flags & VM_NO_THP);
 	hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
 	hend = vma->vm_end & HPAGE_PMD_MASK;
 	if (hstart < hend)
-		return khugepaged_enter(vma);
+		return khugepaged_enter(vma, vm_flags);
 	return 0;
 }
 
+/*
+ * Move the mm to the front of the scan list, right behind the cursor,
+ * for khugepaged to look at it on its next pass.  Used when a process
+ * asks for huge pages with madvise, which it is unlikely to do for
+ * memory it doesn't care about.
+ */
+static void khugepaged_prioritize(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+
+	spin_lock(&khugepaged_mm_lock);
+	mm_slot = get_mm_slot(mm);
+	if (mm_slot && mm_slot != khugepaged_scan.mm_slot) {
+		if (khugepaged_scan.mm_slot)
+			list_move(&mm_slot->mm_node,
+				  &khugepaged_scan.mm_slot->mm_node);
+		else
+			list_move(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (mm_slot)
+		wake_up_interruptible(&khugepaged_wait);
+}
+
 void __khugepaged_exit(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
@@ -1633,6 +1861,15 @@ void __khugepaged_exit(struct mm_struct *mm)
 		spin_unlock(&khugepaged_mm_lock);
 }
 
+/*
+ * All references to a page khugepaged replaces must come from page
+ * tables and the swap cache: an extra one could be a gup pin.
+ */
+static inline int khugepaged_page_unpinned(struct page *page)
+{
+	return page_count(page) == page_mapcount(page) + !!PageSwapCache(page);
+}
+
 static void release_pte_page(struct page *page)
 {
 	/* 0 stands for page_is_file_cache(page) == false */
@@ -1661,22 +1898,26 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 {
 	struct page *page;
 	pte_t *_pte;
-	int referenced = 0, isolated = 0, none = 0;
+	int referenced = 0, writable = 0, isolated = 0, none = 0, shared = 0;
 	for (_pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
 		if (pte_none(pteval)) {
-			if (++none <= khugepaged_max_ptes_none)
+			/* userland is to fill the holes of uffd ranges */
+			if (!userfaultfd_missing(vma) &&
+			    ++none <= khugepaged_max_ptes_none)
 				continue;
 			else {
 				release_pte_pages(pte, _pte);
 				goto out;
 			}
 		}
-		if (!pte_present(pteval) || !pte_write(pteval)) {
+		if (!pte_present(pteval)) {
 			release_pte_pages(pte, _pte);
 			goto out;
 		}
+		if (pte_write(pteval))
+			writable = 1;
 		page = vm_normal_page(vma, address, pteval);
 		if (unlikely(!page)) {
 			release_pte_pages(pte, _pte);
@@ -1684,10 +1925,13 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 		}
 		VM_BUG_ON(PageCompound(page));
 		BUG_ON(!PageAnon(page));
-		VM_BUG_ON(!PageSwapBacked(page));
 
-		/* cannot use mapcount: can't collapse if there's a gup pin */
-		if (page_count(page) != 1) {
+		if (page_mapcount(page) > 1 &&
+		    ++shared > khugepaged_max_ptes_shared) {
+			release_pte_pages(pte, _pte);
+			goto out;
+		}
+		if (!khugepaged_page_unpinned(page)) {
 			release_pte_pages(pte, _pte);
 			goto out;
 		}
@@ -1720,7 +1964,7 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 		    mmu_notifier_test_young(vma->vm_mm, address))
 			referenced = 1;
 	}
-	if (unlikely(!referenced))
+	if (unlikely(!referenced || !writable))
 		release_all_pte_pages(pte);
 	else
 		isolated = 1;
@@ -1744,8 +1988,6 @@ static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
 		} else {
 			src_page = pte_page(pteval);
 			copy_user_highpage(page, src_page, address, vma);
-			VM_BUG_ON(page_mapcount(src_page) != 1);
-			VM_BUG_ON(page_count(src_page) != 2);
 			release_pte_page(src_page);
 			/*
 			 * ptl mostly unnecessary, but preempt has to
@@ -1863,7 +2105,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 
 	pmd = pmd_offset(pud, address);
 	/* pmd can't go away or become huge under us */
-	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd) ||
+	    pmd_table_shared(*pmd))
 		goto out;
 
 	anon_vma_lock(vma->anon_vma);
@@ -1871,6 +2114,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 	pte = pte_offset_map(pmd, address);
 	ptl = pte_lockptr(mm, pmd);
 
+	/* Speculative faults must not populate the ptes being collapsed */
+	vm_write_begin(vma);
 	spin_lock(&mm->page_table_lock); /* probably unnecessary */
 	/*
 	 * After this gup_fast can't run anymore. This also removes
@@ -1891,6 +2136,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		BUG_ON(!pmd_none(*pmd));
 		set_pmd_at(mm, address, pmd, _pmd);
 		spin_unlock(&mm->page_table_lock);
+		vm_write_end(vma);
 		anon_vma_unlock(vma->anon_vma);
 		goto out;
 	}
@@ -1927,11 +2173,13 @@ static void collapse_huge_page(struct mm_struct *mm,
 	prepare_pmd_huge_pte(pgtable, mm);
 	mm->nr_ptes--;
 	spin_unlock(&mm->page_table_lock);
+	vm_write_end(vma);
 
 #ifndef CONFIG_NUMA
 	*hpage = NULL;
 #endif
 	khugepaged_pages_collapsed++;
+	mm->thp_collapsed++;
 out_up_write:
 	up_write(&mm->mmap_sem);
 	return;
@@ -1944,6 +2192,119 @@ out:
 	goto out_up_write;
 }
 
+#ifdef CONFIG_NUMA
+/* pages of the range being scanned per node, only used by khugepaged */
+static int khugepaged_node_load[MAX_NUMNODES];
+
+/*
+ * With zone_reclaim_mode set, the admin prefers local allocations over
+ * huge pages: don't pull pages from distant nodes into one huge page.
+ */
+static int khugepaged_scan_abort(int nid)
+{
+	int i;
+
+	if (!zone_reclaim_mode)
+		return 0;
+
+	/* if there is a count for this node already, it must be acceptable */
+	if (khugepaged_node_load[nid])
+		return 0;
+
+	for (i = 0; i < MAX_NUMNODES; i++) {
+		if (!khugepaged_node_load[i])
+			continue;
+		if (node_distance(nid, i) > RECLAIM_DISTANCE)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * The node holding most of the small pages of the range gets the huge
+ * page.  Ties go round robin so that a range spread evenly over the
+ * nodes doesn't always end up on the lowest one.
+ */
+static int khugepaged_find_target_node(void)
+{
+	static int last_target_node = -1;
+	int nid, target_node = 0, max_value = 0;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++)
+		if (khugepaged_node_load[nid] > max_value) {
+			max_value = khugepaged_node_load[nid];
+			target_node = nid;
+		}
+
+	if (target_node <= last_target_node)
+		for (nid = last_target_node + 1; nid < MAX_NUMNODES; nid++)
+			if (khugepaged_node_load[nid] == max_value) {
+				target_node = nid;
+				break;
+			}
+
+	last_target_node = target_node;
+	return target_node;
+}
+
+static inline void khugepaged_reset_node_load(void)
+{
+	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+}
+
+static inline void khugepaged_count_node(int nid)
+{
+	khugepaged_node_load[nid]++;
+}
+#else
+static inline int khugepaged_scan_abort(int nid)
+{
+	return 0;
+}
+
+static inline int khugepaged_find_target_node(void)
+{
+	return 0;
+}
+
+static inline void khugepaged_reset_node_load(void)
+{
+}
+
+static inline void khugepaged_count_node(int nid)
+{
+}
+#endif
+
+/*
+ * Read the swapped out pages of the range back in, so that it can be
+ * collapsed.  Called with mmap_sem held for reading, which the faults
+ * don't release.  Returns 0 if any page could not be brought back.
+ */
+static int __collapse_huge_page_swapin(struct mm_struct *mm,
+				       struct vm_area_struct *vma,
+				       unsigned long address, pmd_t *pmd)
+{
+	unsigned long _address;
+	pte_t *pte, pteval;
+	int ret;
+
+	for (_address = address; _address < address + HPAGE_PMD_SIZE;
+	     _address += PAGE_SIZE) {
+		pte = pte_offset_map(pmd, _address);
+		pteval = *pte;
+		pte_unmap(pte);
+		if (!is_swap_pte(pteval))
+			continue;
+		ret = handle_mm_fault(mm, vma, _address, 0);
+		if (ret & VM_FAULT_ERROR)
+			return 0;
+	}
+	/* get the pages out of the pagevecs and onto the LRU */
+	lru_add_drain();
+	return 1;
+}
+
 static int khugepaged_scan_pmd(struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
@@ -1953,11 +2314,12 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte, *_pte;
-	int ret = 0, referenced = 0, none = 0;
+	int ret = 0, referenced = 0, writable = 0, none = 0;
+	int swapped = 0, shared = 0;
 	struct page *page;
 	unsigned long _address;
 	spinlock_t *ptl;
-	int node = -1;
+	int node;
 
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
@@ -1970,48 +2332,64 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		goto out;
 
 	pmd = pmd_offset(pud, address);
-	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+	/* a table shared by fork is left alone until it gets unshared */
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd) ||
+	    pmd_table_shared(*pmd))
 		goto out;
 
+	khugepaged_reset_node_load();
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
+		if (is_swap_pte(pteval)) {
+			if (++swapped <= khugepaged_max_ptes_swap)
+				continue;
+			else
+				goto out_unmap;
+		}
 		if (pte_none(pteval)) {
-			if (++none <= khugepaged_max_ptes_none)
+			if (!userfaultfd_missing(vma) &&
+			    ++none <= khugepaged_max_ptes_none)
 				continue;
 			else
 				goto out_unmap;
 		}
-		if (!pte_present(pteval) || !pte_write(pteval))
+		if (!pte_present(pteval))
 			goto out_unmap;
+		if (pte_write(pteval))
+			writable = 1;
 		page = vm_normal_page(vma, _address, pteval);
 		if (unlikely(!page))
 			goto out_unmap;
-		/*
-		 * Chose the node of the first page. This could
-		 * be more sophisticated and look at more pages,
-		 * but isn't for now.
-		 */
-		if (node == -1)
-			node = page_to_nid(page);
+		if (page_mapcount(page) > 1 &&
+		    ++shared > khugepaged_max_ptes_shared)
+			goto out_unmap;
+		/* the huge page goes where most of the small pages are */
+		node = page_to_nid(page);
+		if (khugepaged_scan_abort(node))
+			goto out_unmap;
+		khugepaged_count_node(node);
 		VM_BUG_ON(PageCompound(page));
 		if (!PageLRU(page) || PageLocked(page) || !PageAnon(page))
 			goto out_unmap;
-		/* cannot use mapcount: can't collapse if there's a gup pin */
-		if (page_count(page) != 1)
+		if (!khugepaged_page_unpinned(page))
 			goto out_unmap;
 		if (pte_young(pteval) || PageReferenced(page) ||
 		    mmu_notifier_test_young(vma->vm_mm, address))
 			referenced = 1;
 	}
-	if (referenced)
+	if (referenced && writable)
 		ret = 1;
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
-	if (ret)
+	if (ret && swapped && !__collapse_huge_page_swapin(mm, vma, address, pmd))
+		ret = 0;
+	if (ret) {
+		node = khugepaged_find_target_node();
 		/* collapse_huge_page will return with the mmap_sem released */
 		collapse_huge_page(mm, address, hpage, vma, node);
+	}
 out:
 	return ret;
 }
@@ -2120,6 +2498,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			/* move to next address */
 			khugepaged_scan.address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
+			mm->thp_scanned++;
 			if (ret)
 				/* we released mmap_sem so break loop */
 				goto breakouterloop_mmap_sem;
@@ -2317,8 +2696,45 @@ static int khugepaged(void *none)
 	return 0;
 }
 
-void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
+/*
+ * Page cache pages mapped by a huge pmd are not compound, so there is
+ * nothing to split on the page side: the pmd is zapped instead and
+ * left pointing to an empty page table, and the next access faults
+ * the pages back in with ptes.
+ */
+static void split_file_huge_pmd(struct vm_area_struct *vma,
+				unsigned long haddr, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t orig_pmd;
+	int i;
+
+	mmu_notifier_invalidate_range_start(mm, haddr, haddr + HPAGE_PMD_SIZE);
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		goto out;
+	}
+	orig_pmd = pmdp_clear_flush(vma, haddr, pmd);
+	page = pmd_page(orig_pmd);
+	unmap_file_huge_pmd(vma, orig_pmd);
+	pgtable = get_pmd_huge_pte(mm);
+	mm->nr_ptes++;
+	pmd_populate(mm, pmd, pgtable);
+	spin_unlock(&mm->page_table_lock);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_cache_release(page + i);
+out:
+	mmu_notifier_invalidate_range_end(mm, haddr, haddr + HPAGE_PMD_SIZE);
+}
+
+void __split_huge_page_pmd(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd)
 {
+	struct mm_struct *mm = vma->vm_mm;
 	struct page *page;
 
 	spin_lock(&mm->page_table_lock);
@@ -2328,6 +2744,11 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 	}
 	page = pmd_page(*pmd);
 	VM_BUG_ON(!page_count(page));
+	if (!PageAnon(page)) {
+		spin_unlock(&mm->page_table_lock);
+		split_file_huge_pmd(vma, address & HPAGE_PMD_MASK, pmd);
+		return;
+	}
 	get_page(page);
 	spin_unlock(&mm->page_table_lock);
 
@@ -2337,15 +2758,24 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 	BUG_ON(pmd_trans_huge(*pmd));
 }
 
-static void split_huge_page_address(struct mm_struct *mm,
-				    unsigned long address)
+void split_huge_page_pmd_mm(struct mm_struct *mm, unsigned long address,
+			    pmd_t *pmd)
 {
+	struct vm_area_struct *vma;
+
+	vma = find_vma(mm, address);
+	BUG_ON(vma == NULL);
+	split_huge_page_pmd(vma, address, pmd);
+}
+
+void split_huge_page_address(struct vm_area_struct *vma,
+			     unsigned long address)
+{
+	struct mm_struct *mm = vma->vm_mm;
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
 
-	VM_BUG_ON(!(address & ~HPAGE_PMD_MASK));
-
 	pgd = pgd_offset(mm, address);
 	if (!pgd_present(*pgd))
 		return;
@@ -2358,10 +2788,24 @@ static void split_huge_page_address(struct mm_struct *mm,
 	if (!pmd_present(*pmd))
 		return;
 	/*
-	 * Caller holds the mmap_sem write mode, so a huge pmd cannot
+	 * Caller holds the mmap_sem write mode, or the page lock of
+	 * the page cache page mapped there, so a huge pmd cannot
 	 * materialize from under us.
 	 */
-	split_huge_page_pmd(mm, pmd);
+	split_huge_page_pmd(vma, address, pmd);
+}
+
+/*
+ * Split all huge pmds within @vma.  The caller holds mmap_sem for
+ * writing, so no new ones can be faulted in meanwhile.
+ */
+void split_huge_page_vma(struct vm_area_struct *vma)
+{
+	unsigned long addr;
+
+	for (addr = ALIGN(vma->vm_start, HPAGE_PMD_SIZE);
+	     addr + HPAGE_PMD_SIZE <= vma->vm_end; addr += HPAGE_PMD_SIZE)
+		split_huge_page_address(vma, addr);
 }
 
 void __vma_adjust_trans_huge(struct vm_area_struct *vma,
@@ -2377,7 +2821,7 @@ void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 	if (start & ~HPAGE_PMD_MASK &&
 	    (start & HPAGE_PMD_MASK) >= vma->vm_start &&
 	    (start & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= vma->vm_end)
-		split_huge_page_address(vma->vm_mm, start);
+		split_huge_page_address(vma, start);
 
 	/*
 	 * If the new end address isn't hpage aligned and it could
@@ -2387,7 +2831,7 @@ void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 	if (end & ~HPAGE_PMD_MASK &&
 	    (end & HPAGE_PMD_MASK) >= vma->vm_start &&
 	    (end & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= vma->vm_end)
-		split_huge_page_address(vma->vm_mm, end);
+		split_huge_page_address(vma, end);
 
 	/*
 	 * If we're also updating the vma->vm_next->vm_start, if the new
@@ -2401,6 +2845,6 @@ void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 		if (nstart & ~HPAGE_PMD_MASK &&
 		    (nstart & HPAGE_PMD_MASK) >= next->vm_start &&
 		    (nstart & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= next->vm_end)
-			split_huge_page_address(next->vm_mm, nstart);
+			split_huge_page_address(next, nstart);
 	}
 }
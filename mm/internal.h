@@ -100,6 +100,14 @@ extern void prep_compound_page(struct page *page, unsigned long order);
 extern bool is_free_buddy_page(struct page *page);
 #endif
 
+#ifdef CONFIG_LRU_GEN
+extern void lru_gen_init_zone(struct zone *zone);
+#else
+static inline void lru_gen_init_zone(struct zone *zone)
+{
+}
+#endif
+
 
 /*
  * function for dealing with page's order in buddy system.
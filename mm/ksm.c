@@ -23,7 +23,6 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -115,30 +114,42 @@ struct ksm_scan {
  * @node: rb node of this ksm page in the stable tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page
+ * @nid: NUMA node id of the stable tree in which linked
  */
 struct stable_node {
 	struct rb_node node;
 	struct hlist_head hlist;
 	unsigned long kpfn;
+#ifdef CONFIG_NUMA
+	int nid;
+#endif
 };
 
 /**
  * struct rmap_item - reverse mapping item for virtual addresses
  * @rmap_list: next rmap_item in mm_slot's singly-linked rmap_list
  * @anon_vma: pointer to anon_vma for this mm,address, when in stable tree
+ * @nid: NUMA node id of unstable tree in which linked (may not match page)
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @oldsample: previous sample of the page's words, when volatile
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
  */
 struct rmap_item {
 	struct rmap_item *rmap_list;
-	struct anon_vma *anon_vma;	/* when stable */
+	union {
+		struct anon_vma *anon_vma;	/* when stable */
+#ifdef CONFIG_NUMA
+		int nid;		/* when node of unstable tree */
+#endif
+	};
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	unsigned int oldsample;		/* when volatile */
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -151,10 +162,11 @@ struct rmap_item {
 #define SEQNR_MASK	0x0ff	/* low bits of unstable tree seqnr */
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
+#define VOLATILE_FLAG	0x400	/* changed since the scan before */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+/* The stable and unstable tree heads, one of each per NUMA node */
+static struct rb_root root_stable_tree[MAX_NUMNODES] = { RB_ROOT, };
+static struct rb_root root_unstable_tree[MAX_NUMNODES] = { RB_ROOT, };
 
 #define MM_SLOTS_HASH_SHIFT 10
 #define MM_SLOTS_HASH_HEADS (1 << MM_SLOTS_HASH_SHIFT)
@@ -189,6 +201,33 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Most milliseconds ksmd backs off to while merging little */
+static unsigned int ksm_thread_max_sleep_millisecs = 1000;
+
+/* Doublings of sleep_millisecs that ksmd currently backs off by */
+static unsigned int ksm_sleep_shift;
+
+/* Pages scanned and merged since the current full scan started */
+static unsigned long ksm_scan_pages_scanned;
+static unsigned long ksm_scan_pages_merged;
+
+/*
+ * A full scan which merged fewer than one in 1 << KSM_YIELD_SHIFT of the
+ * pages it looked at makes ksmd back off.
+ */
+#define KSM_YIELD_SHIFT	10
+
+/* Whether to merge pages residing on different NUMA nodes */
+static unsigned int ksm_merge_across_nodes;
+
+#ifdef CONFIG_NUMA
+#define NUMA(x)		(x)
+#define DO_NUMA(x)	do { (x); } while (0)
+#else
+#define NUMA(x)		(0)
+#define DO_NUMA(x)	do { } while (0)
+#endif
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -297,6 +336,15 @@ static void insert_to_mm_slots_hash(struct mm_struct *mm,
 	hlist_add_head(&mm_slot->link, bucket);
 }
 
+/*
+ * The tree in which a page belongs: that of the node it resides on,
+ * unless merging across nodes is allowed.
+ */
+static inline int get_kpfn_nid(unsigned long kpfn)
+{
+	return ksm_merge_across_nodes ? 0 : NUMA(pfn_to_nid(kpfn));
+}
+
 static inline int in_stable_tree(struct rmap_item *rmap_item)
 {
 	return rmap_item->address & STABLE_FLAG;
@@ -458,7 +506,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 		cond_resched();
 	}
 
-	rb_erase(&stable_node->node, &root_stable_tree);
+	rb_erase(&stable_node->node, &root_stable_tree[NUMA(stable_node->nid)]);
 	free_stable_node(stable_node);
 }
 
@@ -556,7 +604,8 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+			rb_erase(&rmap_item->node,
+				 &root_unstable_tree[NUMA(rmap_item->nid)]);
 
 		ksm_pages_unshared--;
 		rmap_item->address &= PAGE_MASK;
@@ -669,13 +718,44 @@ error:
 }
 #endif /* CONFIG_SYSFS */
 
+/*
+ * The checksum only has to tell whether a page changed since the last
+ * scan, it need not spread well: two running sums over 64-bit words
+ * cost a fraction of a jhash2 over the page.
+ */
 static u32 calc_checksum(struct page *page)
 {
-	u32 checksum;
-	void *addr = kmap_atomic(page, KM_USER0);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	u64 *addr = kmap_atomic(page, KM_USER0);
+	u64 a = 0, b = 0;
+	int i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(u64); i++) {
+		a += addr[i];
+		b += a;
+	}
+	kunmap_atomic(addr, KM_USER0);
+	b ^= a;
+	return (u32)b ^ (u32)(b >> 32);
+}
+
+/* Words of a page read by calc_sample(), spread over all of it */
+#define KSM_SAMPLE_WORDS	16
+
+/*
+ * A much cheaper checksum, of a few cache lines of the page only: a
+ * page changing all the time is usually caught changing there too.
+ */
+static u32 calc_sample(struct page *page)
+{
+	u64 *addr = kmap_atomic(page, KM_USER0);
+	u64 sample = 0;
+	int i;
+
+	for (i = 0; i < KSM_SAMPLE_WORDS; i++)
+		sample = (sample ^ addr[i * (PAGE_SIZE / sizeof(u64) /
+					     KSM_SAMPLE_WORDS)]) * 31;
 	kunmap_atomic(addr, KM_USER0);
-	return checksum;
+	return (u32)sample ^ (u32)(sample >> 32);
 }
 
 static int memcmp_pages(struct page *page1, struct page *page2)
@@ -711,6 +791,10 @@ static int write_protect_page(struct vm_area_struct *vma, struct page *page,
 		goto out;
 
 	BUG_ON(PageTransCompound(page));
+	/* replace_page() must not change a pte other mms map through */
+	if (unshare_pte_table_rmap(vma, addr, GFP_KERNEL))
+		goto out;
+
 	ptep = page_check_address(page, mm, addr, &ptl, 0);
 	if (!ptep)
 		goto out;
@@ -787,7 +871,7 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 
 	pmd = pmd_offset(pud, addr);
 	BUG_ON(pmd_trans_huge(*pmd));
-	if (!pmd_present(*pmd))
+	if (!pmd_present(*pmd) || pmd_table_shared(*pmd))
 		goto out;
 
 	ptep = pte_offset_map_lock(mm, pmd, addr, &ptl);
@@ -888,7 +972,13 @@ static int try_to_merge_one_page(struct vm_area_struct *vma,
 			 * While we hold page lock, upgrade page from
 			 * PageAnon+anon_vma to PageKsm+NULL stable_node:
 			 * stable_tree_insert() will update stable_node.
+			 *
+			 * Reclaim would drop a clean MADV_FREE page from all
+			 * the processes it gets merged into: dirty it, so it
+			 * is swapped out like any other KSM page.
 			 */
+			if (!PageDirty(page))
+				SetPageDirty(page);
 			set_page_stable_node(page, NULL);
 			mark_page_accessed(page);
 			err = 0;
@@ -935,6 +1025,9 @@ static int try_to_merge_with_ksm_page(struct rmap_item *rmap_item,
 	if (err)
 		goto out;
 
+	/* Unstable nid is in union with stable anon_vma: remove first */
+	remove_rmap_item_from_tree(rmap_item);
+
 	/* Must get reference to anon_vma while still holding mmap_sem */
 	rmap_item->anon_vma = vma->anon_vma;
 	get_anon_vma(vma->anon_vma);
@@ -985,8 +1078,9 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  */
 static struct page *stable_tree_search(struct page *page)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	struct rb_node *node;
 	struct stable_node *stable_node;
+	int nid;
 
 	stable_node = page_stable_node(page);
 	if (stable_node) {			/* ksm page forked */
@@ -994,6 +1088,9 @@ static struct page *stable_tree_search(struct page *page)
 		return page;
 	}
 
+	nid = get_kpfn_nid(page_to_pfn(page));
+	node = root_stable_tree[nid].rb_node;
+
 	while (node) {
 		struct page *tree_page;
 		int ret;
@@ -1012,8 +1109,19 @@ static struct page *stable_tree_search(struct page *page)
 		} else if (ret > 0) {
 			put_page(tree_page);
 			node = node->rb_right;
-		} else
+		} else {
+			/*
+			 * The ksm page may have been migrated to another
+			 * node since it was put in this tree: don't merge
+			 * with it then.
+			 */
+			if (get_kpfn_nid(stable_node->kpfn) !=
+			    NUMA(stable_node->nid)) {
+				put_page(tree_page);
+				return NULL;
+			}
 			return tree_page;
+		}
 	}
 
 	return NULL;
@@ -1028,7 +1136,9 @@ static struct page *stable_tree_search(struct page *page)
  */
 static struct stable_node *stable_tree_insert(struct page *kpage)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	int nid = get_kpfn_nid(page_to_pfn(kpage));
+	struct rb_root *root = &root_stable_tree[nid];
+	struct rb_node **new = &root->rb_node;
 	struct rb_node *parent = NULL;
 	struct stable_node *stable_node;
 
@@ -1065,11 +1175,12 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		return NULL;
 
 	rb_link_node(&stable_node->node, parent, new);
-	rb_insert_color(&stable_node->node, &root_stable_tree);
+	rb_insert_color(&stable_node->node, root);
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 
 	stable_node->kpfn = page_to_pfn(kpage);
+	DO_NUMA(stable_node->nid = nid);
 	set_page_stable_node(kpage, stable_node);
 
 	return stable_node;
@@ -1095,7 +1206,9 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 					      struct page **tree_pagep)
 
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	int nid = get_kpfn_nid(page_to_pfn(page));
+	struct rb_root *root = &root_unstable_tree[nid];
+	struct rb_node **new = &root->rb_node;
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -1117,6 +1230,16 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 			return NULL;
 		}
 
+		/*
+		 * If tree_page has been migrated to another NUMA node, it
+		 * will be flushed out and put in the right unstable tree
+		 * next time: only merge with it when across_nodes.
+		 */
+		if (!ksm_merge_across_nodes && page_to_nid(tree_page) != nid) {
+			put_page(tree_page);
+			return NULL;
+		}
+
 		ret = memcmp_pages(page, tree_page);
 
 		parent = *new;
@@ -1134,8 +1257,9 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 	rmap_item->address |= UNSTABLE_FLAG;
 	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, root);
 
 	ksm_pages_unshared++;
 	return NULL;
@@ -1157,6 +1281,7 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 		ksm_pages_sharing++;
 	else
 		ksm_pages_shared++;
+	ksm_scan_pages_merged++;
 }
 
 /*
@@ -1174,7 +1299,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
+	unsigned int checksum, sample;
 	int err;
 
 	remove_rmap_item_from_tree(rmap_item);
@@ -1196,6 +1321,19 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		return;
 	}
 
+	/*
+	 * A page that changed since the scan before is likely to have
+	 * changed again: if a sample of it did, skip it right away,
+	 * without computing the checksum of the whole page.
+	 */
+	if (rmap_item->address & VOLATILE_FLAG) {
+		sample = calc_sample(page);
+		if (rmap_item->oldsample != sample) {
+			rmap_item->oldsample = sample;
+			return;
+		}
+	}
+
 	/*
 	 * If the hash value of the page has changed from the last time
 	 * we calculated it, this page is changing frequently: therefore we
@@ -1205,8 +1343,11 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
+		rmap_item->oldsample = calc_sample(page);
+		rmap_item->address |= VOLATILE_FLAG;
 		return;
 	}
+	rmap_item->address &= ~VOLATILE_FLAG;
 
 	tree_rmap_item =
 		unstable_tree_search_insert(rmap_item, page, &tree_page);
@@ -1220,8 +1361,6 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		 * tree, and insert it instead as new node in the stable tree.
 		 */
 		if (kpage) {
-			remove_rmap_item_from_tree(tree_rmap_item);
-
 			lock_page(kpage);
 			stable_node = stable_tree_insert(kpage);
 			if (stable_node) {
@@ -1272,12 +1411,44 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
+/*
+ * At the end of each full scan: if it merged next to nothing, double the
+ * time ksmd sleeps between batches, up to max_sleep_millisecs; go back
+ * to sleep_millisecs as soon as a scan pays off again.  The first two
+ * scans only gather checksums and fill the unstable tree.
+ */
+static void ksm_adapt_sleep(void)
+{
+	if (ksm_scan.seqnr > 2 && ksm_scan_pages_merged <
+	    (ksm_scan_pages_scanned >> KSM_YIELD_SHIFT)) {
+		if (ksm_sleep_shift < 16 &&
+		    ((unsigned long)ksm_thread_sleep_millisecs <<
+		     ksm_sleep_shift) < ksm_thread_max_sleep_millisecs)
+			ksm_sleep_shift++;
+	} else
+		ksm_sleep_shift = 0;
+
+	ksm_scan_pages_scanned = 0;
+	ksm_scan_pages_merged = 0;
+}
+
+static unsigned int ksm_sleep_millisecs(void)
+{
+	unsigned long msecs;
+
+	msecs = (unsigned long)ksm_thread_sleep_millisecs << ksm_sleep_shift;
+	if (ksm_sleep_shift && msecs > ksm_thread_max_sleep_millisecs)
+		msecs = ksm_thread_max_sleep_millisecs;
+	return msecs;
+}
+
 static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
+	int nid;
 
 	if (list_empty(&ksm_mm_head.mm_list))
 		return NULL;
@@ -1296,7 +1467,8 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		 */
 		lru_add_drain_all();
 
-		root_unstable_tree = RB_ROOT;
+		for (nid = 0; nid < nr_node_ids; nid++)
+			root_unstable_tree[nid] = RB_ROOT;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
@@ -1400,6 +1572,7 @@ next_mm:
 		goto next_mm;
 
 	ksm_scan.seqnr++;
+	ksm_adapt_sleep();
 	return NULL;
 }
 
@@ -1417,6 +1590,7 @@ static void ksm_do_scan(unsigned int scan_npages)
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
 			return;
+		ksm_scan_pages_scanned++;
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
 			cmp_and_merge_page(page, rmap_item);
 		put_page(page);
@@ -1443,7 +1617,7 @@ static int ksm_scan_thread(void *nothing)
 
 		if (ksmd_should_run()) {
 			schedule_timeout_interruptible(
-				msecs_to_jiffies(ksm_thread_sleep_millisecs));
+				msecs_to_jiffies(ksm_sleep_millisecs()));
 		} else {
 			wait_event_freezable(ksm_thread_wait,
 				ksmd_should_run() || kthread_should_stop());
@@ -1475,6 +1649,8 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 				return err;
 		}
 
+		/* New candidates: stop backing off */
+		ksm_sleep_shift = 0;
 		*vm_flags |= VM_MERGEABLE;
 		break;
 
@@ -1764,14 +1940,18 @@ static struct stable_node *ksm_check_stable_tree(unsigned long start_pfn,
 						 unsigned long end_pfn)
 {
 	struct rb_node *node;
+	int nid;
 
-	for (node = rb_first(&root_stable_tree); node; node = rb_next(node)) {
-		struct stable_node *stable_node;
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		for (node = rb_first(&root_stable_tree[nid]); node;
+		     node = rb_next(node)) {
+			struct stable_node *stable_node;
 
-		stable_node = rb_entry(node, struct stable_node, node);
-		if (stable_node->kpfn >= start_pfn &&
-		    stable_node->kpfn < end_pfn)
-			return stable_node;
+			stable_node = rb_entry(node, struct stable_node, node);
+			if (stable_node->kpfn >= start_pfn &&
+			    stable_node->kpfn < end_pfn)
+				return stable_node;
+		}
 	}
 	return NULL;
 }
@@ -1844,11 +2024,36 @@ static ssize_t sleep_millisecs_store(struct kobject *kobj,
 		return -EINVAL;
 
 	ksm_thread_sleep_millisecs = msecs;
+	ksm_sleep_shift = 0;
 
 	return count;
 }
 KSM_ATTR(sleep_millisecs);
 
+static ssize_t max_sleep_millisecs_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_thread_max_sleep_millisecs);
+}
+
+static ssize_t max_sleep_millisecs_store(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 const char *buf, size_t count)
+{
+	unsigned long msecs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &msecs);
+	if (err || msecs > UINT_MAX)
+		return -EINVAL;
+
+	ksm_thread_max_sleep_millisecs = msecs;
+	ksm_sleep_shift = 0;
+
+	return count;
+}
+KSM_ATTR(max_sleep_millisecs);
+
 static ssize_t pages_to_scan_show(struct kobject *kobj,
 				  struct kobj_attribute *attr, char *buf)
 {
@@ -1921,6 +2126,41 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 }
 KSM_ATTR(run);
 
+#ifdef CONFIG_NUMA
+static ssize_t merge_across_nodes_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_merge_across_nodes);
+}
+
+static ssize_t merge_across_nodes_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = strict_strtoul(buf, 10, &knob);
+	if (err)
+		return err;
+	if (knob > 1)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (ksm_merge_across_nodes != knob) {
+		/* The stable trees are only switched over while empty */
+		if (ksm_pages_shared)
+			err = -EBUSY;
+		else
+			ksm_merge_across_nodes = knob;
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(merge_across_nodes);
+#endif
+
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
@@ -1968,6 +2208,7 @@ KSM_ATTR_RO(full_scans);
 
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
+	&max_sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
 	&run_attr.attr,
 	&pages_shared_attr.attr,
@@ -1975,6 +2216,9 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+#ifdef CONFIG_NUMA
+	&merge_across_nodes_attr.attr,
+#endif
 	NULL,
 };
 
@@ -21,7 +21,7 @@
  * GNU General Public License for more details.
  */
 
-#include <linux/res_counter.h>
+#include <linux/page_counter.h>
 #include <linux/memcontrol.h>
 #include <linux/cgroup.h>
 #include <linux/mm.h>
@@ -107,12 +107,10 @@ enum mem_cgroup_events_index {
  */
 enum mem_cgroup_events_target {
 	MEM_CGROUP_TARGET_THRESH,
-	MEM_CGROUP_TARGET_SOFTLIMIT,
 	MEM_CGROUP_TARGET_NUMAINFO,
 	MEM_CGROUP_NTARGETS,
 };
 #define THRESHOLDS_EVENTS_TARGET (128)
-#define SOFTLIMIT_EVENTS_TARGET (1024)
 #define NUMAINFO_EVENTS_TARGET	(1024)
 
 struct mem_cgroup_stat_cpu {
@@ -132,10 +130,6 @@ struct mem_cgroup_per_zone {
 	unsigned long		count[NR_LRU_LISTS];
 
 	struct zone_reclaim_stat reclaim_stat;
-	struct rb_node		tree_node;	/* RB tree node */
-	unsigned long long	usage_in_excess;/* Set to the value by which */
-						/* the soft limit is exceeded*/
-	bool			on_tree;
 	struct mem_cgroup	*mem;		/* Back pointer, we cannot */
 						/* use container_of	   */
 };
@@ -150,26 +144,6 @@ struct mem_cgroup_lru_info {
 	struct mem_cgroup_per_node *nodeinfo[MAX_NUMNODES];
 };
 
-/*
- * Cgroups above their limits are maintained in a RB-Tree, independent of
- * their hierarchy representation
- */
-
-struct mem_cgroup_tree_per_zone {
-	struct rb_root rb_root;
-	spinlock_t lock;
-};
-
-struct mem_cgroup_tree_per_node {
-	struct mem_cgroup_tree_per_zone rb_tree_per_zone[MAX_NR_ZONES];
-};
-
-struct mem_cgroup_tree {
-	struct mem_cgroup_tree_per_node *rb_tree_per_node[MAX_NUMNODES];
-};
-
-static struct mem_cgroup_tree soft_limit_tree __read_mostly;
-
 struct mem_cgroup_threshold {
 	struct eventfd_ctx *eventfd;
 	u64 threshold;
@@ -221,11 +195,24 @@ struct mem_cgroup {
 	/*
 	 * the counter to account for memory usage
 	 */
-	struct res_counter res;
+	struct page_counter memory;
 	/*
 	 * the counter to account for mem+swap usage.
 	 */
-	struct res_counter memsw;
+	struct page_counter memsw;
+	/*
+	 * memory usage above this is reclaimed first under global pressure
+	 */
+	unsigned long soft_limit;
+	/*
+	 * global reclaim leaves the group alone while it and its ancestors
+	 * are within this
+	 */
+	unsigned long low;
+	/*
+	 * usage above this is reclaimed by the charging tasks themselves
+	 */
+	unsigned long high;
 	/*
 	 * Per cgroup active and inactive list, similar to the
 	 * per zone LRU lists.
@@ -253,7 +240,7 @@ struct mem_cgroup {
 	/* OOM-Killer disable */
 	int		oom_kill_disable;
 
-	/* set when res.limit == memsw.limit */
+	/* set when memory.limit == memsw.limit */
 	bool		memsw_is_minimum;
 
 	/* protect arrays of thresholds */
@@ -323,13 +310,6 @@ static bool move_file(void)
 					&mc.to->move_charge_at_immigrate);
 }
 
-/*
- * Maximum loops in mem_cgroup_hierarchical_reclaim(), used for soft
- * limit reclaim to prevent infinite loops, if they ever occur.
- */
-#define	MEM_CGROUP_MAX_RECLAIM_LOOPS		(100)
-#define	MEM_CGROUP_MAX_SOFT_LIMIT_RECLAIM_LOOPS	(2)
-
 enum charge_type {
 	MEM_CGROUP_CHARGE_TYPE_CACHE = 0,
 	MEM_CGROUP_CHARGE_TYPE_MAPPED,
@@ -347,6 +327,16 @@ enum charge_type {
 #define MEMFILE_PRIVATE(x, val)	(((x) << 16) | (val))
 #define MEMFILE_TYPE(val)	(((val) >> 16) & 0xffff)
 #define MEMFILE_ATTR(val)	((val) & 0xffff)
+/* attributes of the memory and memsw files */
+enum {
+	RES_USAGE,
+	RES_LIMIT,
+	RES_MAX_USAGE,
+	RES_FAILCNT,
+	RES_SOFT_LIMIT,
+	RES_LOW,
+	RES_HIGH,
+};
 /* Used for OOM nofiier */
 #define OOM_CONTROL		(0)
 
@@ -357,8 +347,6 @@ enum charge_type {
 #define MEM_CGROUP_RECLAIM_NOSWAP	(1 << MEM_CGROUP_RECLAIM_NOSWAP_BIT)
 #define MEM_CGROUP_RECLAIM_SHRINK_BIT	0x1
 #define MEM_CGROUP_RECLAIM_SHRINK	(1 << MEM_CGROUP_RECLAIM_SHRINK_BIT)
-#define MEM_CGROUP_RECLAIM_SOFT_BIT	0x2
-#define MEM_CGROUP_RECLAIM_SOFT		(1 << MEM_CGROUP_RECLAIM_SOFT_BIT)
 
 static void mem_cgroup_get(struct mem_cgroup *mem);
 static void mem_cgroup_put(struct mem_cgroup *mem);
@@ -385,164 +373,6 @@ page_cgroup_zoneinfo(struct mem_cgroup *mem, struct page *page)
 	return mem_cgroup_zoneinfo(mem, nid, zid);
 }
 
-static struct mem_cgroup_tree_per_zone *
-soft_limit_tree_node_zone(int nid, int zid)
-{
-	return &soft_limit_tree.rb_tree_per_node[nid]->rb_tree_per_zone[zid];
-}
-
-static struct mem_cgroup_tree_per_zone *
-soft_limit_tree_from_page(struct page *page)
-{
-	int nid = page_to_nid(page);
-	int zid = page_zonenum(page);
-
-	return &soft_limit_tree.rb_tree_per_node[nid]->rb_tree_per_zone[zid];
-}
-
-static void
-__mem_cgroup_insert_exceeded(struct mem_cgroup *mem,
-				struct mem_cgroup_per_zone *mz,
-				struct mem_cgroup_tree_per_zone *mctz,
-				unsigned long long new_usage_in_excess)
-{
-	struct rb_node **p = &mctz->rb_root.rb_node;
-	struct rb_node *parent = NULL;
-	struct mem_cgroup_per_zone *mz_node;
-
-	if (mz->on_tree)
-		return;
-
-	mz->usage_in_excess = new_usage_in_excess;
-	if (!mz->usage_in_excess)
-		return;
-	while (*p) {
-		parent = *p;
-		mz_node = rb_entry(parent, struct mem_cgroup_per_zone,
-					tree_node);
-		if (mz->usage_in_excess < mz_node->usage_in_excess)
-			p = &(*p)->rb_left;
-		/*
-		 * We can't avoid mem cgroups that are over their soft
-		 * limit by the same amount
-		 */
-		else if (mz->usage_in_excess >= mz_node->usage_in_excess)
-			p = &(*p)->rb_right;
-	}
-	rb_link_node(&mz->tree_node, parent, p);
-	rb_insert_color(&mz->tree_node, &mctz->rb_root);
-	mz->on_tree = true;
-}
-
-static void
-__mem_cgroup_remove_exceeded(struct mem_cgroup *mem,
-				struct mem_cgroup_per_zone *mz,
-				struct mem_cgroup_tree_per_zone *mctz)
-{
-	if (!mz->on_tree)
-		return;
-	rb_erase(&mz->tree_node, &mctz->rb_root);
-	mz->on_tree = false;
-}
-
-static void
-mem_cgroup_remove_exceeded(struct mem_cgroup *mem,
-				struct mem_cgroup_per_zone *mz,
-				struct mem_cgroup_tree_per_zone *mctz)
-{
-	spin_lock(&mctz->lock);
-	__mem_cgroup_remove_exceeded(mem, mz, mctz);
-	spin_unlock(&mctz->lock);
-}
-
-
-static void mem_cgroup_update_tree(struct mem_cgroup *mem, struct page *page)
-{
-	unsigned long long excess;
-	struct mem_cgroup_per_zone *mz;
-	struct mem_cgroup_tree_per_zone *mctz;
-	int nid = page_to_nid(page);
-	int zid = page_zonenum(page);
-	mctz = soft_limit_tree_from_page(page);
-
-	/*
-	 * Necessary to update all ancestors when hierarchy is used.
-	 * because their event counter is not touched.
-	 */
-	for (; mem; mem = parent_mem_cgroup(mem)) {
-		mz = mem_cgroup_zoneinfo(mem, nid, zid);
-		excess = res_counter_soft_limit_excess(&mem->res);
-		/*
-		 * We have to update the tree if mz is on RB-tree or
-		 * mem is over its softlimit.
-		 */
-		if (excess || mz->on_tree) {
-			spin_lock(&mctz->lock);
-			/* if on-tree, remove it */
-			if (mz->on_tree)
-				__mem_cgroup_remove_exceeded(mem, mz, mctz);
-			/*
-			 * Insert again. mz->usage_in_excess will be updated.
-			 * If excess is 0, no tree ops.
-			 */
-			__mem_cgroup_insert_exceeded(mem, mz, mctz, excess);
-			spin_unlock(&mctz->lock);
-		}
-	}
-}
-
-static void mem_cgroup_remove_from_trees(struct mem_cgroup *mem)
-{
-	int node, zone;
-	struct mem_cgroup_per_zone *mz;
-	struct mem_cgroup_tree_per_zone *mctz;
-
-	for_each_node_state(node, N_POSSIBLE) {
-		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
-			mz = mem_cgroup_zoneinfo(mem, node, zone);
-			mctz = soft_limit_tree_node_zone(node, zone);
-			mem_cgroup_remove_exceeded(mem, mz, mctz);
-		}
-	}
-}
-
-static struct mem_cgroup_per_zone *
-__mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_zone *mctz)
-{
-	struct rb_node *rightmost = NULL;
-	struct mem_cgroup_per_zone *mz;
-
-retry:
-	mz = NULL;
-	rightmost = rb_last(&mctz->rb_root);
-	if (!rightmost)
-		goto done;		/* Nothing to reclaim from */
-
-	mz = rb_entry(rightmost, struct mem_cgroup_per_zone, tree_node);
-	/*
-	 * Remove the node now but someone else can add it back,
-	 * we will to add it back at the end of reclaim to its correct
-	 * position in the tree.
-	 */
-	__mem_cgroup_remove_exceeded(mz->mem, mz, mctz);
-	if (!res_counter_soft_limit_excess(&mz->mem->res) ||
-		!css_tryget(&mz->mem->css))
-		goto retry;
-done:
-	return mz;
-}
-
-static struct mem_cgroup_per_zone *
-mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_zone *mctz)
-{
-	struct mem_cgroup_per_zone *mz;
-
-	spin_lock(&mctz->lock);
-	mz = __mem_cgroup_largest_soft_limit_node(mctz);
-	spin_unlock(&mctz->lock);
-	return mz;
-}
-
 /*
  * Implementation Note: reading percpu statistics for memcg.
  *
@@ -680,9 +510,6 @@ static void __mem_cgroup_target_update(struct mem_cgroup *mem, int target)
 	case MEM_CGROUP_TARGET_THRESH:
 		next = val + THRESHOLDS_EVENTS_TARGET;
 		break;
-	case MEM_CGROUP_TARGET_SOFTLIMIT:
-		next = val + SOFTLIMIT_EVENTS_TARGET;
-		break;
 	case MEM_CGROUP_TARGET_NUMAINFO:
 		next = val + NUMAINFO_EVENTS_TARGET;
 		break;
@@ -699,16 +526,10 @@ static void __mem_cgroup_target_update(struct mem_cgroup *mem, int target)
  */
 static void memcg_check_events(struct mem_cgroup *mem, struct page *page)
 {
-	/* threshold event is triggered in finer grain than soft limit */
+	/* threshold event is triggered in finer grain than numainfo */
 	if (unlikely(__memcg_event_check(mem, MEM_CGROUP_TARGET_THRESH))) {
 		mem_cgroup_threshold(mem);
 		__mem_cgroup_target_update(mem, MEM_CGROUP_TARGET_THRESH);
-		if (unlikely(__memcg_event_check(mem,
-			     MEM_CGROUP_TARGET_SOFTLIMIT))) {
-			mem_cgroup_update_tree(mem, page);
-			__mem_cgroup_target_update(mem,
-						   MEM_CGROUP_TARGET_SOFTLIMIT);
-		}
 #if MAX_NUMNODES > 1
 		if (unlikely(__memcg_event_check(mem,
 			MEM_CGROUP_TARGET_NUMAINFO))) {
@@ -845,6 +666,71 @@ static inline bool mem_cgroup_is_root(struct mem_cgroup *mem)
 	return (mem == root_mem_cgroup);
 }
 
+/*
+ * Is @mem, and under hierarchy each of its ancestors, using no more
+ * memory than its low limit?
+ */
+static bool mem_cgroup_low(struct mem_cgroup *mem)
+{
+	if (mem_cgroup_is_root(mem))
+		return false;
+	for (; mem && !mem_cgroup_is_root(mem); mem = parent_mem_cgroup(mem))
+		if (page_counter_read(&mem->memory) > ACCESS_ONCE(mem->low))
+			return false;
+	return true;
+}
+
+/*
+ * Global reclaim skips pages of memory cgroups within their low
+ * protection, as long as it can make progress elsewhere.
+ */
+bool mem_cgroup_page_protected(struct page *page)
+{
+	struct page_cgroup *pc;
+	bool ret = false;
+
+	if (mem_cgroup_disabled())
+		return false;
+	pc = lookup_page_cgroup(page);
+	if (unlikely(!pc) || !PageCgroupUsed(pc))
+		return false;
+	lock_page_cgroup(pc);
+	if (PageCgroupUsed(pc))
+		ret = mem_cgroup_low(pc->mem_cgroup);
+	unlock_page_cgroup(pc);
+	return ret;
+}
+
+/*
+ * The share of its pages, in 1/(1 << SOFT_LIMIT_PRESSURE_SHIFT), that
+ * global reclaim takes from @mem: how far the usage is above the memory
+ * the group is protected for - the larger of its soft and low limit -
+ * relative to the usage.  Under hierarchy a group also
+ * feels the pressure of its ancestors.
+ */
+#define SOFT_LIMIT_PRESSURE_SHIFT	10
+
+static unsigned long soft_limit_pressure(struct mem_cgroup *mem)
+{
+	unsigned long pressure = 0;
+
+	if (mem_cgroup_low(mem))
+		return 0;
+	for (; mem && !mem_cgroup_is_root(mem); mem = parent_mem_cgroup(mem)) {
+		unsigned long usage = page_counter_read(&mem->memory);
+		unsigned long protect = max(ACCESS_ONCE(mem->soft_limit),
+					    ACCESS_ONCE(mem->low));
+		unsigned long tmp;
+
+		if (usage <= protect)
+			continue;
+		tmp = div64_u64((u64)(usage - protect) <<
+				SOFT_LIMIT_PRESSURE_SHIFT, usage);
+		pressure = max(pressure, tmp);
+	}
+	return pressure;
+}
+
 void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx)
 {
 	struct mem_cgroup *mem;
@@ -1309,7 +1195,7 @@ unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
 	return nr_taken;
 }
 
-#define mem_cgroup_from_res_counter(counter, member)	\
+#define mem_cgroup_from_counter(counter, member)	\
 	container_of(counter, struct mem_cgroup, member)
 
 /**
@@ -1321,12 +1207,12 @@ unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
  */
 static unsigned long mem_cgroup_margin(struct mem_cgroup *mem)
 {
-	unsigned long long margin;
+	unsigned long margin;
 
-	margin = res_counter_margin(&mem->res);
+	margin = page_counter_margin(&mem->memory);
 	if (do_swap_account)
-		margin = min(margin, res_counter_margin(&mem->memsw));
-	return margin >> PAGE_SHIFT;
+		margin = min(margin, page_counter_margin(&mem->memsw));
+	return margin;
 }
 
 static unsigned int get_swappiness(struct mem_cgroup *memcg)
@@ -1482,15 +1368,13 @@ void mem_cgroup_print_oom_info(struct mem_cgroup *memcg, struct task_struct *p)
 	printk(KERN_CONT " as a result of limit of %s\n", memcg_name);
 done:
 
-	printk(KERN_INFO "memory: usage %llukB, limit %llukB, failcnt %llu\n",
-		res_counter_read_u64(&memcg->res, RES_USAGE) >> 10,
-		res_counter_read_u64(&memcg->res, RES_LIMIT) >> 10,
-		res_counter_read_u64(&memcg->res, RES_FAILCNT));
-	printk(KERN_INFO "memory+swap: usage %llukB, limit %llukB, "
-		"failcnt %llu\n",
-		res_counter_read_u64(&memcg->memsw, RES_USAGE) >> 10,
-		res_counter_read_u64(&memcg->memsw, RES_LIMIT) >> 10,
-		res_counter_read_u64(&memcg->memsw, RES_FAILCNT));
+	printk(KERN_INFO "memory: usage %lukB, limit %lukB, failcnt %lu\n",
+		page_counter_read(&memcg->memory) << (PAGE_SHIFT-10),
+		memcg->memory.limit << (PAGE_SHIFT-10), memcg->memory.failcnt);
+	printk(KERN_INFO "memory+swap: usage %lukB, limit %lukB, "
+		"failcnt %lu\n",
+		page_counter_read(&memcg->memsw) << (PAGE_SHIFT-10),
+		memcg->memsw.limit << (PAGE_SHIFT-10), memcg->memsw.failcnt);
 }
 
 /*
@@ -1515,10 +1399,10 @@ u64 mem_cgroup_get_limit(struct mem_cgroup *memcg)
 	u64 limit;
 	u64 memsw;
 
-	limit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-	limit += total_swap_pages << PAGE_SHIFT;
+	limit = (u64)memcg->memory.limit * PAGE_SIZE;
+	limit += (u64)total_swap_pages << PAGE_SHIFT;
 
-	memsw = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
+	memsw = (u64)memcg->memsw.limit * PAGE_SIZE;
 	/*
 	 * If memsw is finite and limits the amount of swap space available
 	 * to this memcg, return that limit.
@@ -1713,37 +1597,24 @@ bool mem_cgroup_reclaimable(struct mem_cgroup *mem, bool noswap)
  * If shrink==true, for avoiding to free too much, this returns immedieately.
  */
 static int mem_cgroup_hierarchical_reclaim(struct mem_cgroup *root_mem,
-						struct zone *zone,
 						gfp_t gfp_mask,
-						unsigned long reclaim_options,
-						unsigned long *total_scanned)
+						unsigned long reclaim_options)
 {
 	struct mem_cgroup *victim;
 	int ret, total = 0;
 	int loop = 0;
 	bool noswap = reclaim_options & MEM_CGROUP_RECLAIM_NOSWAP;
 	bool shrink = reclaim_options & MEM_CGROUP_RECLAIM_SHRINK;
-	bool check_soft = reclaim_options & MEM_CGROUP_RECLAIM_SOFT;
-	unsigned long excess;
-	unsigned long nr_scanned;
-
-	excess = res_counter_soft_limit_excess(&root_mem->res) >> PAGE_SHIFT;
 
 	/* If memsw_is_minimum==1, swap-out is of-no-use. */
-	if (!check_soft && !shrink && root_mem->memsw_is_minimum)
+	if (!shrink && root_mem->memsw_is_minimum)
 		noswap = true;
 
 	while (1) {
 		victim = mem_cgroup_select_victim(root_mem);
 		if (victim == root_mem) {
 			loop++;
-			/*
-			 * We are not draining per cpu cached charges during
-			 * soft limit reclaim  because global reclaim doesn't
-			 * care about charges. It tries to free some memory and
-			 * charges will not give any.
-			 */
-			if (!check_soft && loop >= 1)
+			if (loop >= 1)
 				drain_all_stock_async(root_mem);
 			if (loop >= 2) {
 				/*
@@ -1751,21 +1622,8 @@ static int mem_cgroup_hierarchical_reclaim(struct mem_cgroup *root_mem,
 				 * anything, it might because there are
 				 * no reclaimable pages under this hierarchy
 				 */
-				if (!check_soft || !total) {
-					css_put(&victim->css);
-					break;
-				}
-				/*
-				 * We want to do more targeted reclaim.
-				 * excess >> 2 is not to excessive so as to
-				 * reclaim too much, nor too less that we keep
-				 * coming back to reclaim from this cgroup
-				 */
-				if (total >= (excess >> 2) ||
-					(loop > MEM_CGROUP_MAX_RECLAIM_LOOPS)) {
-					css_put(&victim->css);
-					break;
-				}
+				css_put(&victim->css);
+				break;
 			}
 		}
 		if (!mem_cgroup_reclaimable(victim, noswap)) {
@@ -1774,14 +1632,8 @@ static int mem_cgroup_hierarchical_reclaim(struct mem_cgroup *root_mem,
 			continue;
 		}
 		/* we use swappiness of local cgroup */
-		if (check_soft) {
-			ret = mem_cgroup_shrink_node_zone(victim, gfp_mask,
-				noswap, get_swappiness(victim), zone,
-				&nr_scanned);
-			*total_scanned += nr_scanned;
-		} else
-			ret = try_to_free_mem_cgroup_pages(victim, gfp_mask,
-						noswap, get_swappiness(victim));
+		ret = try_to_free_mem_cgroup_pages(victim, gfp_mask, noswap,
+						   get_swappiness(victim));
 		css_put(&victim->css);
 		/*
 		 * At shrinking usage, we can't check we should stop here or
@@ -1791,10 +1643,7 @@ static int mem_cgroup_hierarchical_reclaim(struct mem_cgroup *root_mem,
 		if (shrink)
 			return ret;
 		total += ret;
-		if (check_soft) {
-			if (!res_counter_soft_limit_excess(&root_mem->res))
-				return total;
-		} else if (mem_cgroup_margin(root_mem))
+		if (mem_cgroup_margin(root_mem))
 			return total;
 	}
 	return total;
@@ -2003,9 +1852,15 @@ EXPORT_SYMBOL(mem_cgroup_update_page_stat);
  * TODO: maybe necessary to use big numbers in big irons.
  */
 #define CHARGE_BATCH	32U
+/*
+ * Number of memcgs a cpu keeps precharged pages for, so that tasks of
+ * different groups sharing a cpu don't keep flushing each other's stock.
+ */
+#define MEMCG_STOCK_NR	4
 struct memcg_stock_pcp {
-	struct mem_cgroup *cached; /* this never be root cgroup */
-	unsigned int nr_pages;
+	struct mem_cgroup *cached[MEMCG_STOCK_NR]; /* never the root cgroup */
+	unsigned int nr_pages[MEMCG_STOCK_NR];
+	unsigned int next_evict;
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	(0)
@@ -2022,33 +1877,49 @@ static DEFINE_MUTEX(percpu_charge_mutex);
 static bool consume_stock(struct mem_cgroup *mem)
 {
 	struct memcg_stock_pcp *stock;
-	bool ret = true;
+	bool ret = false;
+	int i;
 
 	stock = &get_cpu_var(memcg_stock);
-	if (mem == stock->cached && stock->nr_pages)
-		stock->nr_pages--;
-	else /* need to call res_counter_charge */
-		ret = false;
+	for (i = 0; i < MEMCG_STOCK_NR; i++) {
+		if (stock->cached[i] != mem)
+			continue;
+		if (stock->nr_pages[i]) {
+			stock->nr_pages[i]--;
+			ret = true;
+		}
+		break;
+	}
 	put_cpu_var(memcg_stock);
 	return ret;
 }
 
 /*
- * Returns stocks cached in percpu to res_counter and reset cached information.
+ * Returns the charges of one stock slot to the page counters and resets it.
  */
-static void drain_stock(struct memcg_stock_pcp *stock)
+static void drain_stock_slot(struct memcg_stock_pcp *stock, int i)
 {
-	struct mem_cgroup *old = stock->cached;
-
-	if (stock->nr_pages) {
-		unsigned long bytes = stock->nr_pages * PAGE_SIZE;
+	struct mem_cgroup *old = stock->cached[i];
 
-		res_counter_uncharge(&old->res, bytes);
+	if (stock->nr_pages[i]) {
+		page_counter_uncharge(&old->memory, stock->nr_pages[i]);
 		if (do_swap_account)
-			res_counter_uncharge(&old->memsw, bytes);
-		stock->nr_pages = 0;
+			page_counter_uncharge(&old->memsw, stock->nr_pages[i]);
+		stock->nr_pages[i] = 0;
 	}
-	stock->cached = NULL;
+	stock->cached[i] = NULL;
+}
+
+/*
+ * Returns stocks cached in percpu to the page counters and reset cached
+ * information.
+ */
+static void drain_stock(struct memcg_stock_pcp *stock)
+{
+	int i;
+
+	for (i = 0; i < MEMCG_STOCK_NR; i++)
+		drain_stock_slot(stock, i);
 }
 
 /*
@@ -2063,26 +1934,61 @@ static void drain_local_stock(struct work_struct *dummy)
 }
 
 /*
- * Cache charges(val) which is from res_counter, to local per_cpu area.
- * This will be consumed by consume_stock() function, later.
+ * Cache charges(val) which is from the page counters, to local per_cpu
+ * area.  This will be consumed by consume_stock() function, later.  When
+ * all slots are used by other memcgs, one of them is flushed round robin.
  */
 static void refill_stock(struct mem_cgroup *mem, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+	int i, slot = -1;
 
-	if (stock->cached != mem) { /* reset if necessary */
-		drain_stock(stock);
-		stock->cached = mem;
+	for (i = 0; i < MEMCG_STOCK_NR; i++) {
+		if (stock->cached[i] == mem) {
+			slot = i;
+			break;
+		}
+		if (!stock->cached[i] && slot < 0)
+			slot = i;
 	}
-	stock->nr_pages += nr_pages;
+	if (slot < 0) {
+		slot = stock->next_evict;
+		stock->next_evict = (slot + 1) % MEMCG_STOCK_NR;
+		drain_stock_slot(stock, slot);
+	}
+	stock->cached[slot] = mem;
+	stock->nr_pages[slot] += nr_pages;
 	put_cpu_var(memcg_stock);
 }
 
+/*
+ * Does @stock cache charges of @root_mem or one of its descendants?
+ */
+static bool stock_has_memcg(struct memcg_stock_pcp *stock,
+			    struct mem_cgroup *root_mem)
+{
+	struct mem_cgroup *mem;
+	int i;
+
+	for (i = 0; i < MEMCG_STOCK_NR; i++) {
+		mem = stock->cached[i];
+		if (!mem)
+			continue;
+		if (mem == root_mem)
+			return true;
+		/* check whether "mem" is under tree of "root_mem" */
+		if (root_mem->use_hierarchy &&
+		    css_is_ancestor(&mem->css, &root_mem->css))
+			return true;
+	}
+	return false;
+}
+
 /*
  * Tries to drain stocked charges in other cpus. This function is asynchronous
  * and just put a work per cpu for draining localy on each cpu. Caller can
- * expects some charges will be back to res_counter later but cannot wait for
- * it.
+ * expects some charges will be back to the page counters later but cannot
+ * wait for it.
  */
 static void drain_all_stock_async(struct mem_cgroup *root_mem)
 {
@@ -2103,21 +2009,11 @@ static void drain_all_stock_async(struct mem_cgroup *root_mem)
 	curcpu = raw_smp_processor_id();
 	for_each_online_cpu(cpu) {
 		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
-		struct mem_cgroup *mem;
 
 		if (cpu == curcpu)
 			continue;
-
-		mem = stock->cached;
-		if (!mem)
+		if (!stock_has_memcg(stock, root_mem))
 			continue;
-		if (mem != root_mem) {
-			if (!root_mem->use_hierarchy)
-				continue;
-			/* check whether "mem" is under tree of "root_mem" */
-			if (!css_is_ancestor(&mem->css, &root_mem->css))
-				continue;
-		}
 		if (!test_and_set_bit(FLUSHING_CACHED_CHARGE, &stock->flags))
 			schedule_work_on(cpu, &stock->work);
 	}
@@ -2208,26 +2104,25 @@ enum {
 static int mem_cgroup_do_charge(struct mem_cgroup *mem, gfp_t gfp_mask,
 				unsigned int nr_pages, bool oom_check)
 {
-	unsigned long csize = nr_pages * PAGE_SIZE;
 	struct mem_cgroup *mem_over_limit;
-	struct res_counter *fail_res;
+	struct page_counter *counter;
 	unsigned long flags = 0;
 	int ret;
 
-	ret = res_counter_charge(&mem->res, csize, &fail_res);
+	ret = page_counter_try_charge(&mem->memory, nr_pages, &counter);
 
 	if (likely(!ret)) {
 		if (!do_swap_account)
 			return CHARGE_OK;
-		ret = res_counter_charge(&mem->memsw, csize, &fail_res);
+		ret = page_counter_try_charge(&mem->memsw, nr_pages, &counter);
 		if (likely(!ret))
 			return CHARGE_OK;
 
-		res_counter_uncharge(&mem->res, csize);
-		mem_over_limit = mem_cgroup_from_res_counter(fail_res, memsw);
+		page_counter_uncharge(&mem->memory, nr_pages);
+		mem_over_limit = mem_cgroup_from_counter(counter, memsw);
 		flags |= MEM_CGROUP_RECLAIM_NOSWAP;
 	} else
-		mem_over_limit = mem_cgroup_from_res_counter(fail_res, res);
+		mem_over_limit = mem_cgroup_from_counter(counter, memory);
 	/*
 	 * nr_pages can be either a huge page (HPAGE_PMD_NR), a batch
 	 * of regular pages (CHARGE_BATCH), or a single regular page (1).
@@ -2241,8 +2136,7 @@ static int mem_cgroup_do_charge(struct mem_cgroup *mem, gfp_t gfp_mask,
 	if (!(gfp_mask & __GFP_WAIT))
 		return CHARGE_WOULDBLOCK;
 
-	ret = mem_cgroup_hierarchical_reclaim(mem_over_limit, NULL,
-					      gfp_mask, flags, NULL);
+	ret = mem_cgroup_hierarchical_reclaim(mem_over_limit, gfp_mask, flags);
 	if (mem_cgroup_margin(mem_over_limit) >= nr_pages)
 		return CHARGE_RETRY;
 	/*
@@ -2274,6 +2168,21 @@ static int mem_cgroup_do_charge(struct mem_cgroup *mem, gfp_t gfp_mask,
 	return CHARGE_RETRY;
 }
 
+/*
+ * Going over the high limit does not fail a charge or invoke the OOM killer.
+ * Instead the charging task reclaims from the groups that are over it,
+ * which throttles a workload that keeps growing beyond it.
+ */
+static void mem_cgroup_reclaim_high(struct mem_cgroup *mem, gfp_t gfp_mask)
+{
+	for (; mem; mem = parent_mem_cgroup(mem)) {
+		if (page_counter_read(&mem->memory) <= ACCESS_ONCE(mem->high))
+			continue;
+		mem_cgroup_hierarchical_reclaim(mem, gfp_mask,
+						MEM_CGROUP_RECLAIM_SHRINK);
+	}
+}
+
 /*
  * Unlike exported interface, "oom" parameter is added. if oom==true,
  * oom-killer can be invoked.
@@ -2398,6 +2307,8 @@ again:
 
 	if (batch > nr_pages)
 		refill_stock(mem, batch - nr_pages);
+	if (gfp_mask & __GFP_WAIT)
+		mem_cgroup_reclaim_high(mem, gfp_mask);
 	css_put(&mem->css);
 done:
 	*memcg = mem;
@@ -2419,11 +2330,9 @@ static void __mem_cgroup_cancel_charge(struct mem_cgroup *mem,
 				       unsigned int nr_pages)
 {
 	if (!mem_cgroup_is_root(mem)) {
-		unsigned long bytes = nr_pages * PAGE_SIZE;
-
-		res_counter_uncharge(&mem->res, bytes);
+		page_counter_uncharge(&mem->memory, nr_pages);
 		if (do_swap_account)
-			res_counter_uncharge(&mem->memsw, bytes);
+			page_counter_uncharge(&mem->memsw, nr_pages);
 	}
 }
 
@@ -2912,7 +2821,7 @@ __mem_cgroup_commit_charge_swapin(struct page *page, struct mem_cgroup *ptr,
 			 * calling css_tryget
 			 */
 			if (!mem_cgroup_is_root(memcg))
-				res_counter_uncharge(&memcg->memsw, PAGE_SIZE);
+				page_counter_uncharge(&memcg->memsw, 1);
 			mem_cgroup_swap_statistics(memcg, false);
 			mem_cgroup_put(memcg);
 		}
@@ -2955,7 +2864,7 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *mem,
 	batch = &current->memcg_batch;
 	/*
 	 * In usual, we do css_get() when we remember memcg pointer.
-	 * But in this case, we keep res->usage until end of a series of
+	 * But in this case, we keep memory usage until end of a series of
 	 * uncharges. Then, it's ok to ignore memcg's refcnt.
 	 */
 	if (!batch->memcg)
@@ -2976,8 +2885,8 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *mem,
 
 	/*
 	 * In typical case, batch->memcg == mem. This means we can
-	 * merge a series of uncharges to an uncharge of res_counter.
-	 * If not, we uncharge res_counter ony by one.
+	 * merge a series of uncharges to an uncharge of the page counters.
+	 * If not, we uncharge the page counters one by one.
 	 */
 	if (batch->memcg != mem)
 		goto direct_uncharge;
@@ -2987,9 +2896,9 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *mem,
 		batch->memsw_nr_pages++;
 	return;
 direct_uncharge:
-	res_counter_uncharge(&mem->res, nr_pages * PAGE_SIZE);
+	page_counter_uncharge(&mem->memory, nr_pages);
 	if (uncharge_memsw)
-		res_counter_uncharge(&mem->memsw, nr_pages * PAGE_SIZE);
+		page_counter_uncharge(&mem->memsw, nr_pages);
 	if (unlikely(batch->memcg != mem))
 		memcg_oom_recover(mem);
 	return;
@@ -3059,7 +2968,7 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 
 	unlock_page_cgroup(pc);
 	/*
-	 * even after unlock, we have mem->res.usage here and this memcg
+	 * even after unlock, we have mem->memory usage here and this memcg
 	 * will never be freed.
 	 */
 	memcg_check_events(mem, page);
@@ -3131,11 +3040,10 @@ void mem_cgroup_uncharge_end(void)
 	 * bacause we hide charges behind us.
 	 */
 	if (batch->nr_pages)
-		res_counter_uncharge(&batch->memcg->res,
-				     batch->nr_pages * PAGE_SIZE);
+		page_counter_uncharge(&batch->memcg->memory, batch->nr_pages);
 	if (batch->memsw_nr_pages)
-		res_counter_uncharge(&batch->memcg->memsw,
-				     batch->memsw_nr_pages * PAGE_SIZE);
+		page_counter_uncharge(&batch->memcg->memsw,
+				      batch->memsw_nr_pages);
 	memcg_oom_recover(batch->memcg);
 	/* forget this pointer (for sanity check) */
 	batch->memcg = NULL;
@@ -3188,7 +3096,7 @@ void mem_cgroup_uncharge_swap(swp_entry_t ent)
 		 * This memcg can be obsolete one. We avoid calling css_tryget
 		 */
 		if (!mem_cgroup_is_root(memcg))
-			res_counter_uncharge(&memcg->memsw, PAGE_SIZE);
+			page_counter_uncharge(&memcg->memsw, 1);
 		mem_cgroup_swap_statistics(memcg, false);
 		mem_cgroup_put(memcg);
 	}
@@ -3200,15 +3108,15 @@ void mem_cgroup_uncharge_swap(swp_entry_t ent)
  * @entry: swap entry to be moved
  * @from:  mem_cgroup which the entry is moved from
  * @to:  mem_cgroup which the entry is moved to
- * @need_fixup: whether we should fixup res_counters and refcounts.
+ * @need_fixup: whether we should fixup page counters and refcounts.
  *
  * It succeeds only when the swap_cgroup's record for this entry is the same
  * as the mem_cgroup's id of @from.
  *
  * Returns 0 on success, -EINVAL on failure.
  *
- * The caller must have charged to @to, IOW, called res_counter_charge() about
- * both res and memsw, and called css_get().
+ * The caller must have charged to @to, IOW, called page_counter_charge() about
+ * both memory and memsw, and called css_get().
  */
 static int mem_cgroup_move_swap_account(swp_entry_t entry,
 		struct mem_cgroup *from, struct mem_cgroup *to, bool need_fixup)
@@ -3223,7 +3131,7 @@ static int mem_cgroup_move_swap_account(swp_entry_t entry,
 		mem_cgroup_swap_statistics(to, true);
 		/*
 		 * This function is only called from task migration context now.
-		 * It postpones res_counter and refcount handling till the end
+		 * It postpones page counter and refcount handling till the end
 		 * of task migration(mem_cgroup_clear_mc()) for performance
 		 * improvement. But we cannot postpone mem_cgroup_get(to)
 		 * because if the process that has been moved to @to does
@@ -3232,14 +3140,14 @@ static int mem_cgroup_move_swap_account(swp_entry_t entry,
 		mem_cgroup_get(to);
 		if (need_fixup) {
 			if (!mem_cgroup_is_root(from))
-				res_counter_uncharge(&from->memsw, PAGE_SIZE);
+				page_counter_uncharge(&from->memsw, 1);
 			mem_cgroup_put(from);
 			/*
-			 * we charged both to->res and to->memsw, so we should
-			 * uncharge to->res.
+			 * we charged both to->memory and to->memsw, so we should
+			 * uncharge to->memory.
 			 */
 			if (!mem_cgroup_is_root(to))
-				res_counter_uncharge(&to->res, PAGE_SIZE);
+				page_counter_uncharge(&to->memory, 1);
 		}
 		return 0;
 	}
@@ -3471,13 +3379,13 @@ void mem_cgroup_print_bad_page(struct page *page)
 static DEFINE_MUTEX(set_limit_mutex);
 
 static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
-				unsigned long long val)
+				unsigned long limit)
 {
 	int retry_count;
-	u64 memswlimit, memlimit;
+	unsigned long memswlimit, memlimit;
 	int ret = 0;
 	int children = mem_cgroup_count_children(memcg);
-	u64 curusage, oldusage;
+	unsigned long curusage, oldusage;
 	int enlarge;
 
 	/*
@@ -3487,7 +3395,7 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 	 */
 	retry_count = MEM_CGROUP_RECLAIM_RETRIES * children;
 
-	oldusage = res_counter_read_u64(&memcg->res, RES_USAGE);
+	oldusage = page_counter_read(&memcg->memory);
 
 	enlarge = 0;
 	while (retry_count) {
@@ -3498,23 +3406,23 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 		/*
 		 * Rather than hide all in some function, I do this in
 		 * open coded manner. You see what this really does.
-		 * We have to guarantee mem->res.limit < mem->memsw.limit.
+		 * We have to guarantee memory.limit < memsw.limit.
 		 */
 		mutex_lock(&set_limit_mutex);
-		memswlimit = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
-		if (memswlimit < val) {
+		memswlimit = memcg->memsw.limit;
+		if (memswlimit < limit) {
 			ret = -EINVAL;
 			mutex_unlock(&set_limit_mutex);
 			break;
 		}
 
-		memlimit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-		if (memlimit < val)
+		memlimit = memcg->memory.limit;
+		if (memlimit < limit)
 			enlarge = 1;
 
-		ret = res_counter_set_limit(&memcg->res, val);
+		ret = page_counter_limit(&memcg->memory, limit);
 		if (!ret) {
-			if (memswlimit == val)
+			if (memswlimit == limit)
 				memcg->memsw_is_minimum = true;
 			else
 				memcg->memsw_is_minimum = false;
@@ -3524,12 +3432,11 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 		if (!ret)
 			break;
 
-		mem_cgroup_hierarchical_reclaim(memcg, NULL, GFP_KERNEL,
-						MEM_CGROUP_RECLAIM_SHRINK,
-						NULL);
-		curusage = res_counter_read_u64(&memcg->res, RES_USAGE);
+		mem_cgroup_hierarchical_reclaim(memcg, GFP_KERNEL,
+						MEM_CGROUP_RECLAIM_SHRINK);
+		curusage = page_counter_read(&memcg->memory);
 		/* Usage is reduced ? */
-  		if (curusage >= oldusage)
+		if (curusage >= oldusage)
 			retry_count--;
 		else
 			oldusage = curusage;
@@ -3541,17 +3448,17 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 }
 
 static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
-					unsigned long long val)
+					unsigned long limit)
 {
 	int retry_count;
-	u64 memlimit, memswlimit, oldusage, curusage;
+	unsigned long memlimit, memswlimit, oldusage, curusage;
 	int children = mem_cgroup_count_children(memcg);
 	int ret = -EBUSY;
 	int enlarge = 0;
 
 	/* see mem_cgroup_resize_res_limit */
  	retry_count = children * MEM_CGROUP_RECLAIM_RETRIES;
-	oldusage = res_counter_read_u64(&memcg->memsw, RES_USAGE);
+	oldusage = page_counter_read(&memcg->memsw);
 	while (retry_count) {
 		if (signal_pending(current)) {
 			ret = -EINTR;
@@ -3560,21 +3467,21 @@ static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
 		/*
 		 * Rather than hide all in some function, I do this in
 		 * open coded manner. You see what this really does.
-		 * We have to guarantee mem->res.limit < mem->memsw.limit.
+		 * We have to guarantee memory.limit < memsw.limit.
 		 */
 		mutex_lock(&set_limit_mutex);
-		memlimit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-		if (memlimit > val) {
+		memlimit = memcg->memory.limit;
+		if (memlimit > limit) {
 			ret = -EINVAL;
 			mutex_unlock(&set_limit_mutex);
 			break;
 		}
-		memswlimit = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
-		if (memswlimit < val)
+		memswlimit = memcg->memsw.limit;
+		if (memswlimit < limit)
 			enlarge = 1;
-		ret = res_counter_set_limit(&memcg->memsw, val);
+		ret = page_counter_limit(&memcg->memsw, limit);
 		if (!ret) {
-			if (memlimit == val)
+			if (memlimit == limit)
 				memcg->memsw_is_minimum = true;
 			else
 				memcg->memsw_is_minimum = false;
@@ -3584,11 +3491,10 @@ static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
 		if (!ret)
 			break;
 
-		mem_cgroup_hierarchical_reclaim(memcg, NULL, GFP_KERNEL,
+		mem_cgroup_hierarchical_reclaim(memcg, GFP_KERNEL,
 						MEM_CGROUP_RECLAIM_NOSWAP |
-						MEM_CGROUP_RECLAIM_SHRINK,
-						NULL);
-		curusage = res_counter_read_u64(&memcg->memsw, RES_USAGE);
+						MEM_CGROUP_RECLAIM_SHRINK);
+		curusage = page_counter_read(&memcg->memsw);
 		/* Usage is reduced ? */
 		if (curusage >= oldusage)
 			retry_count--;
@@ -3600,97 +3506,45 @@ static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
 	return ret;
 }
 
-unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
-					    gfp_t gfp_mask,
+/*
+ * Global reclaim calls this before scanning the LRU lists of @zone.  Each
+ * memory cgroup over its soft limit gives up a share of its pages in the
+ * zone that follows soft_limit_pressure(), rather than the group with the
+ * largest excess being hammered alone.  Like the LRU scan counts in
+ * get_scan_count(), the amount grows as @priority drops.
+ */
+unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int priority,
+					    int order, gfp_t gfp_mask,
 					    unsigned long *total_scanned)
 {
+	struct mem_cgroup *mem;
 	unsigned long nr_reclaimed = 0;
-	struct mem_cgroup_per_zone *mz, *next_mz = NULL;
-	unsigned long reclaimed;
-	int loop = 0;
-	struct mem_cgroup_tree_per_zone *mctz;
-	unsigned long long excess;
-	unsigned long nr_scanned;
 
 	if (order > 0)
 		return 0;
 
-	mctz = soft_limit_tree_node_zone(zone_to_nid(zone), zone_idx(zone));
-	/*
-	 * This loop can run a while, specially if mem_cgroup's continuously
-	 * keep exceeding their soft limit and putting the system under
-	 * pressure
-	 */
-	do {
-		if (next_mz)
-			mz = next_mz;
-		else
-			mz = mem_cgroup_largest_soft_limit_node(mctz);
-		if (!mz)
-			break;
+	for_each_mem_cgroup_all(mem) {
+		unsigned long pressure, nr_pages = 0;
+		unsigned long nr_to_reclaim, nr_scanned = 0;
+		enum lru_list l;
 
-		nr_scanned = 0;
-		reclaimed = mem_cgroup_hierarchical_reclaim(mz->mem, zone,
-						gfp_mask,
-						MEM_CGROUP_RECLAIM_SOFT,
-						&nr_scanned);
-		nr_reclaimed += reclaimed;
-		*total_scanned += nr_scanned;
-		spin_lock(&mctz->lock);
+		if (mem_cgroup_is_root(mem))
+			continue;
+		pressure = soft_limit_pressure(mem);
+		if (!pressure)
+			continue;
+		for_each_evictable_lru(l)
+			nr_pages += mem_cgroup_zone_nr_lru_pages(mem, zone, l);
+		nr_to_reclaim = ((u64)nr_pages * pressure) >>
+				(SOFT_LIMIT_PRESSURE_SHIFT + priority);
+		if (!nr_to_reclaim)
+			continue;
 
-		/*
-		 * If we failed to reclaim anything from this memory cgroup
-		 * it is time to move on to the next cgroup
-		 */
-		next_mz = NULL;
-		if (!reclaimed) {
-			do {
-				/*
-				 * Loop until we find yet another one.
-				 *
-				 * By the time we get the soft_limit lock
-				 * again, someone might have aded the
-				 * group back on the RB tree. Iterate to
-				 * make sure we get a different mem.
-				 * mem_cgroup_largest_soft_limit_node returns
-				 * NULL if no other cgroup is present on
-				 * the tree
-				 */
-				next_mz =
-				__mem_cgroup_largest_soft_limit_node(mctz);
-				if (next_mz == mz)
-					css_put(&next_mz->mem->css);
-				else /* next_mz == NULL or other memcg */
-					break;
-			} while (1);
-		}
-		__mem_cgroup_remove_exceeded(mz->mem, mz, mctz);
-		excess = res_counter_soft_limit_excess(&mz->mem->res);
-		/*
-		 * One school of thought says that we should not add
-		 * back the node to the tree if reclaim returns 0.
-		 * But our reclaim could return 0, simply because due
-		 * to priority we are exposing a smaller subset of
-		 * memory to reclaim from. Consider this as a longer
-		 * term TODO.
-		 */
-		/* If excess == 0, no tree ops */
-		__mem_cgroup_insert_exceeded(mz->mem, mz, mctz, excess);
-		spin_unlock(&mctz->lock);
-		css_put(&mz->mem->css);
-		loop++;
-		/*
-		 * Could not reclaim anything and there are no more
-		 * mem cgroups to try or we seem to be looping without
-		 * reclaiming anything.
-		 */
-		if (!nr_reclaimed &&
-			(next_mz == NULL ||
-			loop > MEM_CGROUP_MAX_SOFT_LIMIT_RECLAIM_LOOPS))
-			break;
-	} while (!nr_reclaimed);
-	if (next_mz)
-		css_put(&next_mz->mem->css);
+		nr_reclaimed += mem_cgroup_shrink_node_zone(mem, gfp_mask,
+					false, get_swappiness(mem), zone,
+					nr_to_reclaim, &nr_scanned);
+		*total_scanned += nr_scanned;
+	}
 	return nr_reclaimed;
 }
 
@@ -3803,7 +3657,7 @@ move_account:
 			goto try_to_free;
 		cond_resched();
 	/* "ret" should also be checked to ensure all lists are empty. */
-	} while (mem->res.usage > 0 || ret);
+	} while (page_counter_read(&mem->memory) || ret);
 out:
 	css_put(&mem->css);
 	return ret;
@@ -3818,7 +3672,7 @@ try_to_free:
 	lru_add_drain_all();
 	/* try to free all pages in this cgroup */
 	shrink = 1;
-	while (nr_retries && mem->res.usage > 0) {
+	while (nr_retries && page_counter_read(&mem->memory)) {
 		int progress;
 
 		if (signal_pending(current)) {
@@ -3905,9 +3759,10 @@ static inline u64 mem_cgroup_usage(struct mem_cgroup *mem, bool swap)
 
 	if (!mem_cgroup_is_root(mem)) {
 		if (!swap)
-			return res_counter_read_u64(&mem->res, RES_USAGE);
+			val = page_counter_read(&mem->memory);
 		else
-			return res_counter_read_u64(&mem->memsw, RES_USAGE);
+			val = page_counter_read(&mem->memsw);
+		return val << PAGE_SHIFT;
 	}
 
 	val = mem_cgroup_recursive_stat(mem, MEM_CGROUP_STAT_CACHE);
@@ -3922,29 +3777,40 @@ static inline u64 mem_cgroup_usage(struct mem_cgroup *mem, bool swap)
 static u64 mem_cgroup_read(struct cgroup *cont, struct cftype *cft)
 {
 	struct mem_cgroup *mem = mem_cgroup_from_cont(cont);
-	u64 val;
+	struct page_counter *counter;
 	int type, name;
 
 	type = MEMFILE_TYPE(cft->private);
 	name = MEMFILE_ATTR(cft->private);
 	switch (type) {
 	case _MEM:
-		if (name == RES_USAGE)
-			val = mem_cgroup_usage(mem, false);
-		else
-			val = res_counter_read_u64(&mem->res, name);
+		counter = &mem->memory;
 		break;
 	case _MEMSWAP:
-		if (name == RES_USAGE)
-			val = mem_cgroup_usage(mem, true);
-		else
-			val = res_counter_read_u64(&mem->memsw, name);
+		counter = &mem->memsw;
 		break;
 	default:
 		BUG();
-		break;
 	}
-	return val;
+
+	switch (name) {
+	case RES_USAGE:
+		return mem_cgroup_usage(mem, type == _MEMSWAP);
+	case RES_LIMIT:
+		return (u64)counter->limit * PAGE_SIZE;
+	case RES_MAX_USAGE:
+		return (u64)counter->watermark * PAGE_SIZE;
+	case RES_FAILCNT:
+		return counter->failcnt;
+	case RES_SOFT_LIMIT:
+		return (u64)mem->soft_limit * PAGE_SIZE;
+	case RES_LOW:
+		return (u64)mem->low * PAGE_SIZE;
+	case RES_HIGH:
+		return (u64)mem->high * PAGE_SIZE;
+	default:
+		BUG();
+	}
 }
 /*
  * The user of this function is...
@@ -3955,7 +3821,7 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
 	int type, name;
-	unsigned long long val;
+	unsigned long nr_pages;
 	int ret;
 
 	type = MEMFILE_TYPE(cft->private);
@@ -3966,17 +3832,16 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 			ret = -EINVAL;
 			break;
 		}
-		/* This function does all necessary parse...reuse it */
-		ret = res_counter_memparse_write_strategy(buffer, &val);
+		ret = page_counter_memparse(buffer, &nr_pages);
 		if (ret)
 			break;
 		if (type == _MEM)
-			ret = mem_cgroup_resize_limit(memcg, val);
+			ret = mem_cgroup_resize_limit(memcg, nr_pages);
 		else
-			ret = mem_cgroup_resize_memsw_limit(memcg, val);
+			ret = mem_cgroup_resize_memsw_limit(memcg, nr_pages);
 		break;
 	case RES_SOFT_LIMIT:
-		ret = res_counter_memparse_write_strategy(buffer, &val);
+		ret = page_counter_memparse(buffer, &nr_pages);
 		if (ret)
 			break;
 		/*
@@ -3985,10 +3850,29 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 		 * control without swap
 		 */
 		if (type == _MEM)
-			ret = res_counter_set_soft_limit(&memcg->res, val);
+			memcg->soft_limit = nr_pages;
 		else
 			ret = -EINVAL;
 		break;
+	case RES_LOW:
+	case RES_HIGH:
+		if (mem_cgroup_is_root(memcg)) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = page_counter_memparse(buffer, &nr_pages);
+		if (ret)
+			break;
+		if (name == RES_LOW) {
+			memcg->low = nr_pages;
+		} else {
+			memcg->high = nr_pages;
+			/* bring the usage down now, not at the next charge */
+			if (page_counter_read(&memcg->memory) > nr_pages)
+				mem_cgroup_hierarchical_reclaim(memcg,
+					GFP_KERNEL, MEM_CGROUP_RECLAIM_SHRINK);
+		}
+		break;
 	default:
 		ret = -EINVAL; /* should be BUG() ? */
 		break;
@@ -3997,13 +3881,13 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 }
 
 static void memcg_get_hierarchical_limit(struct mem_cgroup *memcg,
-		unsigned long long *mem_limit, unsigned long long *memsw_limit)
+		unsigned long *mem_limit, unsigned long *memsw_limit)
 {
 	struct cgroup *cgroup;
-	unsigned long long min_limit, min_memsw_limit, tmp;
+	unsigned long min_limit, min_memsw_limit;
 
-	min_limit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-	min_memsw_limit = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
+	min_limit = memcg->memory.limit;
+	min_memsw_limit = memcg->memsw.limit;
 	cgroup = memcg->css.cgroup;
 	if (!memcg->use_hierarchy)
 		goto out;
@@ -4013,10 +3897,8 @@ static void memcg_get_hierarchical_limit(struct mem_cgroup *memcg,
 		memcg = mem_cgroup_from_cont(cgroup);
 		if (!memcg->use_hierarchy)
 			break;
-		tmp = res_counter_read_u64(&memcg->res, RES_LIMIT);
-		min_limit = min(min_limit, tmp);
-		tmp = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
-		min_memsw_limit = min(min_memsw_limit, tmp);
+		min_limit = min(min_limit, memcg->memory.limit);
+		min_memsw_limit = min(min_memsw_limit, memcg->memsw.limit);
 	}
 out:
 	*mem_limit = min_limit;
@@ -4035,15 +3917,15 @@ static int mem_cgroup_reset(struct cgroup *cont, unsigned int event)
 	switch (name) {
 	case RES_MAX_USAGE:
 		if (type == _MEM)
-			res_counter_reset_max(&mem->res);
+			page_counter_reset_watermark(&mem->memory);
 		else
-			res_counter_reset_max(&mem->memsw);
+			page_counter_reset_watermark(&mem->memsw);
 		break;
 	case RES_FAILCNT:
 		if (type == _MEM)
-			res_counter_reset_failcnt(&mem->res);
+			mem->memory.failcnt = 0;
 		else
-			res_counter_reset_failcnt(&mem->memsw);
+			mem->memsw.failcnt = 0;
 		break;
 	}
 
@@ -4237,11 +4119,13 @@ static int mem_control_stat_show(struct cgroup *cont, struct cftype *cft,
 
 	/* Hierarchical information */
 	{
-		unsigned long long limit, memsw_limit;
+		unsigned long limit, memsw_limit;
 		memcg_get_hierarchical_limit(mem_cont, &limit, &memsw_limit);
-		cb->fill(cb, "hierarchical_memory_limit", limit);
+		cb->fill(cb, "hierarchical_memory_limit",
+			 (u64)limit * PAGE_SIZE);
 		if (do_swap_account)
-			cb->fill(cb, "hierarchical_memsw_limit", memsw_limit);
+			cb->fill(cb, "hierarchical_memsw_limit",
+				 (u64)memsw_limit * PAGE_SIZE);
 	}
 
 	memset(&mystat, 0, sizeof(mystat));
@@ -4415,12 +4299,14 @@ static int mem_cgroup_usage_register_event(struct cgroup *cgrp,
 	struct mem_cgroup_thresholds *thresholds;
 	struct mem_cgroup_threshold_ary *new;
 	int type = MEMFILE_TYPE(cft->private);
+	unsigned long nr_pages;
 	u64 threshold, usage;
 	int i, size, ret;
 
-	ret = res_counter_memparse_write_strategy(args, &threshold);
+	ret = page_counter_memparse(args, &nr_pages);
 	if (ret)
 		return ret;
+	threshold = (u64)nr_pages * PAGE_SIZE;
 
 	mutex_lock(&memcg->thresholds_lock);
 
@@ -4694,6 +4580,18 @@ static struct cftype mem_cgroup_files[] = {
 		.write_string = mem_cgroup_write,
 		.read_u64 = mem_cgroup_read,
 	},
+	{
+		.name = "low_limit_in_bytes",
+		.private = MEMFILE_PRIVATE(_MEM, RES_LOW),
+		.write_string = mem_cgroup_write,
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "high_limit_in_bytes",
+		.private = MEMFILE_PRIVATE(_MEM, RES_HIGH),
+		.write_string = mem_cgroup_write,
+		.read_u64 = mem_cgroup_read,
+	},
 	{
 		.name = "failcnt",
 		.private = MEMFILE_PRIVATE(_MEM, RES_FAILCNT),
@@ -4808,8 +4706,6 @@ static int alloc_mem_cgroup_per_zone_info(struct mem_cgroup *mem, int node)
 		mz = &pn->zoneinfo[zone];
 		for_each_lru(l)
 			INIT_LIST_HEAD(&mz->lists[l]);
-		mz->usage_in_excess = 0;
-		mz->on_tree = false;
 		mz->mem = mem;
 	}
 	return 0;
@@ -4863,7 +4759,6 @@ static void __mem_cgroup_free(struct mem_cgroup *mem)
 {
 	int node;
 
-	mem_cgroup_remove_from_trees(mem);
 	free_css_id(&mem_cgroup_subsys, &mem->css);
 
 	for_each_node_state(node, N_POSSIBLE)
@@ -4901,9 +4796,9 @@ static void mem_cgroup_put(struct mem_cgroup *mem)
  */
 static struct mem_cgroup *parent_mem_cgroup(struct mem_cgroup *mem)
 {
-	if (!mem->res.parent)
+	if (!mem->memory.parent)
 		return NULL;
-	return mem_cgroup_from_res_counter(mem->res.parent, res);
+	return mem_cgroup_from_counter(mem->memory.parent, memory);
 }
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_SWAP
@@ -4918,31 +4813,6 @@ static void __init enable_swap_cgroup(void)
 }
 #endif
 
-static int mem_cgroup_soft_limit_tree_init(void)
-{
-	struct mem_cgroup_tree_per_node *rtpn;
-	struct mem_cgroup_tree_per_zone *rtpz;
-	int tmp, node, zone;
-
-	for_each_node_state(node, N_POSSIBLE) {
-		tmp = node;
-		if (!node_state(node, N_NORMAL_MEMORY))
-			tmp = -1;
-		rtpn = kzalloc_node(sizeof(*rtpn), GFP_KERNEL, tmp);
-		if (!rtpn)
-			return 1;
-
-		soft_limit_tree.rb_tree_per_node[node] = rtpn;
-
-		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
-			rtpz = &rtpn->rb_tree_per_zone[zone];
-			rtpz->rb_root = RB_ROOT;
-			spin_lock_init(&rtpz->lock);
-		}
-	}
-	return 0;
-}
-
 static struct cgroup_subsys_state * __ref
 mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 {
@@ -4964,8 +4834,6 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 		enable_swap_cgroup();
 		parent = NULL;
 		root_mem_cgroup = mem;
-		if (mem_cgroup_soft_limit_tree_init())
-			goto free_out;
 		for_each_possible_cpu(cpu) {
 			struct memcg_stock_pcp *stock =
 						&per_cpu(memcg_stock, cpu);
@@ -4979,19 +4847,22 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	}
 
 	if (parent && parent->use_hierarchy) {
-		res_counter_init(&mem->res, &parent->res);
-		res_counter_init(&mem->memsw, &parent->memsw);
+		page_counter_init(&mem->memory, &parent->memory);
+		page_counter_init(&mem->memsw, &parent->memsw);
 		/*
 		 * We increment refcnt of the parent to ensure that we can
-		 * safely access it on res_counter_charge/uncharge.
+		 * safely access it on page_counter_charge/uncharge.
 		 * This refcnt will be decremented when freeing this
 		 * mem_cgroup(see mem_cgroup_put).
 		 */
 		mem_cgroup_get(parent);
 	} else {
-		res_counter_init(&mem->res, NULL);
-		res_counter_init(&mem->memsw, NULL);
+		page_counter_init(&mem->memory, NULL);
+		page_counter_init(&mem->memsw, NULL);
 	}
+	mem->soft_limit = PAGE_COUNTER_MAX;
+	mem->low = 0;
+	mem->high = PAGE_COUNTER_MAX;
 	mem->last_scanned_child = 0;
 	mem->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&mem->oom_notify);
@@ -5053,18 +4924,18 @@ static int mem_cgroup_do_precharge(unsigned long count)
 	}
 	/* try to charge at once */
 	if (count > 1) {
-		struct res_counter *dummy;
+		struct page_counter *dummy;
 		/*
 		 * "mem" cannot be under rmdir() because we've already checked
 		 * by cgroup_lock_live_cgroup() that it is not removed and we
 		 * are still under the same cgroup_mutex. So we can postpone
 		 * css_get().
 		 */
-		if (res_counter_charge(&mem->res, PAGE_SIZE * count, &dummy))
+		if (page_counter_try_charge(&mem->memory, count, &dummy))
 			goto one_by_one;
-		if (do_swap_account && res_counter_charge(&mem->memsw,
-						PAGE_SIZE * count, &dummy)) {
-			res_counter_uncharge(&mem->res, PAGE_SIZE * count);
+		if (do_swap_account &&
+		    page_counter_try_charge(&mem->memsw, count, &dummy)) {
+			page_counter_uncharge(&mem->memory, count);
 			goto one_by_one;
 		}
 		mc.precharge += count;
@@ -5243,7 +5114,7 @@ static int mem_cgroup_count_precharge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
-	split_huge_page_pmd(walk->mm, pmd);
+	split_huge_page_pmd(vma, addr, pmd);
 
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE)
@@ -5312,17 +5183,15 @@ static void __mem_cgroup_clear_mc(void)
 	if (mc.moved_swap) {
 		/* uncharge swap account from the old cgroup */
 		if (!mem_cgroup_is_root(mc.from))
-			res_counter_uncharge(&mc.from->memsw,
-						PAGE_SIZE * mc.moved_swap);
+			page_counter_uncharge(&mc.from->memsw, mc.moved_swap);
 		__mem_cgroup_put(mc.from, mc.moved_swap);
 
 		if (!mem_cgroup_is_root(mc.to)) {
 			/*
-			 * we charged both to->res and to->memsw, so we should
-			 * uncharge to->res.
+			 * we charged both to->memory and to->memsw, so we should
+			 * uncharge to->memory.
 			 */
-			res_counter_uncharge(&mc.to->res,
-						PAGE_SIZE * mc.moved_swap);
+			page_counter_uncharge(&mc.to->memory, mc.moved_swap);
 		}
 		/* we've already done mem_cgroup_get(mc.to) */
 		mc.moved_swap = 0;
@@ -5404,7 +5273,7 @@ static int mem_cgroup_move_charge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
-	split_huge_page_pmd(walk->mm, pmd);
+	split_huge_page_pmd(vma, addr, pmd);
 retry:
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; addr += PAGE_SIZE) {
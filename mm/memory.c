@@ -51,12 +51,14 @@
 #include <linux/delayacct.h>
 #include <linux/init.h>
 #include <linux/writeback.h>
+#include <linux/backing-dev.h>
 #include <linux/memcontrol.h>
 #include <linux/mmu_notifier.h>
 #include <linux/kallsyms.h>
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/userfaultfd_k.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -423,6 +425,8 @@ static void free_pte_range(struct mmu_gather *tlb, pmd_t *pmd,
 			   unsigned long addr)
 {
 	pgtable_t token = pmd_pgtable(*pmd);
+	/* zap_pmd_range() let go of shared tables */
+	VM_BUG_ON(pmd_table_shared(*pmd));
 	pmd_clear(pmd);
 	pte_free_tlb(tlb, token, addr);
 	tlb->mm->nr_ptes--;
@@ -987,6 +991,384 @@ again:
 	return 0;
 }
 
+#ifdef CONFIG_FORK_SHARE_PTE
+/*
+ * Instead of copying them pte by pte, fork can hand the page tables of
+ * private anonymous memory to the child as they are.  The pmds pointing
+ * to such a shared table are write protected in every mm using it, so
+ * no write goes through, and the table is only copied by the first
+ * fault, munmap() or mprotect() that has to change it: from then on its
+ * pages are shared copy-on-write as after a regular fork.
+ *
+ * The table as a whole holds one reference and mapcount on each of its
+ * pages, while every mm using it accounts them in its rss.  So no page
+ * may be unmapped from a shared table: the rmap walks of reclaim,
+ * migration and KSM only flush the TLB of the mm they walk, and would
+ * free a page the other mms still map.  They unshare the table first.
+ *
+ * The number of write protected pmds pointing to the table, minus one,
+ * is kept in the _mapcount of the page table page: 0 when the other mms
+ * went away and left the last one a write protected pmd, -1 when the
+ * table is not shared.  It only changes under the pte lock.
+ */
+int sysctl_fork_share_pte __read_mostly;
+
+/* Do other mms still use the table? */
+static inline bool pte_table_shared(struct page *table)
+{
+	return atomic_read(&table->_mapcount) > 0;
+}
+
+/*
+ * Add up the rss a pte table stands for, from the ptes alone.  Returns
+ * true if it holds swap entries.
+ */
+static bool pte_table_rss(struct vm_area_struct *vma, pmd_t *pmd,
+			  unsigned long addr, int *rss)
+{
+	pte_t *orig_pte, *pte;
+	bool swap = false;
+	int i;
+
+	orig_pte = pte = pte_offset_map(pmd, addr);
+	for (i = 0; i < PTRS_PER_PTE; i++, pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+
+		if (pte_none(ptent))
+			continue;
+		if (pte_present(ptent)) {
+			if (vm_normal_page(vma, addr, ptent))
+				rss[MM_ANONPAGES]++;
+		} else if (!non_swap_entry(pte_to_swp_entry(ptent))) {
+			rss[MM_SWAPENTS]++;
+			swap = true;
+		}
+	}
+	pte_unmap(orig_pte);
+	return swap;
+}
+
+/*
+ * Share the table @src_pmd points to with the child if it lies entirely
+ * within @vma, a private anonymous one.  Returns false when the ptes
+ * have to be copied.
+ */
+static bool share_pte_table(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
+		unsigned long addr, unsigned long end)
+{
+	int rss[NR_MM_COUNTERS];
+	struct page *table;
+	spinlock_t *ptl;
+	bool swap;
+
+	if (!USE_SPLIT_PTLOCKS || !sysctl_fork_share_pte)
+		return false;
+	if (vma->vm_file || vma->vm_ops || (vma->vm_flags &
+	    (VM_SHARED | VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP | VM_IO |
+	     VM_INSERTPAGE | VM_NONLINEAR)))
+		return false;
+	if ((addr & ~PMD_MASK) || end - addr != PMD_SIZE)
+		return false;
+
+	init_rss_vec(rss);
+	ptl = pte_lockptr(src_mm, src_pmd);
+	/* a speculative fault must not fill in the table behind our back */
+	vm_write_begin(vma);
+	spin_lock(ptl);
+	table = pmd_page(*src_pmd);
+	swap = pte_table_rss(vma, src_pmd, addr, rss);
+	if (pmd_write(*src_pmd))
+		atomic_inc(&table->_mapcount);
+	atomic_inc(&table->_mapcount);
+	set_pmd(src_pmd, pmd_wrprotect(*src_pmd));
+	set_pmd(dst_pmd, *src_pmd);
+	spin_unlock(ptl);
+	vm_write_end(vma);
+
+	dst_mm->nr_ptes++;
+	add_mm_rss_vec(dst_mm, rss);
+	/* make sure dst_mm is on swapoff's mmlist. */
+	if (swap && unlikely(list_empty(&dst_mm->mmlist))) {
+		spin_lock(&mmlist_lock);
+		if (list_empty(&dst_mm->mmlist))
+			list_add(&dst_mm->mmlist, &src_mm->mmlist);
+		spin_unlock(&mmlist_lock);
+	}
+	return true;
+}
+
+/*
+ * Drop the references taken by the first @nr ptes of an unfinished
+ * copy of a shared table.
+ */
+static void release_pte_copy(struct vm_area_struct *vma, pte_t *pte,
+			     unsigned long addr, int nr)
+{
+	for (; nr > 0; nr--, pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+
+		if (pte_none(ptent))
+			continue;
+		if (pte_present(ptent)) {
+			struct page *page = vm_normal_page(vma, addr, ptent);
+
+			if (page) {
+				page_remove_rmap(page);
+				put_page(page);
+			}
+		} else {
+			swp_entry_t entry = pte_to_swp_entry(ptent);
+
+			if (!non_swap_entry(entry))
+				swap_free(entry);
+		}
+		pte_clear(vma->vm_mm, addr, pte);
+	}
+}
+
+static int __unshare_pte_table(struct mm_struct *mm,
+		struct vm_area_struct *vma, pmd_t *pmd, unsigned long address,
+		gfp_t gfp_mask)
+{
+	unsigned long start = address & PMD_MASK;
+	unsigned long addr;
+	pte_t *src_pte, *dst_pte;
+	struct page *table;
+	swp_entry_t entry;
+	spinlock_t *ptl;
+	pgtable_t new;
+	pmd_t pmdval;
+	int i;
+
+again:
+	new = alloc_page(gfp_mask | __GFP_NOTRACK | __GFP_ZERO);
+	if (!new)
+		return -ENOMEM;
+	pgtable_page_ctor(new);
+
+	pmdval = *pmd;
+	barrier();
+	if (!pmd_table_shared(pmdval))
+		goto out_free;
+	table = pmd_page(pmdval);
+	ptl = pte_lockptr(mm, &pmdval);
+	spin_lock(ptl);
+	/* Another thread unshared or unmapped it first */
+	if (!pmd_table_shared(*pmd) || pmd_page(*pmd) != table)
+		goto out_unlock;
+
+	if (!pte_table_shared(table)) {
+		/* The other mms are gone: the table is ours again */
+		atomic_dec(&table->_mapcount);
+		set_pmd(pmd, pmd_mkwrite(*pmd));
+		goto out_unlock;
+	}
+
+	entry.val = 0;
+	src_pte = pte_offset_map(pmd, start);
+	dst_pte = kmap_atomic(new);
+	arch_enter_lazy_mmu_mode();
+	for (i = 0, addr = start; i < PTRS_PER_PTE; i++, addr += PAGE_SIZE) {
+		pte_t pte = src_pte[i];
+
+		if (pte_none(pte))
+			continue;
+		if (!pte_present(pte)) {
+			entry = pte_to_swp_entry(pte);
+			if (swap_duplicate(entry) < 0)
+				break;
+			if (is_write_migration_entry(entry)) {
+				make_migration_entry_read(&entry);
+				pte = swp_entry_to_pte(entry);
+				set_pte_at(mm, addr, &src_pte[i], pte);
+			}
+			entry.val = 0;
+		} else {
+			struct page *page = vm_normal_page(vma, addr, pte);
+
+			if (page) {
+				get_page(page);
+				page_dup_rmap(page);
+			}
+			/* write protect it for the other mms too */
+			if (pte_write(pte)) {
+				ptep_set_wrprotect(mm, addr, &src_pte[i]);
+				pte = pte_wrprotect(pte);
+			}
+		}
+		set_pte_at(mm, addr, &dst_pte[i], pte);
+	}
+	arch_leave_lazy_mmu_mode();
+
+	if (unlikely(entry.val)) {
+		release_pte_copy(vma, dst_pte, start, i);
+		kunmap_atomic(dst_pte);
+		pte_unmap_unlock(src_pte, ptl);
+		pte_free(mm, new);
+		if (add_swap_count_continuation(entry, gfp_mask) < 0)
+			return -ENOMEM;
+		goto again;
+	}
+	kunmap_atomic(dst_pte);
+	pte_unmap(src_pte);
+
+	atomic_dec(&table->_mapcount);
+	pmd_populate(mm, pmd, new);
+	/*
+	 * Once the lock is dropped, the last user of the old table may
+	 * change it: nothing of this mm may still be cached to it.
+	 */
+	flush_tlb_range(vma, start, start + PMD_SIZE);
+	spin_unlock(ptl);
+	return 0;
+
+out_unlock:
+	spin_unlock(ptl);
+out_free:
+	pte_free(mm, new);
+	return 0;
+}
+
+/**
+ * unshare_pte_table - give an mm back a page table of its own
+ * @mm: the mm owning @pmd
+ * @vma: the vma covering @address
+ * @pmd: a pmd pointing to a table shared by fork
+ * @address: an address mapped by that table
+ *
+ * Copies the table if other mms still use it, or takes it over if they
+ * went away meanwhile, and makes @pmd writable again.  The copy shares
+ * the pages copy-on-write, as copy_one_pte() does.
+ *
+ * Returns 0 on success or -ENOMEM.
+ */
+int unshare_pte_table(struct mm_struct *mm, struct vm_area_struct *vma,
+		      pmd_t *pmd, unsigned long address)
+{
+	return __unshare_pte_table(mm, vma, pmd, address, GFP_KERNEL);
+}
+
+/**
+ * unshare_pte_table_rmap - unshare the table mapping an address for rmap
+ * @vma: the vma covering @address
+ * @address: the address an rmap walk is about to change the pte of
+ * @gfp_mask: how to allocate the copy
+ *
+ * For rmap walks, which may not hold mmap_sem: the anon_vma lock they
+ * hold keeps the table from being freed.  A @gfp_mask that reclaims
+ * could deadlock on that lock.
+ *
+ * Returns 0 when the table at @address is not shared (any more), or
+ * -ENOMEM, counted as deferred when @gfp_mask could not reclaim.
+ */
+int unshare_pte_table_rmap(struct vm_area_struct *vma, unsigned long address,
+			   gfp_t gfp_mask)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	int err;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return 0;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return 0;
+	pmd = pmd_offset(pud, address);
+	if (!pmd_table_shared(*pmd))
+		return 0;
+	err = __unshare_pte_table(mm, vma, pmd, address, gfp_mask);
+	if (err)
+		count_vm_event(gfp_mask & __GFP_WAIT ? PTE_UNSHARE_FAILED :
+			       PTE_UNSHARE_DEFERRED);
+	return err;
+}
+
+/*
+ * For munmap() and mprotect(), which cannot fail, and which only get
+ * to split up a shared table when changing part of it.
+ */
+void unshare_pte_table_nofail(struct mm_struct *mm, struct vm_area_struct *vma,
+			      pmd_t *pmd, unsigned long address)
+{
+	while (unshare_pte_table(mm, vma, pmd, address))
+		congestion_wait(BLK_RW_ASYNC, HZ/50);
+}
+
+/*
+ * Called by zap_pmd_range() on a shared table.  When all of it goes
+ * away, the mm only drops its reference and its rss; returns false
+ * when the table is to be zapped as usual, after unsharing it.
+ */
+static bool zap_shared_pte_table(struct mmu_gather *tlb,
+		struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = tlb->mm;
+	int rss[NR_MM_COUNTERS];
+	struct page *table;
+	spinlock_t *ptl;
+	pmd_t pmdval;
+	int i;
+
+	if ((addr & ~PMD_MASK) || end - addr != PMD_SIZE) {
+		unshare_pte_table_nofail(mm, vma, pmd, addr);
+		return false;
+	}
+
+	pmdval = *pmd;
+	barrier();
+	if (!pmd_table_shared(pmdval))
+		return false;
+	table = pmd_page(pmdval);
+	ptl = pte_lockptr(mm, &pmdval);
+	spin_lock(ptl);
+	if (!pmd_table_shared(*pmd) || pmd_page(*pmd) != table) {
+		spin_unlock(ptl);
+		return false;
+	}
+	if (!pte_table_shared(table)) {
+		atomic_dec(&table->_mapcount);
+		set_pmd(pmd, pmd_mkwrite(*pmd));
+		spin_unlock(ptl);
+		return false;
+	}
+
+	init_rss_vec(rss);
+	pte_table_rss(vma, pmd, addr, rss);
+	atomic_dec(&table->_mapcount);
+	pmd_clear(pmd);
+	flush_tlb_range(vma, addr, end);
+	spin_unlock(ptl);
+
+	for (i = 0; i < NR_MM_COUNTERS; i++)
+		rss[i] = -rss[i];
+	add_mm_rss_vec(mm, rss);
+	spin_lock(&mm->page_table_lock);
+	mm->nr_ptes--;
+	spin_unlock(&mm->page_table_lock);
+	return true;
+}
+#else
+static inline bool share_pte_table(struct mm_struct *dst_mm,
+		struct mm_struct *src_mm, pmd_t *dst_pmd, pmd_t *src_pmd,
+		struct vm_area_struct *vma, unsigned long addr,
+		unsigned long end)
+{
+	return false;
+}
+
+static inline bool zap_shared_pte_table(struct mmu_gather *tlb,
+		struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long addr, unsigned long end)
+{
+	return false;
+}
+#endif /* CONFIG_FORK_SHARE_PTE */
+
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
@@ -1000,6 +1382,9 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/* page cache pmds are dropped and refaulted, not copied */
+		if (pmd_trans_huge(*src_pmd) && vma->vm_ops)
+			split_huge_page_pmd(vma, addr, src_pmd);
 		if (pmd_trans_huge(*src_pmd)) {
 			int err;
 			VM_BUG_ON(next-addr != HPAGE_PMD_SIZE);
@@ -1013,6 +1398,9 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (share_pte_table(dst_mm, src_mm, dst_pmd, src_pmd,
+				    vma, addr, next))
+			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -1229,14 +1617,19 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		next = pmd_addr_end(addr, end);
 		if (pmd_trans_huge(*pmd)) {
 			if (next-addr != HPAGE_PMD_SIZE) {
-				VM_BUG_ON(!rwsem_is_locked(&tlb->mm->mmap_sem));
-				split_huge_page_pmd(vma->vm_mm, pmd);
-			} else if (zap_huge_pmd(tlb, vma, pmd))
+				/* truncation splits page cache pmds */
+				VM_BUG_ON(!vma_has_file_pmds(vma) &&
+					  !rwsem_is_locked(&tlb->mm->mmap_sem));
+				split_huge_page_pmd(vma, addr, pmd);
+			} else if (zap_huge_pmd(tlb, vma, pmd, addr))
 				continue;
 			/* fall through */
 		}
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
+		if (unlikely(pmd_table_shared(*pmd)) &&
+		    zap_shared_pte_table(tlb, vma, pmd, addr, next))
+			continue;
 		next = zap_pte_range(tlb, vma, pmd, addr, next, details);
 		cond_resched();
 	} while (pmd++, addr = next, addr != end);
@@ -1475,7 +1868,7 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	}
 	if (pmd_trans_huge(*pmd)) {
 		if (flags & FOLL_SPLIT) {
-			split_huge_page_pmd(mm, pmd);
+			split_huge_page_pmd(vma, address, pmd);
 			goto split_fallthrough;
 		}
 		spin_lock(&mm->page_table_lock);
@@ -1496,6 +1889,9 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 split_fallthrough:
 	if (unlikely(pmd_bad(*pmd)))
 		goto no_page_table;
+	/* the fault unshares the table first */
+	if ((flags & FOLL_WRITE) && pmd_table_shared(*pmd))
+		goto no_page_table;
 
 	ptep = pte_offset_map_lock(mm, pmd, address, &ptl);
 
@@ -3072,30 +3468,166 @@ static inline int check_stack_guard_page(struct vm_area_struct *vma, unsigned lo
 	return 0;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Whether @vma changed since vm_sequence read @seq, or was unlinked.
+ */
+static inline bool vma_has_changed(struct vm_area_struct *vma,
+				   unsigned int seq)
+{
+	if (RB_EMPTY_NODE(&vma->vm_rb))
+		return true;
+	return read_seqcount_retry(&vma->vm_sequence, seq);
+}
+
+/*
+ * Walk the page tables of @mm down to the pmd covering @address, with
+ * interrupts disabled and no lock held.  As for get_user_pages_fast(),
+ * page tables are only freed after a TLB flush IPI or an RCU-sched
+ * grace period, neither of which can complete before interrupts are
+ * enabled again.  Returns false unless the pmd maps a page table.
+ */
+static bool spf_walk_pmd(struct mm_struct *mm, unsigned long address,
+			 pmd_t *pmdval)
+{
+	pgd_t pgd;
+	pud_t pud;
+
+	pgd = *pgd_offset(mm, address);
+	if (pgd_none(pgd) || pgd_bad(pgd))
+		return false;
+	pud = *pud_offset(&pgd, address);
+	if (pud_none(pud) || pud_bad(pud))
+		return false;
+	*pmdval = *pmd_offset(&pud, address);
+	barrier();
+	if (pmd_none(*pmdval) || pmd_trans_huge(*pmdval) || pmd_bad(*pmdval) ||
+	    pmd_table_shared(*pmdval))
+		return false;
+	return true;
+}
+
+static bool pte_map_lock_speculative(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		unsigned int seq, pte_t **ptep, spinlock_t **ptlp)
+{
+	pmd_t pmdval;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	local_irq_disable();
+	if (!spf_walk_pmd(mm, address, &pmdval))
+		goto fail;
+	ptl = pte_lockptr(mm, &pmdval);
+	pte = pte_offset_map(&pmdval, address);
+	/*
+	 * Only try the lock: its holder may be waiting for our interrupts
+	 * to come back on, to flush the TLB.
+	 */
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto fail;
+	}
+	/*
+	 * With the pte lock held, the vma can't be torn down under us.
+	 * If it's still the one we started with, the fault is good.
+	 */
+	if (vma_has_changed(vma, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto fail;
+	}
+	local_irq_enable();
+	*ptep = pte;
+	*ptlp = ptl;
+	return true;
+fail:
+	local_irq_enable();
+	return false;
+}
+#else
+static inline bool pte_map_lock_speculative(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		unsigned int seq, pte_t **ptep, spinlock_t **ptlp)
+{
+	return false;
+}
+#endif
+
+/*
+ * Map and lock the pte for @address, on which a new page is about to be
+ * installed.  A speculative fault finds its page tables again and fails
+ * if the vma changed since @seq, after which it has to be retried with
+ * mmap_sem held.
+ */
+static inline bool pte_map_lock(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address, pmd_t *pmd,
+		unsigned int flags, unsigned int seq,
+		pte_t **ptep, spinlock_t **ptlp)
+{
+	if (!(flags & FAULT_FLAG_SPECULATIVE)) {
+		*ptep = pte_offset_map_lock(mm, pmd, address, ptlp);
+		return true;
+	}
+	return pte_map_lock_speculative(mm, vma, address, seq, ptep, ptlp);
+}
+
+/*
+ * Allocate a page for @address in @vma.  Without mmap_sem, the vma's
+ * mempolicy may be freed at any time: speculative faults are only
+ * attempted on vmas without one, and use the task's policy.
+ */
+static inline struct page *alloc_fault_page(struct vm_area_struct *vma,
+		unsigned long address, unsigned int flags, bool zero)
+{
+	struct page *page;
+
+	if (!(flags & FAULT_FLAG_SPECULATIVE)) {
+		if (zero)
+			return alloc_zeroed_user_highpage_movable(vma, address);
+		return alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma, address);
+	}
+	page = alloc_page(GFP_HIGHUSER_MOVABLE);
+	if (page && zero)
+		clear_user_highpage(page, address);
+	return page;
+}
+
 /*
  * We enter with non-exclusive mmap_sem (to exclude vma changes,
  * but allow concurrent faults), and pte mapped but not yet locked.
  * We return with mmap_sem still held, but pte unmapped and unlocked.
+ *
+ * A speculative fault enters without mmap_sem and with no pte mapped.
  */
 static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		unsigned long address, pte_t *page_table, pmd_t *pmd,
-		unsigned int flags)
+		unsigned int flags, unsigned int seq)
 {
 	struct page *page;
 	spinlock_t *ptl;
 	pte_t entry;
 
-	pte_unmap(page_table);
+	if (!(flags & FAULT_FLAG_SPECULATIVE))
+		pte_unmap(page_table);
 
 	/* Check if we need to add a guard page to the stack */
 	if (check_stack_guard_page(vma, address) < 0)
 		return VM_FAULT_SIGBUS;
 
+	/* Deliver the missing page fault to userland */
+	if (userfaultfd_missing(vma)) {
+		if (flags & FAULT_FLAG_SPECULATIVE)
+			return VM_FAULT_RETRY;
+		return handle_userfault(vma, address, flags);
+	}
+
 	/* Use the zero-page for reads */
 	if (!(flags & FAULT_FLAG_WRITE)) {
 		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
 						vma->vm_page_prot));
-		page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
+		if (!pte_map_lock(mm, vma, address, pmd, flags, seq,
+				  &page_table, &ptl))
+			return VM_FAULT_RETRY;
 		if (!pte_none(*page_table))
 			goto unlock;
 		goto setpte;
@@ -3104,7 +3636,7 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	/* Allocate our own private page. */
 	if (unlikely(anon_vma_prepare(vma)))
 		goto oom;
-	page = alloc_zeroed_user_highpage_movable(vma, address);
+	page = alloc_fault_page(vma, address, flags, true);
 	if (!page)
 		goto oom;
 	__SetPageUptodate(page);
@@ -3116,7 +3648,12 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (vma->vm_flags & VM_WRITE)
 		entry = pte_mkwrite(pte_mkdirty(entry));
 
-	page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
+	if (!pte_map_lock(mm, vma, address, pmd, flags, seq,
+			  &page_table, &ptl)) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+		return VM_FAULT_RETRY;
+	}
 	if (!pte_none(*page_table))
 		goto release;
 
@@ -3152,10 +3689,11 @@ oom:
  * We enter with non-exclusive mmap_sem (to exclude vma changes,
  * but allow concurrent faults), and pte neither mapped nor locked.
  * We return with mmap_sem still held, but pte unmapped and unlocked.
+ * A speculative fault enters without mmap_sem.
  */
 static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
-		unsigned long address, pmd_t *pmd,
-		pgoff_t pgoff, unsigned int flags, pte_t orig_pte)
+		unsigned long address, pmd_t *pmd, pgoff_t pgoff,
+		unsigned int flags, pte_t orig_pte, unsigned int seq)
 {
 	pte_t *page_table;
 	spinlock_t *ptl;
@@ -3204,8 +3742,7 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 				ret = VM_FAULT_OOM;
 				goto out;
 			}
-			page = alloc_page_vma(GFP_HIGHUSER_MOVABLE,
-						vma, address);
+			page = alloc_fault_page(vma, address, flags, false);
 			if (!page) {
 				ret = VM_FAULT_OOM;
 				goto out;
@@ -3250,7 +3787,11 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	}
 
-	page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
+	if (!pte_map_lock(mm, vma, address, pmd, flags, seq,
+			  &page_table, &ptl)) {
+		ret = VM_FAULT_RETRY;
+		goto unmapped;
+	}
 
 	/*
 	 * This silly early PAGE_DIRTY setting removes a race
@@ -3283,7 +3824,10 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 
 		/* no need to invalidate: a not-present page won't be cached */
 		update_mmu_cache(vma, address, page_table);
+		pte_unmap_unlock(page_table, ptl);
 	} else {
+		pte_unmap_unlock(page_table, ptl);
+unmapped:
 		if (charged)
 			mem_cgroup_uncharge_page(page);
 		if (anon)
@@ -3292,8 +3836,6 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 			anon = 1; /* no anon but release faulted_page */
 	}
 
-	pte_unmap_unlock(page_table, ptl);
-
 out:
 	if (dirty_page) {
 		struct address_space *mapping = page->mapping;
@@ -3334,7 +3876,7 @@ static int do_linear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 			- vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
 
 	pte_unmap(page_table);
-	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
+	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte, 0);
 }
 
 /*
@@ -3366,7 +3908,7 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	}
 
 	pgoff = pte_to_pgoff(orig_pte);
-	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
+	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte, 0);
 }
 
 /*
@@ -3398,7 +3940,7 @@ int handle_pte_fault(struct mm_struct *mm,
 						pte, pmd, flags, entry);
 			}
 			return do_anonymous_page(mm, vma, address,
-						 pte, pmd, flags);
+						 pte, pmd, flags, 0);
 		}
 		if (pte_file(entry))
 			return do_nonlinear_fault(mm, vma, address,
@@ -3464,7 +4006,12 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+	if (pmd_none(*pmd) && vma_has_file_pmds(vma)) {
+		int ret = vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else if (pmd_none(*pmd) && transparent_hugepage_enabled(vma) &&
+		   !userfaultfd_missing(vma)) {
 		if (!vma->vm_ops)
 			return do_huge_pmd_anonymous_page(mm, vma, address,
 							  pmd, flags);
@@ -3472,12 +4019,14 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		pmd_t orig_pmd = *pmd;
 		barrier();
 		if (pmd_trans_huge(orig_pmd)) {
-			if (flags & FAULT_FLAG_WRITE &&
-			    !pmd_write(orig_pmd) &&
-			    !pmd_trans_splitting(orig_pmd))
+			if (!(flags & FAULT_FLAG_WRITE) || pmd_write(orig_pmd) ||
+			    pmd_trans_splitting(orig_pmd))
+				return 0;
+			if (!vma->vm_ops)
 				return do_huge_pmd_wp_page(mm, vma, address,
 							   pmd, orig_pmd);
-			return 0;
+			/* page cache pages are written through ptes */
+			split_huge_page_pmd(vma, address, pmd);
 		}
 	}
 
@@ -3486,6 +4035,10 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	 * run pte_offset_map on the pmd, if an huge pmd could
 	 * materialize from under us from a different thread.
 	 */
+	/* A page table shared by fork is copied before anything changes */
+	if (unlikely(pmd_table_shared(*pmd)) &&
+	    unshare_pte_table(mm, vma, pmd, address))
+		return VM_FAULT_OOM;
 	if (unlikely(pmd_none(*pmd)) && __pte_alloc(mm, vma, pmd, address))
 		return VM_FAULT_OOM;
 	/* if an huge pmd materialized from under us just retry later */
@@ -3502,6 +4055,120 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * The vmas and faults that handle_speculative_fault() deals with: first
+ * faults on anonymous memory and on regular files.  Anything else, and
+ * anything needing to change the vma, like growing the stack or setting
+ * up its anon_vma, is left to the locked path.
+ */
+static bool vma_can_speculate(struct vm_area_struct *vma, unsigned int flags)
+{
+	if (vma->vm_flags & (VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP | VM_IO |
+			     VM_NONLINEAR | VM_GROWSDOWN | VM_GROWSUP))
+		return false;
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vma->vm_flags & VM_WRITE))
+			return false;
+	} else if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		return false;
+	if (vma_policy(vma))
+		return false;
+	/* Missing pages are handled by userland, which drops mmap_sem */
+	if (userfaultfd_missing(vma))
+		return false;
+
+	if (!vma->vm_ops)
+		return vma->anon_vma || !(flags & FAULT_FLAG_WRITE);
+	/* Other fault handlers may rely on mmap_sem */
+	if (vma->vm_ops->fault != filemap_fault)
+		return false;
+	/* Shared writes go through ->page_mkwrite, private ones COW */
+	if (flags & FAULT_FLAG_WRITE)
+		return !(vma->vm_flags & VM_SHARED) && vma->anon_vma;
+	return true;
+}
+
+/**
+ * handle_speculative_fault - try to handle a user fault without mmap_sem
+ * @mm: the faulting mm, which must be current's
+ * @address: the faulting address
+ * @flags: FAULT_FLAG_xxx flags of the fault
+ *
+ * Handles a fault on a pte that is not populated yet, in a vma that is
+ * looked up without mmap_sem.  The new pte is only installed if the vma
+ * did not change since the lookup, as told by its vm_sequence.
+ *
+ * Returns VM_FAULT_RETRY if the fault has to be handled again with
+ * mmap_sem held, by handle_mm_fault(): this includes any error, which
+ * the locked path will then report.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma;
+	unsigned int seq;
+	pmd_t pmdval;
+	pte_t *pte, entry;
+	int ret = VM_FAULT_RETRY;
+
+	flags &= ~(FAULT_FLAG_ALLOW_RETRY | FAULT_FLAG_KILLABLE);
+	flags |= FAULT_FLAG_SPECULATIVE;
+
+	vma = get_vma_speculative(mm, address);
+	if (!vma)
+		goto out;
+
+	seq = ACCESS_ONCE(vma->vm_sequence.sequence);
+	smp_rmb();
+	if ((seq & 1) || RB_EMPTY_NODE(&vma->vm_rb))
+		goto out_put;
+	if (address < vma->vm_start || address >= vma->vm_end)
+		goto out_put;
+	if (!vma_can_speculate(vma, flags))
+		goto out_put;
+
+	local_irq_disable();
+	if (!spf_walk_pmd(mm, address, &pmdval)) {
+		local_irq_enable();
+		goto out_put;
+	}
+	pte = pte_offset_map(&pmdval, address);
+	entry = *pte;
+	pte_unmap(pte);
+	local_irq_enable();
+	if (!pte_none(entry))
+		goto out_put;
+
+	__set_current_state(TASK_RUNNING);
+	check_sync_rss_stat(current);
+
+	if (!vma->vm_ops) {
+		ret = do_anonymous_page(mm, vma, address, NULL, NULL,
+					flags, seq);
+	} else {
+		pgoff_t pgoff = (((address & PAGE_MASK) - vma->vm_start)
+				 >> PAGE_SHIFT) + vma->vm_pgoff;
+
+		ret = __do_fault(mm, vma, address, NULL, pgoff, flags,
+				 entry, seq);
+	}
+	if (ret & VM_FAULT_ERROR)
+		ret = VM_FAULT_RETRY;
+out_put:
+	put_vma(vma);
+out:
+	if (ret & VM_FAULT_RETRY) {
+		count_vm_event(SPECULATIVE_PGFAULT_FALLBACK);
+		return VM_FAULT_RETRY;
+	}
+	count_vm_event(PGFAULT);
+	mem_cgroup_count_vm_event(mm, PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -41,7 +41,7 @@ static pmd_t *get_old_pmd(struct mm_struct *mm, unsigned long addr)
 		return NULL;
 
 	pmd = pmd_offset(pud, addr);
-	split_huge_page_pmd(mm, pmd);
+	split_huge_page_pmd_mm(mm, addr, pmd);
 	if (pmd_none_or_clear_bad(pmd))
 		return NULL;
 
@@ -150,6 +150,12 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 		new_pmd = alloc_new_pmd(vma->vm_mm, vma, new_addr);
 		if (!new_pmd)
 			break;
+		if (unlikely(pmd_table_shared(*old_pmd)) &&
+		    unshare_pte_table(vma->vm_mm, vma, old_pmd, old_addr))
+			break;
+		if (unlikely(pmd_table_shared(*new_pmd)) &&
+		    unshare_pte_table(vma->vm_mm, new_vma, new_pmd, new_addr))
+			break;
 		next = (new_addr + PMD_SIZE) & PMD_MASK;
 		if (extent > next - new_addr)
 			extent = next - new_addr;
@@ -162,6 +168,34 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 	return len + old_addr - old_end;	/* how much done */
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * End the vm_write_begin() sections of move_vma(), on the vmas either
+ * side of the range it unmapped, which may be pieces split_vma() copied
+ * them to, and on the vma at @addr.
+ */
+static void move_vma_write_end(struct mm_struct *mm, unsigned long unmapped,
+			       unsigned long addr)
+{
+	struct vm_area_struct *vma, *prev;
+
+	vma = find_vma_prev(mm, unmapped, &prev);
+	if (prev && vm_write_locked(prev))
+		vm_write_end(prev);
+	if (vma && vm_write_locked(vma))
+		vm_write_end(vma);
+	vma = find_vma(mm, addr);
+	if (vma && vm_write_locked(vma))
+		vm_write_end(vma);
+}
+#else
+static inline void move_vma_write_end(struct mm_struct *mm,
+				      unsigned long unmapped,
+				      unsigned long addr)
+{
+}
+#endif
+
 static unsigned long move_vma(struct vm_area_struct *vma,
 		unsigned long old_addr, unsigned long old_len,
 		unsigned long new_len, unsigned long new_addr)
@@ -171,6 +205,7 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	unsigned long vm_flags = vma->vm_flags;
 	unsigned long new_pgoff;
 	unsigned long moved_len;
+	unsigned long kept_addr = new_addr;
 	unsigned long excess = 0;
 	unsigned long hiwater_vm;
 	int split = 0;
@@ -196,9 +231,23 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		return err;
 
 	new_pgoff = vma->vm_pgoff + ((old_addr - vma->vm_start) >> PAGE_SHIFT);
+
+	/*
+	 * Speculative faults must not fill in the new range before the
+	 * ptes are moved there, nor the old range once they have left it,
+	 * or do_munmap() would silently discard what they mapped: keep
+	 * both vmas in vm_write_begin() sections until the old range is
+	 * unmapped.  copy_vma() returns new_vma in one.
+	 */
+	vm_write_begin(vma);
 	new_vma = copy_vma(&vma, new_addr, new_len, new_pgoff);
-	if (!new_vma)
+	if (!new_vma) {
+		vm_write_end(vma);
 		return -ENOMEM;
+	}
+	/* vma and new_vma are the same vma, extended over the new range */
+	if (vm_write_locked(new_vma) > 1)
+		vm_write_end(new_vma);
 
 	moved_len = move_page_tables(vma, old_addr, new_vma, new_addr, old_len);
 	if (moved_len < old_len) {
@@ -208,6 +257,7 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		 * and then proceed to unmap new area instead of old.
 		 */
 		move_page_tables(new_vma, new_addr, vma, old_addr, moved_len);
+		kept_addr = old_addr;
 		vma = new_vma;
 		old_len = new_len;
 		old_addr = new_addr;
@@ -242,6 +292,7 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		excess = 0;
 	}
 	mm->hiwater_vm = hiwater_vm;
+	move_vma_write_end(mm, old_addr, kept_addr);
 
 	/* Restore VM_ACCOUNT if one or two pieces of vma left */
 	if (excess) {
@@ -57,6 +57,8 @@
 #include <linux/ftrace_event.h>
 #include <linux/memcontrol.h>
 #include <linux/prefetch.h>
+#include <linux/migrate.h>
+#include <linux/mm_inline.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -579,10 +581,25 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+/* Buddies warmed up for the merging of a bulk free */
+#define PCP_PREFETCH_MAX	32
+
+static inline void prefetch_buddy(struct page *page, unsigned int order)
+{
+	unsigned long page_idx = page_to_pfn(page) & ((1 << MAX_ORDER) - 1);
+	unsigned long buddy_idx = __find_buddy_index(page_idx, order);
+
+	prefetch(page + (buddy_idx - page_idx));
+}
+
 /*
  * Frees a number of pages from the PCP lists
  * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * count is the number of pages, or blocks of @order, to free.
+ *
+ * The pages are taken off the lists before zone->lock is taken, so that
+ * the lock is only held for merging them into the buddy lists; the
+ * per-cpu lists are protected by disabled interrupts.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -591,15 +608,14 @@ static inline int free_pages_check(struct page *page)
  * pinned" detection logic.
  */
 static void free_pcppages_bulk(struct zone *zone, int count,
-					struct per_cpu_pages *pcp)
+			       struct per_cpu_pages *pcp, unsigned int order)
 {
 	int migratetype = 0;
 	int batch_free = 0;
 	int to_free = count;
-
-	spin_lock(&zone->lock);
-	zone->all_unreclaimable = 0;
-	zone->pages_scanned = 0;
+	int prefetch_nr = 0;
+	struct page *page, *next;
+	LIST_HEAD(head);
 
 	while (to_free) {
 		struct page *page;
@@ -625,17 +641,36 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 
 		do {
 			page = list_entry(list->prev, struct page, lru);
-			/* must delete as __free_one_page list manipulates */
-			list_del(&page->lru);
-			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
+			list_move_tail(&page->lru, &head);
+			if (prefetch_nr++ < PCP_PREFETCH_MAX)
+				prefetch_buddy(page, order);
 		} while (--to_free && --batch_free && !list_empty(list));
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
+
+	spin_lock(&zone->lock);
+	zone->all_unreclaimable = 0;
+	zone->pages_scanned = 0;
+
+	list_for_each_entry_safe(page, next, &head, lru) {
+		/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
+		int mt = page_private(page);
+
+		/* must delete as __free_one_page list manipulates */
+		list_del(&page->lru);
+		__free_one_page(page, zone, order, mt);
+		trace_mm_page_pcpu_drain(page, order, mt);
+	}
+	__mod_zone_page_state(zone, NR_FREE_PAGES, count << order);
 	spin_unlock(&zone->lock);
 }
 
+/* The per-cpu lists of @order in @pset */
+static inline struct per_cpu_pages *
+pageset_pcp(struct per_cpu_pageset *pset, unsigned int order)
+{
+	return order ? &pset->pcp_orders[order - 1] : &pset->pcp;
+}
+
 static void free_one_page(struct zone *zone, struct page *page, int order,
 				int migratetype)
 {
@@ -674,11 +709,19 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 	return true;
 }
 
+static void free_pcp_page(struct page *page, unsigned int order, int cold);
+
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
-	int wasMlocked = __TestClearPageMlocked(page);
+	int wasMlocked;
 
+	if (order <= PCP_MAX_ORDER) {
+		free_pcp_page(page, order, 0);
+		return;
+	}
+
+	wasMlocked = __TestClearPageMlocked(page);
 	if (!free_pages_prepare(page, order))
 		return;
 
@@ -719,6 +762,24 @@ void __meminit __free_pages_bootmem(struct page *page, unsigned int order)
 	}
 }
 
+#ifdef CONFIG_CMA
+/* Free whole pageblock and set its migration type to MIGRATE_CMA. */
+void __init init_cma_reserved_pageblock(struct page *page)
+{
+	unsigned i = pageblock_nr_pages;
+	struct page *p = page;
+
+	do {
+		__ClearPageReserved(p);
+		set_page_count(p, 0);
+	} while (++p, --i);
+
+	set_page_refcounted(page);
+	set_pageblock_migratetype(page, MIGRATE_CMA);
+	__free_pages(page, pageblock_order);
+	totalram_pages += pageblock_nr_pages;
+}
+#endif
 
 /*
  * The order of subdivision here is critical for the IO subsystem.
@@ -827,11 +888,17 @@ struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
  * This array describes the order lists are fallen back to when
  * the free lists for the desirable migrate type are depleted
  */
-static int fallbacks[MIGRATE_TYPES][MIGRATE_TYPES-1] = {
-	[MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE,   MIGRATE_RESERVE },
-	[MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE,   MIGRATE_RESERVE },
-	[MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_RESERVE },
-	[MIGRATE_RESERVE]     = { MIGRATE_RESERVE,     MIGRATE_RESERVE,   MIGRATE_RESERVE }, /* Never used */
+static int fallbacks[MIGRATE_TYPES][4] = {
+	[MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE,     MIGRATE_RESERVE },
+	[MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE,     MIGRATE_RESERVE },
+#ifdef CONFIG_CMA
+	[MIGRATE_MOVABLE]     = { MIGRATE_CMA,         MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_RESERVE },
+	[MIGRATE_CMA]         = { MIGRATE_RESERVE }, /* Never used */
+#else
+	[MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE,   MIGRATE_RESERVE },
+#endif
+	[MIGRATE_RESERVE]     = { MIGRATE_RESERVE }, /* Never used */
+	[MIGRATE_ISOLATE]     = { MIGRATE_RESERVE }, /* Never used */
 };
 
 /*
@@ -926,12 +993,12 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 	/* Find the largest possible block of pages in the other list */
 	for (current_order = MAX_ORDER-1; current_order >= order;
 						--current_order) {
-		for (i = 0; i < MIGRATE_TYPES - 1; i++) {
+		for (i = 0;; i++) {
 			migratetype = fallbacks[start_migratetype][i];
 
 			/* MIGRATE_RESERVE handled later if necessary */
 			if (migratetype == MIGRATE_RESERVE)
-				continue;
+				break;
 
 			area = &(zone->free_area[current_order]);
 			if (list_empty(&area->free_list[migratetype]))
@@ -946,10 +1013,16 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			 * pages to the preferred allocation list. If falling
 			 * back for a reclaimable kernel allocation, be more
 			 * aggressive about taking ownership of free pages
+			 *
+			 * On the other hand, never change migration type of
+			 * MIGRATE_CMA pageblocks nor move CMA pages to different
+			 * free lists. We don't want unmovable pages to be
+			 * allocated from MIGRATE_CMA areas.
 			 */
-			if (unlikely(current_order >= (pageblock_order >> 1)) ||
+			if (!is_migrate_cma(migratetype) &&
+			    (unlikely(current_order >= (pageblock_order >> 1)) ||
 					start_migratetype == MIGRATE_RECLAIMABLE ||
-					page_group_by_mobility_disabled) {
+					page_group_by_mobility_disabled)) {
 				unsigned long pages;
 				pages = move_freepages_block(zone, page,
 								start_migratetype);
@@ -968,7 +1041,8 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			rmv_page_order(page);
 
 			/* Take ownership for orders >= pageblock_order */
-			if (current_order >= pageblock_order)
+			if (current_order >= pageblock_order &&
+			    !is_migrate_cma(migratetype))
 				change_pageblock_range(page, current_order,
 							start_migratetype);
 
@@ -1028,6 +1102,8 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 	spin_lock(&zone->lock);
 	for (i = 0; i < count; ++i) {
 		struct page *page = __rmqueue(zone, order, migratetype);
+		int mt = migratetype;
+
 		if (unlikely(page == NULL))
 			break;
 
@@ -1044,7 +1120,12 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 			list_add(&page->lru, list);
 		else
 			list_add_tail(&page->lru, list);
-		set_page_private(page, migratetype);
+#ifdef CONFIG_CMA
+		/* Pages taken from a CMA pageblock go back to it when freed */
+		if (is_migrate_cma(get_pageblock_migratetype(page)))
+			mt = MIGRATE_CMA;
+#endif
+		set_page_private(page, mt);
 		list = &page->lru;
 	}
 	__mod_zone_page_state(zone, NR_FREE_PAGES, -(i << order));
@@ -1061,20 +1142,40 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
  * Note that this function must be called with the thread pinned to
  * a single processor.
  */
-void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
+void drain_zone_pages(struct zone *zone, struct per_cpu_pageset *pset)
 {
 	unsigned long flags;
+	unsigned int order;
 	int to_drain;
 
 	local_irq_save(flags);
-	if (pcp->count >= pcp->batch)
-		to_drain = pcp->batch;
-	else
-		to_drain = pcp->count;
-	free_pcppages_bulk(zone, to_drain, pcp);
-	pcp->count -= to_drain;
+	for (order = 0; order <= PCP_MAX_ORDER; order++) {
+		struct per_cpu_pages *pcp = pageset_pcp(pset, order);
+
+		if (pcp->count >= pcp->batch)
+			to_drain = pcp->batch;
+		else
+			to_drain = pcp->count;
+		if (!to_drain)
+			continue;
+		free_pcppages_bulk(zone, to_drain, pcp, order);
+		pcp->count -= to_drain;
+	}
 	local_irq_restore(flags);
 }
+
+/*
+ * Whether any of the per-cpu lists of @pset still hold pages.
+ */
+bool pageset_has_pages(struct per_cpu_pageset *pset)
+{
+	unsigned int order;
+
+	for (order = 0; order <= PCP_MAX_ORDER; order++)
+		if (pageset_pcp(pset, order)->count)
+			return true;
+	return false;
+}
 #endif
 
 /*
@@ -1092,14 +1193,17 @@ static void drain_pages(unsigned int cpu)
 	for_each_populated_zone(zone) {
 		struct per_cpu_pageset *pset;
 		struct per_cpu_pages *pcp;
+		unsigned int order;
 
 		local_irq_save(flags);
 		pset = per_cpu_ptr(zone->pageset, cpu);
 
-		pcp = &pset->pcp;
-		if (pcp->count) {
-			free_pcppages_bulk(zone, pcp->count, pcp);
-			pcp->count = 0;
+		for (order = 0; order <= PCP_MAX_ORDER; order++) {
+			pcp = pageset_pcp(pset, order);
+			if (pcp->count) {
+				free_pcppages_bulk(zone, pcp->count, pcp, order);
+				pcp->count = 0;
+			}
 		}
 		local_irq_restore(flags);
 	}
@@ -1158,10 +1262,10 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Free a page of an order cached on the per-cpu lists
  * cold == 1 ? free a cold page : free a hot page
  */
-void free_hot_cold_page(struct page *page, int cold)
+static void free_pcp_page(struct page *page, unsigned int order, int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
@@ -1169,7 +1273,14 @@ void free_hot_cold_page(struct page *page, int cold)
 	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
-	if (!free_pages_prepare(page, 0))
+	if (!free_pages_prepare(page, order))
+		return;
+
+	/*
+	 * The lists hold plain blocks; a compound page is taken apart
+	 * here rather than when it is merged back into the buddy lists.
+	 */
+	if (PageCompound(page) && unlikely(destroy_compound_page(page, order)))
 		return;
 
 	migratetype = get_pageblock_migratetype(page);
@@ -1177,7 +1288,7 @@ void free_hot_cold_page(struct page *page, int cold)
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -1188,20 +1299,20 @@ void free_hot_cold_page(struct page *page, int cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
-			free_one_page(zone, page, 0, migratetype);
+			free_one_page(zone, page, order, migratetype);
 			goto out;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
 
-	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	pcp = pageset_pcp(this_cpu_ptr(zone->pageset), order);
 	if (cold)
 		list_add_tail(&page->lru, &pcp->lists[migratetype]);
 	else
 		list_add(&page->lru, &pcp->lists[migratetype]);
 	pcp->count++;
 	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
+		free_pcppages_bulk(zone, pcp->batch, pcp, order);
 		pcp->count -= pcp->batch;
 	}
 
@@ -1209,6 +1320,15 @@ out:
 	local_irq_restore(flags);
 }
 
+/*
+ * Free a 0-order page
+ * cold == 1 ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, int cold)
+{
+	free_pcp_page(page, 0, cold);
+}
+
 /*
  * split_page takes a non-compound higher-order page, and splits it into
  * n (1<<order) sub-pages: page[0..n]
@@ -1275,8 +1395,12 @@ int split_free_page(struct page *page)
 
 	if (order >= pageblock_order - 1) {
 		struct page *endpage = page + (1 << order) - 1;
-		for (; page < endpage; page += pageblock_nr_pages)
-			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+		for (; page < endpage; page += pageblock_nr_pages) {
+			int mt = get_pageblock_migratetype(page);
+			if (mt != MIGRATE_ISOLATE && !is_migrate_cma(mt))
+				set_pageblock_migratetype(page,
+							  MIGRATE_MOVABLE);
+		}
 	}
 
 	return 1 << order;
@@ -1296,16 +1420,30 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	struct page *page;
 	int cold = !!(gfp_flags & __GFP_COLD);
 
+	if (unlikely(order && (gfp_flags & __GFP_NOFAIL))) {
+		/*
+		 * __GFP_NOFAIL is not to be used in new code.
+		 *
+		 * All __GFP_NOFAIL callers should be fixed so that they
+		 * properly detect and handle allocation failures.
+		 *
+		 * We most definitely don't want callers attempting to
+		 * allocate greater than order-1 page units with
+		 * __GFP_NOFAIL.
+		 */
+		WARN_ON_ONCE(order > 1);
+	}
+
 again:
-	if (likely(order == 0)) {
+	if (likely(order <= PCP_MAX_ORDER)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
-		pcp = &this_cpu_ptr(zone->pageset)->pcp;
+		pcp = pageset_pcp(this_cpu_ptr(zone->pageset), order);
 		list = &pcp->lists[migratetype];
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
+			pcp->count += rmqueue_bulk(zone, order,
 					pcp->batch, list,
 					migratetype, cold);
 			if (unlikely(list_empty(list)))
@@ -1320,19 +1458,6 @@ again:
 		list_del(&page->lru);
 		pcp->count--;
 	} else {
-		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
-			/*
-			 * __GFP_NOFAIL is not to be used in new code.
-			 *
-			 * All __GFP_NOFAIL callers should be fixed so that they
-			 * properly detect and handle allocation failures.
-			 *
-			 * We most definitely don't want callers attempting to
-			 * allocate greater than order-1 page units with
-			 * __GFP_NOFAIL.
-			 */
-			WARN_ON_ONCE(order > 1);
-		}
 		spin_lock_irqsave(&zone->lock, flags);
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
@@ -3577,9 +3702,27 @@ static int zone_batchsize(struct zone *zone)
 #endif
 }
 
+/*
+ * The high order lists follow the order-0 watermarks, halved for each
+ * order, so that every order caches about as many pages as half the
+ * order below it.
+ */
+static void setup_pageset_orders(struct per_cpu_pageset *p)
+{
+	unsigned int order;
+
+	for (order = 1; order <= PCP_MAX_ORDER; order++) {
+		struct per_cpu_pages *pcp = pageset_pcp(p, order);
+
+		pcp->high = p->pcp.high >> (order + 1);
+		pcp->batch = max(1, p->pcp.batch >> (order + 1));
+	}
+}
+
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
+	unsigned int order;
 	int migratetype;
 
 	memset(p, 0, sizeof(*p));
@@ -3588,8 +3731,13 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (order = 0; order <= PCP_MAX_ORDER; order++) {
+		pcp = pageset_pcp(p, order);
+		for (migratetype = 0; migratetype < MIGRATE_PCPTYPES;
+		     migratetype++)
+			INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	}
+	setup_pageset_orders(p);
 }
 
 /*
@@ -3607,6 +3755,7 @@ static void setup_pagelist_highmark(struct per_cpu_pageset *p,
 	pcp->batch = max(1UL, high/4);
 	if ((high/4) > (PAGE_SHIFT * 8))
 		pcp->batch = PAGE_SHIFT * 8;
+	setup_pageset_orders(p);
 }
 
 static void setup_zone_pageset(struct zone *zone)
@@ -3691,12 +3840,17 @@ static int __zone_pcp_update(void *data)
 	for_each_possible_cpu(cpu) {
 		struct per_cpu_pageset *pset;
 		struct per_cpu_pages *pcp;
+		unsigned int order;
 
 		pset = per_cpu_ptr(zone->pageset, cpu);
-		pcp = &pset->pcp;
 
 		local_irq_save(flags);
-		free_pcppages_bulk(zone, pcp->count, pcp);
+		for (order = 0; order <= PCP_MAX_ORDER; order++) {
+			pcp = pageset_pcp(pset, order);
+			if (pcp->count)
+				free_pcppages_bulk(zone, pcp->count, pcp,
+						   order);
+		}
 		setup_pageset(pset, batch);
 		local_irq_restore(flags);
 	}
@@ -4302,6 +4456,11 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	pgdat->kswapd_max_order = 0;
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = MAX_NR_ZONES - 1;
+#endif
 	pgdat_page_cgroup_init(pgdat);
 	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -4359,6 +4518,7 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 		zone_pcp_init(zone);
 		for_each_lru(l)
 			INIT_LIST_HEAD(&zone->lru[l].list);
+		lru_gen_init_zone(zone);
 		zone->reclaim_stat.recent_rotated[0] = 0;
 		zone->reclaim_stat.recent_rotated[1] = 0;
 		zone->reclaim_stat.recent_scanned[0] = 0;
@@ -5501,11 +5661,16 @@ void set_pageblock_flags_group(struct page *page, unsigned long flags,
 	VM_BUG_ON(pfn < zone->zone_start_pfn);
 	VM_BUG_ON(pfn >= zone->zone_start_pfn + zone->spanned_pages);
 
+	/*
+	 * The migratetype bits are changed under zone->lock but compaction
+	 * updates the skip bit of the same word without it, so the bits must
+	 * be set atomically or one update could undo the other.
+	 */
 	for (; start_bitidx <= end_bitidx; start_bitidx++, value <<= 1)
 		if (flags & value)
-			__set_bit(bitidx + start_bitidx, bitmap);
+			set_bit(bitidx + start_bitidx, bitmap);
 		else
-			__clear_bit(bitidx + start_bitidx, bitmap);
+			clear_bit(bitidx + start_bitidx, bitmap);
 }
 
 /*
@@ -5518,6 +5683,7 @@ static int
 __count_immobile_pages(struct zone *zone, struct page *page, int count)
 {
 	unsigned long pfn, iter, found;
+	int mt;
 	/*
 	 * For avoiding noise data, lru_add_drain_all() should be called
 	 * If ZONE_MOVABLE, the zone never contains immobile pages
@@ -5525,7 +5691,8 @@ __count_immobile_pages(struct zone *zone, struct page *page, int count)
 	if (zone_idx(zone) == ZONE_MOVABLE)
 		return true;
 
-	if (get_pageblock_migratetype(page) == MIGRATE_MOVABLE)
+	mt = get_pageblock_migratetype(page);
+	if (mt == MIGRATE_MOVABLE || is_migrate_cma(mt))
 		return true;
 
 	pfn = page_to_pfn(page);
@@ -5624,7 +5791,7 @@ out:
 	return ret;
 }
 
-void unset_migratetype_isolate(struct page *page)
+void unset_migratetype_isolate(struct page *page, unsigned migratetype)
 {
 	struct zone *zone;
 	unsigned long flags;
@@ -5632,12 +5799,236 @@ void unset_migratetype_isolate(struct page *page)
 	spin_lock_irqsave(&zone->lock, flags);
 	if (get_pageblock_migratetype(page) != MIGRATE_ISOLATE)
 		goto out;
-	set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-	move_freepages_block(zone, page, MIGRATE_MOVABLE);
+	set_pageblock_migratetype(page, migratetype);
+	move_freepages_block(zone, page, migratetype);
 out:
 	spin_unlock_irqrestore(&zone->lock, flags);
 }
 
+#ifdef CONFIG_CMA
+
+static unsigned long pfn_max_align_down(unsigned long pfn)
+{
+	return pfn & ~(max_t(unsigned long, MAX_ORDER_NR_PAGES,
+			     pageblock_nr_pages) - 1);
+}
+
+static unsigned long pfn_max_align_up(unsigned long pfn)
+{
+	return ALIGN(pfn, max_t(unsigned long, MAX_ORDER_NR_PAGES,
+				pageblock_nr_pages));
+}
+
+static struct page *
+__alloc_contig_migrate_alloc(struct page *page, unsigned long private,
+			     int **resultp)
+{
+	return alloc_page(GFP_HIGHUSER_MOVABLE);
+}
+
+#define NR_CONTIG_MIGRATE_RETRIES	5
+
+/*
+ * Isolate the LRU pages of [pfn, end) onto @list, at most
+ * SWAP_CLUSTER_MAX of them.  Returns the pfn to continue from.
+ */
+static unsigned long
+__alloc_contig_isolate_lru(unsigned long pfn, unsigned long end,
+			   struct list_head *list)
+{
+	int nr = 0;
+
+	for (; pfn < end && nr < SWAP_CLUSTER_MAX; pfn++) {
+		struct page *page;
+
+		if (!pfn_valid_within(pfn))
+			continue;
+		page = pfn_to_page(pfn);
+		if (!PageLRU(page) || !get_page_unless_zero(page))
+			continue;
+		if (!isolate_lru_page(page)) {
+			list_add_tail(&page->lru, list);
+			inc_zone_page_state(page, NR_ISOLATED_ANON +
+					    page_is_file_cache(page));
+			nr++;
+		}
+		put_page(page);
+	}
+	return pfn;
+}
+
+/* Move the pages in use in [start, end) out of the range */
+static int __alloc_contig_migrate_range(unsigned long start, unsigned long end)
+{
+	unsigned long pfn = start;
+	unsigned int tries = 0;
+	int ret = 0;
+	LIST_HEAD(source);
+
+	migrate_prep();
+
+	while (pfn < end || !list_empty(&source)) {
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+
+		if (list_empty(&source)) {
+			pfn = __alloc_contig_isolate_lru(pfn, end, &source);
+			tries = 0;
+			if (list_empty(&source))
+				continue;
+		} else if (++tries == NR_CONTIG_MIGRATE_RETRIES) {
+			ret = -EBUSY;
+			break;
+		}
+
+		/* Pages that can not be migrated at all are put back here */
+		ret = migrate_pages(&source, __alloc_contig_migrate_alloc,
+				    0, false, true);
+	}
+
+	putback_lru_pages(&source);
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * Take the free pages in [start, end) out of the buddy allocator, start
+ * being the first pfn of a free buddy page.  Returns the pfn the last
+ * page taken ends at, which may be beyond @end, or 0 if part of the range
+ * was not free.
+ */
+static unsigned long
+__alloc_contig_take_free(struct zone *zone, unsigned long start,
+			 unsigned long end)
+{
+	unsigned long flags, pfn = start;
+
+	spin_lock_irqsave(&zone->lock, flags);
+	while (pfn < end) {
+		int isolated = 0;
+
+		if (pfn_valid_within(pfn) && PageBuddy(pfn_to_page(pfn)))
+			isolated = split_free_page(pfn_to_page(pfn));
+		if (!isolated)
+			break;
+		pfn += isolated;
+	}
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	if (pfn < end) {
+		free_contig_range(start, pfn - start);
+		return 0;
+	}
+
+	/* split_free_page does not map the pages */
+	for (end = pfn, pfn = start; pfn < end; pfn++) {
+		arch_alloc_page(pfn_to_page(pfn), 0);
+		kernel_map_pages(pfn_to_page(pfn), 1, 1);
+	}
+	return end;
+}
+
+/**
+ * alloc_contig_range() -- tries to allocate given range of pages
+ * @start:	start PFN to allocate
+ * @end:	one-past-the-last PFN to allocate
+ * @migratetype:	migratetype of the underlaying pageblocks (either
+ *			#MIGRATE_MOVABLE or #MIGRATE_CMA).  All pageblocks
+ *			in range must have the same migratetype and it must
+ *			be either of the two.
+ *
+ * The PFN range does not have to be pageblock or MAX_ORDER_NR_PAGES
+ * aligned, however it's the caller's responsibility to guarantee that
+ * we are the only thread that changes migrate type of pageblocks the
+ * pages fall in.
+ *
+ * The PFN range must belong to a single zone.
+ *
+ * Returns zero on success or negative error code.  On success all
+ * pages which PFN is in [start, end) are allocated for the caller and
+ * need to be freed with free_contig_range().
+ */
+int alloc_contig_range(unsigned long start, unsigned long end,
+		       unsigned migratetype)
+{
+	struct zone *zone = page_zone(pfn_to_page(start));
+	unsigned long outer_start, outer_end;
+	int ret, order;
+
+	/*
+	 * All pageblocks in the range are marked MIGRATE_ISOLATE first.
+	 * The range is aligned to the bigger of pageblock and MAX_ORDER
+	 * pages, so that the allocator does not merge buddies across the
+	 * boundary of an isolated block and change MIGRATE_ISOLATE back
+	 * to another type.
+	 *
+	 * The pages in use in the unaligned range are then migrated away;
+	 * as they are freed they end up on the isolated free lists.  What
+	 * is left is to take the free pages out of the buddy allocator and
+	 * restore the original migratetype, so the pages of the aligned
+	 * range outside [start, end) can be allocated again.
+	 */
+	ret = start_isolate_page_range(pfn_max_align_down(start),
+				       pfn_max_align_up(end), migratetype);
+	if (ret)
+		return ret;
+
+	ret = __alloc_contig_migrate_range(start, end);
+	if (ret)
+		goto done;
+
+	/*
+	 * The pages at the start of the range may be part of a bigger
+	 * free buddy page, find where that starts.  The free pages need
+	 * not be taken under zone->lock as they are isolated.
+	 */
+	lru_add_drain_all();
+	drain_all_pages();
+
+	order = 0;
+	outer_start = start;
+	while (!PageBuddy(pfn_to_page(outer_start))) {
+		if (++order >= MAX_ORDER) {
+			ret = -EBUSY;
+			goto done;
+		}
+		outer_start &= ~0UL << order;
+	}
+
+	/* Make sure the range is really isolated. */
+	if (test_pages_isolated(outer_start, end)) {
+		pr_warn("alloc_contig_range test_pages_isolated(%lx, %lx) failed\n",
+			outer_start, end);
+		ret = -EBUSY;
+		goto done;
+	}
+
+	outer_end = __alloc_contig_take_free(zone, outer_start, end);
+	if (!outer_end) {
+		ret = -EBUSY;
+		goto done;
+	}
+
+	/* Free head and tail (if any) */
+	if (start != outer_start)
+		free_contig_range(outer_start, start - outer_start);
+	if (end != outer_end)
+		free_contig_range(end, outer_end - end);
+
+done:
+	undo_isolate_page_range(pfn_max_align_down(start),
+				pfn_max_align_up(end), migratetype);
+	return ret;
+}
+
+void free_contig_range(unsigned long pfn, unsigned nr_pages)
+{
+	for (; nr_pages--; ++pfn)
+		__free_page(pfn_to_page(pfn));
+}
+#endif
+
 #ifdef CONFIG_MEMORY_HOTREMOVE
 /*
  * All pages in the range must be isolated before calling this.
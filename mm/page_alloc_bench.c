@@ -0,0 +1,206 @@
+/*
+ * Page allocator microbenchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * For every order up to max_order and for 1, 2, 4, ... up to nthreads
+ * cpus, one thread bound to each cpu allocates and frees blocks of that
+ * order in rounds of batch blocks for duration_ms milliseconds.  The
+ * combined rate of alloc+free pairs is reported with printk.
+ *
+ * See also:  Documentation/vm/page_alloc_bench.txt
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+
+MODULE_LICENSE("GPL");
+
+static int max_order = PAGE_ALLOC_COSTLY_ORDER + 1; /* Highest order run */
+static int nthreads = -1;	/* Most cpus used, defaults to all online */
+static int batch = 64;		/* Blocks held by a thread at a time */
+static int duration_ms = 1000;	/* Length of a single run */
+
+module_param(max_order, int, 0444);
+MODULE_PARM_DESC(max_order, "Highest allocation order to measure");
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "Largest number of cpus to run on, -1=all online");
+module_param(batch, int, 0444);
+MODULE_PARM_DESC(batch, "Number of blocks allocated before they are freed");
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Length of each measurement in milliseconds");
+
+#define BENCH_FLAG "page_alloc_bench: "
+
+struct bench_thread {
+	struct task_struct *task;
+	struct page **pages;
+	unsigned int order;
+	unsigned long ops;
+	unsigned long failed;
+};
+
+static struct bench_thread *bench_threads;
+static DECLARE_COMPLETION(bench_start);
+static int bench_stop;
+
+static int page_alloc_bench_thread(void *arg)
+{
+	struct bench_thread *bt = arg;
+	gfp_t gfp = GFP_KERNEL | __GFP_NOWARN;
+	int i, nr;
+
+	wait_for_completion(&bench_start);
+	while (!ACCESS_ONCE(bench_stop)) {
+		for (nr = 0; nr < batch; nr++) {
+			bt->pages[nr] = alloc_pages(gfp, bt->order);
+			if (!bt->pages[nr]) {
+				bt->failed++;
+				break;
+			}
+		}
+		for (i = 0; i < nr; i++)
+			__free_pages(bt->pages[i], bt->order);
+		bt->ops += nr;
+		cond_resched();
+	}
+
+	while (!kthread_should_stop())
+		schedule_timeout_interruptible(1);
+	return 0;
+}
+
+/*
+ * One measurement: @nr threads on the first @nr online cpus.
+ */
+static int page_alloc_bench_run(unsigned int order, int nr)
+{
+	unsigned long ops = 0, failed = 0;
+	ktime_t start, end;
+	u64 elapsed_ns, rate;
+	int cpu, i = 0;
+
+	INIT_COMPLETION(bench_start);
+	bench_stop = 0;
+
+	for_each_online_cpu(cpu) {
+		struct bench_thread *bt = &bench_threads[i];
+
+		if (i == nr)
+			break;
+		bt->order = order;
+		bt->ops = 0;
+		bt->failed = 0;
+		bt->task = kthread_create(page_alloc_bench_thread, bt,
+					  "page_alloc_bench/%d", cpu);
+		if (IS_ERR(bt->task)) {
+			int err = PTR_ERR(bt->task);
+
+			bt->task = NULL;
+			bench_stop = 1;
+			complete_all(&bench_start);
+			while (i--)
+				kthread_stop(bench_threads[i].task);
+			return err;
+		}
+		kthread_bind(bt->task, cpu);
+		wake_up_process(bt->task);
+		i++;
+	}
+	nr = i;
+
+	start = ktime_get();
+	complete_all(&bench_start);
+	msleep(duration_ms);
+	bench_stop = 1;
+	smp_mb();
+
+	for (i = 0; i < nr; i++) {
+		kthread_stop(bench_threads[i].task);
+		bench_threads[i].task = NULL;
+		ops += bench_threads[i].ops;
+		failed += bench_threads[i].failed;
+	}
+	end = ktime_get();
+
+	elapsed_ns = ktime_to_ns(ktime_sub(end, start));
+	rate = (u64)ops * NSEC_PER_SEC;
+	do_div(rate, max_t(u64, elapsed_ns, 1));
+	printk(KERN_INFO BENCH_FLAG
+	       "order %u cpus %d: %llu alloc+free/s (%llu per cpu), %lu failed\n",
+	       order, nr, (unsigned long long)rate,
+	       (unsigned long long)div_u64(rate, nr), failed);
+	return 0;
+}
+
+static int __init page_alloc_bench_init(void)
+{
+	unsigned int order;
+	int i, nr, err = 0;
+
+	if (nthreads <= 0 || nthreads > num_online_cpus())
+		nthreads = num_online_cpus();
+	if (max_order < 0 || max_order >= MAX_ORDER)
+		max_order = MAX_ORDER - 1;
+	if (batch <= 0 || duration_ms <= 0)
+		return -EINVAL;
+
+	bench_threads = kcalloc(nthreads, sizeof(*bench_threads), GFP_KERNEL);
+	if (!bench_threads)
+		return -ENOMEM;
+	for (i = 0; i < nthreads; i++) {
+		bench_threads[i].pages = kcalloc(batch, sizeof(struct page *),
+						 GFP_KERNEL);
+		if (!bench_threads[i].pages) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	printk(KERN_INFO BENCH_FLAG
+	       "max_order=%d nthreads=%d batch=%d duration_ms=%d\n",
+	       max_order, nthreads, batch, duration_ms);
+
+	get_online_cpus();
+	for (order = 0; order <= max_order && !err; order++) {
+		for (nr = 1; nr < nthreads && !err; nr <<= 1)
+			err = page_alloc_bench_run(order, nr);
+		if (!err)
+			err = page_alloc_bench_run(order, nthreads);
+	}
+	put_online_cpus();
+
+out:
+	for (i = 0; i < nthreads; i++)
+		kfree(bench_threads[i].pages);
+	kfree(bench_threads);
+	bench_threads = NULL;
+	return err;
+}
+
+static void __exit page_alloc_bench_exit(void)
+{
+}
+
+module_init(page_alloc_bench_init);
+module_exit(page_alloc_bench_exit);
@@ -0,0 +1,409 @@
+/*
+ * linux/mm/process_vm_access.c
+ *
+ * Copy data directly between the address spaces of two processes,
+ * without going through the kernel twice as with a pipe, nor a system
+ * call per word as with ptrace(PTRACE_PEEKDATA).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/ptrace.h>
+#include <linux/slab.h>
+#include <linux/syscalls.h>
+
+#ifdef CONFIG_COMPAT
+#include <linux/compat.h>
+#endif
+
+/* Pages pinned at a time without allocating the array of them */
+#define PVM_MAX_PP_ARRAY_COUNT 16
+
+/* Most pages pinned at a time, with an allocated array */
+#define PVM_MAX_KMALLOC_PAGES (PAGE_SIZE * 2 / sizeof(struct page *))
+
+/* Position in the local iovec array */
+struct pvm_iter {
+	const struct iovec *iov;
+	unsigned long nr_segs;
+	size_t offset;		/* within iov[0] */
+};
+
+/*
+ * Copy between the local iovecs and @len bytes from @offset in the
+ * pinned remote @pages, dirtying the pages written.
+ *
+ * Returns the number of bytes copied, short if a local buffer faulted
+ * or the local iovecs were exhausted.
+ */
+static size_t process_vm_rw_pages(struct page **pages, unsigned long offset,
+				  size_t len, struct pvm_iter *iter,
+				  int vm_write)
+{
+	size_t copied = 0;
+
+	while (len && iter->nr_segs) {
+		struct page *page = *pages;
+		size_t copy = min_t(size_t, PAGE_SIZE - offset, len);
+		char __user *buf;
+		void *kaddr;
+		int ret;
+
+		copy = min(copy, iter->iov->iov_len - iter->offset);
+		buf = iter->iov->iov_base + iter->offset;
+
+		kaddr = kmap(page) + offset;
+		if (vm_write) {
+			ret = copy_from_user(kaddr, buf, copy);
+			set_page_dirty_lock(page);
+		} else
+			ret = copy_to_user(buf, kaddr, copy);
+		kunmap(page);
+
+		copied += copy - ret;
+		if (ret)
+			break;
+
+		len -= copy;
+		offset += copy;
+		if (offset == PAGE_SIZE) {
+			offset = 0;
+			pages++;
+		}
+		iter->offset += copy;
+		if (iter->offset == iter->iov->iov_len) {
+			iter->iov++;
+			iter->nr_segs--;
+			iter->offset = 0;
+		}
+	}
+	return copied;
+}
+
+/*
+ * Copy between the remote range [@addr, @addr + @len) and the local
+ * iovecs, pinning up to @max_pages remote pages at a time in @pages.
+ *
+ * Returns 0 once the range or the local iovecs are exhausted, or an
+ * error if the transfer stopped short; @copied counts the bytes
+ * transferred either way.
+ */
+static int process_vm_rw_single_vec(unsigned long addr, unsigned long len,
+				    struct pvm_iter *iter,
+				    struct page **pages, unsigned long max_pages,
+				    struct mm_struct *mm,
+				    struct task_struct *task,
+				    int vm_write, ssize_t *copied)
+{
+	unsigned long pa = addr & PAGE_MASK;
+	unsigned long offset = addr - pa;
+	unsigned long nr_pages;
+
+	if (!len)
+		return 0;
+	nr_pages = (addr + len - 1) / PAGE_SIZE - addr / PAGE_SIZE + 1;
+
+	while (nr_pages && iter->nr_segs) {
+		unsigned long batch = min(nr_pages, max_pages);
+		size_t bytes, done;
+		int i, pinned;
+
+		down_read(&mm->mmap_sem);
+		pinned = get_user_pages(task, mm, pa, batch, vm_write, 0,
+					pages, NULL);
+		up_read(&mm->mmap_sem);
+		if (pinned <= 0)
+			return -EFAULT;
+
+		bytes = min_t(unsigned long, len,
+			      pinned * PAGE_SIZE - offset);
+		done = process_vm_rw_pages(pages, offset, bytes, iter,
+					   vm_write);
+		*copied += done;
+		len -= done;
+
+		for (i = 0; i < pinned; i++)
+			put_page(pages[i]);
+
+		/* A local buffer faulted, unless the iovecs ran out */
+		if (done < bytes)
+			return iter->nr_segs ? -EFAULT : 0;
+		/* The rest of the remote range could not be pinned */
+		if (pinned < batch)
+			return -EFAULT;
+
+		nr_pages -= pinned;
+		pa += pinned * PAGE_SIZE;
+		offset = 0;
+	}
+	return 0;
+}
+
+/*
+ * Find the mm of @pid, if the caller may access it as a tracer would.
+ * cred_guard_mutex keeps the task from exec'ing a setuid binary between
+ * the permission check and the mm lookup.
+ */
+static struct mm_struct *process_vm_get_mm(struct task_struct *task)
+{
+	struct mm_struct *mm;
+	int err;
+
+	err = mutex_lock_killable(&task->signal->cred_guard_mutex);
+	if (err)
+		return ERR_PTR(err);
+
+	mm = get_task_mm(task);
+	if (!mm)
+		mm = ERR_PTR(-EINVAL);
+	else if (mm != current->mm &&
+		 !ptrace_may_access(task, PTRACE_MODE_ATTACH)) {
+		mmput(mm);
+		mm = ERR_PTR(-EPERM);
+	}
+	mutex_unlock(&task->signal->cred_guard_mutex);
+
+	return mm;
+}
+
+/**
+ * process_vm_rw_core - core of reading/writing pages from task specified
+ * @pid: PID of process to read/write from/to
+ * @lvec: iovec array specifying where to copy to/from locally
+ * @liovcnt: size of lvec array
+ * @rvec: iovec array specifying where to copy to/from in the other process
+ * @riovcnt: size of rvec array
+ * @flags: currently unused
+ * @vm_write: 0 if reading from other process, 1 if writing to other process
+ *
+ * Both iovec arrays are already copied in and checked.  Returns the
+ * number of bytes read/written, or an error if nothing was.
+ */
+static ssize_t process_vm_rw_core(pid_t pid, const struct iovec *lvec,
+				  unsigned long liovcnt,
+				  const struct iovec *rvec,
+				  unsigned long riovcnt,
+				  unsigned long flags, int vm_write)
+{
+	struct task_struct *task;
+	struct page *pp_stack[PVM_MAX_PP_ARRAY_COUNT];
+	struct page **process_pages = pp_stack;
+	struct mm_struct *mm;
+	struct pvm_iter iter;
+	unsigned long i, nr_pages = 0, max_pages;
+	ssize_t rc = 0, copied = 0;
+
+	/* Size the array of pages after the largest remote iovec */
+	for (i = 0; i < riovcnt; i++) {
+		unsigned long start = (unsigned long)rvec[i].iov_base;
+		unsigned long len = rvec[i].iov_len;
+
+		if (len)
+			nr_pages = max(nr_pages, (start + len - 1) / PAGE_SIZE -
+					start / PAGE_SIZE + 1);
+	}
+	if (!nr_pages)
+		return 0;
+
+	max_pages = PVM_MAX_PP_ARRAY_COUNT;
+	if (nr_pages > PVM_MAX_PP_ARRAY_COUNT) {
+		max_pages = min_t(unsigned long, nr_pages,
+				  PVM_MAX_KMALLOC_PAGES);
+		process_pages = kmalloc(max_pages * sizeof(struct page *),
+					GFP_KERNEL);
+		if (!process_pages)
+			return -ENOMEM;
+	}
+
+	/* Get process information */
+	rcu_read_lock();
+	task = find_task_by_vpid(pid);
+	if (task)
+		get_task_struct(task);
+	rcu_read_unlock();
+	if (!task) {
+		rc = -ESRCH;
+		goto free_proc_pages;
+	}
+
+	mm = process_vm_get_mm(task);
+	if (IS_ERR(mm)) {
+		rc = PTR_ERR(mm);
+		goto put_task_struct;
+	}
+
+	iter.iov = lvec;
+	iter.nr_segs = liovcnt;
+	iter.offset = 0;
+	for (i = 0; i < riovcnt && iter.nr_segs; i++) {
+		rc = process_vm_rw_single_vec(
+			(unsigned long)rvec[i].iov_base, rvec[i].iov_len,
+			&iter, process_pages, max_pages, mm, task, vm_write,
+			&copied);
+		if (rc < 0)
+			break;
+	}
+
+	/* A partial transfer is a success */
+	if (copied)
+		rc = copied;
+
+	mmput(mm);
+
+put_task_struct:
+	put_task_struct(task);
+
+free_proc_pages:
+	if (process_pages != pp_stack)
+		kfree(process_pages);
+	return rc;
+}
+
+/**
+ * process_vm_rw - check iovecs before calling core routine
+ * @pid: PID of process to read/write from/to
+ * @lvec: iovec array specifying where to copy to/from locally
+ * @liovcnt: size of lvec array
+ * @rvec: iovec array specifying where to copy to/from in the other process
+ * @riovcnt: size of rvec array
+ * @flags: currently unused
+ * @vm_write: 0 if reading from other process, 1 if writing to other process
+ *
+ * Returns the number of bytes read/written or error code. May
+ *  return less bytes than expected if an error occurs during the copying
+ *  process.
+ */
+static ssize_t process_vm_rw(pid_t pid,
+			     const struct iovec __user *lvec,
+			     unsigned long liovcnt,
+			     const struct iovec __user *rvec,
+			     unsigned long riovcnt,
+			     unsigned long flags, int vm_write)
+{
+	struct iovec iovstack_l[UIO_FASTIOV];
+	struct iovec iovstack_r[UIO_FASTIOV];
+	struct iovec *iov_l = iovstack_l;
+	struct iovec *iov_r = iovstack_r;
+	ssize_t rc;
+
+	if (flags != 0)
+		return -EINVAL;
+
+	/* Check iovecs */
+	rc = rw_copy_check_uvector(vm_write ? WRITE : READ, lvec, liovcnt,
+				   UIO_FASTIOV, iovstack_l, &iov_l);
+	if (rc <= 0)
+		goto free_iovecs;
+
+	rc = rw_copy_check_uvector(CHECK_IOVEC_ONLY, rvec, riovcnt,
+				   UIO_FASTIOV, iovstack_r, &iov_r);
+	if (rc <= 0)
+		goto free_iovecs;
+
+	rc = process_vm_rw_core(pid, iov_l, liovcnt, iov_r, riovcnt, flags,
+				vm_write);
+
+free_iovecs:
+	if (iov_r != iovstack_r)
+		kfree(iov_r);
+	if (iov_l != iovstack_l)
+		kfree(iov_l);
+
+	return rc;
+}
+
+SYSCALL_DEFINE6(process_vm_readv, pid_t, pid, const struct iovec __user *, lvec,
+		unsigned long, liovcnt, const struct iovec __user *, rvec,
+		unsigned long, riovcnt,	unsigned long, flags)
+{
+	return process_vm_rw(pid, lvec, liovcnt, rvec, riovcnt, flags, 0);
+}
+
+SYSCALL_DEFINE6(process_vm_writev, pid_t, pid,
+		const struct iovec __user *, lvec,
+		unsigned long, liovcnt, const struct iovec __user *, rvec,
+		unsigned long, riovcnt,	unsigned long, flags)
+{
+	return process_vm_rw(pid, lvec, liovcnt, rvec, riovcnt, flags, 1);
+}
+
+#ifdef CONFIG_COMPAT
+
+static ssize_t
+compat_process_vm_rw(compat_pid_t pid,
+		     const struct compat_iovec __user *lvec,
+		     unsigned long liovcnt,
+		     const struct compat_iovec __user *rvec,
+		     unsigned long riovcnt,
+		     unsigned long flags, int vm_write)
+{
+	struct iovec iovstack_l[UIO_FASTIOV];
+	struct iovec iovstack_r[UIO_FASTIOV];
+	struct iovec *iov_l = iovstack_l;
+	struct iovec *iov_r = iovstack_r;
+	ssize_t rc = -EFAULT;
+
+	if (flags != 0)
+		return -EINVAL;
+
+	if (!access_ok(VERIFY_READ, lvec, liovcnt * sizeof(*lvec)))
+		goto out;
+
+	if (!access_ok(VERIFY_READ, rvec, riovcnt * sizeof(*rvec)))
+		goto out;
+
+	rc = compat_rw_copy_check_uvector(vm_write ? WRITE : READ, lvec,
+					  liovcnt, UIO_FASTIOV, iovstack_l,
+					  &iov_l);
+	if (rc <= 0)
+		goto free_iovecs;
+	rc = compat_rw_copy_check_uvector(CHECK_IOVEC_ONLY, rvec, riovcnt,
+					  UIO_FASTIOV, iovstack_r, &iov_r);
+	if (rc <= 0)
+		goto free_iovecs;
+
+	rc = process_vm_rw_core(pid, iov_l, liovcnt, iov_r, riovcnt, flags,
+				vm_write);
+
+free_iovecs:
+	if (iov_r != iovstack_r)
+		kfree(iov_r);
+	if (iov_l != iovstack_l)
+		kfree(iov_l);
+
+out:
+	return rc;
+}
+
+asmlinkage ssize_t
+compat_sys_process_vm_readv(compat_pid_t pid,
+			    const struct compat_iovec __user *lvec,
+			    unsigned long liovcnt,
+			    const struct compat_iovec __user *rvec,
+			    unsigned long riovcnt,
+			    unsigned long flags)
+{
+	return compat_process_vm_rw(pid, lvec, liovcnt, rvec,
+				    riovcnt, flags, 0);
+}
+
+asmlinkage ssize_t
+compat_sys_process_vm_writev(compat_pid_t pid,
+			     const struct compat_iovec __user *lvec,
+			     unsigned long liovcnt,
+			     const struct compat_iovec __user *rvec,
+			     unsigned long riovcnt,
+			     unsigned long flags)
+{
+	return compat_process_vm_rw(pid, lvec, liovcnt, rvec,
+				    riovcnt, flags, 1);
+}
+
+#endif
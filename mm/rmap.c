@@ -654,10 +654,9 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 {
 	struct mm_struct *mm = vma->vm_mm;
 	int referenced = 0;
+	pmd_t *pmd;
 
 	if (unlikely(PageTransHuge(page))) {
-		pmd_t *pmd;
-
 		spin_lock(&mm->page_table_lock);
 		/*
 		 * rmap might return false positives; we must filter
@@ -681,6 +680,31 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 		if (pmdp_clear_flush_young_notify(vma, address, pmd))
 			referenced++;
 		spin_unlock(&mm->page_table_lock);
+	} else if (unlikely(vma_has_file_pmds(vma)) &&
+		   (pmd = page_check_address_file_pmd(page, mm, address))) {
+		struct page *head = pmd_page(*pmd);
+		int i;
+
+		if (vma->vm_flags & VM_LOCKED) {
+			spin_unlock(&mm->page_table_lock);
+			*mapcount = 0;	/* break early from loop */
+			*vm_flags |= VM_LOCKED;
+			goto out;
+		}
+
+		/*
+		 * The accessed bit covers all pages under the pmd, pass
+		 * it on to the ones not being looked at before clearing.
+		 */
+		if (pmdp_clear_flush_young_notify(vma, address & HPAGE_PMD_MASK,
+						  pmd)) {
+			for (i = 0; i < HPAGE_PMD_NR; i++)
+				if (head + i != page)
+					SetPageReferenced(head + i);
+			if (likely(!VM_SequentialReadHint(vma)))
+				referenced++;
+		}
+		spin_unlock(&mm->page_table_lock);
 	} else {
 		pte_t *pte;
 		spinlock_t *ptl;
@@ -1176,6 +1200,33 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	spinlock_t *ptl;
 	int ret = SWAP_AGAIN;
 
+	/*
+	 * Page cache pages mapped by a huge pmd are unmapped by
+	 * splitting the pmd, which drops the whole mapping.
+	 */
+	if (unlikely(vma_has_file_pmds(vma)) &&
+	    page_check_address_file_pmd(page, mm, address)) {
+		spin_unlock(&mm->page_table_lock);
+		if (!(flags & TTU_IGNORE_MLOCK)) {
+			if (vma->vm_flags & VM_LOCKED)
+				goto out_mlock_unlocked;
+			if (TTU_ACTION(flags) == TTU_MUNLOCK)
+				goto out;
+		}
+		split_huge_page_address(vma, address);
+		goto out;
+	}
+
+	/*
+	 * Only this mm's TLB is flushed below, and the page's mapcount does
+	 * not count the other mms using a page table shared by fork.  Under
+	 * the anon_vma lock it can only be unshared without reclaiming: if
+	 * that fails, try_to_unmap() unshares it after the walk.
+	 */
+	if (TTU_ACTION(flags) != TTU_MUNLOCK &&
+	    unshare_pte_table_rmap(vma, address, GFP_NOWAIT | __GFP_NOWARN))
+		goto out;
+
 	pte = page_check_address(page, mm, address, &ptl, 0);
 	if (!pte)
 		goto out;
@@ -1220,6 +1271,21 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else if (PageAnon(page)) {
 		swp_entry_t entry = { .val = page_private(page) };
 
+		if (!PageSwapBacked(page) && TTU_ACTION(flags) == TTU_UNMAP) {
+			/*
+			 * MADV_FREE page: discard it unless it was
+			 * written to again since it was marked, or KSM
+			 * shares it with processes that never freed it.
+			 */
+			if (PageDirty(page) || PageKsm(page)) {
+				set_pte_at(mm, address, pte, pteval);
+				ret = SWAP_FAIL;
+				goto out_unmap;
+			}
+			dec_mm_counter(mm, MM_ANONPAGES);
+			goto discard;
+		}
+
 		if (PageSwapCache(page)) {
 			/*
 			 * Store the swap location in the pte.
@@ -1257,6 +1323,7 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else
 		dec_mm_counter(mm, MM_FILEPAGES);
 
+discard:
 	page_remove_rmap(page);
 	page_cache_release(page);
 
@@ -1267,7 +1334,7 @@ out:
 
 out_mlock:
 	pte_unmap_unlock(pte, ptl);
-
+out_mlock_unlocked:
 
 	/*
 	 * We need mmap_sem locking, Otherwise VM_LOCKED check makes
@@ -1471,6 +1538,77 @@ static int try_to_unmap_anon(struct page *page, enum ttu_flags flags)
 	return ret;
 }
 
+#ifdef CONFIG_FORK_SHARE_PTE
+static bool pte_table_shared_at(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return false;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return false;
+	pmd = pmd_offset(pud, address);
+	return pmd_table_shared(*pmd);
+}
+
+/*
+ * try_to_unmap_one() leaves a page mapped through a page table fork
+ * shared when it cannot copy the table without reclaiming.  Unshare one
+ * such table out here, where we may sleep to allocate, under mmap_sem
+ * rather than the anon_vma lock.  mmap_sem nests outside the page lock
+ * we hold, so it can only be tried.  Returns true when the page is worth
+ * another walk.
+ */
+static bool try_to_unshare_anon(struct page *page)
+{
+	struct anon_vma *anon_vma;
+	struct anon_vma_chain *avc;
+	struct vm_area_struct *vma;
+	struct mm_struct *mm = NULL;
+	unsigned long address = 0;
+	int err = -EAGAIN;
+
+	anon_vma = page_lock_anon_vma(page);
+	if (!anon_vma)
+		return false;
+	list_for_each_entry(avc, &anon_vma->head, same_anon_vma) {
+		vma = avc->vma;
+		address = vma_address(page, vma);
+		if (address == -EFAULT ||
+		    !pte_table_shared_at(vma->vm_mm, address))
+			continue;
+		if (atomic_inc_not_zero(&vma->vm_mm->mm_users)) {
+			mm = vma->vm_mm;
+			break;
+		}
+	}
+	page_unlock_anon_vma(anon_vma);
+	if (!mm)
+		return false;
+
+	if (down_read_trylock(&mm->mmap_sem)) {
+		err = 0;
+		vma = find_vma(mm, address);
+		if (vma && vma->vm_start <= address)
+			err = unshare_pte_table_rmap(vma, address, GFP_NOIO);
+		up_read(&mm->mmap_sem);
+	} else
+		count_vm_event(PTE_UNSHARE_FAILED);
+	mmput(mm);
+
+	return !err;
+}
+#else
+static inline bool try_to_unshare_anon(struct page *page)
+{
+	return false;
+}
+#endif
+
 /**
  * try_to_unmap_file - unmap/unlock file page using the object-based rmap method
  * @page: the page to unmap/unlock
@@ -1605,9 +1743,12 @@ int try_to_unmap(struct page *page, enum ttu_flags flags)
 
 	if (unlikely(PageKsm(page)))
 		ret = try_to_unmap_ksm(page, flags);
-	else if (PageAnon(page))
+	else if (PageAnon(page)) {
 		ret = try_to_unmap_anon(page, flags);
-	else
+		while (ret == SWAP_AGAIN && page_mapped(page) &&
+		       try_to_unshare_anon(page))
+			ret = try_to_unmap_anon(page, flags);
+	} else
 		ret = try_to_unmap_file(page, flags);
 	if (ret != SWAP_MLOCK && !page_mapped(page))
 		ret = SWAP_SUCCESS;
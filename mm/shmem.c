@@ -50,6 +50,7 @@ static struct vfsmount *shm_mnt;
 #include <linux/backing-dev.h>
 #include <linux/shmem_fs.h>
 #include <linux/writeback.h>
+#include <linux/pagevec.h>
 #include <linux/blkdev.h>
 #include <linux/security.h>
 #include <linux/swapops.h>
@@ -60,6 +61,9 @@ static struct vfsmount *shm_mnt;
 #include <linux/highmem.h>
 #include <linux/seq_file.h>
 #include <linux/magic.h>
+#include <linux/syscalls.h>
+#include <linux/fcntl.h>
+#include <linux/memfd.h>
 
 #include <asm/uaccess.h>
 #include <asm/div64.h>
@@ -99,6 +103,12 @@ static struct vfsmount *shm_mnt;
 /* Pretend that each entry is of this size in directory's i_size */
 #define BOGO_DIRENT_SIZE 20
 
+/* Values of the huge= mount option, see Documentation/filesystems/tmpfs.txt */
+#define SHMEM_HUGE_NEVER	0
+#define SHMEM_HUGE_ALWAYS	1
+#define SHMEM_HUGE_WITHIN_SIZE	2
+#define SHMEM_HUGE_ADVISE	3
+
 struct shmem_xattr {
 	struct list_head list;	/* anchored by shmem_inode_info->xattr_list */
 	char *name;		/* xattr name */
@@ -205,13 +215,13 @@ static inline void shmem_unacct_size(unsigned long flags, loff_t size)
 /*
  * ... whereas tmpfs objects are accounted incrementally as
  * pages are allocated, in order to allow huge sparse files.
- * shmem_getpage reports shmem_acct_block failure as -ENOSPC not -ENOMEM,
+ * shmem_getpage reports shmem_acct_blocks failure as -ENOSPC not -ENOMEM,
  * so that a failure on a sparse tmpfs mapping will give SIGBUS not OOM.
  */
-static inline int shmem_acct_block(unsigned long flags)
+static inline int shmem_acct_blocks(unsigned long flags, long pages)
 {
-	return (flags & VM_NORESERVE) ?
-		security_vm_enough_memory_kern(VM_ACCT(PAGE_CACHE_SIZE)) : 0;
+	return (flags & VM_NORESERVE) ? security_vm_enough_memory_kern(
+				pages * VM_ACCT(PAGE_CACHE_SIZE)) : 0;
 }
 
 static inline void shmem_unacct_blocks(unsigned long flags, long pages)
@@ -297,6 +307,80 @@ static void shmem_recalc_inode(struct inode *inode)
 	}
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A huge extent is a naturally aligned range of HPAGE_PMD_NR pages of
+ * a file that were allocated as one physically contiguous, aligned
+ * block, and can be mapped by a huge pmd as long as they all stay in
+ * the page cache.  They are otherwise ordinary small pages: each of
+ * them is reclaimed, swapped, migrated and truncated on its own, and
+ * as soon as one of them goes, the extent is forgotten.
+ *
+ * info->huge_extents holds the first page of each extent believed to
+ * be intact, indexed by the extent's page index >> HPAGE_PMD_ORDER;
+ * the fault path checks the pages themselves before mapping them.
+ * Clean pages dropped by reclaim leave a stale entry behind, which is
+ * forgotten when the fault path finds the extent incomplete.
+ */
+
+/*
+ * shmem_huge_forget - the extent around @index is no longer intact
+ *
+ * It has to be called with the spinlock held.
+ */
+static void shmem_huge_forget(struct shmem_inode_info *info,
+			      unsigned long index)
+{
+	struct page *head;
+
+	head = radix_tree_delete(&info->huge_extents, index >> HPAGE_PMD_ORDER);
+	if (head)
+		dec_zone_page_state(head, NR_SHMEM_THPS);
+}
+
+/*
+ * Forget the extents overlapping the byte range being truncated.
+ */
+static void shmem_huge_forget_range(struct inode *inode, loff_t start,
+				    loff_t end)
+{
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	unsigned long indices[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	unsigned long first, last;
+	unsigned int i, nr;
+
+	first = start >> (PAGE_CACHE_SHIFT + HPAGE_PMD_ORDER);
+	last = end < 0 ? ULONG_MAX : end >> (PAGE_CACHE_SHIFT + HPAGE_PMD_ORDER);
+
+	spin_lock(&info->lock);
+	while (first <= last) {
+		nr = radix_tree_gang_lookup_slot(&info->huge_extents, slots,
+						 indices, first, PAGEVEC_SIZE);
+		if (!nr)
+			break;
+		for (i = 0; i < nr && indices[i] <= last; i++)
+			shmem_huge_forget(info, indices[i] << HPAGE_PMD_ORDER);
+		if (i < nr)
+			break;
+		first = indices[nr - 1] + 1;
+		if (!first)
+			break;
+	}
+	spin_unlock(&info->lock);
+}
+#else
+static inline void shmem_huge_forget(struct shmem_inode_info *info,
+				     unsigned long index)
+{
+}
+
+static inline void shmem_huge_forget_range(struct inode *inode, loff_t start,
+					   loff_t end)
+{
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 /**
  * shmem_swp_entry - find the swap vector position in the info structure
  * @info:  info structure for the inode
@@ -563,6 +647,7 @@ void shmem_truncate_range(struct inode *inode, loff_t start, loff_t end)
 	unsigned long upper_limit;
 
 	truncate_inode_pages_range(inode->i_mapping, start, end);
+	shmem_huge_forget_range(inode, start, end);
 
 	inode->i_ctime = inode->i_mtime = CURRENT_TIME;
 	idx = (start + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
@@ -765,6 +850,7 @@ EXPORT_SYMBOL_GPL(shmem_truncate_range);
 static int shmem_setattr(struct dentry *dentry, struct iattr *attr)
 {
 	struct inode *inode = dentry->d_inode;
+	struct shmem_inode_info *info = SHMEM_I(inode);
 	int error;
 
 	error = inode_change_ok(inode, attr);
@@ -776,6 +862,11 @@ static int shmem_setattr(struct dentry *dentry, struct iattr *attr)
 		loff_t newsize = attr->ia_size;
 		struct page *page = NULL;
 
+		/* i_mutex is held: seals cannot be added meanwhile */
+		if ((newsize < oldsize && (info->seals & F_SEAL_SHRINK)) ||
+		    (newsize > oldsize && (info->seals & F_SEAL_GROW)))
+			return -EPERM;
+
 		if (newsize < oldsize) {
 			/*
 			 * If truncating down to a partial page, then
@@ -799,7 +890,6 @@ static int shmem_setattr(struct dentry *dentry, struct iattr *attr)
 			 * nrpages check is efficient enough in that case.
 			 */
 			if (newsize) {
-				struct shmem_inode_info *info = SHMEM_I(inode);
 				spin_lock(&info->lock);
 				info->flags &= ~SHMEM_PAGEIN;
 				spin_unlock(&info->lock);
@@ -1113,6 +1203,7 @@ static int shmem_writepage(struct page *page, struct writeback_control *wbc)
 
 	if (swap.val && add_to_swap_cache(page, swap, GFP_ATOMIC) == 0) {
 		delete_from_page_cache(page);
+		shmem_huge_forget(info, index);
 		shmem_swp_set(info, entry, swap.val);
 		shmem_swp_unmap(entry);
 		swap_shmem_alloc(swap);
@@ -1184,8 +1275,9 @@ static struct page *shmem_swapin(swp_entry_t entry, gfp_t gfp,
 	return page;
 }
 
-static struct page *shmem_alloc_page(gfp_t gfp,
-			struct shmem_inode_info *info, unsigned long idx)
+static struct page *shmem_alloc_pages(gfp_t gfp,
+			struct shmem_inode_info *info, unsigned long idx,
+			unsigned int order)
 {
 	struct vm_area_struct pvma;
 
@@ -1196,9 +1288,9 @@ static struct page *shmem_alloc_page(gfp_t gfp,
 	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy, idx);
 
 	/*
-	 * alloc_page_vma() will drop the shared policy reference
+	 * alloc_pages_vma() will drop the shared policy reference
 	 */
-	return alloc_page_vma(gfp, &pvma, 0);
+	return alloc_pages_vma(gfp, order, &pvma, 0, numa_node_id());
 }
 #else /* !CONFIG_NUMA */
 #ifdef CONFIG_TMPFS
@@ -1213,19 +1305,363 @@ static inline struct page *shmem_swapin(swp_entry_t entry, gfp_t gfp,
 	return swapin_readahead(entry, gfp, NULL, 0);
 }
 
+static inline struct page *shmem_alloc_pages(gfp_t gfp,
+			struct shmem_inode_info *info, unsigned long idx,
+			unsigned int order)
+{
+	return alloc_pages(gfp, order);
+}
+#endif /* CONFIG_NUMA */
+
 static inline struct page *shmem_alloc_page(gfp_t gfp,
 			struct shmem_inode_info *info, unsigned long idx)
 {
-	return alloc_page(gfp);
+	return shmem_alloc_pages(gfp, info, idx, 0);
 }
-#endif /* CONFIG_NUMA */
 
 #if !defined(CONFIG_NUMA) || !defined(CONFIG_TMPFS)
 static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
 {
 	return NULL;
 }
+
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Should the extent around @index of @inode be allocated huge?  @vma is
+ * the mapping being faulted, if any, for huge=advise.
+ */
+static bool shmem_huge_enabled(struct inode *inode, unsigned long index,
+			       struct vm_area_struct *vma)
+{
+	unsigned long end = (index | (HPAGE_PMD_NR - 1)) + 1;
+	loff_t i_size;
+
+	if (!S_ISREG(inode->i_mode))
+		return false;
+
+	switch (SHMEM_SB(inode->i_sb)->huge) {
+	case SHMEM_HUGE_ALWAYS:
+		return true;
+	case SHMEM_HUGE_WITHIN_SIZE:
+		i_size = round_up(i_size_read(inode), PAGE_CACHE_SIZE);
+		return end <= (i_size >> PAGE_CACHE_SHIFT);
+	case SHMEM_HUGE_ADVISE:
+		return vma && (vma->vm_flags & VM_HUGEPAGE);
+	}
+	return false;
+}
+
+/*
+ * shmem_alloc_huge - allocate the huge extent around @index
+ *
+ * All HPAGE_PMD_NR pages of the extent are allocated with one high
+ * order allocation, split up, zeroed and added to the page cache.
+ * This fails, for the caller to fall back to a small page, if any
+ * page of the extent is already in the page cache or out on swap,
+ * if the block cannot be allocated without much effort, or if it
+ * would not fit the limits of the filesystem.
+ */
+static int shmem_alloc_huge(struct inode *inode, unsigned long index,
+			    enum sgp_type sgp)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	unsigned long start = index & ~(HPAGE_PMD_NR - 1UL);
+	struct page *page, *probe;
+	swp_entry_t *entry;
+	int charged = 0, added = 0, uncharged = 0;
+	int error = 0, i;
+	gfp_t gfp;
+
+	if (start + HPAGE_PMD_NR > SHMEM_MAX_INDEX)
+		return -EFBIG;
+	if (sgp != SGP_WRITE &&
+	    ((loff_t)(start + HPAGE_PMD_NR - 1) << PAGE_CACHE_SHIFT) >=
+	    i_size_read(inode))
+		return -EINVAL;
+	if (find_get_pages(mapping, start, 1, &probe)) {
+		if (probe->index < start + HPAGE_PMD_NR)
+			error = -EEXIST;
+		page_cache_release(probe);
+		if (error)
+			return error;
+	}
+
+	gfp = mapping_gfp_mask(mapping) | __GFP_NORETRY | __GFP_NOWARN |
+		__GFP_NO_KSWAPD | __GFP_NOMEMALLOC;
+	page = shmem_alloc_pages(gfp, info, start, HPAGE_PMD_ORDER);
+	if (!page) {
+		count_vm_event(THP_FILE_FALLBACK);
+		return -ENOMEM;
+	}
+	split_page(page, HPAGE_PMD_ORDER);
+
+	for (; charged < HPAGE_PMD_NR; charged++) {
+		SetPageSwapBacked(page + charged);
+		error = mem_cgroup_cache_charge(page + charged, current->mm,
+						GFP_KERNEL);
+		if (error)
+			goto free;
+	}
+
+	spin_lock(&info->lock);
+	shmem_recalc_inode(inode);
+	if (sbinfo->max_blocks) {
+		if (sbinfo->max_blocks < HPAGE_PMD_NR ||
+		    percpu_counter_compare(&sbinfo->used_blocks,
+				sbinfo->max_blocks - HPAGE_PMD_NR) > 0 ||
+		    shmem_acct_blocks(info->flags, HPAGE_PMD_NR))
+			goto nospace;
+		percpu_counter_add(&sbinfo->used_blocks, HPAGE_PMD_NR);
+		spin_lock(&inode->i_lock);
+		inode->i_blocks += HPAGE_PMD_NR * BLOCKS_PER_PAGE;
+		spin_unlock(&inode->i_lock);
+	} else if (shmem_acct_blocks(info->flags, HPAGE_PMD_NR))
+		goto nospace;
+
+	for (; added < HPAGE_PMD_NR; added++) {
+		/* this may drop and retake info->lock */
+		entry = shmem_swp_alloc(info, start + added, sgp);
+		if (IS_ERR(entry)) {
+			error = PTR_ERR(entry);
+			break;
+		}
+		if (entry->val)
+			error = -EEXIST;
+		shmem_swp_unmap(entry);
+		if (error)
+			break;
+		error = add_to_page_cache_lru(page + added, mapping,
+					      start + added, GFP_NOWAIT);
+		if (error) {
+			/* which has uncharged the page already */
+			uncharged = 1;
+			break;
+		}
+	}
+	if (error) {
+		for (i = 0; i < added; i++) {
+			delete_from_page_cache(page + i);
+			unlock_page(page + i);
+		}
+		spin_unlock(&info->lock);
+		shmem_unacct_blocks(info->flags, HPAGE_PMD_NR);
+		shmem_free_blocks(inode, HPAGE_PMD_NR);
+		goto free;
+	}
+	info->alloced += HPAGE_PMD_NR;
+	info->flags |= SHMEM_PAGEIN;
+	if (!radix_tree_insert(&info->huge_extents, start >> HPAGE_PMD_ORDER,
+			       page))
+		inc_zone_page_state(page, NR_SHMEM_THPS);
+	spin_unlock(&info->lock);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		clear_highpage(page + i);
+		flush_dcache_page(page + i);
+		SetPageUptodate(page + i);
+		if (sgp == SGP_DIRTY)
+			set_page_dirty(page + i);
+		unlock_page(page + i);
+		page_cache_release(page + i);
+		cond_resched();
+	}
+	count_vm_event(THP_FILE_ALLOC);
+	return 0;
+
+nospace:
+	spin_unlock(&info->lock);
+	error = -ENOSPC;
+free:
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (i >= added + uncharged && i < charged)
+			mem_cgroup_uncharge_cache_page(page + i);
+		page_cache_release(page + i);
+	}
+	count_vm_event(THP_FILE_FALLBACK);
+	return error;
+}
+
+/*
+ * Map an intact huge extent with a huge pmd, allocating it first if
+ * the range is still empty and the mount asks for huge pages.
+ */
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *pages[PAGEVEC_SIZE];
+	struct page *head, *page;
+	unsigned long start;
+	int locked = 0, broken = 0;
+	int err;
+	int i, nr;
+
+	if (!(vma->vm_flags & VM_SHARED) ||
+	    (vma->vm_flags & (VM_NONLINEAR | VM_NOHUGEPAGE)))
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	start = linear_page_index(vma, haddr);
+	if (start & (HPAGE_PMD_NR - 1))
+		return VM_FAULT_FALLBACK;
+	if (((loff_t)(start + HPAGE_PMD_NR - 1) << PAGE_CACHE_SHIFT) >=
+	    i_size_read(inode))
+		return VM_FAULT_FALLBACK;
+
+	spin_lock(&info->lock);
+	head = radix_tree_lookup(&info->huge_extents, start >> HPAGE_PMD_ORDER);
+	spin_unlock(&info->lock);
+	if (!head) {
+		if (!shmem_huge_enabled(inode, start, vma) ||
+		    shmem_alloc_huge(inode, start, SGP_CACHE))
+			return VM_FAULT_FALLBACK;
+		spin_lock(&info->lock);
+		head = radix_tree_lookup(&info->huge_extents,
+					 start >> HPAGE_PMD_ORDER);
+		spin_unlock(&info->lock);
+		if (!head)
+			return VM_FAULT_FALLBACK;
+	}
+
+	/*
+	 * Grab and lock every page of the extent, making sure it is still
+	 * complete and still the aligned block it started out as.  A page
+	 * that is locked or not uptodate only makes this attempt fall back.
+	 */
+	if (page_to_pfn(head) & (HPAGE_PMD_NR - 1)) {
+		broken = 1;
+		goto fallback;
+	}
+	while (locked < HPAGE_PMD_NR) {
+		nr = find_get_pages_contig(mapping, start + locked,
+				min_t(int, HPAGE_PMD_NR - locked, PAGEVEC_SIZE),
+				pages);
+		if (!nr) {
+			broken = 1;
+			goto fallback;
+		}
+		for (i = 0; i < nr; i++) {
+			page = pages[i];
+			if (page != head + locked) {
+				broken = 1;
+				break;
+			}
+			if (!trylock_page(page))
+				break;
+			if (!PageUptodate(page) || page->mapping != mapping) {
+				unlock_page(page);
+				break;
+			}
+			locked++;
+		}
+		if (i < nr) {
+			for (; i < nr; i++)
+				page_cache_release(pages[i]);
+			goto fallback;
+		}
+	}
+
+	/* Truncation takes the page locks, so i_size is stable now */
+	if (((loff_t)(start + HPAGE_PMD_NR - 1) << PAGE_CACHE_SHIFT) >=
+	    i_size_read(inode))
+		goto fallback;
+
+	err = map_file_huge_pmd(vma, address, pmd, head, flags);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		unlock_page(head + i);
+		if (err)
+			page_cache_release(head + i);
+	}
+	if (err == -ENOMEM)
+		return VM_FAULT_FALLBACK;
+	return 0;
+
+fallback:
+	for (i = 0; i < locked; i++) {
+		unlock_page(head + i);
+		page_cache_release(head + i);
+	}
+	if (broken) {
+		spin_lock(&info->lock);
+		shmem_huge_forget(info, start);
+		spin_unlock(&info->lock);
+	}
+	return VM_FAULT_FALLBACK;
+}
+
+/*
+ * Give mappings of a huge mount the same offset into a huge page as
+ * the file offset they map, so that huge extents can be mapped by pmds.
+ */
+static unsigned long shmem_get_unmapped_area(struct file *file,
+		unsigned long addr, unsigned long len,
+		unsigned long pgoff, unsigned long flags)
+{
+	unsigned long (*get_area)(struct file *, unsigned long, unsigned long,
+				  unsigned long, unsigned long);
+	struct inode *inode = file->f_path.dentry->d_inode;
+	unsigned long offset, inflated_addr;
+
+	get_area = current->mm->get_unmapped_area;
+	addr = get_area(file, addr, len, pgoff, flags);
+	if (IS_ERR_VALUE(addr) || (flags & MAP_FIXED) ||
+	    len < HPAGE_PMD_SIZE ||
+	    SHMEM_SB(inode->i_sb)->huge == SHMEM_HUGE_NEVER)
+		return addr;
+
+	offset = (pgoff << PAGE_SHIFT) & ~HPAGE_PMD_MASK;
+	if ((addr & ~HPAGE_PMD_MASK) == offset)
+		return addr;
+
+	inflated_addr = get_area(NULL, 0, len + HPAGE_PMD_SIZE - PAGE_SIZE,
+				 0, flags);
+	if (IS_ERR_VALUE(inflated_addr))
+		return addr;
+
+	inflated_addr += (offset - inflated_addr) & ~HPAGE_PMD_MASK;
+	return inflated_addr;
+}
+
+#ifdef CONFIG_MIGRATION
+static int shmem_migratepage(struct address_space *mapping,
+			     struct page *newpage, struct page *page)
+{
+	struct shmem_inode_info *info = SHMEM_I(mapping->host);
+	int rc;
+
+	rc = migrate_page(mapping, newpage, page);
+	if (!rc) {
+		spin_lock(&info->lock);
+		shmem_huge_forget(info, page->index);
+		spin_unlock(&info->lock);
+	}
+	return rc;
+}
+#else
+#define shmem_migratepage migrate_page
+#endif
+
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+static inline bool shmem_huge_enabled(struct inode *inode, unsigned long index,
+				      struct vm_area_struct *vma)
+{
+	return false;
+}
+
+static inline int shmem_alloc_huge(struct inode *inode, unsigned long index,
+				   enum sgp_type sgp)
+{
+	return -EINVAL;
+}
+
+#define shmem_migratepage migrate_page
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
 /*
  * shmem_getpage - either get the page from swap or allocate a new one
@@ -1246,6 +1682,7 @@ static int shmem_getpage(struct inode *inode, unsigned long idx,
 	swp_entry_t *entry;
 	swp_entry_t swap;
 	gfp_t gfp;
+	bool huge_tried = false;
 	int error;
 
 	if (idx >= SHMEM_MAX_INDEX)
@@ -1277,6 +1714,13 @@ repeat:
 		if (error)
 			goto failed;
 		radix_tree_preload_end();
+		if ((sgp == SGP_WRITE || sgp == SGP_CACHE) && !huge_tried &&
+		    shmem_huge_enabled(inode, idx, NULL)) {
+			/* On success the page is found in the cache */
+			huge_tried = true;
+			if (!shmem_alloc_huge(inode, idx, sgp))
+				goto repeat;
+		}
 		if (sgp != SGP_READ && !prealloc_page) {
 			/* We don't care if this fails */
 			prealloc_page = shmem_alloc_page(gfp, info, idx);
@@ -1418,13 +1862,13 @@ repeat:
 		if (sbinfo->max_blocks) {
 			if (percpu_counter_compare(&sbinfo->used_blocks,
 						sbinfo->max_blocks) >= 0 ||
-			    shmem_acct_block(info->flags))
+			    shmem_acct_blocks(info->flags, 1))
 				goto nospace;
 			percpu_counter_inc(&sbinfo->used_blocks);
 			spin_lock(&inode->i_lock);
 			inode->i_blocks += BLOCKS_PER_PAGE;
 			spin_unlock(&inode->i_lock);
-		} else if (shmem_acct_block(info->flags))
+		} else if (shmem_acct_blocks(info->flags, 1))
 			goto nospace;
 
 		if (!filepage) {
@@ -1629,8 +2073,12 @@ static struct inode *shmem_get_inode(struct super_block *sb, const struct inode
 		memset(info, 0, (char *)inode - (char *)info);
 		spin_lock_init(&info->lock);
 		info->flags = flags & VM_NORESERVE;
+		info->seals = F_SEAL_SEAL;
 		INIT_LIST_HEAD(&info->swaplist);
 		INIT_LIST_HEAD(&info->xattr_list);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		INIT_RADIX_TREE(&info->huge_extents, GFP_ATOMIC);
+#endif
 		cache_no_acl(inode);
 
 		switch (mode & S_IFMT) {
@@ -1688,7 +2136,17 @@ shmem_write_begin(struct file *file, struct address_space *mapping,
 			struct page **pagep, void **fsdata)
 {
 	struct inode *inode = mapping->host;
+	struct shmem_inode_info *info = SHMEM_I(inode);
 	pgoff_t index = pos >> PAGE_CACHE_SHIFT;
+
+	/* i_mutex is held: seals cannot be added meanwhile */
+	if (unlikely(info->seals & (F_SEAL_WRITE | F_SEAL_GROW))) {
+		if (info->seals & F_SEAL_WRITE)
+			return -EPERM;
+		if (pos + len > inode->i_size)
+			return -EPERM;
+	}
+
 	*pagep = NULL;
 	return shmem_getpage(inode, index, pagep, SGP_WRITE, NULL);
 }
@@ -1846,6 +2304,210 @@ static ssize_t shmem_file_aio_read(struct kiocb *iocb,
 	return retval;
 }
 
+/*
+ * Sealing: a memfd_create() file may be sealed with F_ADD_SEALS, so that
+ * whoever it is passed to can check with F_GET_SEALS that it will not
+ * change under them, and use it in place rather than copying it first.
+ * Seals are never removed, and once F_SEAL_SEAL is set no more are added.
+ * Other shmem files, and memfds created without MFD_ALLOW_SEALING, start
+ * out with F_SEAL_SEAL.
+ *
+ * F_SEAL_SHRINK and F_SEAL_GROW are checked in shmem_setattr() and
+ * shmem_write_begin(), F_SEAL_WRITE there and in mmap_region() through
+ * i_mmap_writable.  These all hold i_mutex, as does shmem_add_seals().
+ */
+#define F_ALL_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+
+#define SHMEM_PIN_SCANS	4
+
+/*
+ * Writable mappings are gone, but pages pinned by get_user_pages() may
+ * still be written through, as by direct I/O in flight.  Give the pins
+ * a little time to be dropped before refusing F_SEAL_WRITE.
+ */
+static int shmem_wait_for_pins(struct address_space *mapping)
+{
+	struct pagevec pvec;
+	pgoff_t index;
+	int scan, pinned, i;
+
+	for (scan = 0; scan <= SHMEM_PIN_SCANS; scan++) {
+		if (scan) {
+			/* Pages on the per-cpu lru_add lists hold a ref too */
+			lru_add_drain_all();
+			schedule_timeout_killable((HZ << scan) / 200);
+			if (fatal_signal_pending(current))
+				break;
+		}
+
+		pinned = 0;
+		index = 0;
+		pagevec_init(&pvec, 0);
+		while (!pinned &&
+		       pagevec_lookup(&pvec, mapping, index, PAGEVEC_SIZE)) {
+			for (i = 0; i < pagevec_count(&pvec); i++) {
+				struct page *page = pvec.pages[i];
+
+				index = page->index + 1;
+				/* page cache and pagevec refs, one per pte */
+				if (page_count(page) - page_mapcount(page) > 2)
+					pinned = 1;
+			}
+			pagevec_release(&pvec);
+			cond_resched();
+		}
+		if (!pinned)
+			return 0;
+	}
+	return -EBUSY;
+}
+
+int shmem_add_seals(struct file *file, unsigned int seals)
+{
+	struct inode *inode = file->f_path.dentry->d_inode;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	int error;
+
+	if (file->f_op != &shmem_file_operations)
+		return -EINVAL;
+	if (!(file->f_mode & FMODE_WRITE))
+		return -EPERM;
+	if (seals & ~(unsigned int)F_ALL_SEALS)
+		return -EINVAL;
+
+	mutex_lock(&inode->i_mutex);
+
+	if (info->seals & F_SEAL_SEAL) {
+		error = -EPERM;
+		goto unlock;
+	}
+
+	if ((seals & F_SEAL_WRITE) && !(info->seals & F_SEAL_WRITE)) {
+		error = mapping_deny_writable(file->f_mapping);
+		if (error)
+			goto unlock;
+
+		error = shmem_wait_for_pins(file->f_mapping);
+		if (error) {
+			mapping_allow_writable(file->f_mapping);
+			goto unlock;
+		}
+	}
+
+	info->seals |= seals;
+	error = 0;
+
+unlock:
+	mutex_unlock(&inode->i_mutex);
+	return error;
+}
+
+int shmem_get_seals(struct file *file)
+{
+	if (file->f_op != &shmem_file_operations)
+		return -EINVAL;
+
+	return SHMEM_I(file->f_path.dentry->d_inode)->seals;
+}
+
+long shmem_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	long error;
+
+	switch (cmd) {
+	case F_ADD_SEALS:
+		/* disallow upper 32bit */
+		if (arg > UINT_MAX)
+			return -EINVAL;
+
+		error = shmem_add_seals(file, arg);
+		break;
+	case F_GET_SEALS:
+		error = shmem_get_seals(file);
+		break;
+	default:
+		error = -EINVAL;
+		break;
+	}
+
+	return error;
+}
+
+#define MFD_NAME_PREFIX "memfd:"
+#define MFD_NAME_PREFIX_LEN (sizeof(MFD_NAME_PREFIX) - 1)
+#define MFD_NAME_MAX_LEN (NAME_MAX - MFD_NAME_PREFIX_LEN)
+
+#define MFD_ALL_FLAGS (MFD_CLOEXEC | MFD_ALLOW_SEALING)
+
+/*
+ * memfd_create() - an unlinked tmpfs file on the internal shm mount, to
+ * be passed around by its fd.  The name only shows in /proc/<pid>/fd and
+ * maps, as "memfd:<name>"; it need not be unique.
+ */
+SYSCALL_DEFINE2(memfd_create,
+		const char __user *, uname,
+		unsigned int, flags)
+{
+	struct shmem_inode_info *info;
+	struct file *file;
+	int fd, error;
+	char *name;
+	long len;
+
+	if (flags & ~(unsigned int)MFD_ALL_FLAGS)
+		return -EINVAL;
+
+	/* length includes terminating zero */
+	len = strnlen_user(uname, MFD_NAME_MAX_LEN + 1);
+	if (len <= 0)
+		return -EFAULT;
+	if (len > MFD_NAME_MAX_LEN + 1)
+		return -EINVAL;
+
+	name = kmalloc(len + MFD_NAME_PREFIX_LEN, GFP_TEMPORARY);
+	if (!name)
+		return -ENOMEM;
+
+	strcpy(name, MFD_NAME_PREFIX);
+	if (copy_from_user(&name[MFD_NAME_PREFIX_LEN], uname, len)) {
+		error = -EFAULT;
+		goto err_name;
+	}
+
+	/* terminating-zero may have changed after strnlen_user() returned */
+	if (name[len + MFD_NAME_PREFIX_LEN - 1]) {
+		error = -EFAULT;
+		goto err_name;
+	}
+
+	fd = get_unused_fd_flags((flags & MFD_CLOEXEC) ? O_CLOEXEC : 0);
+	if (fd < 0) {
+		error = fd;
+		goto err_name;
+	}
+
+	file = shmem_file_setup(name, 0, VM_NORESERVE);
+	if (IS_ERR(file)) {
+		error = PTR_ERR(file);
+		goto err_fd;
+	}
+	info = SHMEM_I(file->f_path.dentry->d_inode);
+	file->f_mode |= FMODE_LSEEK | FMODE_PREAD | FMODE_PWRITE;
+	file->f_flags |= O_RDWR | O_LARGEFILE;
+	if (flags & MFD_ALLOW_SEALING)
+		info->seals &= ~F_SEAL_SEAL;
+
+	fd_install(fd, file);
+	kfree(name);
+	return fd;
+
+err_fd:
+	put_unused_fd(fd);
+err_name:
+	kfree(name);
+	return error;
+}
+
 static int shmem_statfs(struct dentry *dentry, struct kstatfs *buf)
 {
 	struct shmem_sb_info *sbinfo = SHMEM_SB(dentry->d_sb);
@@ -2402,6 +3064,23 @@ static const struct export_operations shmem_export_ops = {
 	.fh_to_dentry	= shmem_fh_to_dentry,
 };
 
+static const char *shmem_huge_names[] = {
+	[SHMEM_HUGE_NEVER]	= "never",
+	[SHMEM_HUGE_ALWAYS]	= "always",
+	[SHMEM_HUGE_WITHIN_SIZE]	= "within_size",
+	[SHMEM_HUGE_ADVISE]	= "advise",
+};
+
+static int shmem_parse_huge(const char *str)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(shmem_huge_names); i++)
+		if (!strcmp(str, shmem_huge_names[i]))
+			return i;
+	return -EINVAL;
+}
+
 static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 			       bool remount)
 {
@@ -2477,6 +3156,16 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
+		} else if (!strcmp(this_char,"huge")) {
+			int huge = shmem_parse_huge(value);
+
+			if (huge < 0)
+				goto bad_val;
+#ifndef CONFIG_TRANSPARENT_HUGEPAGE
+			if (huge != SHMEM_HUGE_NEVER)
+				goto bad_val;
+#endif
+			sbinfo->huge = huge;
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2523,6 +3212,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge        = config.huge;
 
 	mpol_put(sbinfo->mpol);
 	sbinfo->mpol        = config.mpol;	/* transfers initial ref */
@@ -2546,6 +3236,8 @@ static int shmem_show_options(struct seq_file *seq, struct vfsmount *vfs)
 		seq_printf(seq, ",uid=%u", sbinfo->uid);
 	if (sbinfo->gid != 0)
 		seq_printf(seq, ",gid=%u", sbinfo->gid);
+	if (sbinfo->huge != SHMEM_HUGE_NEVER)
+		seq_printf(seq, ",huge=%s", shmem_huge_names[sbinfo->huge]);
 	shmem_show_mpol(seq, sbinfo->mpol);
 	return 0;
 }
@@ -2688,12 +3380,15 @@ static const struct address_space_operations shmem_aops = {
 	.write_begin	= shmem_write_begin,
 	.write_end	= shmem_write_end,
 #endif
-	.migratepage	= migrate_page,
+	.migratepage	= shmem_migratepage,
 	.error_remove_page = generic_error_remove_page,
 };
 
 static const struct file_operations shmem_file_operations = {
 	.mmap		= shmem_mmap,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.get_unmapped_area = shmem_get_unmapped_area,
+#endif
 #ifdef CONFIG_TMPFS
 	.llseek		= generic_file_llseek,
 	.read		= do_sync_read,
@@ -2773,6 +3468,9 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
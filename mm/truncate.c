@@ -183,6 +183,47 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/*
+ * Remove the shadow entries of evicted pages in [start, end]: there are no
+ * refaults to detect in a truncated range, and the radix tree nodes are
+ * freed with the last of them.
+ */
+static void truncate_shadow_entries(struct address_space *mapping,
+				    pgoff_t start, pgoff_t end)
+{
+	void **slots[PAGEVEC_SIZE];
+	void *entries[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	unsigned int i, nr;
+
+	spin_lock_irq(&mapping->tree_lock);
+	while (mapping->nrshadows && start <= end) {
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, start, PAGEVEC_SIZE);
+		if (!nr)
+			break;
+		/* deleting may free the nodes the slots point into */
+		for (i = 0; i < nr; i++)
+			entries[i] = radix_tree_deref_slot_protected(slots[i],
+							&mapping->tree_lock);
+		for (i = 0; i < nr && indices[i] <= end; i++) {
+			if (!radix_tree_exceptional_entry(entries[i]))
+				continue;
+			page_cache_tree_remove(mapping, indices[i]);
+			mapping->nrshadows--;
+			workingset_forget(entries[i]);
+		}
+		start = indices[nr - 1] + 1;
+		if (!start)
+			break;
+
+		spin_unlock_irq(&mapping->tree_lock);
+		cond_resched();
+		spin_lock_irq(&mapping->tree_lock);
+	}
+	spin_unlock_irq(&mapping->tree_lock);
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -217,7 +258,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	int i;
 
 	cleancache_flush_inode(mapping);
-	if (mapping->nrpages == 0)
+	if (mapping->nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -294,6 +335,14 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		pagevec_release(&pvec);
 		mem_cgroup_uncharge_end();
 	}
+
+	/*
+	 * Reclaim replaces a page with its shadow entry before the slot
+	 * reads as empty of pages, see page_cache_tree_delete().
+	 */
+	smp_rmb();
+	if (mapping->nrshadows)
+		truncate_shadow_entries(mapping, start, end);
 	cleancache_flush_inode(mapping);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
@@ -404,7 +453,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
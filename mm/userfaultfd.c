@@ -0,0 +1,237 @@
+/*
+ *  mm/userfaultfd.c
+ *
+ *  Resolution of userfaultfd missing page faults: UFFDIO_COPY maps
+ *  pages filled with data from userland into the registered ranges.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/highmem.h>
+#include <linux/memcontrol.h>
+#include <linux/userfaultfd_k.h>
+
+#include <asm/tlbflush.h>
+#include <asm/uaccess.h>
+
+/*
+ * Map one page, copied from @src_addr, at @dst_addr if nothing is mapped
+ * there yet.  The copy is attempted with page faults disabled, since
+ * mmap_sem is held: if it faults, the page is handed back in @pagep to
+ * be filled by the caller with mmap_sem released, and -EFAULT returned.
+ */
+static int mcopy_atomic_pte(struct mm_struct *dst_mm, pmd_t *dst_pmd,
+			    struct vm_area_struct *dst_vma,
+			    unsigned long dst_addr, unsigned long src_addr,
+			    struct page **pagep)
+{
+	pte_t _dst_pte, *dst_pte;
+	spinlock_t *ptl;
+	struct page *page;
+	void *page_kaddr;
+	int ret;
+
+	if (!*pagep) {
+		page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, dst_vma, dst_addr);
+		if (!page)
+			return -ENOMEM;
+
+		/*
+		 * copy_from_user() would might_sleep() under kmap_atomic():
+		 * check the range it would check, then copy.
+		 */
+		ret = PAGE_SIZE;
+		page_kaddr = kmap_atomic(page, KM_USER0);
+		if (access_ok(VERIFY_READ, (const void __user *) src_addr,
+			      PAGE_SIZE))
+			ret = __copy_from_user_inatomic(page_kaddr,
+					(const void __user *) src_addr,
+					PAGE_SIZE);
+		kunmap_atomic(page_kaddr, KM_USER0);
+
+		if (unlikely(ret)) {
+			*pagep = page;
+			return -EFAULT;
+		}
+	} else {
+		page = *pagep;
+		*pagep = NULL;
+	}
+
+	/*
+	 * The memory barrier inside __SetPageUptodate makes sure that the
+	 * copy above is visible before the set_pte_at() write.
+	 */
+	__SetPageUptodate(page);
+
+	ret = -ENOMEM;
+	if (mem_cgroup_newpage_charge(page, dst_mm, GFP_KERNEL))
+		goto out_release;
+
+	_dst_pte = mk_pte(page, dst_vma->vm_page_prot);
+	if (dst_vma->vm_flags & VM_WRITE)
+		_dst_pte = pte_mkwrite(pte_mkdirty(_dst_pte));
+
+	ret = -EEXIST;
+	dst_pte = pte_offset_map_lock(dst_mm, dst_pmd, dst_addr, &ptl);
+	if (!pte_none(*dst_pte))
+		goto out_release_uncharge_unlock;
+
+	inc_mm_counter(dst_mm, MM_ANONPAGES);
+	page_add_new_anon_rmap(page, dst_vma, dst_addr);
+	set_pte_at(dst_mm, dst_addr, dst_pte, _dst_pte);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(dst_vma, dst_addr, dst_pte);
+
+	pte_unmap_unlock(dst_pte, ptl);
+	return 0;
+
+out_release_uncharge_unlock:
+	pte_unmap_unlock(dst_pte, ptl);
+	mem_cgroup_uncharge_page(page);
+out_release:
+	page_cache_release(page);
+	return ret;
+}
+
+/* Allocate the page table of @address, unshared, in a registered vma */
+static pmd_t *mm_alloc_pmd(struct mm_struct *mm, struct vm_area_struct *vma,
+			   unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	pud = pud_alloc(mm, pgd, address);
+	if (!pud)
+		return NULL;
+	pmd = pmd_alloc(mm, pud, address);
+	if (!pmd)
+		return NULL;
+	/* Huge pmds are never instantiated in registered vmas */
+	if (unlikely(pmd_trans_huge(*pmd)))
+		return NULL;
+	if (unlikely(pmd_none(*pmd)) &&
+	    unlikely(__pte_alloc(mm, vma, pmd, address)))
+		return NULL;
+	if (unlikely(pmd_table_shared(*pmd)) &&
+	    unshare_pte_table(mm, vma, pmd, address))
+		return NULL;
+	return pmd;
+}
+
+/**
+ * mcopy_atomic - resolve missing page faults with userland data
+ * @dst_mm: the mm the userfaultfd was created for
+ * @dst_start: the first destination address, in a registered vma
+ * @src_start: the address of the data in the current mm
+ * @len: the length to copy
+ *
+ * The destination range must lie within a single vma registered to a
+ * userfaultfd.  Pages already mapped make it fail with -EEXIST.
+ *
+ * Returns the number of bytes copied, or a negative error if none were.
+ */
+ssize_t mcopy_atomic(struct mm_struct *dst_mm, unsigned long dst_start,
+		     unsigned long src_start, unsigned long len)
+{
+	struct vm_area_struct *dst_vma;
+	ssize_t err;
+	pmd_t *dst_pmd;
+	unsigned long src_addr, dst_addr;
+	long copied = 0;
+	struct page *page = NULL;
+
+	/* Sanitize the command parameters */
+	BUG_ON(dst_start & ~PAGE_MASK);
+	BUG_ON(len & ~PAGE_MASK);
+
+	/* Does the address range wrap, or is the span zero-sized? */
+	BUG_ON(src_start + len <= src_start);
+	BUG_ON(dst_start + len <= dst_start);
+
+retry:
+	down_read(&dst_mm->mmap_sem);
+
+	/*
+	 * Make sure that the dst range is both valid and fully within a
+	 * single existing vma, registered to a userfaultfd: the vma may
+	 * have changed while mmap_sem was released below.
+	 */
+	err = -EINVAL;
+	dst_vma = find_vma(dst_mm, dst_start);
+	if (!dst_vma || dst_vma->vm_ops)
+		goto out_unlock;
+	if (dst_start < dst_vma->vm_start ||
+	    dst_start + len > dst_vma->vm_end)
+		goto out_unlock;
+	if (!userfaultfd_missing(dst_vma))
+		goto out_unlock;
+
+	err = -ENOMEM;
+	if (unlikely(anon_vma_prepare(dst_vma)))
+		goto out_unlock;
+
+	src_addr = src_start + copied;
+	dst_addr = dst_start + copied;
+	while (src_addr < src_start + len) {
+		BUG_ON(dst_addr >= dst_start + len);
+
+		err = -ENOMEM;
+		dst_pmd = mm_alloc_pmd(dst_mm, dst_vma, dst_addr);
+		if (unlikely(!dst_pmd))
+			break;
+
+		err = mcopy_atomic_pte(dst_mm, dst_pmd, dst_vma, dst_addr,
+				       src_addr, &page);
+		cond_resched();
+
+		if (unlikely(err == -EFAULT)) {
+			void *page_kaddr;
+
+			up_read(&dst_mm->mmap_sem);
+			BUG_ON(!page);
+
+			page_kaddr = kmap(page);
+			err = copy_from_user(page_kaddr,
+					     (const void __user *) src_addr,
+					     PAGE_SIZE);
+			kunmap(page);
+			if (unlikely(err)) {
+				err = -EFAULT;
+				goto out;
+			}
+			goto retry;
+		} else
+			BUG_ON(page);
+
+		if (!err) {
+			dst_addr += PAGE_SIZE;
+			src_addr += PAGE_SIZE;
+			copied += PAGE_SIZE;
+
+			if (fatal_signal_pending(current))
+				err = -EINTR;
+		}
+		if (err)
+			break;
+	}
+
+out_unlock:
+	up_read(&dst_mm->mmap_sem);
+out:
+	if (page)
+		put_page(page);
+	BUG_ON(copied < 0);
+	BUG_ON(err > 0);
+	BUG_ON(!copied && !err);
+	return copied ? copied : err;
+}
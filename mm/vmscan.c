@@ -29,6 +29,7 @@
 #include <linux/pagevec.h>
 #include <linux/backing-dev.h>
 #include <linux/rmap.h>
+#include <linux/ksm.h>
 #include <linux/topology.h>
 #include <linux/cpu.h>
 #include <linux/cpuset.h>
@@ -108,6 +109,9 @@ struct scan_control {
 	/* Which cgroup do we reclaim from */
 	struct mem_cgroup *mem_cgroup;
 
+	/* Leave pages of memory cgroups within their low limit alone */
+	int protect_low;
+
 	/*
 	 * Nodemask of nodes allowed by the caller. If NULL, all nodes
 	 * are scanned.
@@ -481,7 +485,8 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
  * Same as remove_mapping, but if the page is removed from the mapping, it
  * gets returned with a refcount of 0.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    bool reclaimed)
 {
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -527,10 +532,16 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		swapcache_free(swap, page);
 	} else {
 		void (*freepage)(struct page *);
+		void *shadow = NULL;
 
 		freepage = mapping->a_ops->freepage;
-
-		__delete_from_page_cache(page);
+		/*
+		 * Remember a reclaimed file page's eviction in its slot, to
+		 * tell a refault of the working set from a first access.
+		 */
+		if (reclaimed && page_is_file_cache(page))
+			shadow = workingset_eviction(mapping, page);
+		__delete_from_page_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 		mem_cgroup_uncharge_cache_page(page);
 
@@ -553,7 +564,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, false)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -650,6 +661,19 @@ static enum page_references page_check_references(struct page *page,
 	int referenced_ptes, referenced_page;
 	unsigned long vm_flags;
 
+	/*
+	 * Pages evicted from the oldest generation were not found accessed
+	 * by the page table walks of the last aging, so skip the rmap walk:
+	 * a page used since is caught by the accessed bit check in
+	 * try_to_unmap() and activated then.
+	 */
+	if (scanning_global_lru(sc) && lru_gen_enabled_zone(page_zone(page))) {
+		referenced_page = TestClearPageReferenced(page);
+		if (referenced_page && !PageSwapBacked(page))
+			return PAGEREF_RECLAIM_CLEAN;
+		return PAGEREF_RECLAIM;
+	}
+
 	referenced_ptes = page_referenced(page, 1, sc->mem_cgroup, &vm_flags);
 	referenced_page = TestClearPageReferenced(page);
 
@@ -715,15 +739,19 @@ static noinline_for_stack void free_page_list(struct list_head *free_pages)
 }
 
 /*
- * shrink_page_list() returns the number of reclaimed pages
+ * shrink_page_list() returns the number of reclaimed pages, and the
+ * number of pages it left alone for their memory cgroup's protection
+ * in *ret_nr_protected
  */
 static unsigned long shrink_page_list(struct list_head *page_list,
 				      struct zone *zone,
-				      struct scan_control *sc)
+				      struct scan_control *sc,
+				      unsigned long *ret_nr_protected)
 {
 	LIST_HEAD(ret_pages);
 	LIST_HEAD(free_pages);
 	int pgactivate = 0;
+	unsigned long nr_protected = 0;
 	unsigned long nr_dirty = 0;
 	unsigned long nr_congested = 0;
 	unsigned long nr_reclaimed = 0;
@@ -735,6 +763,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		struct address_space *mapping;
 		struct page *page;
 		int may_enter_fs;
+		int lazyfree;
 
 		cond_resched();
 
@@ -747,6 +776,18 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		VM_BUG_ON(PageActive(page));
 		VM_BUG_ON(page_zone(page) != zone);
 
+		/*
+		 * Pages of memory cgroups within their low limit go back
+		 * to the inactive list as they are.  Activating them would
+		 * only have them deactivated and scanned again, and counting
+		 * them as scanned would drive the priority down to where
+		 * the protection is dropped.
+		 */
+		if (sc->protect_low && mem_cgroup_page_protected(page)) {
+			nr_protected++;
+			goto keep_locked;
+		}
+
 		sc->nr_scanned++;
 
 		if (unlikely(!page_evictable(page, NULL)))
@@ -795,7 +836,8 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
 		 */
-		if (PageAnon(page) && !PageSwapCache(page)) {
+		if (PageAnon(page) && PageSwapBacked(page) &&
+		    !PageSwapCache(page)) {
 			if (!(sc->gfp_mask & __GFP_IO))
 				goto keep_locked;
 			if (!add_to_swap(page))
@@ -804,12 +846,13 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		}
 
 		mapping = page_mapping(page);
+		lazyfree = PageAnon(page) && !PageSwapBacked(page);
 
 		/*
 		 * The page is mapped into the page tables of one or more
 		 * processes. Try to unmap it here.
 		 */
-		if (page_mapped(page) && mapping) {
+		if (page_mapped(page) && (mapping || lazyfree)) {
 			switch (try_to_unmap(page, TTU_UNMAP)) {
 			case SWAP_FAIL:
 				goto activate_locked;
@@ -822,6 +865,24 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
+		/*
+		 * A clean MADV_FREE page can simply be dropped.  Once the
+		 * references are frozen nobody can dirty it behind our back.
+		 */
+		if (lazyfree) {
+			if (PageDirty(page) || PageKsm(page))
+				goto activate_locked;
+			if (!page_freeze_refs(page, 1))
+				goto keep_locked;
+			if (PageDirty(page)) {
+				page_unfreeze_refs(page, 1);
+				goto activate_locked;
+			}
+			count_vm_event(PGLAZYFREED);
+			__clear_page_locked(page);
+			goto free_it;
+		}
+
 		if (PageDirty(page)) {
 			nr_dirty++;
 
@@ -901,7 +962,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -934,6 +995,13 @@ activate_locked:
 		/* Not a candidate for swapping, so reclaim swap space. */
 		if (PageSwapCache(page) && vm_swap_full())
 			try_to_free_swap(page);
+		/*
+		 * A redirtied MADV_FREE page is regular anon memory again,
+		 * and so is one KSM shares with other processes.
+		 */
+		if (PageAnon(page) && !PageSwapBacked(page) &&
+		    (PageDirty(page) || PageKsm(page)))
+			SetPageSwapBacked(page);
 		VM_BUG_ON(PageActive(page));
 		SetPageActive(page);
 		pgactivate++;
@@ -959,6 +1027,7 @@ keep_lumpy:
 
 	list_splice(&ret_pages, page_list);
 	count_vm_events(PGACTIVATE, pgactivate);
+	*ret_nr_protected = nr_protected;
 	return nr_reclaimed;
 }
 
@@ -1008,6 +1077,7 @@ int __isolate_lru_page(struct page *page, int mode, int file)
 		 * page release code relies on it.
 		 */
 		ClearPageLRU(page);
+		lru_gen_del_page(page);
 		ret = 0;
 	}
 
@@ -1394,6 +1464,88 @@ static inline bool should_reclaim_stall(unsigned long nr_taken,
 	return priority <= lumpy_stall_priority;
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Bound on the pages that eviction moves to the list of the generation
+ * aging promoted them to, per call, so as not to hold lru_lock too long.
+ */
+#define LRU_GEN_MAX_SORT	(SWAP_CLUSTER_MAX * 16)
+
+/* The pages of the MIN_NR_GENS youngest generations are not evicted. */
+static bool lru_gen_can_evict(struct lru_gen_struct *lrugen, int file)
+{
+	return lrugen->max_seq - lrugen->min_seq[file] >= MIN_NR_GENS;
+}
+
+/*
+ * Isolate up to @nr_to_scan pages from the oldest generation of @file
+ * pages, moving on to the next generation when it runs empty.  Pages that
+ * aging promoted are not isolated but moved to the list of their new
+ * generation.  zone->lru_lock must be held.
+ */
+static unsigned long lru_gen_isolate_pages(struct zone *zone,
+		unsigned long nr_to_scan, struct list_head *dst,
+		unsigned long *scanned, int file)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	unsigned long nr_taken = 0;
+	unsigned long scan = 0;
+	int nr_sorted = 0;
+
+	while (scan < nr_to_scan && nr_sorted < LRU_GEN_MAX_SORT &&
+	       lru_gen_can_evict(lrugen, file)) {
+		int gen = lru_gen_from_seq(lrugen->min_seq[file]);
+		struct list_head *src = &lrugen->lists[gen][file];
+		struct page *page;
+		int new_gen;
+
+		if (list_empty(src)) {
+			lrugen->min_seq[file]++;
+			continue;
+		}
+
+		page = lru_to_page(src);
+		prefetchw_prev_lru_page(page, src, flags);
+
+		VM_BUG_ON(!PageLRU(page));
+
+		new_gen = page_lru_gen(page);
+		if (new_gen != gen) {
+			list_move(&page->lru, &lrugen->lists[new_gen][file]);
+			nr_sorted++;
+			continue;
+		}
+
+		scan++;
+		switch (__isolate_lru_page(page, ISOLATE_INACTIVE, file)) {
+		case 0:
+			list_move(&page->lru, dst);
+			nr_taken += hpage_nr_pages(page);
+			break;
+
+		case -EBUSY:
+			/* else it is being freed elsewhere */
+			list_move(&page->lru, src);
+			break;
+
+		default:
+			BUG();
+		}
+	}
+
+	*scanned = scan;
+	return nr_taken;
+}
+#else
+static inline unsigned long lru_gen_isolate_pages(struct zone *zone,
+		unsigned long nr_to_scan, struct list_head *dst,
+		unsigned long *scanned, int file)
+{
+	BUG();
+	return 0;
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * shrink_inactive_list() is a helper for shrink_zone().  It returns the number
  * of reclaimed pages
@@ -1405,6 +1557,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct zone *zone,
 	LIST_HEAD(page_list);
 	unsigned long nr_scanned;
 	unsigned long nr_reclaimed = 0;
+	unsigned long nr_protected;
 	unsigned long nr_taken;
 	unsigned long nr_anon;
 	unsigned long nr_file;
@@ -1422,11 +1575,15 @@ shrink_inactive_list(unsigned long nr_to_scan, struct zone *zone,
 	spin_lock_irq(&zone->lru_lock);
 
 	if (scanning_global_lru(sc)) {
-		nr_taken = isolate_pages_global(nr_to_scan,
-			&page_list, &nr_scanned, sc->order,
-			sc->reclaim_mode & RECLAIM_MODE_LUMPYRECLAIM ?
-					ISOLATE_BOTH : ISOLATE_INACTIVE,
-			zone, 0, file);
+		if (lru_gen_enabled_zone(zone))
+			nr_taken = lru_gen_isolate_pages(zone, nr_to_scan,
+					&page_list, &nr_scanned, file);
+		else
+			nr_taken = isolate_pages_global(nr_to_scan,
+				&page_list, &nr_scanned, sc->order,
+				sc->reclaim_mode & RECLAIM_MODE_LUMPYRECLAIM ?
+						ISOLATE_BOTH : ISOLATE_INACTIVE,
+				zone, 0, file);
 		zone->pages_scanned += nr_scanned;
 		if (current_is_kswapd())
 			__count_zone_vm_events(PGSCAN_KSWAPD, zone,
@@ -1456,12 +1613,24 @@ shrink_inactive_list(unsigned long nr_to_scan, struct zone *zone,
 
 	spin_unlock_irq(&zone->lru_lock);
 
-	nr_reclaimed = shrink_page_list(&page_list, zone, sc);
+	nr_reclaimed = shrink_page_list(&page_list, zone, sc, &nr_protected);
 
 	/* Check if we should syncronously wait for writeback */
 	if (should_reclaim_stall(nr_taken, nr_reclaimed, priority, sc)) {
 		set_reclaim_mode(priority, sc, true);
-		nr_reclaimed += shrink_page_list(&page_list, zone, sc);
+		nr_reclaimed += shrink_page_list(&page_list, zone, sc,
+						 &nr_protected);
+	}
+
+	/*
+	 * Protected pages do not count towards the zone looking
+	 * unreclaimable either.  The pages_scanned reset by the page
+	 * allocator is not serialised against this; stay above zero.
+	 */
+	if (nr_protected && scanning_global_lru(sc)) {
+		spin_lock_irq(&zone->lru_lock);
+		zone->pages_scanned -= min(zone->pages_scanned, nr_protected);
+		spin_unlock_irq(&zone->lru_lock);
 	}
 
 	local_irq_disable();
@@ -1513,9 +1682,14 @@ static void move_active_pages_to_lru(struct zone *zone,
 		VM_BUG_ON(PageLRU(page));
 		SetPageLRU(page);
 
-		list_move(&page->lru, &zone->lru[lru].list);
-		mem_cgroup_add_lru_list(page, lru);
-		pgmoved += hpage_nr_pages(page);
+		if (lru_gen_enabled_zone(zone)) {
+			list_del(&page->lru);
+			lru_gen_add_page(zone, page, lru);
+		} else {
+			list_move(&page->lru, &zone->lru[lru].list);
+			mem_cgroup_add_lru_list(page, lru);
+			pgmoved += hpage_nr_pages(page);
+		}
 
 		if (!pagevec_add(&pvec, page) || list_empty(list)) {
 			spin_unlock_irq(&zone->lru_lock);
@@ -1928,6 +2102,378 @@ static inline bool should_continue_reclaim(struct zone *zone,
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Aging walks the page tables of the mm_structs on this list.  A walk pins
+ * the mm with mm_count and only goes ahead if the mm still has users once
+ * it holds mmap_sem; lru_gen_del_mm() cycles mmap_sem before exit_mmap()
+ * to wait for it, as khugepaged does.  dup_mm() and exec_mmap() only add
+ * an mm once it is set up, so that every mm on the list leaves it through
+ * mmput(), and none through their failure paths.
+ */
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+static unsigned long lru_gen_nr_mms;
+
+/* One walk at a time; aging that cannot get it goes without */
+static DEFINE_MUTEX(lru_gen_walk_mutex);
+
+/* Thrashing protection: do not evict generations younger than this */
+static unsigned long lru_gen_min_ttl __read_mostly;
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_add_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+	lru_gen_nr_mms++;
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	if (list_empty(&mm->lru_gen_list)) {
+		spin_unlock(&lru_gen_mm_lock);
+		return;
+	}
+	list_del_init(&mm->lru_gen_list);
+	lru_gen_nr_mms--;
+	spin_unlock(&lru_gen_mm_lock);
+
+	/* wait for a walk of this mm to finish */
+	down_write(&mm->mmap_sem);
+	up_write(&mm->mmap_sem);
+}
+
+struct lru_gen_walk {
+	struct vm_area_struct *vma;
+	int nid;
+};
+
+/*
+ * Move a page found accessed to the youngest generation of its zone,
+ * unless it has left the generation lists meanwhile.  Only page->flags is
+ * updated; eviction puts the page on the right list when it meets it.
+ */
+static void lru_gen_promote_page(struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long old, new;
+	int gen;
+
+	do {
+		old = ACCESS_ONCE(page->flags);
+		if (!(old & LRU_GEN_MASK))
+			return;
+		gen = lru_gen_from_seq(ACCESS_ONCE(zone->lrugen.max_seq));
+		new = (old & ~LRU_GEN_MASK) |
+		      ((unsigned long)(gen + 1) << LRU_GEN_PGOFF);
+	} while (cmpxchg(&page->flags, old, new) != old);
+}
+
+static int lru_gen_walk_pmd_range(pmd_t *pmd, unsigned long addr,
+				  unsigned long end, struct mm_walk *walk)
+{
+	struct lru_gen_walk *args = walk->private;
+	struct vm_area_struct *vma = args->vma;
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	spin_lock(&walk->mm->page_table_lock);
+	if (pmd_trans_huge(*pmd)) {
+		if (!pmd_trans_splitting(*pmd)) {
+			page = pmd_page(*pmd);
+			if (page_to_nid(page) == args->nid &&
+			    pmdp_test_and_clear_young(vma, addr, pmd)) {
+				/* page cache pmds map small pages */
+				int i, nr = PageAnon(page) ? 1 : HPAGE_PMD_NR;
+
+				for (i = 0; i < nr; i++)
+					lru_gen_promote_page(page + i);
+			}
+		}
+		spin_unlock(&walk->mm->page_table_lock);
+		return 0;
+	}
+	/* a zapped huge pmd; a page table stays until munmap */
+	if (pmd_none(*pmd)) {
+		spin_unlock(&walk->mm->page_table_lock);
+		return 0;
+	}
+	spin_unlock(&walk->mm->page_table_lock);
+
+	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page || page_to_nid(page) != args->nid)
+			continue;
+
+		if (ptep_test_and_clear_young(vma, addr, pte))
+			lru_gen_promote_page(page);
+	}
+	pte_unmap_unlock(pte - 1, ptl);
+	cond_resched();
+	return 0;
+}
+
+static void lru_gen_walk_mm(struct mm_struct *mm, int nid)
+{
+	struct lru_gen_walk args = { .nid = nid };
+	struct mm_walk walk = {
+		.pmd_entry = lru_gen_walk_pmd_range,
+		.mm = mm,
+		.private = &args,
+	};
+	struct vm_area_struct *vma;
+
+	if (!down_read_trylock(&mm->mmap_sem))
+		return;
+
+	/* the mm is on its way out if it has no users */
+	if (atomic_read(&mm->mm_users)) {
+		for (vma = mm->mmap; vma; vma = vma->vm_next) {
+			if (vma->vm_flags & (VM_LOCKED | VM_IO | VM_PFNMAP))
+				continue;
+			if (is_vm_hugetlb_page(vma))
+				continue;
+			args.vma = vma;
+			walk_page_range(vma->vm_start, vma->vm_end, &walk);
+		}
+	}
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Clear the accessed bits in the page tables of every mm, promoting the
+ * pages of node @nid found accessed.  The list is rotated as the walk goes
+ * so that mms coming and going do not upset it.
+ */
+static void lru_gen_walk_mm_list(int nid)
+{
+	struct mm_struct *mm;
+	unsigned long nr;
+
+	spin_lock(&lru_gen_mm_lock);
+	for (nr = lru_gen_nr_mms; nr && !list_empty(&lru_gen_mm_list); nr--) {
+		mm = list_entry(lru_gen_mm_list.next, struct mm_struct,
+				lru_gen_list);
+		list_move_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+		if (!atomic_read(&mm->mm_users))
+			continue;
+		atomic_inc(&mm->mm_count);
+		spin_unlock(&lru_gen_mm_lock);
+
+		lru_gen_walk_mm(mm, nid);
+		mmdrop(mm);
+		cond_resched();
+
+		spin_lock(&lru_gen_mm_lock);
+	}
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+/*
+ * Merge the oldest generation of @file pages into the next one, to make
+ * room for a new generation.  Gives up after LRU_GEN_MAX_SORT pages so
+ * that the caller can drop zone->lru_lock, which must be held; returns
+ * true once done.
+ */
+static bool lru_gen_merge_oldest(struct zone *zone, int file)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	int old_gen = lru_gen_from_seq(lrugen->min_seq[file]);
+	int new_gen = lru_gen_from_seq(lrugen->min_seq[file] + 1);
+	struct list_head *head = &lrugen->lists[old_gen][file];
+	int nr = 0;
+
+	/* from the head, so the oldest pages end up at the tail */
+	while (!list_empty(head)) {
+		struct page *page = list_entry(head->next, struct page, lru);
+		int gen = page_lru_gen(page);
+
+		if (nr++ == LRU_GEN_MAX_SORT)
+			return false;
+
+		if (gen == old_gen) {
+			set_page_lru_gen(page, new_gen);
+			gen = new_gen;
+		}
+		list_move_tail(&page->lru, &lrugen->lists[gen][file]);
+	}
+	lrugen->min_seq[file]++;
+	return true;
+}
+
+/*
+ * Start a new youngest generation.  zone->lru_lock must be held.  Returns
+ * false if room has yet to be made, in which case the caller should drop
+ * the lock and try again.
+ */
+static bool lru_gen_inc_max_seq(struct zone *zone)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	int file;
+
+	for (file = 0; file < 2; file++) {
+		if (lrugen->max_seq - lrugen->min_seq[file] + 1 < MAX_NR_GENS)
+			continue;
+		if (!lru_gen_merge_oldest(zone, file))
+			return false;
+	}
+	lrugen->timestamps[lru_gen_from_seq(lrugen->max_seq + 1)] = jiffies;
+	lrugen->max_seq++;
+	return true;
+}
+
+/*
+ * Age @zone: promote the pages accessed since the last aging and start a
+ * new generation, unless someone else started one since @max_seq was
+ * read.  Only kswapd walks page tables, which is too slow for direct
+ * reclaim; without a walk, accessed mapped pages are only caught when
+ * try_to_unmap() finds them young.
+ */
+static void lru_gen_age_zone(struct zone *zone, unsigned long max_seq)
+{
+	if (current_is_kswapd() && mutex_trylock(&lru_gen_walk_mutex)) {
+		lru_gen_walk_mm_list(zone->zone_pgdat->node_id);
+		mutex_unlock(&lru_gen_walk_mutex);
+	}
+
+	spin_lock_irq(&zone->lru_lock);
+	while (zone->lrugen.enabled && zone->lrugen.max_seq == max_seq) {
+		if (lru_gen_inc_max_seq(zone))
+			break;
+		spin_unlock_irq(&zone->lru_lock);
+		cond_resched();
+		spin_lock_irq(&zone->lru_lock);
+	}
+	spin_unlock_irq(&zone->lru_lock);
+}
+
+/*
+ * Pick the type to evict from, file (1) or anon (0), weighed by swappiness
+ * and by how often recently scanned pages got rotated, as get_scan_count()
+ * does.  Returns -1 if the zone should be aged first: the preferred type
+ * has no generation old enough to evict, and the other type is only
+ * fallen back on once the zone has been @aged.
+ */
+static int lru_gen_type_to_scan(struct zone *zone, int swappiness, bool aged)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	struct zone_reclaim_stat *reclaim_stat = &zone->reclaim_stat;
+	unsigned long anon, file, ap, fp;
+	int type;
+
+	anon = swappiness ? zone_page_state(zone, NR_INACTIVE_ANON) : 0;
+	file = zone_page_state(zone, NR_INACTIVE_FILE);
+
+	if (!anon || !file) {
+		type = !!file;
+		goto out;
+	}
+
+	spin_lock_irq(&zone->lru_lock);
+	if (unlikely(reclaim_stat->recent_scanned[0] > anon / 4)) {
+		reclaim_stat->recent_scanned[0] /= 2;
+		reclaim_stat->recent_rotated[0] /= 2;
+	}
+	if (unlikely(reclaim_stat->recent_scanned[1] > file / 4)) {
+		reclaim_stat->recent_scanned[1] /= 2;
+		reclaim_stat->recent_rotated[1] /= 2;
+	}
+	ap = (swappiness + 1) * (reclaim_stat->recent_scanned[0] + 1);
+	ap /= reclaim_stat->recent_rotated[0] + 1;
+	fp = (200 - swappiness + 1) * (reclaim_stat->recent_scanned[1] + 1);
+	fp /= reclaim_stat->recent_rotated[1] + 1;
+	spin_unlock_irq(&zone->lru_lock);
+
+	type = fp >= ap;
+	if (!lru_gen_can_evict(lrugen, type) && aged &&
+	    lru_gen_can_evict(lrugen, !type))
+		return !type;
+out:
+	return lru_gen_can_evict(lrugen, type) ? type : -1;
+}
+
+/* Is the oldest generation of @file pages within the min_ttl_ms window? */
+static bool lru_gen_protected(struct zone *zone, int file)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	unsigned long birth;
+
+	if (!lru_gen_min_ttl)
+		return false;
+
+	birth = lrugen->timestamps[lru_gen_from_seq(lrugen->min_seq[file])];
+	return time_is_after_jiffies(birth + lru_gen_min_ttl);
+}
+
+/*
+ * The shrink_zone() of the multi-generational LRU: evict from the oldest
+ * generations, aging the zone when they run out.
+ */
+static unsigned long lru_gen_shrink_zone(int priority, struct zone *zone,
+					 struct scan_control *sc)
+{
+	unsigned long nr_to_scan, nr_reclaimed = 0;
+	int swappiness = 0;
+	bool aged = false;
+
+	if (sc->may_swap && nr_swap_pages > 0)
+		swappiness = sc->swappiness;
+
+	nr_to_scan = zone_page_state(zone, NR_INACTIVE_FILE);
+	if (swappiness)
+		nr_to_scan += zone_page_state(zone, NR_INACTIVE_ANON);
+	if (!nr_to_scan)
+		return 0;
+
+	nr_to_scan >>= priority;
+	/* kswapd does zone balancing and needs to scan this zone */
+	if (!nr_to_scan && current_is_kswapd())
+		nr_to_scan = SWAP_CLUSTER_MAX;
+
+	while (nr_to_scan) {
+		unsigned long max_seq = ACCESS_ONCE(zone->lrugen.max_seq);
+		unsigned long nr;
+		int file;
+
+		file = lru_gen_type_to_scan(zone, swappiness, aged);
+		if (file < 0) {
+			/* one aging per pass is plenty */
+			if (aged)
+				break;
+			lru_gen_age_zone(zone, max_seq);
+			aged = true;
+			continue;
+		}
+
+		if (lru_gen_protected(zone, file))
+			break;
+
+		nr = min_t(unsigned long, nr_to_scan, SWAP_CLUSTER_MAX);
+		nr_to_scan -= nr;
+		nr_reclaimed += shrink_inactive_list(nr, zone, sc,
+						     priority, file);
+
+		if (nr_reclaimed >= sc->nr_to_reclaim && priority < DEF_PRIORITY)
+			break;
+	}
+
+	return nr_reclaimed;
+}
+#else
+static inline unsigned long lru_gen_shrink_zone(int priority,
+		struct zone *zone, struct scan_control *sc)
+{
+	return 0;
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
@@ -1940,9 +2486,22 @@ static void shrink_zone(int priority, struct zone *zone,
 	unsigned long nr_reclaimed, nr_scanned;
 	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
 
+	/*
+	 * Global reclaim spares memory cgroups within their low limit
+	 * until the last priority, so that it still makes progress when
+	 * nothing else is left to reclaim.
+	 */
+	sc->protect_low = scanning_global_lru(sc) && priority;
 restart:
 	nr_reclaimed = 0;
 	nr_scanned = sc->nr_scanned;
+
+	if (scanning_global_lru(sc) && lru_gen_enabled_zone(zone)) {
+		nr_reclaimed = lru_gen_shrink_zone(priority, zone, sc);
+		sc->nr_reclaimed += nr_reclaimed;
+		goto continue_reclaim;
+	}
+
 	get_scan_count(zone, sc, nr, priority);
 
 	while (nr[LRU_INACTIVE_ANON] || nr[LRU_ACTIVE_FILE] ||
@@ -1977,6 +2536,7 @@ restart:
 	if (inactive_anon_is_low(zone, sc))
 		shrink_active_list(SWAP_CLUSTER_MAX, zone, sc, priority, 0);
 
+continue_reclaim:
 	/* reclaim/compaction might need reclaim to continue */
 	if (should_continue_reclaim(zone, nr_reclaimed,
 					sc->nr_scanned - nr_scanned, sc))
@@ -2030,7 +2590,7 @@ static void shrink_zones(int priority, struct zonelist *zonelist,
 			 */
 			nr_soft_scanned = 0;
 			nr_soft_reclaimed = mem_cgroup_soft_limit_reclaim(zone,
-						sc->order, sc->gfp_mask,
+						priority, sc->order, sc->gfp_mask,
 						&nr_soft_scanned);
 			sc->nr_reclaimed += nr_soft_reclaimed;
 			sc->nr_scanned += nr_soft_scanned;
@@ -2211,11 +2771,12 @@ unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 						gfp_t gfp_mask, bool noswap,
 						unsigned int swappiness,
 						struct zone *zone,
+						unsigned long nr_to_reclaim,
 						unsigned long *nr_scanned)
 {
 	struct scan_control sc = {
 		.nr_scanned = 0,
-		.nr_to_reclaim = SWAP_CLUSTER_MAX,
+		.nr_to_reclaim = nr_to_reclaim,
 		.may_writepage = !laptop_mode,
 		.may_unmap = 1,
 		.may_swap = !noswap,
@@ -2497,7 +3058,7 @@ loop_again:
 			 * Call soft limit reclaim before calling shrink_zone.
 			 */
 			nr_soft_reclaimed = mem_cgroup_soft_limit_reclaim(zone,
-							order, sc.gfp_mask,
+							priority, order, sc.gfp_mask,
 							&nr_soft_scanned);
 			sc.nr_reclaimed += nr_soft_reclaimed;
 			total_scanned += nr_soft_scanned;
@@ -2662,7 +3223,8 @@ out:
 	return order;
 }
 
-static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
+static void kswapd_try_to_sleep(pg_data_t *pgdat, int order,
+				int alloc_order, int classzone_idx)
 {
 	long remaining = 0;
 	DEFINE_WAIT(wait);
@@ -2695,6 +3257,16 @@ static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
 		 * them before going back to sleep.
 		 */
 		set_pgdat_percpu_threshold(pgdat, calculate_normal_threshold);
+
+		/*
+		 * Compaction records what it cannot isolate pages from in
+		 * pageblock skip bits.  Clear them before going to sleep as
+		 * reclaim may have changed the picture, and let kcompactd
+		 * defragment the memory freed for a high-order request.
+		 */
+		reset_isolation_suitable(pgdat);
+		wakeup_kcompactd(pgdat, alloc_order, classzone_idx);
+
 		schedule();
 		set_pgdat_percpu_threshold(pgdat, calculate_pressure_threshold);
 	} else {
@@ -2721,7 +3293,7 @@ static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
  */
 static int kswapd(void *p)
 {
-	unsigned long order, new_order;
+	unsigned long order, new_order, alloc_order;
 	int classzone_idx, new_classzone_idx;
 	pg_data_t *pgdat = (pg_data_t*)p;
 	struct task_struct *tsk = current;
@@ -2752,7 +3324,7 @@ static int kswapd(void *p)
 	tsk->flags |= PF_MEMALLOC | PF_SWAPWRITE | PF_KSWAPD;
 	set_freezable();
 
-	order = new_order = 0;
+	order = new_order = alloc_order = 0;
 	classzone_idx = new_classzone_idx = pgdat->nr_zones - 1;
 	for ( ; ; ) {
 		int ret;
@@ -2777,7 +3349,8 @@ static int kswapd(void *p)
 			order = new_order;
 			classzone_idx = new_classzone_idx;
 		} else {
-			kswapd_try_to_sleep(pgdat, order, classzone_idx);
+			kswapd_try_to_sleep(pgdat, order, alloc_order,
+					    classzone_idx);
 			order = pgdat->kswapd_max_order;
 			classzone_idx = pgdat->classzone_idx;
 			pgdat->kswapd_max_order = 0;
@@ -2794,6 +3367,8 @@ static int kswapd(void *p)
 		 */
 		if (!ret) {
 			trace_mm_vmscan_kswapd_wake(pgdat->node_id, order);
+			/* balance_pgdat() may fall back to order-0 reclaim */
+			alloc_order = order;
 			order = balance_pgdat(pgdat, order, &classzone_idx);
 		}
 	}
@@ -3236,10 +3811,8 @@ retry:
 	if (page_evictable(page, NULL)) {
 		enum lru_list l = page_lru_base_type(page);
 
-		__dec_zone_state(zone, NR_UNEVICTABLE);
-		list_move(&page->lru, &zone->lru[l].list);
-		mem_cgroup_move_lists(page, LRU_UNEVICTABLE, l);
-		__inc_zone_state(zone, NR_INACTIVE_ANON + l);
+		del_page_from_lru_list(zone, page, LRU_UNEVICTABLE);
+		add_page_to_lru_list(zone, page, l);
 		__count_vm_event(UNEVICTABLE_PGRESCUED);
 	} else {
 		/*
@@ -3437,3 +4010,200 @@ void scan_unevictable_unregister_node(struct node *node)
 	sysdev_remove_file(&node->sysdev, &attr_scan_unevictable_pages);
 }
 #endif
+
+#ifdef CONFIG_LRU_GEN
+#ifdef CONFIG_LRU_GEN_ENABLED
+static int lru_gen_enabled = 1;
+#else
+static int lru_gen_enabled;
+#endif
+/* serializes switching between the generations and the active/inactive lists */
+static DEFINE_MUTEX(lru_gen_state_mutex);
+
+void lru_gen_init_zone(struct zone *zone)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	int gen, file;
+
+	lrugen->max_seq = MIN_NR_GENS - 1;
+	lrugen->min_seq[0] = lrugen->min_seq[1] = 0;
+	for (gen = 0; gen < MAX_NR_GENS; gen++) {
+		lrugen->timestamps[gen] = jiffies;
+		for (file = 0; file < 2; file++)
+			INIT_LIST_HEAD(&lrugen->lists[gen][file]);
+	}
+	lrugen->enabled = lru_gen_enabled;
+}
+
+/*
+ * Both directions move every evictable page of the zone, so lru_lock is
+ * dropped every SWAP_CLUSTER_MAX pages.  Pages added meanwhile already go
+ * where lrugen->enabled says.
+ */
+static void lru_gen_relax(struct zone *zone, int *batch)
+{
+	if (++*batch % SWAP_CLUSTER_MAX)
+		return;
+	spin_unlock_irq(&zone->lru_lock);
+	cond_resched();
+	spin_lock_irq(&zone->lru_lock);
+}
+
+/* Active pages go to the youngest generation, inactive ones to the oldest */
+static void lru_gen_fill_zone(struct zone *zone)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	int batch = 0;
+	enum lru_list l;
+
+	for_each_evictable_lru(l) {
+		struct list_head *head = &zone->lru[l].list;
+
+		while (!list_empty(head)) {
+			struct page *page = lru_to_page(head);
+			unsigned long seq;
+
+			if (is_active_lru(l))
+				seq = lrugen->max_seq;
+			else
+				seq = lrugen->min_seq[is_file_lru(l)];
+
+			del_page_from_lru_list(zone, page, l);
+			__lru_gen_add_page(zone, page, l, seq);
+			lru_gen_relax(zone, &batch);
+		}
+	}
+}
+
+/* The two youngest generations become the active lists, the rest inactive */
+static void lru_gen_drain_zone(struct zone *zone)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	int batch = 0;
+	int file;
+
+	for (file = 0; file < 2; file++) {
+		unsigned long seq;
+
+		/* every generation, oldest first */
+		for (seq = lrugen->max_seq + 1 - MAX_NR_GENS;
+		     seq != lrugen->max_seq + 1; seq++) {
+			struct list_head *head;
+
+			head = &lrugen->lists[lru_gen_from_seq(seq)][file];
+			while (!list_empty(head)) {
+				struct page *page = lru_to_page(head);
+				enum lru_list l = file ? LRU_INACTIVE_FILE :
+							 LRU_INACTIVE_ANON;
+				int gen = page_lru_gen(page);
+
+				del_page_from_lru_list(zone, page, l);
+				if (gen == lru_gen_from_seq(lrugen->max_seq) ||
+				    gen == lru_gen_from_seq(lrugen->max_seq - 1)) {
+					SetPageActive(page);
+					l += LRU_ACTIVE;
+				}
+				__add_page_to_lru_list(zone, page, l,
+						       &zone->lru[l].list);
+				lru_gen_relax(zone, &batch);
+			}
+		}
+	}
+}
+
+static void lru_gen_change_state(int enable)
+{
+	struct zone *zone;
+
+	mutex_lock(&lru_gen_state_mutex);
+	if (enable == lru_gen_enabled)
+		goto out;
+
+	lru_gen_enabled = enable;
+	for_each_populated_zone(zone) {
+		spin_lock_irq(&zone->lru_lock);
+		zone->lrugen.enabled = enable;
+		if (enable)
+			lru_gen_fill_zone(zone);
+		else
+			lru_gen_drain_zone(zone);
+		spin_unlock_irq(&zone->lru_lock);
+	}
+out:
+	mutex_unlock(&lru_gen_state_mutex);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", lru_gen_enabled);
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned long enable;
+	int err;
+
+	err = strict_strtoul(buf, 10, &enable);
+	if (err || enable > 1)
+		return -EINVAL;
+
+	lru_gen_change_state(enable);
+
+	return count;
+}
+static struct kobj_attribute enabled_attr =
+	__ATTR(enabled, 0644, enabled_show, enabled_store);
+
+static ssize_t min_ttl_ms_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", jiffies_to_msecs(lru_gen_min_ttl));
+}
+
+static ssize_t min_ttl_ms_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned long msecs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &msecs);
+	if (err || msecs > UINT_MAX)
+		return -EINVAL;
+
+	lru_gen_min_ttl = msecs_to_jiffies(msecs);
+
+	return count;
+}
+static struct kobj_attribute min_ttl_ms_attr =
+	__ATTR(min_ttl_ms, 0644, min_ttl_ms_show, min_ttl_ms_store);
+
+static struct attribute *lru_gen_attrs[] = {
+	&enabled_attr.attr,
+	&min_ttl_ms_attr.attr,
+	NULL,
+};
+
+static struct attribute_group lru_gen_attr_group = {
+	.attrs = lru_gen_attrs,
+	.name = "lru_gen",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init lru_gen_init(void)
+{
+	BUILD_BUG_ON(MIN_NR_GENS + 1 > MAX_NR_GENS);
+	BUILD_BUG_ON(MAX_NR_GENS + 1 > 1U << LRU_GEN_WIDTH);
+
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &lru_gen_attr_group))
+		printk(KERN_ERR "lru_gen: register sysfs failed\n");
+#endif
+	return 0;
+}
+module_init(lru_gen_init)
+#endif /* CONFIG_LRU_GEN */
@@ -0,0 +1,432 @@
+/*
+ * Workingset detection
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/swap.h>
+#include <linux/pagemap.h>
+#include <linux/mm_inline.h>
+#include <linux/atomic.h>
+#include <linux/module.h>
+
+/*
+ *		Double CLOCK lists
+ *
+ * Per zone, two clock lists are maintained for file pages: the
+ * inactive and the active list.  Freshly faulted pages start out at
+ * the head of the inactive list and page reclaim scans pages from the
+ * tail.  Pages that are accessed multiple times on the inactive list
+ * are promoted to the active list, to protect them from reclaim,
+ * whereas active pages are demoted to the inactive list when the
+ * active list grows too big.
+ *
+ *   fault ------------------------+
+ *                                 |
+ *              +--------------+   |            +-------------+
+ *   reclaim <- |   inactive   | <-+-- demotion |    active   | <--+
+ *              +--------------+                +-------------+    |
+ *                     |                                           |
+ *                     +-------------- promotion ------------------+
+ *
+ *
+ *		Access frequency and refault distance
+ *
+ * A workload is thrashing when its pages are frequently used but they
+ * are evicted from the inactive list every time before another access
+ * would have promoted them to the active list.
+ *
+ * In cases where the average access distance between thrashing pages
+ * is bigger than the size of memory there is nothing that can be
+ * done - the thrashing set could never fit into memory under any
+ * circumstance.
+ *
+ * However, the average access distance could be bigger than the
+ * inactive list, yet smaller than the size of memory.  In this case,
+ * the set could fit into memory if it weren't for the currently
+ * active pages - which may be used more, hopefully less frequently:
+ *
+ *      +-memory available to cache-+
+ *      |                           |
+ *      +-inactive------+-active----+
+ *  a b | c d e f g h i | J K L M N |
+ *      +---------------+-----------+
+ *
+ * It is prohibitively expensive to accurately track access frequency
+ * of pages.  But a reasonable approximation can be made to measure
+ * thrashing on the inactive list, after which refaulting pages can be
+ * activated optimistically to compete with the existing active pages.
+ *
+ * Approximating inactive page access frequency - Observations:
+ *
+ * 1. When a page is accessed for the first time, it is added to the
+ *    head of the inactive list, slides every existing inactive page
+ *    towards the tail by one slot, and pushes the current tail page
+ *    out of memory.
+ *
+ * 2. When a page is accessed for the second time and promoted to the
+ *    active list, it shrinks the inactive list by one slot.  This
+ *    also slides all inactive pages that were faulted into the cache
+ *    more recently than the activated page towards the tail of the
+ *    inactive list.
+ *
+ * Thus:
+ *
+ * 1. The sum of evictions and activations between any two points in
+ *    time indicate the minimum number of inactive pages accessed in
+ *    between.
+ *
+ * 2. Moving one inactive page N page slots towards the tail of the
+ *    list requires at least N inactive page accesses.
+ *
+ * Combining these:
+ *
+ * 1. When a page is finally evicted from memory, the number of
+ *    inactive pages accessed while the page was in cache is at least
+ *    the number of page slots on the inactive list.
+ *
+ * 2. In addition, measuring the sum of evictions and activations (E)
+ *    at the time of a page's eviction, and comparing it to another
+ *    reading (R) at the time the page faults back into memory tells
+ *    the minimum number of accesses while the page was not cached.
+ *    This is called the refault distance.
+ *
+ * Because the first access of the page was the fault and the second
+ * access the refault, we combine the in-cache distance with the
+ * out-of-cache distance to get the complete minimum access distance
+ * of this page:
+ *
+ *      NR_inactive + (R - E)
+ *
+ * And knowing the minimum access distance of a page, we can easily
+ * tell if the page would be able to stay in cache assuming all page
+ * slots in the cache were available:
+ *
+ *   NR_inactive + (R - E) <= NR_inactive + NR_active
+ *
+ * which can be further simplified to
+ *
+ *   (R - E) <= NR_active
+ *
+ * Put into words, the refault distance (out-of-cache) can be seen as
+ * a deficit in inactive list space (in-cache).  If the inactive list
+ * had (R - E) more page slots, the page would not have been evicted
+ * in between accesses, but activated instead.  And on a full system,
+ * the only thing eating into inactive list space is active pages.
+ *
+ *
+ *		Activating refaulting pages
+ *
+ * All that is known about the active list is that the pages have been
+ * accessed more than once in the past.  This means that at any given
+ * time there is actually a good chance that pages on the active list
+ * are no longer in active use.
+ *
+ * So when a refault distance of (R - E) is observed and there are at
+ * least (R - E) active pages, the refaulting page is activated
+ * optimistically in the hope that (R - E) active pages are actually
+ * used less frequently than the refaulting page - or even not used at
+ * all anymore.
+ *
+ * If this is wrong and demotion kicks in, the pages which are truly
+ * used more frequently will be reactivated while the less frequently
+ * used once will be evicted from memory.
+ *
+ * But if this is right, the stale pages will be pushed out of memory
+ * and the used pages get to stay in cache.
+ *
+ *
+ *		Implementation
+ *
+ * For each zone's file LRU lists, a counter for inactive evictions
+ * and activations is maintained (zone->inactive_age).
+ *
+ * On eviction, a snapshot of this counter (along with some bits to
+ * identify the zone) is stored in the now empty page cache radix tree
+ * slot of the evicted page.  This is called a shadow entry.
+ *
+ * On cache misses for which there are shadow entries, an eligible
+ * refault distance will immediately activate the refaulting page.
+ *
+ * Shadow entries stay in the radix tree until their slot is reused or
+ * the file is truncated.  Tree nodes that hold nothing but shadow
+ * entries would then pile up in files that are not used anymore, so
+ * such nodes are tracked on a list and reclaimed by a shrinker once
+ * there are more of them than the file cache could ever refault
+ * against, see count_shadow_nodes().
+ */
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone->zone_pgdat->node_id;
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static struct zone *unpack_shadow(void *shadow, unsigned long *eviction)
+{
+	unsigned long entry = (unsigned long)shadow;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	*eviction = entry;
+
+	return NODE_DATA(nid)->node_zones + zid;
+}
+
+/*
+ * The pages a refaulting page has to compete with.  The multi-gen LRU
+ * accounts all its pages as inactive; there the younger half of the
+ * file pages stands in for the active list.
+ */
+static unsigned long workingset_active_file(struct zone *zone)
+{
+	if (lru_gen_enabled_zone(zone))
+		return zone_page_state(zone, NR_INACTIVE_FILE) / 2;
+	return zone_page_state(zone, NR_ACTIVE_FILE);
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @mapping->page_tree in place
+ * of the evicted @page so that a later refault can be detected.
+ *
+ * The caller holds @mapping->tree_lock with interrupts disabled.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	__inc_zone_state(zone, NR_SHADOW_ENTRIES);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Calculates and evaluates the refault distance of the previously
+ * evicted page in the context of the zone it was allocated in.
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	unsigned long eviction;
+	unsigned long refault;
+	unsigned long mask;
+	struct zone *zone;
+
+	zone = unpack_shadow(shadow, &eviction);
+	refault = atomic_long_read(&zone->inactive_age);
+	mask = ~0UL >> (NODES_SHIFT + ZONES_SHIFT +
+			RADIX_TREE_EXCEPTIONAL_SHIFT);
+	/*
+	 * The unsigned subtraction here gives an accurate distance
+	 * across inactive_age overflows in most cases.
+	 *
+	 * There is a special case: usually, shadow entries have a
+	 * short lifetime and are either refaulted or reclaimed along
+	 * with the inode before they get too old.  But it is not
+	 * impossible for the inactive_age to lap a shadow entry in
+	 * the field, which can then result in a false small
+	 * refault distance, leading to a false activation should this
+	 * old entry actually refault again.  However, earlier kernels
+	 * used to deactivate unconditionally with *every* reclaim
+	 * invocation for the longest time, so the occasional
+	 * inappropriate activation leading to pressure on the active
+	 * list is not a problem.
+	 */
+	refault_distance = (refault - eviction) & mask;
+
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= workingset_active_file(zone)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_forget - a shadow entry is removed from the page cache
+ * @shadow: the shadow entry
+ *
+ * The caller holds the tree_lock of the mapping the entry was stored in,
+ * with interrupts disabled.
+ */
+void workingset_forget(void *shadow)
+{
+	unsigned long eviction;
+
+	__dec_zone_state(unpack_shadow(shadow, &eviction), NR_SHADOW_ENTRIES);
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Page cache radix tree nodes holding only shadow entries, linked by
+ * their private_list.  A node goes on and off the list under the
+ * tree_lock of its mapping, which nests outside shadow_nodes_lock.
+ */
+static LIST_HEAD(shadow_nodes);
+static DEFINE_SPINLOCK(shadow_nodes_lock);
+static unsigned long nr_shadow_nodes;
+
+/**
+ * workingset_update_node - track a tree node holding only shadow entries
+ * @node: leaf node of @mapping's page_tree whose entries changed
+ * @mapping: the address_space
+ * @index: an index covered by @node
+ *
+ * Puts @node on the list of shadow nodes when all its entries are
+ * shadow entries, and takes it off the list when it holds pages again,
+ * or before it is freed.
+ *
+ * The caller holds @mapping->tree_lock with interrupts disabled.
+ */
+void workingset_update_node(struct radix_tree_node *node,
+			    struct address_space *mapping, pgoff_t index)
+{
+	if (node->count && node->count == node->shadows) {
+		if (!list_empty(&node->private_list))
+			return;
+		node->private_data = mapping;
+		node->index = index & ~RADIX_TREE_MAP_MASK;
+		spin_lock(&shadow_nodes_lock);
+		list_add_tail(&node->private_list, &shadow_nodes);
+		nr_shadow_nodes++;
+		spin_unlock(&shadow_nodes_lock);
+	} else if (!list_empty(&node->private_list)) {
+		spin_lock(&shadow_nodes_lock);
+		list_del_init(&node->private_list);
+		nr_shadow_nodes--;
+		spin_unlock(&shadow_nodes_lock);
+	}
+}
+
+/*
+ * Active cache pages are limited to half of the file cache, and shadow
+ * entries that represent a refault distance bigger than that can not
+ * activate anything.  Allow as many shadow nodes as it takes to hold
+ * that many shadow entries at a population density of 1/8th: with 64
+ * slots per node, this reclaims shadow nodes when they take up ~2% of
+ * the memory of the file cache.
+ */
+static unsigned long count_shadow_nodes(void)
+{
+	unsigned long pages, max_nodes;
+
+	pages = global_page_state(NR_ACTIVE_FILE) +
+		global_page_state(NR_INACTIVE_FILE);
+	max_nodes = pages >> (1 + RADIX_TREE_MAP_SHIFT - 3);
+
+	if (nr_shadow_nodes <= max_nodes)
+		return 0;
+	return min(nr_shadow_nodes - max_nodes, (unsigned long)INT_MAX);
+}
+
+/*
+ * Remove all shadow entries of @node from @mapping, which frees @node
+ * along with the last of them.  The caller holds the tree_lock and has
+ * taken @node off the list.
+ */
+static void reclaim_shadow_node(struct address_space *mapping,
+				struct radix_tree_node *node)
+{
+	DECLARE_BITMAP(present, RADIX_TREE_MAP_SIZE);
+	unsigned long index = node->index;
+	unsigned int i;
+
+	/* Something put a page in behind the page cache's back */
+	if (node->count != node->shadows)
+		return;
+
+	bitmap_zero(present, RADIX_TREE_MAP_SIZE);
+	for (i = 0; i < RADIX_TREE_MAP_SIZE; i++) {
+		void *shadow;
+
+		shadow = radix_tree_deref_slot_protected(&node->slots[i],
+							 &mapping->tree_lock);
+		if (!shadow)
+			continue;
+		BUG_ON(!radix_tree_exceptional_entry(shadow));
+		mapping->nrshadows--;
+		workingset_forget(shadow);
+		__set_bit(i, present);
+	}
+	node->shadows = 0;
+	__inc_zone_state(page_zone(virt_to_page(node)),
+			 WORKINGSET_NODERECLAIM);
+
+	/* The node is gone after the last deletion, don't touch it */
+	for_each_set_bit(i, present, RADIX_TREE_MAP_SIZE)
+		radix_tree_delete(&mapping->page_tree, index + i);
+}
+
+static int shrink_shadow_nodes(struct shrinker *shrink,
+			       struct shrink_control *sc)
+{
+	unsigned long nr_to_scan = sc->nr_to_scan;
+	int ret;
+
+	spin_lock_irq(&shadow_nodes_lock);
+	while (nr_to_scan && count_shadow_nodes()) {
+		struct radix_tree_node *node;
+		struct address_space *mapping;
+
+		nr_to_scan--;
+		node = list_first_entry(&shadow_nodes, struct radix_tree_node,
+					private_list);
+		mapping = node->private_data;
+		/* Coming from the list, the lock order is inverted */
+		if (!spin_trylock(&mapping->tree_lock)) {
+			list_move_tail(&node->private_list, &shadow_nodes);
+			continue;
+		}
+		list_del_init(&node->private_list);
+		nr_shadow_nodes--;
+		spin_unlock(&shadow_nodes_lock);
+
+		reclaim_shadow_node(mapping, node);
+		spin_unlock_irq(&mapping->tree_lock);
+
+		cond_resched();
+		spin_lock_irq(&shadow_nodes_lock);
+	}
+	ret = count_shadow_nodes();
+	spin_unlock_irq(&shadow_nodes_lock);
+
+	return ret;
+}
+
+static struct shrinker workingset_shadow_shrinker = {
+	.shrink = shrink_shadow_nodes,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	register_shrinker(&workingset_shadow_shrinker);
+	return 0;
+}
+module_init(workingset_init);